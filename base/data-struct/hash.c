@@ -22,6 +22,7 @@ struct dm_hash_node {
 	void *data;
 	unsigned data_len;
 	unsigned keylen;
+	unsigned hash;
 	char key[0];
 };
 
@@ -31,33 +32,11 @@ struct dm_hash_table {
 	struct dm_hash_node **slots;
 };
 
-/* Permutation of the Integers 0 through 255 */
-static unsigned char _nums[] = {
-	1, 14, 110, 25, 97, 174, 132, 119, 138, 170, 125, 118, 27, 233, 140, 51,
-	87, 197, 177, 107, 234, 169, 56, 68, 30, 7, 173, 73, 188, 40, 36, 65,
-	49, 213, 104, 190, 57, 211, 148, 223, 48, 115, 15, 2, 67, 186, 210, 28,
-	12, 181, 103, 70, 22, 58, 75, 78, 183, 167, 238, 157, 124, 147, 172,
-	144,
-	176, 161, 141, 86, 60, 66, 128, 83, 156, 241, 79, 46, 168, 198, 41, 254,
-	178, 85, 253, 237, 250, 154, 133, 88, 35, 206, 95, 116, 252, 192, 54,
-	221,
-	102, 218, 255, 240, 82, 106, 158, 201, 61, 3, 89, 9, 42, 155, 159, 93,
-	166, 80, 50, 34, 175, 195, 100, 99, 26, 150, 16, 145, 4, 33, 8, 189,
-	121, 64, 77, 72, 208, 245, 130, 122, 143, 55, 105, 134, 29, 164, 185,
-	194,
-	193, 239, 101, 242, 5, 171, 126, 11, 74, 59, 137, 228, 108, 191, 232,
-	139,
-	6, 24, 81, 20, 127, 17, 91, 92, 251, 151, 225, 207, 21, 98, 113, 112,
-	84, 226, 18, 214, 199, 187, 13, 32, 94, 220, 224, 212, 247, 204, 196,
-	43,
-	249, 236, 45, 244, 111, 182, 153, 136, 129, 90, 217, 202, 19, 165, 231,
-	71,
-	230, 142, 96, 227, 62, 179, 246, 114, 162, 53, 160, 215, 205, 180, 47,
-	109,
-	44, 38, 31, 149, 135, 0, 216, 52, 63, 23, 37, 69, 39, 117, 146, 184,
-	163, 200, 222, 235, 248, 243, 219, 10, 152, 131, 123, 229, 203, 76, 120,
-	209
-};
+/*
+ * The table doubles in size once the number of entries exceeds the number
+ * of slots, so chains stay short however small the size_hint was.
+ */
+#define MAX_SLOTS (1u << 28)
 
 static struct dm_hash_node *_create_node(const char *str, unsigned len)
 {
@@ -71,22 +50,53 @@ static struct dm_hash_node *_create_node(const char *str, unsigned len)
 	return n;
 }
 
-static unsigned long _hash(const char *str, unsigned len)
+/*
+ * MurmurHash64A, public domain, by Austin Appleby.  Consumes the key a
+ * word at a time rather than a byte at a time.
+ */
+static unsigned _hash(const void *key, unsigned len)
 {
-	unsigned long h = 0, g;
-	unsigned i;
+	const uint64_t m = UINT64_C(0xc6a4a7935bd1e995);
+	const int r = 47;
+	const unsigned char *data = key;
+	const unsigned char *end = data + (len & ~7u);
+	uint64_t h = UINT64_C(0x5bd1e9955bd1e995) ^ (len * m);
+	uint64_t k;
+
+	while (data != end) {
+		memcpy(&k, data, sizeof(k));
+		data += sizeof(k);
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
 
-	for (i = 0; i < len; i++) {
-		h <<= 4;
-		h += _nums[(unsigned char) *str++];
-		g = h & ((unsigned long) 0xf << 16u);
-		if (g) {
-			h ^= g >> 16u;
-			h ^= g >> 5u;
-		}
+	switch (len & 7) {
+	case 7: h ^= (uint64_t) data[6] << 48;
+		/* Fall through */
+	case 6: h ^= (uint64_t) data[5] << 40;
+		/* Fall through */
+	case 5: h ^= (uint64_t) data[4] << 32;
+		/* Fall through */
+	case 4: h ^= (uint64_t) data[3] << 24;
+		/* Fall through */
+	case 3: h ^= (uint64_t) data[2] << 16;
+		/* Fall through */
+	case 2: h ^= (uint64_t) data[1] << 8;
+		/* Fall through */
+	case 1: h ^= (uint64_t) data[0];
+		h *= m;
 	}
 
-	return h;
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return (unsigned) (h ^ (h >> 32));
 }
 
 struct dm_hash_table *dm_hash_create(unsigned size_hint)
@@ -134,14 +144,60 @@ void dm_hash_destroy(struct dm_hash_table *t)
 	free(t);
 }
 
+/*
+ * Failing to grow is not an error, the table just gets slower.
+ */
+static void _grow(struct dm_hash_table *t)
+{
+	struct dm_hash_node **slots, *c, *n;
+	unsigned num_slots = t->num_slots << 1;
+	unsigned i, h;
+
+	if (num_slots > MAX_SLOTS)
+		return;
+
+	if (!(slots = zalloc(sizeof(*slots) * num_slots)))
+		return;
+
+	/* Walk each chain in order so entries with equal keys keep their order. */
+	for (i = 0; i < t->num_slots; i++)
+		for (c = t->slots[i]; c; c = n) {
+			n = c->next;
+			h = c->hash & (num_slots - 1);
+			c->next = slots[h];
+			slots[h] = c;
+		}
+
+	/* Restore chain order, it was reversed above. */
+	for (i = 0; i < num_slots; i++) {
+		struct dm_hash_node *rev = NULL;
+
+		for (c = slots[i]; c; c = n) {
+			n = c->next;
+			c->next = rev;
+			rev = c;
+		}
+		slots[i] = rev;
+	}
+
+	free(t->slots);
+	t->slots = slots;
+	t->num_slots = num_slots;
+}
+
+static void _node_added(struct dm_hash_table *t)
+{
+	if (++t->num_nodes > t->num_slots)
+		_grow(t);
+}
+
 static struct dm_hash_node **_find(struct dm_hash_table *t, const void *key,
-				   uint32_t len)
+				   uint32_t len, unsigned hash)
 {
-	unsigned h = _hash(key, len) & (t->num_slots - 1);
 	struct dm_hash_node **c;
 
-	for (c = &t->slots[h]; *c; c = &((*c)->next)) {
-		if ((*c)->keylen != len)
+	for (c = &t->slots[hash & (t->num_slots - 1)]; *c; c = &((*c)->next)) {
+		if (((*c)->hash != hash) || ((*c)->keylen != len))
 			continue;
 
 		if (!memcmp(key, (*c)->key, len))
@@ -154,7 +210,7 @@ static struct dm_hash_node **_find(struct dm_hash_table *t, const void *key,
 void *dm_hash_lookup_binary(struct dm_hash_table *t, const void *key,
 			    uint32_t len)
 {
-	struct dm_hash_node **c = _find(t, key, len);
+	struct dm_hash_node **c = _find(t, key, len, _hash(key, len));
 
 	return *c ? (*c)->data : 0;
 }
@@ -162,7 +218,8 @@ void *dm_hash_lookup_binary(struct dm_hash_table *t, const void *key,
 int dm_hash_insert_binary(struct dm_hash_table *t, const void *key,
 			  uint32_t len, void *data)
 {
-	struct dm_hash_node **c = _find(t, key, len);
+	unsigned hash = _hash(key, len);
+	struct dm_hash_node **c = _find(t, key, len, hash);
 
 	if (*c)
 		(*c)->data = data;
@@ -173,9 +230,10 @@ int dm_hash_insert_binary(struct dm_hash_table *t, const void *key,
 			return 0;
 
 		n->data = data;
+		n->hash = hash;
 		n->next = 0;
 		*c = n;
-		t->num_nodes++;
+		_node_added(t);
 	}
 
 	return 1;
@@ -184,7 +242,7 @@ int dm_hash_insert_binary(struct dm_hash_table *t, const void *key,
 void dm_hash_remove_binary(struct dm_hash_table *t, const void *key,
 			uint32_t len)
 {
-	struct dm_hash_node **c = _find(t, key, len);
+	struct dm_hash_node **c = _find(t, key, len, _hash(key, len));
 
 	if (*c) {
 		struct dm_hash_node *old = *c;
@@ -214,12 +272,10 @@ static struct dm_hash_node **_find_str_with_val(struct dm_hash_table *t,
 					        uint32_t len, uint32_t val_len)
 {
 	struct dm_hash_node **c;
-	unsigned h;
-       
-	h = _hash(key, len) & (t->num_slots - 1);
+	unsigned hash = _hash(key, len);
 
-	for (c = &t->slots[h]; *c; c = &((*c)->next)) {
-		if ((*c)->keylen != len)
+	for (c = &t->slots[hash & (t->num_slots - 1)]; *c; c = &((*c)->next)) {
+		if (((*c)->hash != hash) || ((*c)->keylen != len))
 			continue;
 
 		if (!memcmp(key, (*c)->key, len) && (*c)->data) {
@@ -246,8 +302,9 @@ int dm_hash_insert_allow_multiple(struct dm_hash_table *t, const char *key,
 
 	n->data = (void *)val;
 	n->data_len = val_len;
+	n->hash = _hash(key, len);
 
-	h = _hash(key, len) & (t->num_slots - 1);
+	h = n->hash & (t->num_slots - 1);
 
 	first = t->slots[h];
 
@@ -257,7 +314,7 @@ int dm_hash_insert_allow_multiple(struct dm_hash_table *t, const char *key,
 		n->next = 0;
 	t->slots[h] = n;
 
-	t->num_nodes++;
+	_node_added(t);
 	return 1;
 }
 
@@ -311,14 +368,12 @@ void *dm_hash_lookup_with_count(struct dm_hash_table *t, const char *key, int *c
 	struct dm_hash_node **c;
 	struct dm_hash_node **c1 = NULL;
 	uint32_t len = strlen(key) + 1;
-	unsigned h;
+	unsigned hash = _hash(key, len);
 
 	*count = 0;
 
-	h = _hash(key, len) & (t->num_slots - 1);
-
-	for (c = &t->slots[h]; *c; c = &((*c)->next)) {
-		if ((*c)->keylen != len)
+	for (c = &t->slots[hash & (t->num_slots - 1)]; *c; c = &((*c)->next)) {
+		if (((*c)->hash != hash) || ((*c)->keylen != len))
 			continue;
 
 		if (!memcmp(key, (*c)->key, len)) {
@@ -388,7 +443,7 @@ struct dm_hash_node *dm_hash_get_first(struct dm_hash_table *t)
 
 struct dm_hash_node *dm_hash_get_next(struct dm_hash_table *t, struct dm_hash_node *n)
 {
-	unsigned h = _hash(n->key, n->keylen) & (t->num_slots - 1);
+	unsigned h = n->hash & (t->num_slots - 1);
 
 	return n->next ? n->next : _next_slot(t, h + 1);
 }
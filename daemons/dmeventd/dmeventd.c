@@ -19,6 +19,8 @@
 #include "device_mapper/misc/dmlib.h"
 #include "base/memory/zalloc.h"
 #include "device_mapper/misc/dm-logging.h"
+#include "device_mapper/misc/dm-ioctl.h"
+#include "device_mapper/misc/kdev_t.h"
 
 #include "daemons/dmeventd/libdevmapper-event.h"
 #include "dmeventd.h"
@@ -28,11 +30,13 @@
 #include <dlfcn.h>
 #include <pthread.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <signal.h>
+#include <poll.h>
 #include <arpa/inet.h>		/* for htonl, ntohl */
 #include <fcntl.h>		/* for musl libc */
 
@@ -99,6 +103,7 @@ static int _use_syslog = 1;
 static int _systemd_activation = 0;
 static int _foreground = 0;
 static int _restart = 0;
+static int _mux_workers = 0;	/* 0 - one monitoring thread per device */
 static time_t _idle_since = 0;
 static char **_initial_registrations = 0;
 
@@ -248,6 +253,14 @@ struct thread_status {
 	struct dm_list timeout_list;
 	void *dso_private; /* dso per-thread status variable */
 	/* TODO per-thread mutex */
+
+	/* Multiplexed mode only, see _mux_thread() */
+	struct dm_list work_list;	/* Link in _mux_queue */
+	uint64_t devno;			/* Kernel encoded dev as in dm_names */
+	uint32_t event_nr;		/* Last seen device event number */
+	int mux_events;			/* Events found while processing */
+	int mux_gone;			/* Device disappeared */
+	unsigned mux_seen;		/* Last scan which found the device */
 };
 
 static DM_LIST_INIT(_thread_registry);
@@ -258,6 +271,30 @@ static DM_LIST_INIT(_timeout_registry);
 static pthread_mutex_t _timeout_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t _timeout_cond = PTHREAD_COND_INITIALIZER;
 
+/*
+ * Multiplexed monitoring.
+ *
+ * Instead of a thread blocked in DM_DEV_WAIT for every device, a single
+ * thread polls the control device for any dm event, finds the devices
+ * whose event number moved with one DM_LIST_DEVICES and hands them to
+ * a small pool of workers which run the plugins.  Timeout events are
+ * kept in a timer wheel with one second slots.
+ *
+ * _mux_queue and the thread_status fields are protected by _global_mutex,
+ * the wheel by _timeout_mutex.  A thread on _mux_queue is never processing.
+ */
+#define DMEVENTD_MUX_WORKERS	4
+#define DMEVENTD_MUX_WHEEL_SLOTS	64
+static int _mux_fd = -1;
+static struct dm_ioctl *_mux_dmi;
+static size_t _mux_dmi_size = 16 * 1024;
+static unsigned _mux_scan_seq;
+static struct dm_hash_table *_mux_devices;	/* devno -> thread_status */
+static DM_LIST_INIT(_mux_queue);
+static pthread_cond_t _mux_cond = PTHREAD_COND_INITIALIZER;
+static struct dm_list _mux_wheel[DMEVENTD_MUX_WHEEL_SLOTS];
+static time_t _mux_wheel_time;
+
 
 /**********
  *   DSO
@@ -439,6 +476,7 @@ static struct thread_status *_alloc_thread_status(const struct message_data *dat
 	thread->pending = DM_EVENT_REGISTRATION_PENDING;
 	thread->timeout = data->timeout_secs;
 	dm_list_init(&thread->timeout_list);
+	dm_list_init(&thread->work_list);
 
 	return thread;
 
@@ -619,6 +657,8 @@ static int _fill_device_data(struct thread_status *ts)
 
 	ts->device.major = dmi.major;
 	ts->device.minor = dmi.minor;
+	ts->devno = MKDEV((uint64_t) dmi.major, (uint64_t) dmi.minor);
+	ts->event_nr = dmi.event_nr;
 	dm_task_set_event_nr(ts->wait_task, dmi.event_nr);
 
 	ret = 1;
@@ -806,6 +846,17 @@ static int _register_for_timeout(struct thread_status *thread)
 
 	pthread_mutex_lock(&_timeout_mutex);
 
+	if (_mux_workers) {
+		/* _mux_thread() walks the wheel every second */
+		if (dm_list_empty(&thread->timeout_list)) {
+			thread->next_time = time(NULL) + thread->timeout;
+			dm_list_add(&_mux_wheel[thread->next_time % DMEVENTD_MUX_WHEEL_SLOTS],
+				    &thread->timeout_list);
+		}
+		pthread_mutex_unlock(&_timeout_mutex);
+		return 0;
+	}
+
 	if (dm_list_empty(&thread->timeout_list)) {
 		thread->next_time = time(NULL) + thread->timeout;
 		dm_list_add(&_timeout_registry, &thread->timeout_list);
@@ -937,8 +988,8 @@ static void _do_process_event(struct thread_status *thread)
 {
 	struct dm_task *task;
 
-	/* NOTE: timeout event gets status */
-	task = (thread->current_events & DM_EVENT_TIMEOUT)
+	/* NOTE: timeout event gets status, as does every multiplexed event */
+	task = ((thread->current_events & DM_EVENT_TIMEOUT) || _mux_workers)
 		? _get_device_status(thread) : thread->wait_task;
 
 	if (!task)
@@ -1076,6 +1127,390 @@ static int _create_thread(struct thread_status *thread)
 	return _pthread_create_smallstack(&thread->thread, _monitor_thread, thread);
 }
 
+/*
+ * Queue a device for the workers.
+ *
+ * Mutex must be held when calling this.
+ */
+static void _mux_queue_thread(struct thread_status *thread)
+{
+	if (!dm_list_empty(&thread->work_list))
+		return; /* Already queued */
+
+	dm_list_add(&_mux_queue, &thread->work_list);
+	pthread_cond_signal(&_mux_cond);
+}
+
+/*
+ * Note events found by _mux_thread().  A device being processed
+ * is requeued by its worker once the plugin returns.
+ *
+ * Mutex must be held when calling this.
+ */
+static void _mux_post(struct thread_status *thread, int events)
+{
+	thread->mux_events |= events;
+
+	if (!thread->processing && (thread->status == DM_THREAD_RUNNING))
+		_mux_queue_thread(thread);
+}
+
+/* Mutex is held on entry and on return. */
+static void _mux_unregister(struct thread_status *thread)
+{
+	dm_hash_remove_binary(_mux_devices, &thread->devno, sizeof(thread->devno));
+	_monitor_unregister(thread);	/* Drops the mutex */
+	_lock_mutex();
+}
+
+/* Read the current event number of a registered device. */
+static int _get_event_nr(struct thread_status *ts, uint32_t *event_nr)
+{
+	struct dm_task *dmt;
+	struct dm_info dmi;
+	int ret = 0;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_INFO)))
+		return 0;
+
+	if (dm_task_set_major_minor(dmt, ts->device.major, ts->device.minor, 0) &&
+	    dm_task_run(dmt) && dm_task_get_info(dmt, &dmi) && dmi.exists) {
+		*event_nr = dmi.event_nr;
+		ret = 1;
+	}
+
+	dm_task_destroy(dmt);
+
+	return ret;
+}
+
+/* Worker counterpart of the start of _monitor_thread(). */
+static void _mux_register(struct thread_status *thread)
+{
+	uint32_t event_nr;
+	int r = 0;
+
+	_unlock_mutex();
+
+	if (!_fill_device_data(thread))
+		log_error("Failed to fill device data for %s.", thread->device.uuid);
+	else if (!_do_register_device(thread))
+		log_error("Failed to register device %s.", thread->device.name);
+	else
+		r = 1;
+
+	_lock_mutex();
+
+	if (!r) {
+		_mux_unregister(thread);
+		return;
+	}
+
+	thread->status = DM_THREAD_RUNNING;
+	/* Events up to the event_nr read above are not reported */
+	thread->mux_seen = _mux_scan_seq;
+
+	if (!dm_hash_insert_binary(_mux_devices, &thread->devno,
+				   sizeof(thread->devno), thread)) {
+		log_error("Failed to monitor %s, out of memory.", thread->device.name);
+		thread->mux_gone = 1;
+	} else {
+		/*
+		 * A scan since _fill_device_data() could not find the device,
+		 * so read event_nr again.  Still processing: events posted
+		 * meanwhile are only noted and the thread cannot go away.
+		 */
+		_unlock_mutex();
+		r = _get_event_nr(thread, &event_nr);
+		_lock_mutex();
+
+		if (!r)
+			/* Next scan detaches a removed device */
+			log_debug("Failed to recheck event number of %s.",
+				  thread->device.name);
+		else if (event_nr != thread->event_nr) {
+			thread->event_nr = event_nr;
+			thread->mux_events |= DM_EVENT_DEVICE_ERROR;
+		}
+	}
+
+	thread->processing = 0;
+
+	/* Filter could have changed during registration */
+	_mux_queue_thread(thread);
+}
+
+/* Worker counterpart of the loop in _monitor_thread(). */
+static void _mux_process(struct thread_status *thread)
+{
+	static const struct timespec _zero = { 0 };
+	sigset_t pendmask, alarm;
+
+	thread->current_events |= thread->mux_events;
+	thread->mux_events = 0;
+	thread->pending = 0;
+
+	if (thread->events && !thread->mux_gone &&
+	    (thread->events & thread->current_events)) {
+		thread->processing = 1;
+		_unlock_mutex();
+
+		_do_process_event(thread);
+		thread->current_events = 0;
+
+		_lock_mutex();
+		thread->processing = 0;
+
+		/* Plugin can still terminate monitoring via SIGALRM */
+		if (sigpending(&pendmask) < 0)
+			log_sys_error("sigpending", "");
+		else if (sigismember(&pendmask, SIGALRM)) {
+			sigemptyset(&alarm);
+			sigaddset(&alarm, SIGALRM);
+			(void) sigtimedwait(&alarm, NULL, &_zero);
+			thread->events = 0;
+		}
+	}
+
+	if (!thread->events || thread->mux_gone)
+		_mux_unregister(thread);
+	else if (thread->pending || (thread->mux_events & thread->events))
+		_mux_queue_thread(thread);
+}
+
+static void *_mux_worker(void *unused __attribute__((unused)))
+{
+	struct thread_status *thread;
+
+	_lock_mutex();
+
+	for (;;) {
+		while (dm_list_empty(&_mux_queue))
+			pthread_cond_wait(&_mux_cond, &_global_mutex);
+
+		thread = dm_list_struct_base(dm_list_first(&_mux_queue),
+					     struct thread_status, work_list);
+		dm_list_del(&thread->work_list);
+		dm_list_init(&thread->work_list);
+
+		if (thread->status == DM_THREAD_REGISTERING)
+			_mux_register(thread);
+		else if (thread->status == DM_THREAD_RUNNING)
+			_mux_process(thread);
+	}
+
+	return NULL;
+}
+
+static int _mux_ioctl(unsigned long command)
+{
+	memset(_mux_dmi, 0, sizeof(*_mux_dmi));
+	_mux_dmi->version[0] = DM_VERSION_MAJOR;
+	_mux_dmi->data_size = _mux_dmi_size;
+	_mux_dmi->data_start = sizeof(*_mux_dmi);
+
+	return ioctl(_mux_fd, command, _mux_dmi) ? 0 : 1;
+}
+
+/*
+ * Find devices whose event number changed since the last scan and
+ * devices which were removed.  Since kernel 4.14 (dm ioctl 4.37, the
+ * same version which added DM_DEV_ARM_POLL) every dm_names entry is
+ * followed by the event number of the device.
+ */
+static void _mux_scan(void)
+{
+	struct dm_names *names;
+	struct dm_hash_node *n;
+	struct thread_status *thread;
+	struct dm_ioctl *dmi;
+	const char *end, *next;
+	const uint32_t *event_nr;
+	unsigned seq;
+
+	_lock_mutex();
+	seq = ++_mux_scan_seq;
+	_unlock_mutex();
+
+	while (1) {
+		if (!_mux_ioctl(DM_LIST_DEVICES)) {
+			log_sys_error("ioctl", "DM_LIST_DEVICES");
+			return;
+		}
+
+		if (!(_mux_dmi->flags & DM_BUFFER_FULL_FLAG))
+			break;
+
+		if (!(dmi = realloc(_mux_dmi, _mux_dmi_size * 2))) {
+			log_error("Failed to list devices, out of memory.");
+			return;
+		}
+		_mux_dmi = dmi;
+		_mux_dmi_size *= 2;
+	}
+
+	names = (struct dm_names *)((char *) _mux_dmi + _mux_dmi->data_start);
+	end = (const char *) _mux_dmi + _mux_dmi->data_size;
+
+	_lock_mutex();
+
+	if (_mux_dmi->data_size > _mux_dmi->data_start && names->dev)
+		while (1) {
+			next = names->next ? (const char *) names + names->next : end;
+			event_nr = (const uint32_t *)
+				(((uintptr_t) names->name + strlen(names->name) + 8) & ~(uintptr_t) 7);
+
+			if ((thread = dm_hash_lookup_binary(_mux_devices, &names->dev,
+							    sizeof(names->dev)))) {
+				thread->mux_seen = seq;
+				/* Without event number every wakeup is an event */
+				if (((const char *) (event_nr + 1) > next) ||
+				    (*event_nr != thread->event_nr)) {
+					if ((const char *) (event_nr + 1) <= next)
+						thread->event_nr = *event_nr;
+					_mux_post(thread, DM_EVENT_DEVICE_ERROR);
+				}
+			}
+
+			if (!names->next)
+				break;
+			names = (struct dm_names *) next;
+		}
+
+	dm_hash_iterate(n, _mux_devices) {
+		thread = dm_hash_get_data(_mux_devices, n);
+		if (thread->mux_seen < seq && !thread->mux_gone) {
+			log_error("%s disappeared, detaching.", thread->device.name);
+			thread->mux_gone = 1;
+			_mux_post(thread, 0);
+		}
+	}
+
+	_unlock_mutex();
+}
+
+/* Fire timeout events up to now. */
+static void _mux_tick(void)
+{
+	struct thread_status *thread, *tmp;
+	struct dm_list *slot;
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&_timeout_mutex);
+
+	if ((now < _mux_wheel_time) || (now - _mux_wheel_time > DMEVENTD_MUX_WHEEL_SLOTS))
+		_mux_wheel_time = now - DMEVENTD_MUX_WHEEL_SLOTS; /* clock change? */
+
+	while (_mux_wheel_time < now) {
+		slot = &_mux_wheel[++_mux_wheel_time % DMEVENTD_MUX_WHEEL_SLOTS];
+
+		dm_list_iterate_items_gen_safe(thread, tmp, slot, timeout_list) {
+			if (thread->next_time > _mux_wheel_time)
+				continue; /* Later round of the wheel */
+
+			dm_list_del(&thread->timeout_list);
+			thread->next_time = now + thread->timeout;
+			dm_list_add(&_mux_wheel[thread->next_time % DMEVENTD_MUX_WHEEL_SLOTS],
+				    &thread->timeout_list);
+
+			_lock_mutex();
+			if (thread->processing)
+				/* Same as _timeout_thread() */
+				log_debug("Skipping timeout for processing %s.",
+					  thread->device.name);
+			else
+				_mux_post(thread, DM_EVENT_TIMEOUT);
+			_unlock_mutex();
+		}
+	}
+
+	pthread_mutex_unlock(&_timeout_mutex);
+}
+
+/*
+ * Wait for dm events on the control device.  DM_DEV_ARM_POLL is issued
+ * before the scan, so events arriving during the scan wake us again.
+ */
+static void *_mux_thread(void *unused __attribute__((unused)))
+{
+	struct pollfd pfd = { .fd = _mux_fd, .events = POLLIN };
+
+	for (;;) {
+		if (poll(&pfd, 1, 1000) < 0) {
+			if (errno != EINTR)
+				log_sys_error("poll", "control device");
+		} else if (pfd.revents & POLLIN) {
+			if (!_mux_ioctl(DM_DEV_ARM_POLL))
+				log_sys_error("ioctl", "DM_DEV_ARM_POLL");
+			_mux_scan();
+		}
+
+		_mux_tick();
+	}
+
+	return NULL;
+}
+
+/*
+ * Start the multiplexing threads, before any device is registered.
+ * Falls back to a thread per device when the kernel cannot poll.
+ */
+static int _mux_init(void)
+{
+	char control[PATH_MAX];
+	int i;
+
+	if (dm_snprintf(control, sizeof(control), "%s/%s",
+			dm_dir(), DM_CONTROL_NODE) < 0)
+		return_0;
+
+	if (!(_mux_dmi = malloc(_mux_dmi_size)))
+		return_0;
+
+	if ((_mux_fd = open(control, O_RDWR | O_CLOEXEC)) < 0) {
+		log_sys_error("open", control);
+		goto bad;
+	}
+
+	if (!_mux_ioctl(DM_DEV_ARM_POLL)) {
+		log_warn("WARNING: Kernel does not support polling %s, "
+			 "using thread per device.", control);
+		goto bad;
+	}
+
+	if (!(_mux_devices = dm_hash_create(128)))
+		goto_bad;
+
+	for (i = 0; i < DMEVENTD_MUX_WHEEL_SLOTS; i++)
+		dm_list_init(&_mux_wheel[i]);
+	_mux_wheel_time = time(NULL);
+
+	/* Threads are detached and run until dmeventd exits */
+	for (i = 0; i < _mux_workers; i++)
+		if (_pthread_create_smallstack(NULL, _mux_worker, NULL))
+			goto_bad;
+
+	if (_pthread_create_smallstack(NULL, _mux_thread, NULL))
+		goto_bad;
+
+	log_info("Monitoring devices with %d worker threads.", _mux_workers);
+
+	return 1;
+bad:
+	/* Started workers only wait on an empty queue */
+	if (_mux_devices) {
+		dm_hash_destroy(_mux_devices);
+		_mux_devices = NULL;
+	}
+	if (_mux_fd >= 0 && close(_mux_fd))
+		log_sys_error("close", control);
+	_mux_fd = -1;
+	free(_mux_dmi);
+	_mux_dmi = NULL;
+
+	return 0;
+}
+
 /* Update events - needs to be locked */
 static int _update_events(struct thread_status *thread, int events)
 {
@@ -1087,8 +1522,12 @@ static int _update_events(struct thread_status *thread, int events)
 	thread->events = events;
 	thread->pending = DM_EVENT_REGISTRATION_PENDING;
 
-	/* Only non-processing threads can be notified */
-	if (!thread->processing) {
+	if (_mux_workers) {
+		/* Worker picks up the change */
+		if (!thread->processing && (thread->status == DM_THREAD_RUNNING))
+			_mux_queue_thread(thread);
+	} else if (!thread->processing) {
+		/* Only non-processing threads can be notified */
 		DEBUGLOG("Sending SIGALRM to wakeup Thr %x.", (int)thread->thread);
 
 		/* Notify thread waiting in ioctl (to speed-up) */
@@ -1188,7 +1627,7 @@ static int _register_for_event(struct message_data *message_data)
 			return -ENOMEM;
 		}
 
-		if ((ret = _create_thread(thread))) {
+		if (!_mux_workers && (ret = _create_thread(thread))) {
 			stack;
 			_free_thread_status(thread);
 			return -ret;
@@ -1197,6 +1636,9 @@ static int _register_for_event(struct message_data *message_data)
 		_lock_mutex();
 		/* Note: same uuid can't be added in parallel */
 		LINK_THREAD(thread);
+
+		if (_mux_workers)
+			_mux_queue_thread(thread);
 	}
 
 	_unlock_mutex();
@@ -1701,7 +2143,7 @@ static void _cleanup_unused_threads(void)
 	while ((l = dm_list_first(&_thread_registry_unused))) {
 		thread = dm_list_item(l, struct thread_status);
 		if (thread->status != DM_THREAD_DONE) {
-			if (thread->processing)
+			if (thread->processing || _mux_workers)
 				break; /* cleanup on the next round */
 
 			/* Signal possibly sleeping thread */
@@ -1717,7 +2159,7 @@ static void _cleanup_unused_threads(void)
 
 		DEBUGLOG("Destroying Thr %x.", (int)thread->thread);
 
-		if (pthread_join(thread->thread, NULL))
+		if (!_mux_workers && pthread_join(thread->thread, NULL))
 			log_sys_error("pthread_join", "");
 
 		_free_thread_status(thread);
@@ -2140,11 +2582,12 @@ bad:
 static void _usage(char *prog, FILE *file)
 {
 	fprintf(file, "Usage:\n"
-		"%s [-d [-d [-d]]] [-f] [-h] [-l] [-R] [-V] [-?]\n\n"
+		"%s [-d [-d [-d]]] [-f] [-h] [-l] [-m] [-R] [-V] [-?]\n\n"
 		"   -d       Log debug messages to syslog (-d, -dd, -ddd)\n"
 		"   -f       Don't fork, run in the foreground\n"
 		"   -h       Show this help information\n"
 		"   -l       Log to stdout,stderr instead of syslog\n"
+		"   -m       Monitor all devices from a fixed pool of threads\n"
 		"   -?       Show this help information on stderr\n"
 		"   -R       Restart dmeventd\n"
 		"   -V       Show version of dmeventd\n\n", prog);
@@ -2163,7 +2606,7 @@ int main(int argc, char *argv[])
 	opterr = 0;
 	optind = 0;
 
-	while ((opt = getopt(argc, argv, "?fhVdlR")) != EOF) {
+	while ((opt = getopt(argc, argv, "?fhVdlmR")) != EOF) {
 		switch (opt) {
 		case 'h':
 			_usage(argv[0], stdout);
@@ -2183,6 +2626,9 @@ int main(int argc, char *argv[])
 		case 'l':
 			_use_syslog = 0;
 			break;
+		case 'm':
+			_mux_workers = DMEVENTD_MUX_WORKERS;
+			break;
 		case 'V':
 			printf("dmeventd version: %s\n", DM_LIB_VERSION);
 			exit(EXIT_SUCCESS);
@@ -2240,6 +2686,9 @@ int main(int argc, char *argv[])
 
 	pthread_mutex_init(&_global_mutex, NULL);
 
+	if (_mux_workers && !_mux_init())
+		_mux_workers = 0;
+
 	if (!_systemd_activation && !_open_fifos(&fifos))
 		exit(EXIT_FIFO_FAILURE);
 
@@ -17,7 +17,10 @@
 #include "daemons/dmeventd/libdevmapper-event.h"
 #include "tools/lvm2cmd.h"
 
+#include <ctype.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sys/wait.h>
 
 /*
  * register_device() is called first and performs initialisation.
@@ -62,6 +65,65 @@ void dmeventd_lvm2_unlock(void)
 	pthread_mutex_unlock(&_event_mutex);
 }
 
+/*
+ * Policy commands for the same VG run one at a time.
+ */
+struct vg_lock {
+	struct dm_list list;
+	pthread_cond_t cond;
+	unsigned users;
+	int busy;
+	char vgname[0];
+};
+
+static pthread_mutex_t _vg_mutex = PTHREAD_MUTEX_INITIALIZER;
+static DM_LIST_INIT(_vg_locks);
+
+static struct vg_lock *_lock_vg(const char *vgname, size_t len)
+{
+	struct vg_lock *vgl;
+
+	pthread_mutex_lock(&_vg_mutex);
+
+	dm_list_iterate_items(vgl, &_vg_locks)
+		if (!strncmp(vgl->vgname, vgname, len) && !vgl->vgname[len])
+			goto found;
+
+	if (!(vgl = zalloc(sizeof(*vgl) + len + 1))) {
+		pthread_mutex_unlock(&_vg_mutex);
+		return NULL;
+	}
+
+	memcpy(vgl->vgname, vgname, len);
+	pthread_cond_init(&vgl->cond, NULL);
+	dm_list_add(&_vg_locks, &vgl->list);
+found:
+	vgl->users++;
+	while (vgl->busy)
+		pthread_cond_wait(&vgl->cond, &_vg_mutex);
+	vgl->busy = 1;
+
+	pthread_mutex_unlock(&_vg_mutex);
+
+	return vgl;
+}
+
+static void _unlock_vg(struct vg_lock *vgl)
+{
+	pthread_mutex_lock(&_vg_mutex);
+
+	vgl->busy = 0;
+	if (--vgl->users)
+		pthread_cond_signal(&vgl->cond);
+	else {
+		dm_list_del(&vgl->list);
+		pthread_cond_destroy(&vgl->cond);
+		free(vgl);
+	}
+
+	pthread_mutex_unlock(&_vg_mutex);
+}
+
 int dmeventd_lvm2_init(void)
 {
 	int r = 0;
@@ -71,6 +133,9 @@ int dmeventd_lvm2_init(void)
 	if (!_lvm_handle) {
 		lvm2_log_fn(_lvm2_print_log);
 
+		/* Commands from dmeventd_lvm2_run_vg() must not talk back to dmeventd */
+		(void) setenv("LVM_RUN_BY_DMEVENTD", "1", 1);
+
 		if (!(_lvm_handle = lvm2_init()))
 			goto out;
 
@@ -126,6 +191,228 @@ int dmeventd_lvm2_run(const char *cmdline)
 	return (lvm2_run(_lvm_handle, cmdline) == LVM2_COMMAND_SUCCEEDED);
 }
 
+/* The limit lvm2_run() has as well */
+#define MAX_ARGS 64
+
+/*
+ * Split a command line into argv honouring quotes, as lvm_split() does
+ * for lvm2_run().  Returns the number of arguments, or -1 if there are
+ * max or more.
+ */
+static int _split_args(char *str, char **argv, int max)
+{
+	char *b = str, *e;
+	char quote;
+	int argc = 0;
+
+	while (*b) {
+		while (*b && isspace(*b))
+			b++;
+
+		if (!*b || (*b == '#'))
+			break;
+
+		if (argc == max - 1)
+			return -1;
+
+		quote = 0;
+		if ((*b == '\'') || (*b == '"'))
+			quote = *b++;
+
+		e = b;
+		while (*e && (quote ? (*e != quote) : !isspace(*e)))
+			e++;
+
+		argv[argc++] = b;
+		if (!*e)
+			break;
+		*e++ = '\0';
+		b = e;
+	}
+
+	argv[argc] = NULL;
+
+	return argc;
+}
+
+/*
+ * Log what the command writes, stderr as errors, a line at a time.
+ */
+static void _log_output(const char *cmdline, int outfd, int errfd)
+{
+	struct pollfd fds[2] = {
+		{ .fd = outfd, .events = POLLIN },
+		{ .fd = errfd, .events = POLLIN },
+	};
+	char buf[2][512];
+	size_t len[2] = { 0 };
+	char *nl;
+	size_t line;
+	ssize_t n;
+	int i, eof, open_fds = 2;
+
+	while (open_fds) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_sys_error("poll", cmdline);
+			break;
+		}
+
+		for (i = 0; i < 2; i++) {
+			if (!fds[i].revents)
+				continue;
+
+			n = read(fds[i].fd, buf[i] + len[i], sizeof(buf[i]) - 1 - len[i]);
+			if ((n < 0) && (errno == EINTR))
+				continue;
+
+			if ((eof = (n <= 0))) {
+				fds[i].fd = -1;
+				open_fds--;
+			} else
+				len[i] += n;
+
+			/* Log complete lines, and the rest at EOF or when full. */
+			while (len[i]) {
+				buf[i][len[i]] = '\0';
+				if ((nl = strchr(buf[i], '\n'))) {
+					*nl = '\0';
+					line = nl + 1 - buf[i];
+				} else if (eof || (len[i] == sizeof(buf[i]) - 1))
+					line = len[i];
+				else
+					break;
+
+				if (i)
+					log_error("%s", buf[i]);
+				else
+					log_print("%s", buf[i]);
+
+				len[i] -= line;
+				memmove(buf[i], buf[i] + line, len[i]);
+			}
+		}
+	}
+}
+
+static int _exec_lvm(const char *cmdline)
+{
+	char *argv[MAX_ARGS + 1], *buf;
+	int outpipe[2] = { -1, -1 }, errpipe[2] = { -1, -1 };
+	int status, i, r = 0;
+	pid_t pid;
+
+	if (!(buf = strdup(cmdline))) {
+		log_error("Unable to allocate command memory.");
+		return 0;
+	}
+
+	argv[0] = (char *) "lvm";
+	if (_split_args(buf, argv + 1, MAX_ARGS) < 0) {
+		log_error("Too many arguments.  Limit is %d.", MAX_ARGS);
+		goto out;
+	}
+
+	if (!argv[1]) {
+		log_error("No command supplied.");
+		goto out;
+	}
+
+	if (pipe(outpipe) || pipe(errpipe)) {
+		log_sys_error("pipe", cmdline);
+		goto out;
+	}
+
+	log_verbose("Executing command: %s", cmdline);
+
+	if (!(pid = fork())) {
+		/* child */
+		(void) close(0);
+		if ((dup2(outpipe[1], STDOUT_FILENO) != STDOUT_FILENO) ||
+		    (dup2(errpipe[1], STDERR_FILENO) != STDERR_FILENO))
+			_exit(errno);
+		for (i = 3; i < 255; ++i) (void) close(i);
+		execv(LVM_PATH, argv);
+		_exit(errno);
+	} else if (pid == -1) {
+		log_sys_error("fork", cmdline);
+		goto out;
+	}
+
+	(void) close(outpipe[1]);
+	(void) close(errpipe[1]);
+	outpipe[1] = errpipe[1] = -1;
+
+	_log_output(cmdline, outpipe[0], errpipe[0]);
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR) {
+			log_sys_error("waitpid", cmdline);
+			status = -1;
+			break;
+		}
+
+	if (WIFEXITED(status) && !WEXITSTATUS(status))
+		r = 1;
+	else
+		log_debug("Command %s failed with status %d.", cmdline, status);
+out:
+	for (i = 0; i < 2; i++) {
+		if ((outpipe[i] >= 0) && close(outpipe[i]))
+			log_sys_debug("close", cmdline);
+		if ((errpipe[i] >= 0) && close(errpipe[i]))
+			log_sys_debug("close", cmdline);
+	}
+	free(buf);
+
+	return r;
+}
+
+/*
+ * Run a policy command for the VG named by its final vg/lv argument.
+ * Commands for the same VG run one at a time.
+ *
+ * liblvm2cmd keeps its state in globals, so the shared _lvm_handle can
+ * only run one command at a time, for any VG.  Repairs still use it:
+ * this process is memlocked, while a new lvm process would have to
+ * page itself in with devices of the VG failing or suspended.  Other
+ * commands, such as extending a thin pool, run as a separate lvm
+ * process when exec_lvm is set, so a slow one does not hold up
+ * repairs in other VGs.
+ */
+int dmeventd_lvm2_run_vg(const char *cmdline, int exec_lvm)
+{
+	const char *vgname, *slash;
+	struct vg_lock *vgl;
+	int r;
+
+	if ((vgname = strrchr(cmdline, ' ')))
+		vgname++;
+	else
+		vgname = cmdline;
+
+	if (!(slash = strchr(vgname, '/')))
+		slash = vgname; /* No VG, share the lock with other such commands */
+
+	if (!(vgl = _lock_vg(vgname, slash - vgname))) {
+		log_error("Unable to allocate VG lock memory.");
+		return 0;
+	}
+
+	if (exec_lvm && !access(LVM_PATH, X_OK))
+		r = _exec_lvm(cmdline);
+	else {
+		dmeventd_lvm2_lock();
+		r = dmeventd_lvm2_run(cmdline);
+		dmeventd_lvm2_unlock();
+	}
+
+	_unlock_vg(vgl);
+
+	return r;
+}
+
 int dmeventd_lvm2_command(struct dm_pool *mem, char *buffer, size_t size,
 			  const char *cmd, const char *device)
 {
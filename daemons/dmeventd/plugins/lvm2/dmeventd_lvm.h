@@ -16,7 +16,9 @@
  * Wrappers around liblvm2cmd functions for dmeventd plug-ins.
  *
  * liblvm2cmd is not thread-safe so the locking in this library helps dmeventd
- * threads to co-operate in sharing a single instance.
+ * threads to co-operate in sharing a single instance.  Policy commands
+ * other than repairs avoid it by running as separate lvm processes, one
+ * per VG at a time.
  *
  * FIXME Either support this properly as a generic liblvm2cmd wrapper or make
  * liblvm2cmd thread-safe so this can go away.
@@ -30,6 +32,7 @@ struct dm_pool;
 int dmeventd_lvm2_init(void);
 void dmeventd_lvm2_exit(void);
 int dmeventd_lvm2_run(const char *cmdline);
+int dmeventd_lvm2_run_vg(const char *cmdline, int exec_lvm);
 
 void dmeventd_lvm2_lock(void);
 void dmeventd_lvm2_unlock(void);
@@ -39,14 +42,13 @@ struct dm_pool *dmeventd_lvm2_pool(void);
 int dmeventd_lvm2_command(struct dm_pool *mem, char *buffer, size_t size,
 			  const char *cmd, const char *device);
 
+/* Repairs run in this process, one at a time */
 #define dmeventd_lvm2_run_with_lock(cmdline) \
-	({\
-		int rc;\
-		dmeventd_lvm2_lock();\
-		rc = dmeventd_lvm2_run(cmdline);\
-		dmeventd_lvm2_unlock();\
-		rc;\
-	})
+	dmeventd_lvm2_run_vg(cmdline, 0)
+
+/* Runs a separate lvm process, only commands for the same VG wait */
+#define dmeventd_lvm2_exec_with_lock(cmdline) \
+	dmeventd_lvm2_run_vg(cmdline, 1)
 
 #define dmeventd_lvm2_init_with_pool(name, st) \
 	({\
@@ -83,7 +83,7 @@ static int _run(const char *cmd, ...)
 static int _extend(const char *cmd)
 {
 	log_debug("Extending snapshot via %s.", cmd);
-	return dmeventd_lvm2_run_with_lock(cmd);
+	return dmeventd_lvm2_exec_with_lock(cmd);
 }
 
 #ifdef SNAPSHOT_REMOVE
@@ -114,7 +114,7 @@ static int _use_policy(struct dm_task *dmt, struct dso_state *state)
 	if (state->argv[0])
 		return _run_command(state);
 
-	if (!dmeventd_lvm2_run_with_lock(state->cmd_str)) {
+	if (!dmeventd_lvm2_exec_with_lock(state->cmd_str)) {
 		log_error("Failed command for %s.", dm_task_get_name(dmt));
 		state->fails = 1;
 		return 0;
@@ -101,6 +101,17 @@ static void find_client_info(uint32_t client_id, uint32_t *pid, char *cl_name)
 
 static int first_ls = 1;
 
+/* fields added to the end of a line by newer versions may be missing */
+static unsigned long long info_val(const char *line, const char *key)
+{
+	const char *p = strstr(line, key);
+
+	if (!p)
+		return 0;
+
+	return strtoull(p + strlen(key), NULL, 10);
+}
+
 static void format_info_ls(char *line)
 {
 	char ls_name[MAX_NAME+1] = { 0 };
@@ -120,6 +131,13 @@ static void format_info_ls(char *line)
 	printf("VG %s lock_type=%s %s\n", vg_name, lock_type, vg_uuid);
 
 	printf("LS %s %s\n", lock_type, ls_name);
+
+	printf("LS resources=%llu lookups=%llu lookup_steps=%llu actions=%llu actions_max=%llu\n",
+	       info_val(line, " resources="),
+	       info_val(line, " resource_lookups="),
+	       info_val(line, " resource_lookup_steps="),
+	       info_val(line, " actions="),
+	       info_val(line, " actions_max="));
 }
 
 static void format_info_ls_action(char *line)
@@ -245,7 +263,11 @@ static void format_info_r_action(char *line, char *r_name, char *r_type)
 static void format_info_line(char *line, char *r_name, char *r_type)
 {
 	if (!strncmp(line, "info=structs ", strlen("info=structs "))) {
-		/* only print this in the raw info dump */
+		/* the unused struct counts are only printed in the raw info dump */
+		printf("CL clients=%llu lookups=%llu\n",
+		       info_val(line, " client_count="),
+		       info_val(line, " client_lookups="));
+		first_ls = 0;
 
 	} else if (!strncmp(line, "info=client ", strlen("info=client "))) {
 		save_client_info(line);
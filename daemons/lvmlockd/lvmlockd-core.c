@@ -199,6 +199,12 @@ static struct list_head client_results; /* actions to send back to clients */
 static uint32_t client_ids;             /* 0 and INTERNAL_CLIENT_ID are skipped */
 static int client_stop;                 /* stop the thread */
 static int client_work;                 /* a client on client_list has work to do */
+static int client_count;                /* number of clients on client_list */
+static uint64_t client_lookups;         /* find_client_id/find_client_pi calls */
+
+#define CLIENT_HASH_SIZE 256
+static struct list_head client_id_hash[CLIENT_HASH_SIZE];
+static struct list_head client_pi_hash[CLIENT_HASH_SIZE];
 
 #define INTERNAL_CLIENT_ID 0xFFFFFFFF   /* special client_id for internal actions */
 static struct list_head adopt_results;  /* special start actions from adopt_locks() */
@@ -408,6 +414,7 @@ static int dump_log(int *dump_len)
 struct lockspace *alloc_lockspace(void)
 {
 	struct lockspace *ls;
+	int i;
 
 	if (!(ls = malloc(sizeof(struct lockspace)))) {
 		log_error("out of memory for lockspace");
@@ -417,8 +424,14 @@ struct lockspace *alloc_lockspace(void)
 	memset(ls, 0, sizeof(struct lockspace));
 	INIT_LIST_HEAD(&ls->actions);
 	INIT_LIST_HEAD(&ls->resources);
+	for (i = 0; i < LS_RESOURCE_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&ls->resource_hash[i]);
+	INIT_LIST_HEAD(&ls->work_resources);
 	pthread_mutex_init(&ls->mutex, NULL);
 	pthread_cond_init(&ls->cond, NULL);
+	pthread_mutex_init(&ls->work_mutex, NULL);
+	pthread_cond_init(&ls->work_cond, NULL);
+	pthread_cond_init(&ls->work_done_cond, NULL);
 	return ls;
 }
 
@@ -479,6 +492,8 @@ static struct resource *alloc_resource(void)
 		memset(r, 0, sizeof(struct resource) + resource_lm_data_size);
 		INIT_LIST_HEAD(&r->locks);
 		INIT_LIST_HEAD(&r->actions);
+		INIT_LIST_HEAD(&r->hash);
+		INIT_LIST_HEAD(&r->work);
 	} else {
 		log_error("out of memory for resource");
 	}
@@ -541,6 +556,69 @@ static void free_resource(struct resource *r)
 	pthread_mutex_unlock(&unused_struct_mutex);
 }
 
+/*
+ * A lockspace can hold a resource for every LV in the VG, so resources
+ * are also kept in a hash table keyed by type and name.  ls->resources
+ * remains the list used for walking all resources.
+ */
+
+static unsigned int resource_hash(int8_t type, const char *name)
+{
+	unsigned int h = 2166136261U ^ (unsigned char) type;
+
+	while (*name)
+		h = (h ^ (unsigned char) *name++) * 16777619U;
+
+	return h % LS_RESOURCE_HASH_SIZE;
+}
+
+static void add_ls_resource(struct lockspace *ls, struct resource *r)
+{
+	list_add_tail(&r->list, &ls->resources);
+	list_add(&r->hash, &ls->resource_hash[resource_hash(r->type, r->name)]);
+	ls->resource_count++;
+}
+
+static void del_ls_resource(struct lockspace *ls, struct resource *r)
+{
+	list_del(&r->list);
+	list_del(&r->hash);
+	ls->resource_count--;
+}
+
+static struct resource *find_ls_resource(struct lockspace *ls, int8_t type, const char *name)
+{
+	struct resource *r;
+
+	ls->resource_lookups++;
+
+	list_for_each_entry(r, &ls->resource_hash[resource_hash(type, name)], hash) {
+		ls->resource_lookup_steps++;
+		if (r->type == type && !strcmp(r->name, name))
+			return r;
+	}
+	return NULL;
+}
+
+/* ls->mutex is held when the actions list is changed */
+
+static void add_ls_action(struct lockspace *ls, struct action *act, int head)
+{
+	if (head)
+		list_add(&act->list, &ls->actions);
+	else
+		list_add_tail(&act->list, &ls->actions);
+
+	if (++ls->action_count > ls->action_count_max)
+		ls->action_count_max = ls->action_count;
+}
+
+static void del_ls_action(struct lockspace *ls, struct action *act)
+{
+	list_del(&act->list);
+	ls->action_count--;
+}
+
 static void free_lock(struct lock *lk)
 {
 	pthread_mutex_lock(&unused_struct_mutex);
@@ -861,11 +939,24 @@ static int lm_rem_lockspace(struct lockspace *ls, struct action *act, int free_v
 	return rv;
 }
 
+/*
+ * In test mode no lock manager is called, so each lock, convert and
+ * unlock can be given a fixed delay standing in for the lock manager
+ * round trip, e.g. to measure request throughput with lock workers.
+ */
+static void lm_test_delay(void)
+{
+	if (daemon_test && daemon_test_latency > 0)
+		usleep(daemon_test_latency);
+}
+
 static int lm_lock(struct lockspace *ls, struct resource *r, int mode, struct action *act,
 		   struct val_blk *vb_out, int *retry, int adopt)
 {
 	int rv;
 
+	lm_test_delay();
+
 	if (ls->lm_type == LD_LM_DLM)
 		rv = lm_lock_dlm(ls, r, mode, vb_out, adopt);
 	else if (ls->lm_type == LD_LM_SANLOCK)
@@ -883,6 +974,8 @@ static int lm_convert(struct lockspace *ls, struct resource *r,
 {
 	int rv;
 
+	lm_test_delay();
+
 	if (ls->lm_type == LD_LM_DLM)
 		rv = lm_convert_dlm(ls, r, mode, r_version);
 	else if (ls->lm_type == LD_LM_SANLOCK)
@@ -900,6 +993,8 @@ static int lm_unlock(struct lockspace *ls, struct resource *r, struct action *ac
 {
 	int rv;
 
+	lm_test_delay();
+
 	if (ls->lm_type == LD_LM_DLM)
 		rv = lm_unlock_dlm(ls, r, r_version, lmu_flags);
 	else if (ls->lm_type == LD_LM_SANLOCK)
@@ -1619,10 +1714,12 @@ out:
  *
  * retry_out: set to 1 if the lock manager said we should retry,
  * meaning we should call res_process() again in a short while to retry.
+ *
+ * Returns 1 if the resource should be freed by the caller.
  */
 
-static void res_process(struct lockspace *ls, struct resource *r,
-			struct list_head *act_close_list, int *retry_out)
+static int res_process(struct lockspace *ls, struct resource *r,
+		       struct list_head *act_close_list, int *retry_out)
 {
 	struct action *act, *safe, *act_close;
 	struct lock *lk;
@@ -1911,7 +2008,7 @@ static void res_process(struct lockspace *ls, struct resource *r,
 	 */
 
 	if (r->mode == LD_LK_EX)
-		return;
+		return 0;
 
 	/*
 	 * r mode is SH or UN, pass lock-sh actions to lm
@@ -1948,7 +2045,7 @@ static void res_process(struct lockspace *ls, struct resource *r,
 	 */
 
 	if (r->mode == LD_LK_SH)
-		return;
+		return 0;
 
 	/*
 	 * r mode is UN, pass lock-ex action to lm
@@ -1977,7 +2074,7 @@ static void res_process(struct lockspace *ls, struct resource *r,
 		}
 	}
 
-	return;
+	return 0;
 
 r_free:
 	/* For the EUNATCH case it may be possible there are queued actions? */
@@ -1988,10 +2085,158 @@ r_free:
 		list_del(&act->list);
 		add_client_result(act);
 	}
-	log_debug("S %s R %s res_process free", ls->name, r->name);
-	lm_rem_resource(ls, r);
-	list_del(&r->list);
-	free_resource(r);
+	return 1;
+}
+
+/*
+ * Lock workers run res_process() for LV resources so that lock requests
+ * for different LVs are not serialized behind each other's lock manager
+ * round trip.  The lockspace thread hands out a batch of resources and
+ * waits for the whole batch before touching ls->resources again, so the
+ * resource list only changes in the lockspace thread, and the actions for
+ * any one resource are still processed in order by one thread.
+ */
+
+static void *lock_worker_main(void *arg_in)
+{
+	struct lockspace *ls = arg_in;
+	struct resource *r;
+	int retry;
+
+	pthread_mutex_lock(&ls->work_mutex);
+	while (1) {
+		while (!ls->work_stop && list_empty(&ls->work_resources))
+			pthread_cond_wait(&ls->work_cond, &ls->work_mutex);
+
+		if (list_empty(&ls->work_resources))
+			break;
+
+		r = list_first_entry(&ls->work_resources, struct resource, work);
+		list_del(&r->work);
+		pthread_mutex_unlock(&ls->work_mutex);
+
+		retry = 0;
+		r->work_free = res_process(ls, r, ls->work_close, &retry) ? 1 : 0;
+
+		pthread_mutex_lock(&ls->work_mutex);
+		if (retry)
+			ls->work_retry = 1;
+		if (!--ls->work_pending)
+			pthread_cond_signal(&ls->work_done_cond);
+	}
+	pthread_mutex_unlock(&ls->work_mutex);
+
+	return NULL;
+}
+
+/*
+ * The sanlock calls share one registered connection per lockspace, so
+ * only dlm lockspaces (and any lockspace in test mode) use lock workers.
+ */
+
+static void start_lock_workers(struct lockspace *ls)
+{
+	int i, rv;
+
+	if (daemon_lock_workers <= 0)
+		return;
+
+	if (ls->lm_type != LD_LM_DLM && !daemon_test)
+		return;
+
+	if (!(ls->workers = malloc(daemon_lock_workers * sizeof(pthread_t)))) {
+		log_error("S %s no memory for lock workers", ls->name);
+		return;
+	}
+
+	for (i = 0; i < daemon_lock_workers; i++) {
+		rv = pthread_create(&ls->workers[i], NULL, lock_worker_main, ls);
+		if (rv) {
+			log_error("S %s lock worker create error %d", ls->name, rv);
+			break;
+		}
+		ls->worker_count++;
+	}
+
+	log_debug("S %s started %d lock workers", ls->name, ls->worker_count);
+}
+
+static void stop_lock_workers(struct lockspace *ls)
+{
+	int i;
+
+	if (!ls->workers)
+		return;
+
+	pthread_mutex_lock(&ls->work_mutex);
+	ls->work_stop = 1;
+	pthread_cond_broadcast(&ls->work_cond);
+	pthread_mutex_unlock(&ls->work_mutex);
+
+	for (i = 0; i < ls->worker_count; i++)
+		pthread_join(ls->workers[i], NULL);
+
+	free(ls->workers);
+	ls->workers = NULL;
+	ls->worker_count = 0;
+}
+
+static void res_process_all(struct lockspace *ls, struct list_head *act_close_list,
+			    int *retry_out)
+{
+	struct resource *r, *r2;
+	int queued = 0;
+
+	if (ls->worker_count) {
+		/*
+		 * An LV resource with no actions only needs processing
+		 * when a client has exited and its locks are released.
+		 */
+		pthread_mutex_lock(&ls->work_mutex);
+		list_for_each_entry(r, &ls->resources, list) {
+			if (r->type != LD_RT_LV)
+				continue;
+			if (list_empty(&r->actions) && list_empty(act_close_list))
+				continue;
+			r->work_queued = 1;
+			r->work_free = 0;
+			list_add_tail(&r->work, &ls->work_resources);
+			queued++;
+		}
+		ls->work_close = act_close_list;
+		ls->work_pending = queued;
+		ls->work_retry = 0;
+		if (queued)
+			pthread_cond_broadcast(&ls->work_cond);
+		pthread_mutex_unlock(&ls->work_mutex);
+	}
+
+	/* gl and vg resources are processed here while the workers run */
+	list_for_each_entry(r, &ls->resources, list) {
+		if (ls->worker_count && r->type == LD_RT_LV)
+			continue;
+		r->work_free = res_process(ls, r, act_close_list, retry_out) ? 1 : 0;
+	}
+
+	if (queued) {
+		pthread_mutex_lock(&ls->work_mutex);
+		while (ls->work_pending)
+			pthread_cond_wait(&ls->work_done_cond, &ls->work_mutex);
+		if (ls->work_retry)
+			*retry_out = 1;
+		ls->work_close = NULL;
+		pthread_mutex_unlock(&ls->work_mutex);
+	}
+
+	list_for_each_entry_safe(r, r2, &ls->resources, list) {
+		r->work_queued = 0;
+		if (!r->work_free)
+			continue;
+		log_debug("S %s R %s res_process free", ls->name, r->name);
+		lm_rem_resource(ls, r);
+		del_ls_resource(ls, r);
+		free_resource(r);
+	}
 }
 
 #define LOCKS_EXIST_ANY 1
@@ -2093,7 +2338,7 @@ static int clear_locks(struct lockspace *ls, int free_vg, int drop_vg)
  r_free:
 		log_debug("S %s R %s free", ls->name, r->name);
 		lm_rem_resource(ls, r);
-		list_del(&r->list);
+		del_ls_resource(ls, r);
 		free_resource(r);
 	}
 
@@ -2112,21 +2357,17 @@ static struct resource *find_resource_act(struct lockspace *ls,
 					  int nocreate)
 {
 	struct resource *r;
+	const char *name;
 
-	list_for_each_entry(r, &ls->resources, list) {
-		if (r->type != act->rt)
-			continue;
-
-		if (r->type == LD_RT_GL && act->rt == LD_RT_GL)
-			return r;
-
-		if (r->type == LD_RT_VG && act->rt == LD_RT_VG)
-			return r;
+	if (act->rt == LD_RT_GL)
+		name = R_NAME_GL;
+	else if (act->rt == LD_RT_VG)
+		name = R_NAME_VG;
+	else
+		name = act->lv_uuid;
 
-		if (r->type == LD_RT_LV && act->rt == LD_RT_LV &&
-		    !strcmp(r->name, act->lv_uuid))
-			return r;
-	}
+	if ((r = find_ls_resource(ls, act->rt, name)))
+		return r;
 
 	if (nocreate)
 		return NULL;
@@ -2148,7 +2389,7 @@ static struct resource *find_resource_act(struct lockspace *ls,
 		r->use_vb = 0;
 	}
 
-	list_add_tail(&r->list, &ls->resources);
+	add_ls_resource(ls, r);
 
 	return r;
 }
@@ -2159,7 +2400,7 @@ static void free_ls_resources(struct lockspace *ls)
 
 	list_for_each_entry_safe(r, r_safe, &ls->resources, list) {
 		lm_rem_resource(ls, r);
-		list_del(&r->list);
+		del_ls_resource(ls, r);
 		free_resource(r);
 	}
 }
@@ -2221,7 +2462,7 @@ static int process_op_during_kill(struct action *act)
 static void *lockspace_thread_main(void *arg_in)
 {
 	struct lockspace *ls = arg_in;
-	struct resource *r, *r2;
+	struct resource *r;
 	struct action *add_act, *act, *safe;
 	struct action *act_op_free = NULL;
 	struct list_head tmp_act;
@@ -2245,7 +2486,7 @@ static void *lockspace_thread_main(void *arg_in)
 		act = list_first_entry(&ls->actions, struct action, list);
 		if (act->op == LD_OP_START) {
 			add_act = act;
-			list_del(&add_act->list);
+			del_ls_action(ls, add_act);
 
 			if (add_act->flags & LD_AF_WAIT)
 				wait_flag = 1;
@@ -2302,6 +2543,8 @@ static void *lockspace_thread_main(void *arg_in)
 	if (error)
 		goto out_act;
 
+	start_lock_workers(ls);
+
 	while (1) {
 		pthread_mutex_lock(&ls->mutex);
 		while (!ls->thread_work) {
@@ -2337,7 +2580,7 @@ static void *lockspace_thread_main(void *arg_in)
 				/* Continue processing until DROP_VG arrives. */
 				log_debug("S %s kill_vg", ls->name);
 				ls->kill_vg = 1;
-				list_del(&act->list);
+				del_ls_action(ls, act);
 				act->result = 0;
 				add_client_result(act);
 				continue;
@@ -2345,7 +2588,7 @@ static void *lockspace_thread_main(void *arg_in)
 
 			if (ls->kill_vg && !process_op_during_kill(act)) {
 				log_debug("S %s disallow op %s after kill_vg", ls->name, op_str(act->op));
-				list_del(&act->list);
+				del_ls_action(ls, act);
 				act->result = -EVGKILLED;
 				add_client_result(act);
 				continue;
@@ -2385,7 +2628,7 @@ static void *lockspace_thread_main(void *arg_in)
 					 * after the ls is stopped on other hosts.
 					 */
 					log_error("S %s lockspace hosts %d", ls->name, rv);
-					list_del(&act->list);
+					del_ls_action(ls, act);
 					act->result = -EBUSY;
 					add_client_result(act);
 					continue;
@@ -2403,7 +2646,7 @@ static void *lockspace_thread_main(void *arg_in)
 					act->result = -EBUSY;
 				else
 					act->result = 0;
-				list_del(&act->list);
+				del_ls_action(ls, act);
 				add_client_result(act);
 				continue;
 			}
@@ -2414,7 +2657,7 @@ static void *lockspace_thread_main(void *arg_in)
 				rv = lm_hosts(ls, 1);
 				if (rv) {
 					log_error("S %s lockspace hosts %d", ls->name, rv);
-					list_del(&act->list);
+					del_ls_action(ls, act);
 					act->result = -EBUSY;
 					add_client_result(act);
 					continue;
@@ -2432,13 +2675,13 @@ static void *lockspace_thread_main(void *arg_in)
 				log_debug("S %s find free lock %d offset %llu",
 					  ls->name, rv, (unsigned long long)free_offset);
 				ls->free_lock_offset = free_offset;
-				list_del(&act->list);
+				del_ls_action(ls, act);
 				act->result = rv;
 				add_client_result(act);
 				continue;
 			}
 
-			list_del(&act->list);
+			del_ls_action(ls, act);
 
 			/* applies to all resources */
 			if (act->op == LD_OP_CLOSE) {
@@ -2476,8 +2719,7 @@ static void *lockspace_thread_main(void *arg_in)
 
 		retry = 0;
 
-		list_for_each_entry_safe(r, r2, &ls->resources, list)
-			res_process(ls, r, &act_close, &retry);
+		res_process_all(ls, &act_close, &retry);
 
 		list_for_each_entry_safe(act, safe, &act_close, list) {
 			list_del(&act->list);
@@ -2493,6 +2735,8 @@ static void *lockspace_thread_main(void *arg_in)
 out_rem:
 	log_debug("S %s stopping", ls->name);
 
+	stop_lock_workers(ls);
+
 	/*
 	 * For sanlock, we need to unlock any existing locks
 	 * before removing the lockspace, otherwise the sanlock
@@ -2560,7 +2804,7 @@ out_act:
 			act->result = 0;
 		else
 			act->result = -ENOLS;
-		list_del(&act->list);
+		del_ls_action(ls, act);
 		list_add_tail(&act->list, &tmp_act);
 	}
 	pthread_mutex_unlock(&ls->mutex);
@@ -2735,7 +2979,7 @@ static int add_lockspace_thread(const char *ls_name,
 	r->mode = LD_LK_UN;
 	r->use_vb = 1;
 	strncpy(r->name, R_NAME_VG, MAX_NAME);
-	list_add_tail(&r->list, &ls->resources);
+	add_ls_resource(ls, r);
 
 	pthread_mutex_lock(&lockspaces_mutex);
 	ls2 = find_lockspace_name(ls->name);
@@ -2758,7 +3002,7 @@ static int add_lockspace_thread(const char *ls_name,
 	 * and not by an explicit client action that wants a result.
 	 */
 	if (act)
-		list_add(&act->list, &ls->actions);
+		add_ls_action(ls, act, 1);
 
 	if (ls->lm_type == LD_LM_DLM && !strcmp(ls->name, gl_lsname_dlm))
 		global_dlm_lockspace_exists = 1;
@@ -2951,7 +3195,7 @@ static int rem_lockspace(struct action *act)
 	}
 	ls->thread_work = 1;
 	ls->thread_stop = 1;
-	list_add_tail(&act->list, &ls->actions);
+	add_ls_action(ls, act, 0);
 	pthread_cond_signal(&ls->cond);
 	pthread_mutex_unlock(&ls->mutex);
 	pthread_mutex_unlock(&lockspaces_mutex);
@@ -3504,12 +3748,39 @@ static struct client *find_client_work(void)
 	return NULL;
 }
 
+/*
+ * Clients are hashed by id and by the pollfd index they were given when
+ * they connected.  cl->pi is set to -1 when the fd is closed, but the
+ * client stays on the pi hash until it is removed from client_list, so
+ * find_client_pi has to compare cl->pi.
+ */
+
+/* client_mutex is locked */
+static void add_client(struct client *cl)
+{
+	list_add_tail(&cl->list, &client_list);
+	list_add(&cl->id_hash, &client_id_hash[cl->id % CLIENT_HASH_SIZE]);
+	list_add(&cl->pi_hash, &client_pi_hash[cl->pi % CLIENT_HASH_SIZE]);
+	client_count++;
+}
+
+/* client_mutex is locked */
+static void del_client(struct client *cl)
+{
+	list_del(&cl->list);
+	list_del(&cl->id_hash);
+	list_del(&cl->pi_hash);
+	client_count--;
+}
+
 /* client_mutex is locked */
 static struct client *find_client_id(uint32_t id)
 {
 	struct client *cl;
 
-	list_for_each_entry(cl, &client_list, list) {
+	client_lookups++;
+
+	list_for_each_entry(cl, &client_id_hash[id % CLIENT_HASH_SIZE], id_hash) {
 		if (cl->id == id)
 			return cl;
 	}
@@ -3521,7 +3792,9 @@ static struct client *find_client_pi(int pi)
 {
 	struct client *cl;
 
-	list_for_each_entry(cl, &client_list, list) {
+	client_lookups++;
+
+	list_for_each_entry(cl, &client_pi_hash[pi % CLIENT_HASH_SIZE], pi_hash) {
 		if (cl->pi == pi)
 			return cl;
 	}
@@ -3711,6 +3984,10 @@ static int client_send_result(struct client *cl, struct action *act)
 					  NULL);
 	}
 
+	/* reply in the format of the request */
+	if (!(act->flags & LD_AF_BINARY) && !buffer_to_text(&res.buffer))
+		log_error("send cl %u reply conversion failed", cl->id);
+
 	if (!buffer_write(cl->fd, &res.buffer)) {
 		rv = -errno;
 		if (rv >= 0)
@@ -3755,7 +4032,7 @@ static void client_purge(struct client *cl)
 
 		pthread_mutex_lock(&ls->mutex);
 		if (!ls->thread_stop) {
-			list_add_tail(&act->list, &ls->actions);
+			add_ls_action(ls, act, 0);
 			ls->thread_work = 1;
 			pthread_cond_signal(&ls->cond);
 		} else {
@@ -3870,7 +4147,7 @@ static int add_lock_action(struct action *act)
 		return -ESTARTING;
 	}
 
-	list_add_tail(&act->list, &ls->actions);
+	add_ls_action(ls, act, 0);
 	ls->thread_work = 1;
 	pthread_cond_signal(&ls->cond);
 	pthread_mutex_unlock(&ls->mutex);
@@ -4140,12 +4417,16 @@ static int print_structs(const char *prefix, int pos, int len)
 			"unused_action_count=%d "
 			"unused_client_count=%d "
 			"unused_resource_count=%d "
-			"unused_lock_count=%d\n",
+			"unused_lock_count=%d "
+			"client_count=%d "
+			"client_lookups=%llu\n",
 			prefix,
 			unused_action_count,
 			unused_client_count,
 			unused_resource_count,
-			unused_lock_count);
+			unused_lock_count,
+			client_count,
+			(unsigned long long)client_lookups);
 }
 
 static int print_client(struct client *cl, const char *prefix, int pos, int len)
@@ -4183,7 +4464,12 @@ static int print_lockspace(struct lockspace *ls, const char *prefix, int pos, in
 			"thread_done=%d "
 			"kill_vg=%d "
 			"drop_vg=%d "
-			"sanlock_gl_enabled=%d\n",
+			"sanlock_gl_enabled=%d "
+			"resources=%u "
+			"resource_lookups=%llu "
+			"resource_lookup_steps=%llu "
+			"actions=%u "
+			"actions_max=%u\n",
 			prefix,
 			ls->name,
 			ls->vg_name,
@@ -4199,7 +4485,12 @@ static int print_lockspace(struct lockspace *ls, const char *prefix, int pos, in
 			ls->thread_done ? 1 : 0,
 			ls->kill_vg,
 			ls->drop_vg,
-			ls->sanlock_gl_enabled ? 1 : 0);
+			ls->sanlock_gl_enabled ? 1 : 0,
+			ls->resource_count,
+			(unsigned long long)ls->resource_lookups,
+			(unsigned long long)ls->resource_lookup_steps,
+			ls->action_count,
+			ls->action_count_max);
 }
 
 static int print_action(struct action *act, const char *prefix, int pos, int len)
@@ -4378,6 +4669,7 @@ static void client_recv_action(struct client *cl)
 	int result = 0;
 	int cl_pid;
 	int op, rt, lm, mode;
+	int binary;
 	int rv;
 
 	buffer_init(&req.buffer);
@@ -4395,7 +4687,8 @@ static void client_recv_action(struct client *cl)
 		return;
 	}
 
-	req.cft = config_tree_from_string_without_dup_node_check(req.buffer.mem);
+	binary = buffer_is_binary(&req.buffer);
+	req.cft = config_tree_from_buffer(&req.buffer);
 	if (!req.cft) {
 		log_error("client recv %u config_from_string error", cl->id);
 		buffer_destroy(&req.buffer);
@@ -4438,7 +4731,10 @@ static void client_recv_action(struct client *cl)
 					  "result = " FMTd64, (int64_t) result,
 					  "protocol = %s", lvmlockd_protocol,
 					  "version = " FMTd64, (int64_t) lvmlockd_protocol_version,
+					  "binary = " FMTd64, INT64_C(1),
 					  NULL);
+		if (!binary && !buffer_to_text(&res.buffer))
+			log_error("client recv %u reply conversion failed", cl->id);
 		buffer_write(cl->fd, &res.buffer);
 		buffer_destroy(&res.buffer);
 		dm_config_destroy(req.cft);
@@ -4490,6 +4786,9 @@ static void client_recv_action(struct client *cl)
 	act->flags = opts;
 	act->lm_type = lm;
 
+	if (binary)
+		act->flags |= LD_AF_BINARY;
+
 	if (vg_name && strcmp(vg_name, "none"))
 		strncpy(act->vg_name, vg_name, MAX_NAME);
 
@@ -4709,7 +5008,7 @@ static void *client_thread_main(void *arg_in)
 				pthread_mutex_unlock(&cl->mutex);
 
 				pthread_mutex_lock(&client_mutex);
-				list_del(&cl->list);
+				del_client(cl);
 				pthread_mutex_unlock(&client_mutex);
 
 				client_purge(cl);
@@ -4727,11 +5026,16 @@ out:
 
 static int setup_client_thread(void)
 {
-	int rv;
+	int i, rv;
 
 	INIT_LIST_HEAD(&client_list);
 	INIT_LIST_HEAD(&client_results);
 
+	for (i = 0; i < CLIENT_HASH_SIZE; i++) {
+		INIT_LIST_HEAD(&client_id_hash[i]);
+		INIT_LIST_HEAD(&client_pi_hash[i]);
+	}
+
 	pthread_mutex_init(&client_mutex, NULL);
 	pthread_cond_init(&client_cond, NULL);
 
@@ -4901,7 +5205,7 @@ static int get_lockd_vgs(struct list_head *vg_lockd)
 				strncpy(r->name, lv_uuid, MAX_NAME);
 				if (lock_args)
 					strncpy(r->lv_args, lock_args, MAX_ARGS);
-				list_add_tail(&r->list, &ls->resources);
+				add_ls_resource(ls, r);
 				log_debug("get_lockd_vgs %s lv %s %s (name %s)",
 					  ls->vg_name, r->name, lock_args ? lock_args : "", lv_cn->key);
 			}
@@ -5113,7 +5417,7 @@ out:
 				r->adopt = 0;
 			} else {
 				log_debug("lockd vg %s remove inactive lv %s", ls->vg_name, r->name);
-				list_del(&r->list);
+				del_ls_resource(ls, r);
 				free_resource(r);
 			}
 		}
@@ -5253,8 +5557,8 @@ static void adopt_locks(void)
 			memcpy(ls1->vg_uuid, ls2->vg_uuid, 64);
 			memcpy(ls1->vg_args, ls2->vg_args, MAX_ARGS);
 			list_for_each_entry_safe(r, rsafe, &ls2->resources, list) {
-				list_del(&r->list);
-				list_add(&r->list, &ls1->resources);
+				del_ls_resource(ls2, r);
+				add_ls_resource(ls1, r);
 			}
 			list_del(&ls2->list);
 			free(ls2);
@@ -5715,7 +6019,7 @@ static void process_listener(int poll_fd)
 		client_ids++;
 
 	cl->id = client_ids;
-	list_add_tail(&cl->list, &client_list);
+	add_client(cl);
 	pthread_mutex_unlock(&client_mutex);
 
 	log_debug("new cl %u pi %d fd %d", cl->id, cl->pi, cl->fd);
@@ -5948,6 +6252,10 @@ static void usage(char *prog, FILE *file)
 	fprintf(file, "        Set the sanlock lockspace I/O timeout.\n");
 	fprintf(file, "  --adopt | -A 0|1\n");
 	fprintf(file, "        Adopt locks from a previous instance of lvmlockd.\n");
+	fprintf(file, "  --lock-workers | -w <num>\n");
+	fprintf(file, "        Threads per dlm lockspace for LV lock requests. [0]\n");
+	fprintf(file, "  --test-latency | -L <usec>\n");
+	fprintf(file, "        Delay each lock manager request in test mode.\n");
 }
 
 int main(int argc, char *argv[])
@@ -5977,6 +6285,8 @@ int main(int argc, char *argv[])
 		{"adopt",           required_argument, 0, 'A' },
 		{"syslog-priority", required_argument, 0, 'S' },
 		{"sanlock-timeout", required_argument, 0, 'o' },
+		{"lock-workers",    required_argument, 0, 'w' },
+		{"test-latency",    required_argument, 0, 'L' },
 		{0, 0, 0, 0 }
 	};
 
@@ -5985,7 +6295,7 @@ int main(int argc, char *argv[])
 		int lm;
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "hVTfDp:s:l:g:S:I:A:o:",
+		c = getopt_long(argc, argv, "hVTfDp:s:l:g:S:I:A:o:w:L:",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -6038,6 +6348,12 @@ int main(int argc, char *argv[])
 		case 'A':
 			adopt_opt = atoi(optarg);
 			break;
+		case 'w':
+			daemon_lock_workers = atoi(optarg);
+			break;
+		case 'L':
+			daemon_test_latency = atoi(optarg);
+			break;
 		case 'S':
 			syslog_priority = _syslog_name_to_num(optarg);
 			break;
@@ -77,6 +77,8 @@ struct list_head {
 
 struct client {
 	struct list_head list;
+	struct list_head id_hash;	/* client_id_hash */
+	struct list_head pi_hash;	/* client_pi_hash */
 	pthread_mutex_t mutex;
 	int pid;
 	int fd;
@@ -105,6 +107,7 @@ struct client {
 #define LD_AF_WARN_GL_REMOVED	   0x00020000
 #define LD_AF_LV_LOCK              0x00040000
 #define LD_AF_LV_UNLOCK            0x00080000
+#define LD_AF_BINARY               0x00100000	/* client sent a binary request */
 
 /*
  * Number of times to repeat a lock request after
@@ -138,6 +141,8 @@ struct action {
 
 struct resource {
 	struct list_head list;		/* lockspace.resources */
+	struct list_head hash;		/* lockspace.resource_hash */
+	struct list_head work;		/* lockspace.work_resources */
 	char name[MAX_NAME+1];		/* vg name or lv name */
 	int8_t type;			/* resource type LD_RT_ */
 	int8_t mode;
@@ -148,6 +153,8 @@ struct resource {
 	unsigned int adopt : 1;		/* temp flag in remove_inactive_lvs */
 	unsigned int version_zero_valid : 1;
 	unsigned int use_vb : 1;
+	unsigned int work_queued : 1;	/* given to a lock worker */
+	unsigned int work_free : 1;	/* lock worker wants r freed */
 	struct list_head locks;
 	struct list_head actions;
 	char lv_args[MAX_ARGS+1];
@@ -164,6 +171,8 @@ struct lock {
 	uint32_t client_id; /* may be 0 for persistent or internal locks */
 };
 
+#define LS_RESOURCE_HASH_SIZE 256
+
 struct lockspace {
 	struct list_head list;		/* lockspaces */
 	char name[MAX_NAME+1];
@@ -193,6 +202,28 @@ struct lockspace {
 
 	struct list_head actions;	/* new client actions */
 	struct list_head resources;	/* resource/lock state for gl/vg/lv */
+
+	/* resources indexed by type and name, see find_ls_resource */
+	struct list_head resource_hash[LS_RESOURCE_HASH_SIZE];
+
+	/* counters reported by lvmlockctl --info */
+	uint32_t resource_count;
+	uint32_t action_count;		/* current length of actions */
+	uint32_t action_count_max;
+	uint64_t resource_lookups;
+	uint64_t resource_lookup_steps;
+
+	/* lock workers process LV resources in parallel, see res_process_all */
+	pthread_t *workers;
+	int worker_count;
+	pthread_mutex_t work_mutex;
+	pthread_cond_t work_cond;	/* workers wait for work_resources */
+	pthread_cond_t work_done_cond;	/* lockspace thread waits for work_pending */
+	struct list_head work_resources;
+	struct list_head *work_close;	/* act_close list for the current batch */
+	int work_pending;
+	unsigned int work_retry : 1;
+	unsigned int work_stop : 1;
 };
 
 /* val_blk version */
@@ -326,6 +357,8 @@ EXTERN char gl_lsname_sanlock[MAX_NAME+1];
 EXTERN int global_dlm_lockspace_exists;
 
 EXTERN int daemon_test; /* run as much as possible without a live lock manager */
+EXTERN int daemon_test_latency; /* usec added to each lock manager call in test mode */
+EXTERN int daemon_lock_workers; /* threads per lockspace for LV lock requests */
 EXTERN int daemon_debug;
 EXTERN int daemon_host_id;
 EXTERN const char *daemon_host_id_file;
@@ -141,6 +141,16 @@ struct lm_sanlock {
 	struct sanlk_lockspace ss;
 	int align_size;
 	int sock; /* sanlock daemon connection */
+
+	/*
+	 * One bit per LV lock slot on the lvmlock lv, set when the slot
+	 * is in use.  Only used by the lockspace thread (find_free_lock
+	 * and free_lv), see lm_find_free_lock_sanlock.
+	 */
+	uint64_t *lv_map;
+	uint32_t lv_map_len;	/* number of uint64_t in lv_map */
+	uint32_t lv_map_slots;	/* number of slots read from disk */
+	uint32_t lv_map_next;	/* search for a clear bit from here */
 };
 
 struct rd_sanlock {
@@ -775,11 +785,35 @@ int lm_rename_vg_sanlock(char *ls_name, char *vg_name, uint32_t flags, char *vg_
 	return 0;
 }
 
+#define LV_MAP_BITS 64
+
+static int lv_map_test(struct lm_sanlock *lms, uint32_t slot)
+{
+	return (lms->lv_map[slot / LV_MAP_BITS] >> (slot % LV_MAP_BITS)) & 1;
+}
+
+static void lv_map_set(struct lm_sanlock *lms, uint32_t slot)
+{
+	lms->lv_map[slot / LV_MAP_BITS] |= UINT64_C(1) << (slot % LV_MAP_BITS);
+}
+
+static void lv_map_clear(struct lm_sanlock *lms, uint32_t slot)
+{
+	lms->lv_map[slot / LV_MAP_BITS] &= ~(UINT64_C(1) << (slot % LV_MAP_BITS));
+}
+
+static uint64_t lv_map_offset(struct lm_sanlock *lms, uint32_t slot)
+{
+	return (uint64_t)lms->align_size * (LV_LOCK_BEGIN + slot);
+}
+
 /* lvremove */
 int lm_free_lv_sanlock(struct lockspace *ls, struct resource *r)
 {
+	struct lm_sanlock *lms = (struct lm_sanlock *)ls->lm_data;
 	struct rd_sanlock *rds = (struct rd_sanlock *)r->lm_data;
 	struct sanlk_resource *rs = &rds->rs;
+	uint64_t slot;
 	int rv;
 
 	log_debug("S %s R %s free_lv_san", ls->name, r->name);
@@ -793,6 +827,16 @@ int lm_free_lv_sanlock(struct lockspace *ls, struct resource *r)
 	if (rv < 0) {
 		log_error("S %s R %s free_lv_san write error %d",
 			  ls->name, r->name, rv);
+		return rv;
+	}
+
+	if (lms->lv_map && rs->disks[0].offset >= lv_map_offset(lms, 0)) {
+		slot = (rs->disks[0].offset - lv_map_offset(lms, 0)) / lms->align_size;
+		if (slot < lms->lv_map_slots) {
+			lv_map_clear(lms, slot);
+			if (slot < lms->lv_map_next)
+				lms->lv_map_next = slot;
+		}
 	}
 
 	return rv;
@@ -973,90 +1017,189 @@ int lm_gl_is_enabled(struct lockspace *ls)
  * been disabled.)
  */
 
+/* Returns the first clear slot from lv_map_next, or -1 if all are set. */
+
+static int64_t lv_map_find(struct lm_sanlock *lms)
+{
+	uint32_t i, slot;
+	uint64_t word;
+
+	for (i = lms->lv_map_next / LV_MAP_BITS; i < lms->lv_map_len; i++) {
+		word = lms->lv_map[i];
+		if (word == ~UINT64_C(0))
+			continue;
+
+		for (slot = i * LV_MAP_BITS; slot < (i + 1) * LV_MAP_BITS; slot++) {
+			if (slot >= lms->lv_map_slots)
+				return -1;
+			if (slot >= lms->lv_map_next && !lv_map_test(lms, slot))
+				return slot;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Read all lock slots until the end of the lvmlock lv, which grows when
+ * lvcreate extends it.  This is done once by the first find_free_lock,
+ * after which a new lock is found without rereading the slots that are
+ * in use.  Other hosts free slots with lvremove, so it is done again
+ * before reporting that no slot is free.
+ */
+
+static int lv_map_read(struct lockspace *ls, struct lm_sanlock *lms)
+{
+	struct sanlk_resourced rd;
+	uint64_t *new_map;
+	uint32_t new_len;
+	uint32_t slot;
+	int rv;
+
+	memset(&rd, 0, sizeof(rd));
+
+	strncpy(rd.rs.lockspace_name, ls->name, SANLK_NAME_LEN);
+	rd.rs.num_disks = 1;
+	strncpy(rd.rs.disks[0].path, lms->ss.host_id_disk.path, SANLK_PATH_LEN-1);
+
+	for (slot = 0; ; slot++) {
+		rd.rs.disks[0].offset = lv_map_offset(lms, slot);
+
+		memset(rd.rs.name, 0, SANLK_NAME_LEN);
+
+		rv = sanlock_read_resource(&rd.rs, 0);
+		if (rv == -EMSGSIZE || rv == -ENOSPC)
+			break;
+
+		if (rv && rv != SANLK_LEADER_MAGIC) {
+			log_error("S %s lv_map read error %d offset %llu",
+				  ls->name, rv, (unsigned long long)rd.rs.disks[0].offset);
+			return rv;
+		}
+
+		if (slot / LV_MAP_BITS >= lms->lv_map_len) {
+			new_len = lms->lv_map_len ? lms->lv_map_len * 2 : 16;
+			if (!(new_map = realloc(lms->lv_map, new_len * sizeof(uint64_t)))) {
+				log_error("S %s lv_map no memory for %u slots",
+					  ls->name, new_len * LV_MAP_BITS);
+				return -ENOMEM;
+			}
+			memset(new_map + lms->lv_map_len, 0,
+			       (new_len - lms->lv_map_len) * sizeof(uint64_t));
+			lms->lv_map = new_map;
+			lms->lv_map_len = new_len;
+		}
+
+		/*
+		 * Newly extended space is not initialized with an "#unused"
+		 * resource, and returns SANLK_LEADER_MAGIC.
+		 */
+		if (!rv && strcmp(rd.rs.name, "#unused"))
+			lv_map_set(lms, slot);
+		else
+			lv_map_clear(lms, slot);
+	}
+
+	lms->lv_map_slots = slot;
+	lms->lv_map_next = 0;
+
+	log_debug("S %s lv_map slots %u", ls->name, lms->lv_map_slots);
+	return 0;
+}
+
+/*
+ * This is called at the beginning of lvcreate to
+ * ensure there is free space for a new LV lock.
+ * If not, lvcreate will extend the lvmlock lv
+ * before continuing with creating the new LV.
+ * This way, lm_init_lv_san() should find a free
+ * lock (unless the autoextend of lvmlock lv has
+ * been disabled.)
+ *
+ * Another host may have used a slot since it was read, so the slot is
+ * read once more before it is returned, and lm_init_lv_san() checks it
+ * again before writing.  The slot returned is not marked in use: if the
+ * lvcreate fails before writing it, the next lvcreate finds it free, and
+ * otherwise the next lvcreate reads it first and then marks it.
+ */
+
 int lm_find_free_lock_sanlock(struct lockspace *ls, uint64_t *free_offset)
 {
 	struct lm_sanlock *lms = (struct lm_sanlock *)ls->lm_data;
 	struct sanlk_resourced rd;
 	uint64_t offset;
-	uint64_t start_offset;
+	int64_t slot;
+	int rescanned = 0;
 	int rv;
-	int round = 0;
 
 	if (daemon_test) {
 		*free_offset = (1048576 * LV_LOCK_BEGIN) + (1048576 * (daemon_test_lv_count + 1));
 		return 0;
 	}
 
+	if (!lms->lv_map && (rv = lv_map_read(ls, lms)) < 0)
+		return rv;
+
 	memset(&rd, 0, sizeof(rd));
 
 	strncpy(rd.rs.lockspace_name, ls->name, SANLK_NAME_LEN);
 	rd.rs.num_disks = 1;
 	strncpy(rd.rs.disks[0].path, lms->ss.host_id_disk.path, SANLK_PATH_LEN-1);
 
-	if (ls->free_lock_offset)
-		offset = ls->free_lock_offset;
-	else
-		offset = lms->align_size * LV_LOCK_BEGIN;
-
-	start_offset = offset;
-
 	while (1) {
-		if (offset >= start_offset && round) {
-			/* This indicates the all space are allocated. */
-			log_debug("S %s init_lv_san read back to start offset %llu",
-				ls->name, (unsigned long long)offset);
-			rv = -EMSGSIZE;
-			return rv;
+		slot = lv_map_find(lms);
+		if (slot < 0) {
+			/*
+			 * Look for slots freed by other hosts, and for space
+			 * added by another host extending lvmlock.
+			 */
+			if (!rescanned++) {
+				if ((rv = lv_map_read(ls, lms)) < 0)
+					return rv;
+				continue;
+			}
+
+			/*
+			 * This indicates all space is allocated.  Remember the
+			 * NO SPACE offset, where the search continues after
+			 * lvmlock is extended.
+			 */
+			*free_offset = lv_map_offset(lms, lms->lv_map_slots);
+			log_debug("S %s find_free_lock_san no free lock, limit offset %llu",
+				  ls->name, (unsigned long long)*free_offset);
+			return -EMSGSIZE;
 		}
 
+		offset = lv_map_offset(lms, slot);
 		rd.rs.disks[0].offset = offset;
 
 		memset(rd.rs.name, 0, SANLK_NAME_LEN);
 
 		rv = sanlock_read_resource(&rd.rs, 0);
 		if (rv == -EMSGSIZE || rv == -ENOSPC) {
-			/* This indicates the end of the device is reached. */
+			/* lvmlock is smaller than when it was read */
 			log_debug("S %s find_free_lock_san read limit offset %llu",
 				  ls->name, (unsigned long long)offset);
-
-			/* remember the NO SPACE offset, if no free area left,
-			 * search from this offset after extend */
-			*free_offset = offset;
-
-			offset = lms->align_size * LV_LOCK_BEGIN;
-			round = 1;
+			lms->lv_map_slots = slot;
 			continue;
 		}
 
-		/*
-		 * If we read newly extended space, it will not be initialized
-		 * with an "#unused" resource, but will return an error about
-		 * an invalid paxos structure on disk.
-		 */
-		if (rv == SANLK_LEADER_MAGIC) {
-			log_debug("S %s find_free_lock_san found empty area at %llu",
-				  ls->name, (unsigned long long)offset);
-			*free_offset = offset;
-			return 0;
-		}
-
-		if (rv) {
+		if (rv && rv != SANLK_LEADER_MAGIC) {
 			log_error("S %s find_free_lock_san read error %d offset %llu",
 				  ls->name, rv, (unsigned long long)offset);
-			break;
+			return rv;
 		}
 
-		if (!strcmp(rd.rs.name, "#unused")) {
+		if (rv == SANLK_LEADER_MAGIC || !strcmp(rd.rs.name, "#unused")) {
 			log_debug("S %s find_free_lock_san found unused area at %llu",
 				  ls->name, (unsigned long long)offset);
 			*free_offset = offset;
 			return 0;
 		}
 
-		offset += lms->align_size;
+		lv_map_set(lms, slot);
+		lms->lv_map_next = slot + 1;
 	}
-
-	return rv;
 }
 
 /*
@@ -1293,6 +1436,7 @@ out:
 fail:
 	if (close(lms->sock))
 		log_error("failed to close sanlock daemon socket connection");
+	free(lms->lv_map);
 	free(lms);
 	ls->lm_data = NULL;
 	return rv;
@@ -1331,6 +1475,7 @@ int lm_rem_lockspace_sanlock(struct lockspace *ls, int free_vg)
 	if (close(lms->sock))
 		log_error("failed to close sanlock daemon socket connection");
 out:
+	free(lms->lv_map);
 	free(lms);
 	ls->lm_data = NULL;
 
@@ -119,7 +119,7 @@ static int copy_env(const char ***cmd_envp, unsigned *i, const char *exclude)
 	return 1;
 }
 
-const char **cmdenvp_ctr(const struct lvmpolld_lv *pdlv)
+const char **cmdenvp_ctr(const struct lvmpolld_lv *pdlv, unsigned single_step)
 {
 	unsigned i = 0;
 	const char **cmd_envp = malloc(MIN_ARGV_SIZE * sizeof(char *));
@@ -131,6 +131,10 @@ const char **cmdenvp_ctr(const struct lvmpolld_lv *pdlv)
 	if (!copy_env(&cmd_envp, &i, "LVM_SYSTEM_DIR="))
 		goto err;
 
+	/* lvpoll checks the LV once, see poll_in_process() */
+	if (single_step && !add_to_cmd_arr(&cmd_envp, LVPOLL_SINGLE_STEP_ENV "=1", &i))
+		goto err;
+
 	/* Add per client LVM_SYSTEM_DIR variable if set */
 	if (*pdlv->lvm_system_dir_env && !add_to_cmd_arr(&cmd_envp, pdlv->lvm_system_dir_env, &i))
 		goto err;
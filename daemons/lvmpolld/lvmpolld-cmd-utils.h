@@ -18,7 +18,7 @@
 #include "lvmpolld-data-utils.h"
 
 const char **cmdargv_ctr(const struct lvmpolld_lv *pdlv, const char *lvm_binary, unsigned abort, unsigned handle_missing_pvs);
-const char **cmdenvp_ctr(const struct lvmpolld_lv *pdlv);
+const char **cmdenvp_ctr(const struct lvmpolld_lv *pdlv, unsigned single_step);
 
 const char *polling_op(enum poll_type);
 
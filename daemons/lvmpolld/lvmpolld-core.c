@@ -13,6 +13,7 @@
  */
 
 #include "lvmpolld-common.h"
+#include "lvmpolld-dm-utils.h"
 
 #include "lvm-version.h"
 #include "daemon-server.h"
@@ -338,7 +339,10 @@ static int poll_for_output(struct lvmpolld_lv *pdlv, struct lvmpolld_thread_data
 
 	if (WIFEXITED(ch_stat)) {
 		cmd_state.retcode = WEXITSTATUS(ch_stat);
-		if (cmd_state.retcode)
+		if (cmd_state.retcode == LVPOLL_RET_IN_PROGRESS)
+			INFO(pdlv->ls, "%s: %s (PID %d) %s", PD_LOG_PREFIX,
+			     "lvm2 cmd", pdlv->cmd_pid, "found the operation unfinished");
+		else if (cmd_state.retcode)
 			ERROR(pdlv->ls, "%s: %s (PID %d) %s (retcode: %d)", PD_LOG_PREFIX,
 			     "lvm2 cmd", pdlv->cmd_pid, "failed", cmd_state.retcode);
 		else
@@ -372,24 +376,22 @@ static void debug_print(struct lvmpolld_state *ls, const char * const* ptr)
 	}
 }
 
-static void *fork_and_poll(void *args)
+/*
+ * Run lvpoll for the LV and wait for it to exit, logging its output.
+ * Returns non-zero on failure to run it, its exit status goes to the
+ * command state.
+ */
+static int fork_and_poll(struct lvmpolld_lv *pdlv, struct lvmpolld_thread_data *data,
+			 const char *const *cmdenvp)
 {
-	int outfd, errfd, state;
-	struct lvmpolld_thread_data *data;
-	pid_t r;
-
-	int error = 1;
-	struct lvmpolld_lv *pdlv = (struct lvmpolld_lv *) args;
+	int outfd, errfd, error;
 	struct lvmpolld_state *ls = pdlv->ls;
+	pid_t r;
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
-	data = lvmpolld_thread_data_constructor(pdlv);
-	pthread_setspecific(key, data);
-	pthread_setcancelstate(state, &state);
-
-	if (!data) {
-		ERROR(ls, "%s: %s", PD_LOG_PREFIX, "Failed to initialize per-thread data");
-		goto err;
+	if (!lvmpolld_thread_data_pipes(data)) {
+		ERROR(ls, "%s: %s: (%d) %s", PD_LOG_PREFIX, "failed to create pipes",
+		      errno, _strerror_r(errno, data));
+		return 1;
 	}
 
 	DEBUGLOG(ls, "%s: %s", PD_LOG_PREFIX, "cmd line arguments:");
@@ -397,7 +399,7 @@ static void *fork_and_poll(void *args)
 	DEBUGLOG(ls, "%s: %s", PD_LOG_PREFIX, "---end---");
 
 	DEBUGLOG(ls, "%s: %s", PD_LOG_PREFIX, "cmd environment variables:");
-	debug_print(ls, pdlv->cmdenvp);
+	debug_print(ls, cmdenvp);
 	DEBUGLOG(ls, "%s: %s", PD_LOG_PREFIX, "---end---");
 
 	outfd = data->outpipe[1];
@@ -412,40 +414,138 @@ static void *fork_and_poll(void *args)
 		    (dup2(errfd, STDERR_FILENO ) != STDERR_FILENO))
 			_exit(LVMPD_RET_DUP_FAILED);
 
-		execve(*(pdlv->cmdargv), (char *const *)pdlv->cmdargv, (char *const *)pdlv->cmdenvp);
+		execve(*(pdlv->cmdargv), (char *const *)pdlv->cmdargv, (char *const *)cmdenvp);
 
 		_exit(LVMPD_RET_EXC_FAILED);
-	} else {
-		/* parent */
-		if (r == -1) {
-			ERROR(ls, "%s: %s: (%d) %s", PD_LOG_PREFIX, "fork failed",
-			      errno, _strerror_r(errno, data));
-			goto err;
-		}
+	}
 
-		INFO(ls, "%s: LVM2 cmd \"%s\" (PID: %d)", PD_LOG_PREFIX, *(pdlv->cmdargv), r);
+	/* parent */
+	if (r == -1) {
+		ERROR(ls, "%s: %s: (%d) %s", PD_LOG_PREFIX, "fork failed",
+		      errno, _strerror_r(errno, data));
+		return 1;
+	}
 
-		pdlv->cmd_pid = r;
+	INFO(ls, "%s: LVM2 cmd \"%s\" (PID: %d)", PD_LOG_PREFIX, *(pdlv->cmdargv), r);
 
-		/* failure to close write end of any pipe will result in broken polling */
-		if (close(data->outpipe[1])) {
-			ERROR(ls, "%s: %s: (%d) %s", PD_LOG_PREFIX, "failed to close write end of pipe",
-			      errno, _strerror_r(errno, data));
-			goto err;
-		}
-		data->outpipe[1] = -1;
+	pdlv->cmd_pid = r;
 
-		if (close(data->errpipe[1])) {
-			ERROR(ls, "%s: %s: (%d) %s", PD_LOG_PREFIX, "failed to close write end of err pipe",
-			      errno, _strerror_r(errno, data));
-			goto err;
+	/* failure to close write end of any pipe will result in broken polling */
+	if (close(data->outpipe[1])) {
+		ERROR(ls, "%s: %s: (%d) %s", PD_LOG_PREFIX, "failed to close write end of pipe",
+		      errno, _strerror_r(errno, data));
+		return 1;
+	}
+	data->outpipe[1] = -1;
+
+	if (close(data->errpipe[1])) {
+		ERROR(ls, "%s: %s: (%d) %s", PD_LOG_PREFIX, "failed to close write end of err pipe",
+		      errno, _strerror_r(errno, data));
+		return 1;
+	}
+	data->errpipe[1] = -1;
+
+	error = poll_for_output(pdlv, data);
+	DEBUGLOG(ls, "%s: %s", PD_LOG_PREFIX, "polling for lvpoll output has finished");
+
+	/* reaped, unless there was an error */
+	if (!error)
+		pdlv->cmd_pid = 0;
+
+	return error;
+}
+
+static unsigned _poll_interval(const struct lvmpolld_lv *pdlv)
+{
+	unsigned interval = 0;
+
+	if (sscanf(pdlv->sinterval, "%u", &interval) != 1 || !interval)
+		interval = 1;
+
+	return interval;
+}
+
+/*
+ * Watch the progress of pvmove, mirror conversion and snapshot merge in
+ * the kernel and run lvpoll only to update the metadata: when a pvmove
+ * segment or the whole operation is finished.  lvpoll then checks the LV
+ * once instead of rereading the VG every interval until it completes.
+ * Anything not understood here is left to lvpoll polling on its own.
+ */
+static int poll_in_process(struct lvmpolld_lv *pdlv, struct lvmpolld_thread_data *data)
+{
+	static const struct lvmpolld_cmd_stat in_progress = { .retcode = -1 };
+	struct lvmpolld_state *ls = pdlv->ls;
+	struct lvmpolld_lv_state st;
+	enum pdlv_progress progress;
+	uint64_t done, total;
+	struct timespec t;
+	int state;
+
+	while (1) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		progress = pdlv_dm_progress(pdlv, &done, &total);
+		pthread_setcancelstate(state, &state);
+
+		switch (progress) {
+		case PDLV_PROGRESS_UNFINISHED:
+			DEBUGLOG(ls, "%s: %s %s: %" PRIu64 "/%" PRIu64, PD_LOG_PREFIX,
+				 "progress of", pdlv->lvname, done, total);
+			break;
+		case PDLV_PROGRESS_FINISHED:
+			INFO(ls, "%s: %s %s", PD_LOG_PREFIX, "running lvm2 cmd to update", pdlv->lvname);
+			if (fork_and_poll(pdlv, data, pdlv->cmdenvp_step))
+				return 1;
+
+			/*
+			 * A single step lvpoll exits with 0 only once the whole
+			 * operation is done, a finished pvmove has removed its LV
+			 * by then.  Another pvmove segment to copy, or progress
+			 * that lvm2 does not see as finished yet, is reported
+			 * as LVPOLL_RET_IN_PROGRESS and watched again.
+			 */
+			st = pdlv_get_status(pdlv);
+			if (st.cmd_state.signal || st.cmd_state.retcode != LVPOLL_RET_IN_PROGRESS)
+				return 0;
+
+			pdlv_set_cmd_state(pdlv, &in_progress);
+			break;
+		default:
+			DEBUGLOG(ls, "%s: %s %s", PD_LOG_PREFIX, "leaving polling to lvm2 cmd for", pdlv->lvname);
+			return fork_and_poll(pdlv, data, pdlv->cmdenvp);
 		}
-		data->errpipe[1] = -1;
 
-		error = poll_for_output(pdlv, data);
-		DEBUGLOG(ls, "%s: %s", PD_LOG_PREFIX, "polling for lvpoll output has finished");
+		t = (struct timespec) { .tv_sec = _poll_interval(pdlv) };
+		while (nanosleep(&t, &t) && errno == EINTR)
+			;
+	}
+}
+
+static void *poll_thread(void *args)
+{
+	int state;
+	struct lvmpolld_thread_data *data;
+	pid_t r;
+
+	int error = 1;
+	struct lvmpolld_lv *pdlv = (struct lvmpolld_lv *) args;
+	struct lvmpolld_state *ls = pdlv->ls;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+	data = lvmpolld_thread_data_constructor(pdlv);
+	pthread_setspecific(key, data);
+	pthread_setcancelstate(state, &state);
+
+	if (!data) {
+		ERROR(ls, "%s: %s", PD_LOG_PREFIX, "Failed to initialize per-thread data");
+		goto err;
 	}
 
+	if (pdlv->cmdenvp_step)
+		error = poll_in_process(pdlv, data);
+	else
+		error = fork_and_poll(pdlv, data, pdlv->cmdenvp);
+
 err:
 	r = 0;
 
@@ -578,7 +678,7 @@ static struct lvmpolld_lv *construct_pdlv(request req, struct lvmpolld_state *ls
 
 	pdlv->cmdargv = cmdargv;
 
-	cmdenvp = cmdenvp_ctr(pdlv);
+	cmdenvp = cmdenvp_ctr(pdlv, 0);
 	if (!cmdenvp) {
 		pdlv_destroy(pdlv);
 		ERROR(ls, "%s: %s", PD_LOG_PREFIX, "failed to construct cmd environment for lvpoll command");
@@ -587,6 +687,17 @@ static struct lvmpolld_lv *construct_pdlv(request req, struct lvmpolld_state *ls
 
 	pdlv->cmdenvp = cmdenvp;
 
+	/* progress is watched in-process, lvpoll only updates metadata */
+	if (!abort_polling && type != MERGE_THIN) {
+		if (!(cmdenvp = cmdenvp_ctr(pdlv, 1))) {
+			pdlv_destroy(pdlv);
+			ERROR(ls, "%s: %s", PD_LOG_PREFIX, "failed to construct cmd environment for lvpoll command");
+			return NULL;
+		}
+
+		pdlv->cmdenvp_step = cmdenvp;
+	}
+
 	return pdlv;
 }
 
@@ -601,7 +712,7 @@ static int spawn_detached_thread(struct lvmpolld_lv *pdlv)
 	if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0)
 		return 0;
 
-	r = pthread_create(&pdlv->tid, &attr, fork_and_poll, (void *)pdlv);
+	r = pthread_create(&pdlv->tid, &attr, poll_thread, (void *)pdlv);
 
 	if (pthread_attr_destroy(&attr) != 0)
 		return 0;
@@ -141,6 +141,7 @@ void pdlv_destroy(struct lvmpolld_lv *pdlv)
 	free((void *)pdlv->lvm_system_dir_env);
 	free((void *)pdlv->cmdargv);
 	free((void *)pdlv->cmdenvp);
+	free((void *)pdlv->cmdenvp_step);
 
 	pthread_mutex_destroy(&pdlv->lock);
 
@@ -331,22 +332,56 @@ struct lvmpolld_thread_data *lvmpolld_thread_data_constructor(struct lvmpolld_lv
 	data->fout = data->ferr = NULL;
 	data->outpipe[0] = data->outpipe[1] = data->errpipe[0] = data->errpipe[1] = -1;
 
-	if (pipe(data->outpipe) || pipe(data->errpipe)) {
+	if (!lvmpolld_thread_data_pipes(data)) {
 		lvmpolld_thread_data_destroy(data);
 		return NULL;
 	}
 
+	data->pdlv = pdlv;
+
+	return data;
+}
+
+static void _close_pipes(struct lvmpolld_thread_data *data)
+{
+	if (data->fout && !fclose(data->fout))
+		data->outpipe[0] = -1;
+
+	if (data->ferr && !fclose(data->ferr))
+		data->errpipe[0] = -1;
+
+	data->fout = data->ferr = NULL;
+
+	if (data->outpipe[0] >= 0)
+		(void) close(data->outpipe[0]);
+
+	if (data->outpipe[1] >= 0)
+		(void) close(data->outpipe[1]);
+
+	if (data->errpipe[0] >= 0)
+		(void) close(data->errpipe[0]);
+
+	if (data->errpipe[1] >= 0)
+		(void) close(data->errpipe[1]);
+
+	data->outpipe[0] = data->outpipe[1] = data->errpipe[0] = data->errpipe[1] = -1;
+}
+
+/* Fresh pipes for the output of the next lvm command. */
+int lvmpolld_thread_data_pipes(struct lvmpolld_thread_data *data)
+{
+	_close_pipes(data);
+
+	if (pipe(data->outpipe) || pipe(data->errpipe))
+		return 0;
+
 	if (fcntl(data->outpipe[0], F_SETFD, FD_CLOEXEC) ||
 	    fcntl(data->outpipe[1], F_SETFD, FD_CLOEXEC) ||
 	    fcntl(data->errpipe[0], F_SETFD, FD_CLOEXEC) ||
-	    fcntl(data->errpipe[1], F_SETFD, FD_CLOEXEC)) {
-		lvmpolld_thread_data_destroy(data);
-		return NULL;
-	}
+	    fcntl(data->errpipe[1], F_SETFD, FD_CLOEXEC))
+		return 0;
 
-	data->pdlv = pdlv;
-
-	return data;
+	return 1;
 }
 
 void lvmpolld_thread_data_destroy(void *thread_private)
@@ -361,7 +396,7 @@ void lvmpolld_thread_data_destroy(void *thread_private)
 		 * FIXME: skip this step if lvmpolld is activated
 		 * 	  by systemd.
 		 */
-		if (!pdlv_get_polling_finished(data->pdlv))
+		if (!pdlv_get_polling_finished(data->pdlv) && data->pdlv->cmd_pid > 0)
 			kill(data->pdlv->cmd_pid, SIGTERM);
 		pdlv_set_polling_finished(data->pdlv, 1);
 		pdst_locked_dec(data->pdlv->pdst);
@@ -371,23 +406,7 @@ void lvmpolld_thread_data_destroy(void *thread_private)
 	/* may get reallocated in getline(). free must not be used */
 	free(data->line);
 
-	if (data->fout && !fclose(data->fout))
-		data->outpipe[0] = -1;
-
-	if (data->ferr && !fclose(data->ferr))
-		data->errpipe[0] = -1;
-
-	if (data->outpipe[0] >= 0)
-		(void) close(data->outpipe[0]);
-
-	if (data->outpipe[1] >= 0)
-		(void) close(data->outpipe[1]);
-
-	if (data->errpipe[0] >= 0)
-		(void) close(data->errpipe[0]);
-
-	if (data->errpipe[1] >= 0)
-		(void) close(data->errpipe[1]);
+	_close_pipes(data);
 
 	free(data);
 }
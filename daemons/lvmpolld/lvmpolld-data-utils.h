@@ -56,6 +56,7 @@ struct lvmpolld_lv {
 	struct lvmpolld_store *const pdst;
 	const char *const *cmdargv;
 	const char *const *cmdenvp;
+	const char *const *cmdenvp_step; /* for a single lvpoll check */
 
 	/* only used by write */
 	pid_t cmd_pid;
@@ -210,6 +211,7 @@ static inline void pdst_locked_remove(struct lvmpolld_store *pdst, const char *k
 }
 
 struct lvmpolld_thread_data *lvmpolld_thread_data_constructor(struct lvmpolld_lv *pdlv);
+int lvmpolld_thread_data_pipes(struct lvmpolld_thread_data *data);
 void lvmpolld_thread_data_destroy(void *thread_private);
 
 #endif /* _LVM_LVMPOLLD_DATA_UTILS_H */
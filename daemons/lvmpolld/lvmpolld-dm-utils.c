@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "lvmpolld-common.h"
+
+#include "lvmpolld-dm-utils.h"
+#include "lib/misc/lvm-string.h"
+#include "device_mapper/misc/dm-ioctl.h"
+
+static int _mirror_progress(struct dm_pool *mem, const char *params,
+			    uint64_t *done, uint64_t *total)
+{
+	struct dm_status_mirror *sm;
+
+	if (!dm_get_status_mirror(mem, params, &sm))
+		return 0;
+
+	*done += sm->insync_regions;
+	*total += sm->total_regions;
+
+	return 1;
+}
+
+static int _merge_progress(struct dm_pool *mem, const char *params,
+			   uint64_t *done, uint64_t *total)
+{
+	struct dm_status_snapshot *ss;
+
+	if (!dm_get_status_snapshot(mem, params, &ss) ||
+	    ss->invalid || ss->merge_failed || !ss->has_metadata_sectors)
+		return 0;
+
+	/* merging is complete when only the metadata is left */
+	if (ss->used_sectors == ss->metadata_sectors)
+		(*done)++;
+	(*total)++;
+
+	return 1;
+}
+
+enum pdlv_progress pdlv_dm_progress(const struct lvmpolld_lv *pdlv,
+				    uint64_t *done, uint64_t *total)
+{
+	enum pdlv_progress r = PDLV_PROGRESS_UNKNOWN;
+	const char *target_type;
+	int (*progress_fn)(struct dm_pool *, const char *, uint64_t *, uint64_t *);
+	char uuid[DM_UUID_LEN];
+	struct dm_pool *mem;
+	struct dm_task *dmt;
+	struct dm_info info;
+	uint64_t start, length;
+	char *type, *params;
+	void *next = NULL;
+	unsigned targets = 0;
+
+	*done = *total = 0;
+
+	switch (pdlv->type) {
+	case PVMOVE:
+	case CONVERT:
+		target_type = "mirror";
+		progress_fn = _mirror_progress;
+		break;
+	case MERGE:
+		target_type = "snapshot-merge";
+		progress_fn = _merge_progress;
+		break;
+	default:
+		return PDLV_PROGRESS_UNKNOWN;
+	}
+
+	if (dm_snprintf(uuid, sizeof(uuid), UUID_PREFIX "%s", pdlv->lvid) < 0)
+		return PDLV_PROGRESS_UNKNOWN;
+
+	if (!(mem = dm_pool_create("lvmpolld_status", 1024)))
+		return PDLV_PROGRESS_UNKNOWN;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_STATUS)))
+		goto out_pool;
+
+	if (!dm_task_set_uuid(dmt, uuid) ||
+	    !dm_task_no_open_count(dmt) ||
+	    !dm_task_run(dmt) ||
+	    !dm_task_get_info(dmt, &info))
+		goto out;
+
+	if (!info.exists) {
+		r = PDLV_PROGRESS_NO_DEVICE;
+		goto out;
+	}
+
+	do {
+		next = dm_get_next_target(dmt, next, &start, &length, &type, &params);
+		if (!type || strcmp(type, target_type))
+			continue;
+		if (!progress_fn(mem, params, done, total))
+			goto out;
+		targets++;
+	} while (next);
+
+	if (targets)
+		r = (*done == *total) ? PDLV_PROGRESS_FINISHED : PDLV_PROGRESS_UNFINISHED;
+out:
+	dm_task_destroy(dmt);
+out_pool:
+	dm_pool_destroy(mem);
+
+	return r;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _LVM_LVMPOLLD_DM_UTILS_H
+#define _LVM_LVMPOLLD_DM_UTILS_H
+
+#include "lvmpolld-data-utils.h"
+
+enum pdlv_progress {
+	PDLV_PROGRESS_UNKNOWN = 0,	/* leave it to lvpoll */
+	PDLV_PROGRESS_NO_DEVICE,	/* the LV is not active here */
+	PDLV_PROGRESS_UNFINISHED,
+	PDLV_PROGRESS_FINISHED		/* lvpoll has metadata to update */
+};
+
+/*
+ * Progress of the polling operation as reported by the kernel for the
+ * LV's top-level device: in-sync regions of its mirror targets for
+ * pvmove and convert, finished snapshot-merge targets for merge.
+ */
+enum pdlv_progress pdlv_dm_progress(const struct lvmpolld_lv *pdlv,
+				    uint64_t *done, uint64_t *total);
+
+#endif /* _LVM_LVMPOLLD_DM_UTILS_H */
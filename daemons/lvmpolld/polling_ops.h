@@ -22,4 +22,18 @@
 #define MERGE_POLL "merge"
 #define MERGE_THIN_POLL "merge_thin"
 
+/*
+ * Set to "1" by lvmpolld, which watches the progress itself and runs
+ * lvpoll only when the metadata needs updating: lvpoll then checks
+ * the LV once instead of polling it until the operation completes.
+ */
+#define LVPOLL_SINGLE_STEP_ENV "LVM_LVPOLL_SINGLE_STEP"
+
+/*
+ * Exit code of such a single step lvpoll when the operation is not
+ * finished yet and lvmpolld should check the LV again later.  Chosen not
+ * to clash with the lvm2 return codes or LVMPD_RET_*.
+ */
+#define LVPOLL_RET_IN_PROGRESS 102
+
 #endif /* _LVM_TOOL_POLLING_OPS_H */
@@ -715,6 +715,14 @@ void dm_tree_use_no_flush_suspend(struct dm_tree_node *dnode);
  */
 void dm_tree_retry_remove(struct dm_tree_node *dnode);
 
+/*
+ * Issue the ioctls for independent nodes at the same level of the tree
+ * from up to 'threads' threads when preloading, activating and
+ * suspending.  Nodes of one level share a udev cookie.
+ * 0 or 1 keeps processing one node at a time.
+ */
+void dm_tree_use_threads(struct dm_tree_node *dnode, unsigned threads);
+
 /*
  * Is the uuid prefix present in the tree?
  * Only returns 0 if every node was checked successfully.
@@ -1892,6 +1900,14 @@ struct dm_config_tree *dm_config_from_string(const char *config_settings);
 int dm_config_parse(struct dm_config_tree *cft, const char *start, const char *end);
 int dm_config_parse_without_dup_node_check(struct dm_config_tree *cft, const char *start, const char *end);
 
+/*
+ * Parses without copying: strings in the tree point into the buffer, which
+ * is modified and must stay valid for as long as the tree is used.  The
+ * byte at end must be writable as it may be overwritten with a '\0'.
+ */
+int dm_config_parse_in_place(struct dm_config_tree *cft, char *start, char *end,
+			     int no_dup_node_check);
+
 void *dm_config_get_custom(struct dm_config_tree *cft);
 void dm_config_set_custom(struct dm_config_tree *cft, void *custom);
 
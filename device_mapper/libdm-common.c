@@ -26,6 +26,7 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #ifdef UDEV_SYNC_SUPPORT
 #  include <sys/types.h>
@@ -71,6 +72,7 @@ static char _default_uuid_prefix[DM_MAX_UUID_PREFIX_LEN + 1] = "LVM-";
 
 static int _verbose = 0;
 static int _suspended_dev_counter = 0;
+static pthread_mutex_t _suspended_dev_counter_mutex = PTHREAD_MUTEX_INITIALIZER;
 static dm_string_mangling_t _name_mangling_mode = DEFAULT_DM_NAME_MANGLING;
 
 #ifdef HAVE_SELINUX_LABEL_H
@@ -252,6 +254,52 @@ void dm_log_init_verbose(int level)
 	_verbose = level;
 }
 
+/*
+ * While tree nodes are processed in threads, every message goes through
+ * the log function under one mutex, as that function is not reentrant.
+ * The mutex is recursive so the log function may itself log via libdm.
+ */
+static pthread_mutex_t _log_mutex;
+static pthread_once_t _log_mutex_once = PTHREAD_ONCE_INIT;
+static int _log_threads = 0;
+
+static void _log_mutex_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&_log_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void dm_log_threads_begin(void)
+{
+	pthread_once(&_log_mutex_once, _log_mutex_init);
+	__atomic_add_fetch(&_log_threads, 1, __ATOMIC_SEQ_CST);
+}
+
+void dm_log_threads_end(void)
+{
+	__atomic_sub_fetch(&_log_threads, 1, __ATOMIC_SEQ_CST);
+}
+
+int dm_log_lock(void)
+{
+	if (!__atomic_load_n(&_log_threads, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&_log_mutex);
+
+	return 1;
+}
+
+void dm_log_unlock(int locked)
+{
+	if (locked)
+		pthread_mutex_unlock(&_log_mutex);
+}
+
 static int _build_dev_path(char *buffer, size_t len, const char *dev_name)
 {
 	int r;
@@ -273,21 +321,32 @@ int dm_get_library_version(char *version, size_t size)
 	return dm_strncpy(version, DM_LIB_VERSION, size);
 }
 
+/* Tree nodes may be suspended and resumed from several threads */
 void inc_suspended(void)
 {
-	_suspended_dev_counter++;
-	log_debug_activation("Suspended device counter increased to %d", _suspended_dev_counter);
+	int counter;
+
+	pthread_mutex_lock(&_suspended_dev_counter_mutex);
+	counter = ++_suspended_dev_counter;
+	pthread_mutex_unlock(&_suspended_dev_counter_mutex);
+
+	log_debug_activation("Suspended device counter increased to %d", counter);
 }
 
 void dec_suspended(void)
 {
-	if (!_suspended_dev_counter) {
+	int counter;
+
+	pthread_mutex_lock(&_suspended_dev_counter_mutex);
+	counter = _suspended_dev_counter ? --_suspended_dev_counter : -1;
+	pthread_mutex_unlock(&_suspended_dev_counter_mutex);
+
+	if (counter < 0) {
 		log_error("Attempted to decrement suspended device counter below zero.");
 		return;
 	}
 
-	_suspended_dev_counter--;
-	log_debug_activation("Suspended device counter reduced to %d", _suspended_dev_counter);
+	log_debug_activation("Suspended device counter reduced to %d", counter);
 }
 
 int dm_get_suspended_counter(void)
@@ -1430,6 +1489,7 @@ static int _do_node_op(node_op_t type, const char *dev_name, uint32_t major,
 
 static DM_LIST_INIT(_node_ops);
 static int _count_node_ops[NUM_NODES];
+static pthread_mutex_t _node_ops_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 struct node_op_parms {
 	struct dm_list list;
@@ -1500,11 +1560,11 @@ static void _log_node_op(const char *action_str, struct node_op_parms *nop)
 	}
 }
 
-static int _stack_node_op(node_op_t type, const char *dev_name, uint32_t major,
-			  uint32_t minor, uid_t uid, gid_t gid, mode_t mode,
-			  const char *old_name, uint32_t read_ahead,
-			  uint32_t read_ahead_flags, int warn_if_udev_failed,
-			  unsigned rely_on_udev)
+static int _stack_node_op_locked(node_op_t type, const char *dev_name, uint32_t major,
+				 uint32_t minor, uid_t uid, gid_t gid, mode_t mode,
+				 const char *old_name, uint32_t read_ahead,
+				 uint32_t read_ahead_flags, int warn_if_udev_failed,
+				 unsigned rely_on_udev)
 {
 	struct node_op_parms *nop;
 	struct dm_list *noph, *nopht;
@@ -1596,6 +1656,24 @@ static int _stack_node_op(node_op_t type, const char *dev_name, uint32_t major,
 	return 1;
 }
 
+/* Task may run in several threads when a tree level is activated in parallel */
+static int _stack_node_op(node_op_t type, const char *dev_name, uint32_t major,
+			  uint32_t minor, uid_t uid, gid_t gid, mode_t mode,
+			  const char *old_name, uint32_t read_ahead,
+			  uint32_t read_ahead_flags, int warn_if_udev_failed,
+			  unsigned rely_on_udev)
+{
+	int r;
+
+	pthread_mutex_lock(&_node_ops_mutex);
+	r = _stack_node_op_locked(type, dev_name, major, minor, uid, gid, mode,
+				  old_name, read_ahead, read_ahead_flags,
+				  warn_if_udev_failed, rely_on_udev);
+	pthread_mutex_unlock(&_node_ops_mutex);
+
+	return r;
+}
+
 static void _pop_node_ops(void)
 {
 	struct dm_list *noph, *nopht;
@@ -1647,7 +1725,9 @@ int set_dev_node_read_ahead(const char *dev_name,
 
 void update_devs(void)
 {
+	pthread_mutex_lock(&_node_ops_mutex);
 	_pop_node_ops();
+	pthread_mutex_unlock(&_node_ops_mutex);
 }
 
 static int _canonicalize_and_set_dir(const char *src, const char *suffix, size_t max_len, char *dir)
@@ -51,6 +51,9 @@ struct parser {
 
 	struct dm_pool *mem;
 	int no_dup_node_check;	/* whether to disable dup node checking */
+
+	int in_place;		/* tokens are terminated in the buffer, not copied */
+	char *pending_nul;	/* end of the last unquoted token */
 };
 
 struct config_output {
@@ -171,7 +174,8 @@ static struct dm_config_node *_config_reverse(struct dm_config_node *head)
 	return middle;
 }
 
-static int _do_dm_config_parse(struct dm_config_tree *cft, const char *start, const char *end, int no_dup_node_check)
+static int _do_dm_config_parse(struct dm_config_tree *cft, const char *start, const char *end,
+				int no_dup_node_check, int in_place)
 {
 	/* TODO? if (start == end) return 1; */
 
@@ -185,6 +189,8 @@ static int _do_dm_config_parse(struct dm_config_tree *cft, const char *start, co
 	p->tb = p->te = p->fb;
 	p->line = 1;
 	p->no_dup_node_check = no_dup_node_check;
+	p->in_place = in_place;
+	p->pending_nul = NULL;
 
 	_get_token(p, TOK_SECTION_E);
 	if (!(cft->root = _file(p)))
@@ -197,12 +203,18 @@ static int _do_dm_config_parse(struct dm_config_tree *cft, const char *start, co
 
 int dm_config_parse(struct dm_config_tree *cft, const char *start, const char *end)
 {
-	return _do_dm_config_parse(cft, start, end, 0);
+	return _do_dm_config_parse(cft, start, end, 0, 0);
 }
 
 int dm_config_parse_without_dup_node_check(struct dm_config_tree *cft, const char *start, const char *end)
 {
-	return _do_dm_config_parse(cft, start, end, 1);
+	return _do_dm_config_parse(cft, start, end, 1, 0);
+}
+
+int dm_config_parse_in_place(struct dm_config_tree *cft, char *start, char *end,
+			     int no_dup_node_check)
+{
+	return _do_dm_config_parse(cft, start, end, no_dup_node_check, 1);
 }
 
 struct dm_config_tree *dm_config_from_string(const char *config_settings)
@@ -481,7 +493,11 @@ static char *_dup_string_tok(struct parser *p)
 		return NULL;
 	}
 
-	if (!(str = _dup_tok(p)))
+	if (p->in_place) {
+		/* The closing quote is behind the tokeniser already. */
+		str = (char *) p->tb;
+		*(char *) p->te = '\0';
+	} else if (!(str = _dup_tok(p)))
 		return_NULL;
 
 	p->te++;
@@ -502,14 +518,18 @@ static struct dm_config_node *_file(struct parser *p)
 
 static struct dm_config_node *_make_node(struct dm_pool *mem,
 					 const char *key_b, const char *key_e,
-					 struct dm_config_node *parent)
+					 struct dm_config_node *parent,
+					 int keep_key)
 {
 	struct dm_config_node *n;
 
 	if (!(n = _create_node(mem)))
 		return_NULL;
 
-	n->key = _dup_token(mem, key_b, key_e);
+	if (keep_key && !*key_e)
+		n->key = key_b;
+	else if (!(n->key = _dup_token(mem, key_b, key_e)))
+		return_NULL;
 	if (parent) {
 		n->parent = parent;
 		n->sib = parent->child;
@@ -518,11 +538,15 @@ static struct dm_config_node *_make_node(struct dm_pool *mem,
 	return n;
 }
 
-/* when mem is not NULL, we create the path if it doesn't exist yet */
+/*
+ * When mem is not NULL, we create the path if it doesn't exist yet.
+ * With keep_key, path outlives the tree and the last key can point into it.
+ */
 static struct dm_config_node *_find_or_make_node(struct dm_pool *mem,
 						 struct dm_config_node *parent,
 						 const char *path,
-						 int no_dup_node_check)
+						 int no_dup_node_check,
+						 int keep_key)
 {
 	const char *e;
 	struct dm_config_node *cn = parent ? parent->child : NULL;
@@ -556,7 +580,7 @@ static struct dm_config_node *_find_or_make_node(struct dm_pool *mem,
 		}
 
 		if (!cn_found && mem) {
-			if (!(cn_found = _make_node(mem, path, e, parent)))
+			if (!(cn_found = _make_node(mem, path, e, parent, keep_key)))
 				return_NULL;
 		}
 
@@ -603,7 +627,7 @@ static struct dm_config_node *_section(struct parser *p, struct dm_config_node *
 		return NULL;
 	}
 
-	if (!(root = _find_or_make_node(p->mem, parent, str, p->no_dup_node_check)))
+	if (!(root = _find_or_make_node(p->mem, parent, str, p->no_dup_node_check, p->in_place)))
 		return_NULL;
 
 	if (p->t == TOK_SECTION_B) {
@@ -747,6 +771,28 @@ static int _match_aux(struct parser *p, int t)
 /*
  * tokeniser
  */
+
+/*
+ * isspace() goes through the locale tables on every call, the tokeniser
+ * only needs the C locale set and calls this for every byte.
+ */
+static inline int _is_space(char c)
+{
+	return (c == ' ') || (c >= '\t' && c <= '\r');
+}
+
+/*
+ * An unquoted token ends at the first character of whatever follows, so
+ * in place parsing can only terminate it once the next token is found.
+ */
+static void _terminate_pending(struct parser *p)
+{
+	if (p->pending_nul) {
+		*p->pending_nul = '\0';
+		p->pending_nul = NULL;
+	}
+}
+
 static void _get_token(struct parser *p, int tok_prev)
 {
 	int values_allowed = 0;
@@ -757,6 +803,7 @@ static void _get_token(struct parser *p, int tok_prev)
 	_eat_space(p);
 	if (p->tb == p->fe || !*p->tb) {
 		p->t = TOK_EOF;
+		_terminate_pending(p);
 		return;
 	}
 
@@ -857,7 +904,7 @@ static void _get_token(struct parser *p, int tok_prev)
 
 	default:
 		p->t = TOK_IDENTIFIER;
-		while ((te != p->fe) && (*te) && !isspace(*te) &&
+		while ((te != p->fe) && (*te) && !_is_space(*te) &&
 		       (*te != '#') && (*te != '=') &&
 		       (*te != SECTION_B_CHAR) &&
 		       (*te != SECTION_E_CHAR))
@@ -868,6 +915,7 @@ static void _get_token(struct parser *p, int tok_prev)
 	}
 
 	p->te = te;
+	_terminate_pending(p);
 }
 
 static void _eat_space(struct parser *p)
@@ -877,10 +925,10 @@ static void _eat_space(struct parser *p)
 			while ((p->te != p->fe) && (*p->te != '\n') && (*p->te))
 				++p->te;
 
-		else if (!isspace(*p->te))
+		else if (!_is_space(*p->te))
 			break;
 
-		while ((p->te != p->fe) && isspace(*p->te)) {
+		while ((p->te != p->fe) && _is_space(*p->te)) {
 			if (*p->te == '\n')
 				++p->line;
 			++p->te;
@@ -918,6 +966,11 @@ static char *_dup_token(struct dm_pool *mem, const char *b, const char *e)
 
 static char *_dup_tok(struct parser *p)
 {
+	if (p->in_place) {
+		p->pending_nul = (char *) p->te;
+		return (char *) p->tb;
+	}
+
 	return _dup_token(p->mem, p->tb, p->te);
 }
 
@@ -937,7 +990,7 @@ typedef const struct dm_config_node *node_lookup_fn(const void *start, const cha
 
 static const struct dm_config_node *_find_config_node(const void *start, const char *path) {
 	struct dm_config_node dummy = { .child = (void *) start };
-	return _find_or_make_node(NULL, &dummy, path, 0);
+	return _find_or_make_node(NULL, &dummy, path, 0, 0);
 }
 
 static const struct dm_config_node *_find_first_config_node(const void *start, const char *path)
@@ -1420,7 +1473,7 @@ static int _override_path(const char *path, struct dm_config_node *node, void *b
 	struct dm_config_tree *cft = baton;
 	struct dm_config_node dummy, *target;
 	dummy.child = cft->root;
-	if (!(target = _find_or_make_node(cft->mem, &dummy, path, 0)))
+	if (!(target = _find_or_make_node(cft->mem, &dummy, path, 0, 0)))
 		return_0;
 	if (!(target->v = _clone_config_value(cft->mem, node->v)))
 		return_0;
@@ -19,11 +19,16 @@
 #include "misc/dm-ioctl.h"
 #include "vdo/target.h"
 
+#include <limits.h>
 #include <stdarg.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/utsname.h>
 
 #define MAX_TARGET_PARAMSIZE 500000
+#define MAX_TREE_THREADS 64
+/* Jobs only issue ioctls and log, keep the stacks out of locked memory. */
+#define TREE_THREAD_STACK_SIZE (128 * 1024)
 
 /* Supported segment types */
 enum {
@@ -320,7 +325,7 @@ struct dm_tree {
 	int no_flush;			/* 1 sets noflush (mirrors/multipath) */
 	int retry_remove;		/* 1 retries remove if not successful */
 	uint32_t cookie;
-	char buf[DM_NAME_LEN + 32];	/* print buffer for device_name (major:minor) */
+	unsigned threads;		/* >1 runs ioctls of one tree level in parallel */
 	const char **optional_uuid_suffixes;	/* uuid suffixes ignored when matching */
 };
 
@@ -400,6 +405,11 @@ void dm_tree_retry_remove(struct dm_tree_node *dnode)
 	dnode->dtree->retry_remove = 1;
 }
 
+void dm_tree_use_threads(struct dm_tree_node *dnode, unsigned threads)
+{
+	dnode->dtree->threads = (threads > MAX_TREE_THREADS) ? MAX_TREE_THREADS : threads;
+}
+
 /*
  * Node functions.
  */
@@ -613,10 +623,13 @@ static struct dm_tree_node *_find_dm_tree_node_by_uuid(struct dm_tree *dtree,
 	return NULL;
 }
 
+/* Print buffer per thread, nodes of a tree level may be loaded in parallel */
+static __thread char _node_name_buf[DM_NAME_LEN + 32];
+
 /* Return node's device_name (major:minor) for debug messages */
 static const char *_node_name(struct dm_tree_node *dnode)
 {
-	if (dm_snprintf(dnode->dtree->buf, sizeof(dnode->dtree->buf),
+	if (dm_snprintf(_node_name_buf, sizeof(_node_name_buf),
 			"%s (" FMTu32 ":" FMTu32 ")",
 			dnode->name ? dnode->name : "",
 			dnode->info.major, dnode->info.minor) < 0) {
@@ -624,7 +637,7 @@ static const char *_node_name(struct dm_tree_node *dnode)
 		return dnode->name;
 	}
 
-	return dnode->dtree->buf;
+	return _node_name_buf;
 }
 
 void dm_tree_node_set_udev_flags(struct dm_tree_node *dnode, uint16_t udev_flags)
@@ -1389,6 +1402,121 @@ out:
 	return r;
 }
 
+/*
+ * Nodes of one tree level that do not depend on each other.
+ * With dm_tree_use_threads() their ioctls are issued from several
+ * threads, otherwise one after another.
+ */
+struct node_job {
+	struct dm_tree_node *node;
+	struct dm_info info;
+	int created;
+	int r;
+};
+
+typedef int (*node_job_fn)(struct node_job *job);
+
+struct node_jobs {
+	node_job_fn fn;
+	struct node_job *jobs;
+	unsigned count;
+	unsigned next;
+	pthread_mutex_t lock;
+};
+
+static void *_node_jobs_thread(void *arg)
+{
+	struct node_jobs *nj = arg;
+	unsigned i;
+
+	for (;;) {
+		pthread_mutex_lock(&nj->lock);
+		i = nj->next++;
+		pthread_mutex_unlock(&nj->lock);
+
+		if (i >= nj->count)
+			break;
+
+		nj->jobs[i].r = nj->fn(&nj->jobs[i]);
+	}
+
+	return NULL;
+}
+
+/*
+ * Run fn for each job and leave the result in it.
+ * The first job runs alone: it opens the control device and creates
+ * the udev cookie, then the rest of the level shares that one cookie.
+ * Returns 0 if any job failed.
+ */
+static int _run_node_jobs(struct dm_tree *dtree, node_job_fn fn,
+			  struct node_job *jobs, unsigned count)
+{
+	struct node_jobs nj = { .fn = fn, .jobs = jobs, .count = count, .next = 1 };
+	pthread_t threads[MAX_TREE_THREADS];
+	pthread_attr_t attr;
+	size_t stack_size = TREE_THREAD_STACK_SIZE;
+	unsigned i, nr_threads = 0;
+	int r = 1;
+
+	if (!count)
+		return 1;
+
+	jobs[0].r = fn(&jobs[0]);
+
+	if ((dtree->threads < 2) || (count < 3)) {
+		for (i = 1; i < count; i++)
+			jobs[i].r = fn(&jobs[i]);
+		goto out;
+	}
+
+	log_debug_activation("Running %u tree nodes with up to %u threads.",
+			     count - 1, dtree->threads);
+
+	pthread_mutex_init(&nj.lock, NULL);
+	dm_log_threads_begin();
+
+	if (pthread_attr_init(&attr))
+		log_sys_debug("pthread_attr_init", "");
+	else {
+		if (stack_size < PTHREAD_STACK_MIN)
+			stack_size = PTHREAD_STACK_MIN;
+		if (pthread_attr_setstacksize(&attr, stack_size))
+			log_sys_debug("pthread_attr_setstacksize", "");
+
+		/* This thread takes jobs too */
+		while ((nr_threads < dtree->threads - 1) && (nr_threads < count - 2) &&
+		       !pthread_create(&threads[nr_threads], &attr, _node_jobs_thread, &nj))
+			nr_threads++;
+
+		pthread_attr_destroy(&attr);
+	}
+
+	(void) _node_jobs_thread(&nj);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	dm_log_threads_end();
+	pthread_mutex_destroy(&nj.lock);
+out:
+	for (i = 0; i < count; i++)
+		if (!jobs[i].r)
+			r = 0;
+
+	return r;
+}
+
+static struct node_job *_alloc_node_jobs(struct dm_tree_node *dnode)
+{
+	struct node_job *jobs;
+
+	if (!(jobs = calloc(dm_list_size(&dnode->uses) + 1, sizeof(*jobs))))
+		log_error("Failed to allocate jobs for %s.", _node_name(dnode));
+
+	return jobs;
+}
+
 static struct dm_task *_dm_task_create_device_status(uint32_t major, uint32_t minor)
 {
 	struct dm_task *dmt;
@@ -1827,6 +1955,144 @@ int dm_tree_deactivate_children(struct dm_tree_node *dnode,
 	return _dm_tree_deactivate_children(dnode, uuid_prefix, uuid_prefix_len, 0);
 }
 
+static int _suspend_job(struct node_job *job)
+{
+	struct dm_tree_node *child = job->node;
+	struct dm_info newinfo;
+
+	if (!_suspend_node(child->name, job->info.major, job->info.minor,
+			   child->dtree->skip_lockfs,
+			   child->dtree->no_flush, &newinfo)) {
+		log_error("Unable to suspend %s (" FMTu32 ":"
+			  FMTu32 ")", child->name, job->info.major, job->info.minor);
+		return 0;
+	}
+
+	/* Update cached info */
+	child->info = newinfo;
+
+	return 1;
+}
+
+/*
+ * Suspend with threads.  Suspends of one level are queued and issued
+ * together; the queue is flushed first whenever a node needs a queued
+ * parent suspended or a thin-pool gets its messages.
+ */
+static int _dm_tree_suspend_children_parallel(struct dm_tree_node *dnode,
+					      const char *uuid_prefix,
+					      size_t uuid_prefix_len)
+{
+	int r = 1;
+	void *handle = NULL;
+	struct dm_tree_node *child = dnode;
+	struct dm_info info;
+	const struct dm_info *dinfo;
+	const char *name;
+	const char *uuid;
+	struct node_job *jobs;
+	unsigned count = 0;
+
+	if (!(jobs = _alloc_node_jobs(dnode)))
+		return_0;
+
+	/* Suspend nodes at this level of the tree */
+	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+		if (!(dinfo = dm_tree_node_get_info(child))) {
+			stack;
+			continue;
+		}
+
+		if (!(name = dm_tree_node_get_name(child))) {
+			stack;
+			continue;
+		}
+
+		if (!(uuid = dm_tree_node_get_uuid(child))) {
+			stack;
+			continue;
+		}
+
+		/* Ignore if it doesn't belong to this VG */
+		if (!_uuid_prefix_matches(uuid, uuid_prefix, uuid_prefix_len))
+			continue;
+
+		/* Ensure immediate parents are already suspended */
+		if (!_children_suspended(child, 1, uuid_prefix, uuid_prefix_len)) {
+			/* Parent may be still queued at this level */
+			if (!count)
+				continue;
+			if (!_run_node_jobs(dnode->dtree, _suspend_job, jobs, count))
+				r = 0;
+			count = 0;
+			if (!_children_suspended(child, 1, uuid_prefix, uuid_prefix_len))
+				continue;
+		}
+
+		if (!_info_by_dev(dinfo->major, dinfo->minor, 0, &info, NULL, NULL, NULL)) {
+			r = 0;
+			goto_out;
+		}
+
+		if (!info.exists || info.suspended)
+			continue;
+
+		/* Messages are sent after the queued suspends */
+		if ((child->props.send_messages > 1) && count) {
+			if (!_run_node_jobs(dnode->dtree, _suspend_job, jobs, count))
+				r = 0;
+			count = 0;
+		}
+
+		/* If child has some real messages send them */
+		if ((child->props.send_messages > 1) && r) {
+			if (!(r = _node_send_messages(child, uuid_prefix, uuid_prefix_len, 1)))
+				stack;
+			else {
+				log_debug_activation("Sent messages to thin-pool %s and "
+						     "skipping suspend of its children.",
+						     _node_name(child));
+				child->props.skip_suspend++;
+			}
+			continue;
+		}
+
+		jobs[count].node = child;
+		jobs[count++].info = info;
+	}
+
+	if (!_run_node_jobs(dnode->dtree, _suspend_job, jobs, count))
+		r = 0;
+
+	/* Then suspend any child nodes */
+	handle = NULL;
+
+	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+		if (child->props.skip_suspend)
+			continue;
+
+		if (!(uuid = dm_tree_node_get_uuid(child))) {
+			stack;
+			continue;
+		}
+
+		/* Ignore if it doesn't belong to this VG */
+		if (!_uuid_prefix_matches(uuid, uuid_prefix, uuid_prefix_len))
+			continue;
+
+		if (dm_tree_node_num_children(child, 0))
+			if (!dm_tree_suspend_children(child, uuid_prefix, uuid_prefix_len)) {
+				r = 0;
+				goto_out;
+			}
+	}
+
+out:
+	free(jobs);
+
+	return r;
+}
+
 int dm_tree_suspend_children(struct dm_tree_node *dnode,
 			     const char *uuid_prefix,
 			     size_t uuid_prefix_len)
@@ -1839,6 +2105,9 @@ int dm_tree_suspend_children(struct dm_tree_node *dnode,
 	const char *name;
 	const char *uuid;
 
+	if (dnode->dtree->threads > 1)
+		return _dm_tree_suspend_children_parallel(dnode, uuid_prefix, uuid_prefix_len);
+
 	/* Suspend nodes at this level of the tree */
 	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
 		if (!(dinfo = dm_tree_node_get_info(child))) {
@@ -1966,6 +2235,137 @@ static int _rename_conflict_exists(struct dm_tree_node *parent,
 	return 0;
 }
 
+static int _resume_job(struct node_job *job)
+{
+	struct dm_tree_node *child = job->node;
+
+	if (!_resume_node(child->name, child->info.major, child->info.minor,
+			  child->props.read_ahead, child->props.read_ahead_flags,
+			  &child->info, &child->dtree->cookie, child->udev_flags,
+			  child->info.suspended)) {
+		log_error("Unable to resume %s.", _node_name(child));
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Activate with threads.  Each priority level is resumed at once,
+ * then thin-pool messages are sent in tree order.
+ */
+static int _dm_tree_activate_children_parallel(struct dm_tree_node *dnode,
+					       const char *uuid_prefix,
+					       size_t uuid_prefix_len)
+{
+	int r = 1;
+	int resolvable_name_conflict, awaiting_peer_rename = 0;
+	void *handle = NULL;
+	struct dm_tree_node *child = dnode;
+	const char *name;
+	const char *uuid;
+	int priority;
+	struct node_job *jobs;
+	unsigned i, count;
+
+	/* Activate children first */
+	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+		if (!(uuid = dm_tree_node_get_uuid(child))) {
+			stack;
+			continue;
+		}
+
+		if (!_uuid_prefix_matches(uuid, uuid_prefix, uuid_prefix_len))
+			continue;
+
+		if (dm_tree_node_num_children(child, 0))
+			if (!dm_tree_activate_children(child, uuid_prefix, uuid_prefix_len))
+				return_0;
+	}
+
+	if (!(jobs = _alloc_node_jobs(dnode)))
+		return_0;
+
+	handle = NULL;
+
+	for (priority = 0; priority < 3; priority++) {
+		awaiting_peer_rename = 0;
+		count = 0;
+		while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+			if (priority != child->activation_priority)
+				continue;
+
+			if (!(uuid = dm_tree_node_get_uuid(child))) {
+				stack;
+				continue;
+			}
+
+			if (!_uuid_prefix_matches(uuid, uuid_prefix, uuid_prefix_len))
+				continue;
+
+			if (!(name = dm_tree_node_get_name(child))) {
+				stack;
+				continue;
+			}
+
+			/* Rename? */
+			if (child->props.new_name) {
+				if (_rename_conflict_exists(dnode, child, &resolvable_name_conflict) &&
+				    resolvable_name_conflict) {
+					awaiting_peer_rename++;
+					continue;
+				}
+				if (!_rename_node(name, child->props.new_name, child->info.major,
+						  child->info.minor, &child->dtree->cookie,
+						  child->udev_flags)) {
+					log_error("Failed to rename %s (%" PRIu32
+						  ":%" PRIu32 ") to %s", name, child->info.major,
+						  child->info.minor, child->props.new_name);
+					r = 0;
+					goto out;
+				}
+				child->name = child->props.new_name;
+				child->props.new_name = NULL;
+			}
+
+			if (!child->info.inactive_table && !child->info.suspended)
+				continue;
+
+			jobs[count++].node = child;
+		}
+
+		/* Resume whole priority level, then send messages in order */
+		(void) _run_node_jobs(dnode->dtree, _resume_job, jobs, count);
+
+		for (i = 0; i < count; i++) {
+			child = jobs[i].node;
+
+			if (!jobs[i].r) {
+				r = 0;
+				continue;
+			}
+
+			/*
+			 * FIXME: Implement delayed error reporting
+			 * activation should be stopped only in the case,
+			 * the submission of transation_id message fails,
+			 * resume should continue further, just whole command
+			 * has to report failure.
+			 */
+			if (r && (child->props.send_messages > 1) &&
+			    !(r = _node_send_messages(child, uuid_prefix, uuid_prefix_len, 1)))
+				stack;
+		}
+		if (awaiting_peer_rename)
+			priority--; /* redo priority level */
+	}
+
+out:
+	free(jobs);
+
+	return r;
+}
+
 int dm_tree_activate_children(struct dm_tree_node *dnode,
 				 const char *uuid_prefix,
 				 size_t uuid_prefix_len)
@@ -1978,6 +2378,9 @@ int dm_tree_activate_children(struct dm_tree_node *dnode,
 	const char *uuid;
 	int priority;
 
+	if (dnode->dtree->threads > 1)
+		return _dm_tree_activate_children_parallel(dnode, uuid_prefix, uuid_prefix_len);
+
 	/* Activate children first */
 	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
 		if (!(uuid = dm_tree_node_get_uuid(child))) {
@@ -2961,6 +3364,173 @@ static int _dm_tree_revert_activated(struct dm_tree_node *parent)
 	return 1;
 }
 
+static int _create_job(struct node_job *job)
+{
+	/* Could have been created as a dependency of a sibling */
+	if (job->node->info.exists)
+		return 1;
+
+	return (job->created = _create_node(job->node));
+}
+
+static int _load_job(struct node_job *job)
+{
+	struct dm_tree_node *child = job->node;
+
+	if (child->info.inactive_table || !child->props.segment_count)
+		return 1;
+
+	return _load_node(child);
+}
+
+/*
+ * Preload with threads.  All subtrees of this level are preloaded
+ * first, then the children are created, loaded and resumed, each step
+ * for all of them at once.  Whatever a child depends on is in its own
+ * subtree, so it is ready before the child table is loaded.
+ */
+static int _dm_tree_preload_children_parallel(struct dm_tree_node *dnode,
+					      const char *uuid_prefix,
+					      size_t uuid_prefix_len)
+{
+	int r = 0;
+	void *handle = NULL;
+	struct dm_tree_node *child;
+	int update_devs_flag = 0;
+	struct node_job *jobs;
+	unsigned i, count = 0, nr_resume = 0;
+
+	if (!(jobs = _alloc_node_jobs(dnode)))
+		return_0;
+
+	/* Preload children first */
+	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+		/* Propagate delay of resume from parent node */
+		if (dnode->props.delay_resume_if_new > 1)
+			child->props.delay_resume_if_new = dnode->props.delay_resume_if_new;
+
+		/* Skip existing non-device-mapper devices */
+		if (!child->info.exists && child->info.major)
+			continue;
+
+		/* Ignore if it doesn't belong to this VG */
+		if (child->info.exists &&
+		    !_uuid_prefix_matches(child->uuid, uuid_prefix, uuid_prefix_len))
+			continue;
+
+		if (dm_tree_node_num_children(child, 0))
+			if (!dm_tree_preload_children(child, uuid_prefix, uuid_prefix_len))
+				goto_out;
+
+		jobs[count++].node = child;
+	}
+
+	/* FIXME Cope if name exists with no uuid? */
+	if (!_run_node_jobs(dnode->dtree, _create_job, jobs, count))
+		goto_out;
+
+	for (i = 0; i < count; i++)
+		/* Propagate delayed resume from exteded child node */
+		if (jobs[i].node->props.delay_resume_if_extended)
+			dnode->props.delay_resume_if_extended = 1;
+
+	if (!_run_node_jobs(dnode->dtree, _load_job, jobs, count)) {
+		/*
+		 * Remove the devices created at this level, so the
+		 * create + load of the level stays atomic.
+		 */
+		for (i = 0; i < count; i++) {
+			if (!jobs[i].created)
+				continue;
+			child = jobs[i].node;
+			if (!_deactivate_node(child->name, child->info.major, child->info.minor,
+					      &child->dtree->cookie, child->udev_flags, 0))
+				log_error("Failed to clean-up device %s.", _node_name(child));
+		}
+		if (!dm_udev_wait(dm_tree_get_cookie(dnode)))
+			stack;
+		dm_tree_set_cookie(dnode, 0);
+		for (i = 0; i < count; i++)
+			if (jobs[i].created)
+				(void) _dm_tree_revert_activated(jobs[i].node);
+		goto_out;
+	}
+
+	for (i = 0; i < count; i++) {
+		child = jobs[i].node;
+
+		/* No resume for a device without parents or with unchanged or smaller size */
+		if (!dm_tree_node_num_children(child, 1) || (child->props.size_changed <= 0))
+			continue;
+
+		if (!child->info.inactive_table && !child->info.suspended)
+			continue;
+
+		jobs[nr_resume++] = jobs[i];
+	}
+
+	(void) _run_node_jobs(dnode->dtree, _resume_job, jobs, nr_resume);
+
+	r = 1;
+
+	for (i = 0; i < nr_resume; i++) {
+		child = jobs[i].node;
+
+		if (!jobs[i].r) {
+			/* If the device was not previously active, we might as well remove this node. */
+			if (!child->info.live_table &&
+			    !_deactivate_node(child->name, child->info.major, child->info.minor,
+					      &child->dtree->cookie, child->udev_flags, 0))
+				log_error("Unable to deactivate %s.", _node_name(child));
+			r = 0;
+			/* Each child is handled independently */
+			continue;
+		}
+
+		if (jobs[i].created) {
+			/* Collect newly introduced devices for revert */
+			dm_list_add_h(&dnode->activated, &child->activated_list);
+
+			/* When creating new node also check transaction_id. */
+			if (child->props.send_messages &&
+			    !_node_send_messages(child, uuid_prefix, uuid_prefix_len, 0)) {
+				stack;
+				if (!dm_udev_wait(dm_tree_get_cookie(dnode)))
+					stack;
+				dm_tree_set_cookie(dnode, 0);
+				(void) _dm_tree_revert_activated(dnode);
+				r = 0;
+				continue;
+			}
+		}
+
+		if (child->props.immediate_dev_node)
+			update_devs_flag = 1;
+	}
+
+	if (update_devs_flag ||
+	    (r && !dnode->info.exists && dnode->callback)) {
+		if (!dm_udev_wait(dm_tree_get_cookie(dnode)))
+			stack;
+		dm_tree_set_cookie(dnode, 0);
+
+		if (r && !dnode->info.exists && dnode->callback &&
+		    !dnode->callback(dnode, DM_NODE_CALLBACK_PRELOADED,
+				     dnode->callback_data))
+		{
+			/* Try to deactivate what has been activated in preload phase */
+			(void) _dm_tree_revert_activated(dnode);
+			r = 0;
+			goto_out;
+		}
+	}
+
+out:
+	free(jobs);
+
+	return r;
+}
+
 int dm_tree_preload_children(struct dm_tree_node *dnode,
 			     const char *uuid_prefix,
 			     size_t uuid_prefix_len)
@@ -2970,6 +3540,9 @@ int dm_tree_preload_children(struct dm_tree_node *dnode,
 	struct dm_tree_node *child;
 	int update_devs_flag = 0;
 
+	if (dnode->dtree->threads > 1)
+		return _dm_tree_preload_children_parallel(dnode, uuid_prefix, uuid_prefix_len);
+
 	/* Preload children first */
 	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
 		/* Propagate delay of resume from parent node */
@@ -20,8 +20,21 @@
 
 extern dm_log_with_errno_fn dm_log_with_errno;
 
+/*
+ * Between dm_log_threads_begin() and dm_log_threads_end() messages
+ * are serialized, so several threads may log through one log function.
+ */
+void dm_log_threads_begin(void);
+void dm_log_threads_end(void);
+int dm_log_lock(void);
+void dm_log_unlock(int locked);
+
 #define LOG_MESG(l, f, ln, e, x...) \
-	dm_log_with_errno(l, f, ln, e, ## x)
+do { \
+	int _dm_log_locked = dm_log_lock(); \
+	dm_log_with_errno(l, f, ln, e, ## x); \
+	dm_log_unlock(_dm_log_locked); \
+} while (0)
 
 #define LOG_LINE(l, x...) LOG_MESG(l, __FILE__, __LINE__, 0, ## x)
 #define LOG_LINE_WITH_ERRNO(l, e, x...) LOG_MESG(l, __FILE__, __LINE__, e, ## x)
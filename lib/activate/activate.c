@@ -226,6 +226,9 @@ int lv_info_by_lvid(struct cmd_context *cmd, const char *lvid_s, int use_layer,
 {
 	return 0;
 }
+void activation_info_cache(struct cmd_context *cmd, int enable)
+{
+}
 int lv_info_with_seg_status(struct cmd_context *cmd, const struct logical_volume *lv,
 			    const struct lv_segment *lv_seg, int use_layer,
 			    struct lv_with_info_and_seg_status *status,
@@ -702,6 +705,14 @@ int lv_info(struct cmd_context *cmd, const struct logical_volume *lv, int use_la
 	return _lv_info(cmd, lv, use_layer, info, NULL, NULL, with_open_count, with_read_ahead);
 }
 
+void activation_info_cache(struct cmd_context *cmd, int enable)
+{
+	cmd->use_dm_info_cache = enable ? 1 : 0;
+
+	if (!enable)
+		dev_manager_info_cache_destroy(cmd);
+}
+
 /*
  * Returns 1 if lv_with_info_and_seg_status info structure populated,
  * else 0 on failure or if device not active locally.
@@ -145,6 +145,15 @@ int lv_info(struct cmd_context *cmd, const struct logical_volume *lv, int use_la
 int lv_info_by_lvid(struct cmd_context *cmd, const char *lvid_s, int use_layer,
 		    struct lvinfo *info, int with_open_count, int with_read_ahead);
 
+/*
+ * While enabled, once lv_info* queries cover more than a few LVs of a VG,
+ * info and status of all its active devices are read at once and later
+ * queries in that VG use them without ioctls.  Devices not found that way
+ * are still queried from the kernel.  Only for commands not changing dm
+ * state, e.g. reports.
+ */
+void activation_info_cache(struct cmd_context *cmd, int enable);
+
 /*
  * Returns 1 if lv_info_and_seg_status structure has been populated,
  * else 0 on failure or if device not active locally.
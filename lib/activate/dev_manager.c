@@ -236,6 +236,24 @@ static uint32_t _seg_len(const struct lv_segment *seg)
 	return seg->len - reshape_len;
 }
 
+/* Table range of the segment seg_status is collected for */
+static void _seg_status_range(const struct lv_seg_status *seg_status,
+			      uint64_t *start, uint64_t *length)
+{
+	*start = *length = seg_status->seg->lv->vg->extent_size;
+	*start *= seg_status->seg->le;
+	*length *= _seg_len(seg_status->seg);
+
+	/* Uses max DM_THIN_MAX_METADATA_SIZE sectors for metadata device */
+	if (lv_is_thin_pool_metadata(seg_status->seg->lv) &&
+	    (*length > DM_THIN_MAX_METADATA_SIZE))
+		*length = DM_THIN_MAX_METADATA_SIZE;
+
+	/* Uses virtual size with headers for VDO pool device */
+	if (lv_is_vdo_pool(seg_status->seg->lv))
+		*length = get_vdo_pool_virtual_size(seg_status->seg);
+}
+
 static int _info_run(const char *dlid, struct dm_info *dminfo,
 		     uint32_t *read_ahead,
 		     struct lv_seg_status *seg_status,
@@ -270,18 +288,7 @@ static int _info_run(const char *dlid, struct dm_info *dminfo,
 
 	/* Query status only for active device */
 	if (seg_status && dminfo->exists) {
-		start = length = seg_status->seg->lv->vg->extent_size;
-		start *= seg_status->seg->le;
-		length *= _seg_len(seg_status->seg);
-
-		/* Uses max DM_THIN_MAX_METADATA_SIZE sectors for metadata device */
-		if (lv_is_thin_pool_metadata(seg_status->seg->lv) &&
-		    (length > DM_THIN_MAX_METADATA_SIZE))
-			length = DM_THIN_MAX_METADATA_SIZE;
-
-		/* Uses virtual size with headers for VDO pool device */
-		if (lv_is_vdo_pool(seg_status->seg->lv))
-			length = get_vdo_pool_virtual_size(seg_status->seg);
+		_seg_status_range(seg_status, &start, &length);
 
 		do {
 			target = dm_get_next_target(dmt, target, &target_start,
@@ -306,6 +313,267 @@ static int _info_run(const char *dlid, struct dm_info *dminfo,
 	return r;
 }
 
+/*
+ * Info and table status of all devices of one VG, read once with one
+ * DM_DEVICE_STATUS per active device and then used by dev_manager_info()
+ * instead of further ioctls.  See activation_info_cache().
+ *
+ * Reading the whole VG only pays off when many of its LVs are queried,
+ * so the devices are read once more than DM_INFO_CACHE_MIN_LVS different
+ * LVs of the VG were queried; until then each query goes to the kernel.
+ */
+#define DM_INFO_CACHE_MIN_LVS 8
+
+struct dm_info_cache {
+	struct dm_pool *mem;
+	struct dm_hash_table *devs;	/* dm uuid -> struct cached_dev, once read */
+	const char *vgname;
+	const struct logical_volume *last_lv;
+	unsigned nr_lvs;		/* LVs queried before reading devs */
+};
+
+struct cached_target {
+	uint64_t start;
+	uint64_t length;
+	const char *type;
+	const char *params;
+};
+
+struct cached_dev {
+	struct dm_info info;
+	uint32_t read_ahead;
+	int read_ahead_ok;
+	unsigned target_count;
+	struct cached_target *targets;
+};
+
+static int _info_cache_add(struct dm_info_cache *cache, uint32_t major, uint32_t minor)
+{
+	struct dm_task *dmt;
+	struct cached_dev *cdev;
+	struct cached_target *ct;
+	void *target = NULL;
+	uint64_t start, length;
+	char *type, *params;
+	const char *uuid;
+	int r = 0;
+
+	if (!(cdev = dm_pool_zalloc(cache->mem, sizeof(*cdev))))
+		return_0;
+
+	/* Same as _info_run() for STATUS, but with open_count */
+	if (!(dmt = _setup_task_run(DM_DEVICE_STATUS, &cdev->info, NULL, NULL, 0,
+				    major, minor, 1, 0, 0)))
+		return_0;
+
+	if (!cdev->info.exists) {
+		r = 1; /* Removed meanwhile */
+		goto out;
+	}
+
+	if (!(uuid = dm_task_get_uuid(dmt)) || !*uuid) {
+		r = 1; /* Not an LV */
+		goto out;
+	}
+
+	cdev->read_ahead_ok = dm_task_get_read_ahead(dmt, &cdev->read_ahead);
+
+	do {
+		target = dm_get_next_target(dmt, target, &start, &length, &type, &params);
+		if (type)
+			cdev->target_count++;
+	} while (target);
+
+	if (cdev->target_count &&
+	    !(cdev->targets = dm_pool_alloc(cache->mem, cdev->target_count * sizeof(*ct))))
+		goto_out;
+
+	ct = cdev->targets;
+	do {
+		target = dm_get_next_target(dmt, target, &start, &length, &type, &params);
+		if (!type)
+			continue;
+		ct->start = start;
+		ct->length = length;
+		if (!(ct->type = dm_pool_strdup(cache->mem, type)) ||
+		    !(ct->params = dm_pool_strdup(cache->mem, params ? : "")))
+			goto_out;
+		ct++;
+	} while (target);
+
+	if (!dm_hash_insert(cache->devs, uuid, cdev))
+		goto_out;
+
+	r = 1;
+out:
+	dm_task_destroy(dmt);
+
+	return r;
+}
+
+static void _info_cache_destroy(struct dm_info_cache *cache)
+{
+	if (cache->devs)
+		dm_hash_destroy(cache->devs);
+	dm_pool_destroy(cache->mem);
+}
+
+static struct dm_info_cache *_info_cache_create(const struct volume_group *vg)
+{
+	struct dm_pool *mem;
+	struct dm_info_cache *cache;
+
+	if (!(mem = dm_pool_create("dm_info_cache", 16 * 1024)))
+		return_NULL;
+
+	if (!(cache = dm_pool_zalloc(mem, sizeof(*cache))) ||
+	    !(cache->vgname = dm_pool_strdup(mem, vg->name))) {
+		dm_pool_destroy(mem);
+		return_NULL;
+	}
+
+	cache->mem = mem;
+
+	return cache;
+}
+
+/*
+ * List all dm devices once and read those named after the VG.
+ * dm names are "vg-lv" with hyphens doubled, so the next character
+ * after "vg-" must not be another hyphen.
+ */
+static int _info_cache_read(struct dm_info_cache *cache)
+{
+	struct dm_task *dmt = NULL;
+	struct dm_names *names;
+	const char *prefix;
+	size_t len;
+	unsigned next = 0;
+
+	if (!(prefix = dm_build_dm_name(cache->mem, cache->vgname, "", NULL)))
+		return_0;
+
+	len = strlen(prefix);
+
+	if (!(cache->devs = dm_hash_create(128)))
+		return_0;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_LIST)) || !dm_task_run(dmt) ||
+	    !(names = dm_task_get_names(dmt)))
+		goto_bad;
+
+	if (names->dev)
+		do {
+			names = (struct dm_names *)((char *) names + next);
+			if (!strncmp(names->name, prefix, len) && (names->name[len] != '-') &&
+			    !_info_cache_add(cache, MAJOR(names->dev), MINOR(names->dev)))
+				goto_bad;
+			next = names->next;
+		} while (next);
+
+	dm_task_destroy(dmt);
+
+	log_debug_activation("Cached status of %u devices in VG %s.",
+			     dm_hash_get_num_entries(cache->devs), cache->vgname);
+
+	return 1;
+bad:
+	if (dmt)
+		dm_task_destroy(dmt);
+
+	return 0;
+}
+
+/* Returns the cache to answer a query for lv from, if any */
+static struct dm_info_cache *_info_cache(struct cmd_context *cmd,
+					 const struct logical_volume *lv)
+{
+	struct dm_info_cache *cache = cmd->dm_info_cache;
+
+	if (cache && strcmp(cache->vgname, lv->vg->name)) {
+		dev_manager_info_cache_destroy(cmd);
+		cache = NULL;
+	}
+
+	if (!cache && !(cache = cmd->dm_info_cache = _info_cache_create(lv->vg)))
+		goto_bad;
+
+	if (cache->devs)
+		return cache;
+
+	if (lv != cache->last_lv) {
+		cache->last_lv = lv;
+		cache->nr_lvs++;
+	}
+
+	if (cache->nr_lvs <= DM_INFO_CACHE_MIN_LVS)
+		return NULL;
+
+	if (!_info_cache_read(cache))
+		goto_bad;
+
+	return cache;
+
+bad:
+	/* On failure all further queries go to the kernel */
+	dev_manager_info_cache_destroy(cmd);
+	cmd->use_dm_info_cache = 0;
+
+	return NULL;
+}
+
+void dev_manager_info_cache_destroy(struct cmd_context *cmd)
+{
+	if (cmd->dm_info_cache) {
+		_info_cache_destroy(cmd->dm_info_cache);
+		cmd->dm_info_cache = NULL;
+	}
+}
+
+/*
+ * _info_run() served from the cache.  Returns 0 if dlid is not cached:
+ * the device may be inactive, or named differently and so not read.
+ */
+static int _cached_info_run(struct dm_info_cache *cache, const char *dlid,
+			    struct dm_info *dminfo, uint32_t *read_ahead,
+			    struct lv_seg_status *seg_status, int with_read_ahead)
+{
+	const struct cached_dev *cdev;
+	const char *target_name = NULL, *target_params = NULL;
+	uint64_t start, length;
+	unsigned i;
+
+	if (!(cdev = dm_hash_lookup(cache->devs, dlid)) ||
+	    (with_read_ahead && !cdev->read_ahead_ok))
+		return 0;
+
+	*dminfo = cdev->info;
+
+	if (with_read_ahead)
+		*read_ahead = cdev->read_ahead;
+	else if (read_ahead)
+		*read_ahead = DM_READ_AHEAD_NONE;
+
+	if (seg_status) {
+		_seg_status_range(seg_status, &start, &length);
+
+		for (i = 0; i < cdev->target_count; i++) {
+			target_name = cdev->targets[i].type;
+			target_params = cdev->targets[i].params;
+			if ((start == cdev->targets[i].start) &&
+			    (length == cdev->targets[i].length))
+				break;
+			target_params = NULL;
+		}
+
+		if (!target_name ||
+		    !_get_segment_status_from_target_params(target_name, target_params, seg_status))
+			stack;
+	}
+
+	return 1;
+}
+
 /*
  * ignore_blocked_mirror_devices
  * @dev
@@ -779,7 +1047,7 @@ static int _original_uuid_format_check_required(struct cmd_context *cmd)
 	return (_kernel_major == -1);
 }
 
-static int _info(struct cmd_context *cmd,
+static int _info(struct cmd_context *cmd, struct dm_info_cache *cache,
 		 const char *name, const char *dlid,
 		 int with_open_count, int with_read_ahead,
 		 struct dm_info *dminfo, uint32_t *read_ahead,
@@ -791,6 +1059,10 @@ static int _info(struct cmd_context *cmd,
 
 	log_debug_activation("Getting device info for %s [%s].", name, dlid);
 
+	if (cache && _cached_info_run(cache, dlid, dminfo, read_ahead,
+				      seg_status, with_read_ahead))
+		return 1;
+
 	/* Check for dlid */
 	if (!_info_run(dlid, dminfo, read_ahead, seg_status,
 		       with_open_count, with_read_ahead, 0, 0))
@@ -838,16 +1110,20 @@ int dev_manager_info(struct cmd_context *cmd,
 		     struct dm_info *dminfo, uint32_t *read_ahead,
 		     struct lv_seg_status *seg_status)
 {
+	struct dm_info_cache *cache = NULL;
 	char *dlid, *name;
 	int r = 0;
 
+	if (cmd->use_dm_info_cache)
+		cache = _info_cache(cmd, lv);
+
 	if (!(name = dm_build_dm_name(cmd->mem, lv->vg->name, lv->name, layer)))
 		return_0;
 
 	if (!(dlid = build_dm_uuid(cmd->mem, lv, layer)))
 		goto_out;
 
-	if (!(r = _info(cmd, name, dlid, with_open_count, with_read_ahead,
+	if (!(r = _info(cmd, cache, name, dlid, with_open_count, with_read_ahead,
 			dminfo, read_ahead, seg_status)))
 		stack;
 out:
@@ -1994,7 +2270,7 @@ static int _add_dev_to_dtree(struct dev_manager *dm, struct dm_tree *dtree,
 	if (!(dlid = build_dm_uuid(dm->mem, lv, layer)))
 		return_0;
 
-	if (!_info(dm->cmd, name, dlid, 1, 0, &info, NULL, NULL))
+	if (!_info(dm->cmd, NULL, name, dlid, 1, 0, &info, NULL, NULL))
 		return_0;
 
 	/*
@@ -2520,7 +2796,7 @@ static char *_add_error_or_zero_device(struct dev_manager *dm, struct dm_tree *d
 				      seg->lv->name, errid)))
 		return_NULL;
 
-	if (!_info(dm->cmd, name, dlid, 1, 0, &info, NULL, NULL))
+	if (!_info(dm->cmd, NULL, name, dlid, 1, 0, &info, NULL, NULL))
 		return_NULL;
 
 	if (!info.exists) {
@@ -3288,6 +3564,7 @@ static int _tree_action(struct dev_manager *dm, const struct logical_volume *lv,
 	struct dm_tree *dtree;
 	struct dm_tree_node *root;
 	char *dlid;
+	int threads;
 	int r = 0;
 
 	if (action < DM_ARRAY_SIZE(_action_names))
@@ -3319,6 +3596,9 @@ static int _tree_action(struct dev_manager *dm, const struct logical_volume *lv,
 	/* Restore fs cookie */
 	dm_tree_set_cookie(root, fs_get_cookie());
 
+	if ((threads = find_config_tree_int(dm->cmd, activation_activation_threads_CFG, NULL)) > 1)
+		dm_tree_use_threads(root, (unsigned) threads);
+
 	if (!(dlid = build_dm_uuid(dm->mem, lv, laopts->origin_only ? lv_layer(lv) : NULL)))
 		goto_out;
 
@@ -38,6 +38,7 @@ struct dev_manager *dev_manager_create(struct cmd_context *cmd,
 void dev_manager_destroy(struct dev_manager *dm);
 void dev_manager_release(void);
 void dev_manager_exit(void);
+void dev_manager_info_cache_destroy(struct cmd_context *cmd);
 
 /*
  * The device handler is responsible for creating all the layered
@@ -2151,6 +2151,20 @@ int lvmcache_vgid_is_cached(const char *vgid) {
 	return 1;
 }
 
+/*
+ * Size of the metadata text found for the VG by the last scan,
+ * or 0 if unknown.
+ */
+size_t lvmcache_vg_mda_size(const char *vgid)
+{
+	struct lvmcache_vginfo *vginfo;
+
+	if (!(vginfo = lvmcache_vginfo_from_vgid(vgid)))
+		return 0;
+
+	return vginfo->mda_size;
+}
+
 uint64_t lvmcache_smallest_mda_size(struct lvmcache_info *info)
 {
 	if (!info)
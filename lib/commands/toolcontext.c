@@ -529,6 +529,7 @@ static int _process_config(struct cmd_context *cmd)
 {
 	mode_t old_umask;
 	const char *dev_ext_info_src;
+	const char *io_engine;
 	const char *read_ahead;
 	struct stat st;
 	const struct dm_config_node *cn;
@@ -571,6 +572,16 @@ static int _process_config(struct cmd_context *cmd)
 		return 0;
 	}
 
+	io_engine = find_config_tree_str(cmd, devices_io_engine_CFG, NULL);
+	if (io_engine && !strcmp(io_engine, "libaio"))
+		init_use_io_uring(0);
+	else if (io_engine && !strcmp(io_engine, "io_uring"))
+		init_use_io_uring(1);
+	else {
+		log_error("Invalid io engine specification.");
+		return 0;
+	}
+
 	/* proc dir */
 	if (dm_snprintf(cmd->proc_dir, sizeof(cmd->proc_dir), "%s",
 			 find_config_tree_str(cmd, global_proc_CFG, NULL)) < 0) {
@@ -806,9 +817,11 @@ static int _load_config_file(struct cmd_context *cmd, const char *tag, int local
 	if (*tag) {
 		if (!_init_tags(cmd, cfl->cft))
 			return_0;
-	} else
+	} else {
 		/* Use temporary copy of lvm.conf while loading other files */
 		cmd->cft = cfl->cft;
+		invalidate_config_tree_cache(cmd);
+	}
 
 	return 1;
 }
@@ -824,6 +837,7 @@ static int _init_lvm_conf(struct cmd_context *cmd)
 			log_error("Failed to create config tree");
 			return 0;
 		}
+		invalidate_config_tree_cache(cmd);
 		return 1;
 	}
 
@@ -889,6 +903,9 @@ static struct dm_config_tree *_merge_config_files(struct cmd_context *cmd, struc
 			return_0;
 	}
 
+	/* The result replaces cmd->cft, or cmd->cft itself was merged into */
+	invalidate_config_tree_cache(cmd);
+
 	return cft;
 }
 
@@ -1925,6 +1942,7 @@ int refresh_toolcontext(struct cmd_context *cmd)
 	cft_tmp = cmd->cft;
 	if (cft_cmdline)
 		cmd->cft = dm_config_insert_cascaded_tree(cft_cmdline, cft_tmp);
+	invalidate_config_tree_cache(cmd);
 
 	/* Reload the global profile. */
 	if (profile_command_name) {
@@ -1961,6 +1979,7 @@ int refresh_toolcontext(struct cmd_context *cmd)
 	/* Finally we can make the proper, fully-merged, cmd->cft */
 	if (cft_cmdline)
 		cmd->cft = dm_config_insert_cascaded_tree(cft_cmdline, cmd->cft);
+	invalidate_config_tree_cache(cmd);
 
 	if (!_process_config(cmd))
 		return_0;
@@ -2015,6 +2034,8 @@ void destroy_toolcontext(struct cmd_context *cmd)
 	_destroy_segtypes(&cmd->segtypes);
 	_destroy_formats(cmd, &cmd->formats);
 	_destroy_filters(cmd);
+	if (cmd->report_status_mem)
+		dm_pool_destroy(cmd->report_status_mem);
 	if (cmd->mem)
 		dm_pool_destroy(cmd->mem);
 	dev_cache_exit();
@@ -52,6 +52,8 @@ struct config_info {
 
 struct dm_config_tree;
 struct profile_params;
+struct config_cache_item;
+struct dm_info_cache;
 struct archive_params;
 struct backup_params;
 struct arg_values;
@@ -172,6 +174,10 @@ struct cmd_context {
 	unsigned is_clvmd:1;
 	unsigned use_full_md_check:1;
 	unsigned is_activating:1;
+	unsigned use_dm_info_cache:1;		/* see activation_info_cache() */
+
+	struct dm_info_cache *dm_info_cache;	/* dm info+status of the VG being reported */
+	struct dm_pool *report_status_mem;	/* reused for LV segment status while reporting */
 
 	/*
 	 * Filtering.
@@ -187,6 +193,8 @@ struct cmd_context {
 	struct profile_params *profile_params;	/* profile handling params including loaded profile configs */
 	struct dm_config_tree *cft;		/* the whole cascade: CONFIG_STRING -> CONFIG_PROFILE -> CONFIG_FILE/CONFIG_MERGED_FILES */
 	struct dm_hash_table *cft_def_hash;	/* config definition hash used for validity check (item type + item recognized) */
+	struct config_cache_item *cft_cache;	/* per config id: precomputed path and last value looked up in cft */
+	unsigned cft_generation;		/* changed whenever cft is replaced or the cascade changes */
 	struct config_info default_settings;	/* selected settings with original default/configured value which can be changed during cmd processing */
 	struct config_info current_settings; 	/* may contain changed values compared to default_settings */
 
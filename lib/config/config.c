@@ -62,6 +62,25 @@ struct config_source {
 	struct cft_check_handle *check_handle;
 };
 
+/*
+ * Compiled lookups for find_config_tree_*(), indexed by config id.
+ * The path is built once per cmd_context.  A value is reused while the
+ * cascade is unchanged (see invalidate_config_tree_cache) and the same
+ * local profile is in effect.
+ */
+struct config_cache_item {
+	const char *path;
+	unsigned generation;
+	struct profile *profile;
+	union {
+		const struct dm_config_node *cn;
+		const char *str;
+		int i;
+		int64_t i64;
+		float f;
+	} v;
+};
+
 /*
  * Map each ID to respective definition of the configuration item.
  */
@@ -326,6 +345,7 @@ struct dm_config_tree *remove_config_tree_by_source(struct cmd_context *cmd,
 			} else
 				cmd->cft = cft->cascade;
 			cft->cascade = NULL;
+			invalidate_config_tree_cache(cmd);
 			break;
 		}
 		previous_cft = cft;
@@ -335,6 +355,21 @@ struct dm_config_tree *remove_config_tree_by_source(struct cmd_context *cmd,
 	return cft;
 }
 
+/*
+ * Generations are never reused, so a value cached while a local profile
+ * was applied cannot match once the profile is gone.  0 is never issued
+ * and marks a cache item that was never filled.
+ */
+static unsigned _cft_generation;
+
+void invalidate_config_tree_cache(struct cmd_context *cmd)
+{
+	if (!++_cft_generation)
+		++_cft_generation;
+
+	cmd->cft_generation = _cft_generation;
+}
+
 struct cft_check_handle *get_config_tree_check_handle(struct cmd_context *cmd,
 						      struct dm_config_tree *cft)
 {
@@ -403,6 +438,7 @@ int override_config_tree_from_string(struct cmd_context *cmd,
 	dm_config_set_custom(cft_new, cs);
 
 	cmd->cft = dm_config_insert_cascaded_tree(cft_new, cmd->cft);
+	invalidate_config_tree_cache(cmd);
 
 	return 1;
 }
@@ -431,6 +467,7 @@ static int _override_config_tree_from_command_profile(struct cmd_context *cmd,
 		cmd->cft = profile->cft;
 
 	dm_config_insert_cascaded_tree(profile->cft, cft);
+	invalidate_config_tree_cache(cmd);
 
 	return 1;
 }
@@ -465,6 +502,7 @@ static int _override_config_tree_from_metadata_profile(struct cmd_context *cmd,
 		cmd->cft = profile->cft;
 
 	dm_config_insert_cascaded_tree(profile->cft, cft);
+	invalidate_config_tree_cache(cmd);
 
 	return 1;
 }
@@ -528,6 +566,24 @@ int config_file_read_fd(struct dm_config_tree *cft, struct device *dev, dev_io_r
 			goto out;
 		}
 		fb = fb + mmap_offset;
+	} else if (!checksum_only) {
+		/*
+		 * The tree is parsed in place and keeps pointers into the
+		 * buffer, so it comes from the tree's pool.  One extra byte
+		 * lets the parser terminate a token at the very end.
+		 */
+		if (!(fb = dm_pool_alloc(cft->mem, size + size2 + 1))) {
+			log_error("Failed to allocate circular buffer.");
+			return 0;
+		}
+
+		if (!dev_read_bytes(dev, offset, size, fb))
+			goto out;
+
+		if (size2) {
+			if (!dev_read_bytes(dev, offset2, size2, fb + size))
+				goto out;
+		}
 	} else {
 		if (!(buf = malloc(size + size2))) {
 			log_error("Failed to allocate circular buffer.");
@@ -560,7 +616,10 @@ int config_file_read_fd(struct dm_config_tree *cft, struct device *dev, dev_io_r
 
 	if (!checksum_only) {
 		fe = fb + size + size2;
-		if (no_dup_node_check) {
+		if (!use_mmap) {
+			if (!dm_config_parse_in_place(cft, fb, fe, no_dup_node_check))
+				goto_out;
+		} else if (no_dup_node_check) {
 			if (!dm_config_parse_without_dup_node_check(cft, fb, fe))
 				goto_out;
 		} else {
@@ -1207,23 +1266,108 @@ out:
 	return r;
 }
 
-static int _apply_local_profile(struct cmd_context *cmd, struct profile *profile)
+/*
+ * Local profile that takes effect for a lookup, if any.
+ * Global metadata profile overrides the local one.
+ * This simply means the "--metadataprofile" arg
+ * overrides any profile attached to VG/LV.
+ */
+static struct profile *_local_profile(struct cmd_context *cmd, struct profile *profile)
 {
-	if (!profile)
-		return 0;
+	if (profile && (profile->source == CONFIG_PROFILE_METADATA) &&
+	    cmd->profile_params->global_metadata_profile)
+		return NULL;
 
-	/*
-	 * Global metadata profile overrides the local one.
-	 * This simply means the "--metadataprofile" arg
-	 * overrides any profile attached to VG/LV.
-	 */
-	if ((profile->source == CONFIG_PROFILE_METADATA) &&
-	     cmd->profile_params->global_metadata_profile)
+	return profile;
+}
+
+static int _apply_local_profile(struct cmd_context *cmd, struct profile *profile)
+{
+	if (!_local_profile(cmd, profile))
 		return 0;
 
 	return override_config_tree_from_profile(cmd, profile);
 }
 
+/*
+ * Removing the local profile leaves the cascade as it was before
+ * _apply_local_profile, so the cached values remain valid.
+ */
+static void _remove_local_profile(struct cmd_context *cmd, struct profile *profile,
+				  unsigned generation)
+{
+	remove_config_tree_by_source(cmd, profile->source);
+	cmd->cft_generation = generation;
+}
+
+static struct config_cache_item *_config_cache_item(struct cmd_context *cmd, int id)
+{
+	if (!cmd->cft_cache) {
+		if (!cmd->libmem ||
+		    !(cmd->cft_cache = dm_pool_zalloc(cmd->libmem, CFG_COUNT * sizeof(*cmd->cft_cache))))
+			return NULL;
+		if (!cmd->cft_generation)
+			invalidate_config_tree_cache(cmd);
+	}
+
+	return &cmd->cft_cache[id];
+}
+
+static const char *_config_path(struct cmd_context *cmd, cfg_def_item_t *item,
+				char *buf, size_t buf_size)
+{
+	struct config_cache_item *ci = _config_cache_item(cmd, item->id);
+
+	if (ci && ci->path)
+		return ci->path;
+
+	_cfg_def_make_path(buf, buf_size, item->id, item, 0);
+
+	if (ci)
+		ci->path = dm_pool_strdup(cmd->libmem, buf);
+
+	return buf;
+}
+
+/*
+ * Values of settings with run-time defaults may depend on more than the
+ * config tree, and disabled settings warn on each use, so neither is cached.
+ */
+static struct config_cache_item *_config_cache_slot(struct cmd_context *cmd, cfg_def_item_t *item)
+{
+	if (item->flags & (CFG_DEFAULT_RUN_TIME | CFG_DISABLED))
+		return NULL;
+
+	return _config_cache_item(cmd, item->id);
+}
+
+static struct config_cache_item *_config_cache_find(struct cmd_context *cmd, cfg_def_item_t *item,
+						    struct profile *profile)
+{
+	struct config_cache_item *ci;
+
+	if (!(ci = _config_cache_slot(cmd, item)) || !ci->generation ||
+	    (ci->generation != cmd->cft_generation) ||
+	    (ci->profile != _local_profile(cmd, profile)))
+		return NULL;
+
+	return ci;
+}
+
+static struct config_cache_item *_config_cache_store(struct cmd_context *cmd, cfg_def_item_t *item,
+						     struct profile *profile)
+{
+	struct config_cache_item *ci;
+
+	if (!(ci = _config_cache_slot(cmd, item)))
+		return NULL;
+
+	ci->generation = cmd->cft_generation;
+	ci->profile = _local_profile(cmd, profile);
+
+	return ci;
+}
+
 static int _config_disabled(struct cmd_context *cmd, cfg_def_item_t *item, const char *path)
 {
 	if ((item->flags & CFG_DISABLED) && dm_config_tree_find_node(cmd->cft, path)) {
@@ -1250,17 +1394,26 @@ const struct dm_config_node *find_config_node(struct cmd_context *cmd, struct dm
 const struct dm_config_node *find_config_tree_node(struct cmd_context *cmd, int id, struct profile *profile)
 {
 	cfg_def_item_t *item = cfg_def_get_item_p(id);
-	char path[CFG_PATH_MAX_LEN];
+	unsigned generation = cmd->cft_generation;
+	struct config_cache_item *ci;
+	char buf[CFG_PATH_MAX_LEN];
+	const char *path;
 	int profile_applied;
 	const struct dm_config_node *cn;
 
+	if ((ci = _config_cache_find(cmd, item, profile)))
+		return ci->v.cn;
+
 	profile_applied = _apply_local_profile(cmd, profile);
-	_cfg_def_make_path(path, sizeof(path), item->id, item, 0);
+	path = _config_path(cmd, item, buf, sizeof(buf));
 
 	cn = dm_config_tree_find_node(cmd->cft, path);
 
 	if (profile_applied && profile)
-		remove_config_tree_by_source(cmd, profile->source);
+		_remove_local_profile(cmd, profile, generation);
+
+	if ((ci = _config_cache_store(cmd, item, profile)))
+		ci->v.cn = cn;
 
 	return cn;
 }
@@ -1268,12 +1421,18 @@ const struct dm_config_node *find_config_tree_node(struct cmd_context *cmd, int
 const char *find_config_tree_str(struct cmd_context *cmd, int id, struct profile *profile)
 {
 	cfg_def_item_t *item = cfg_def_get_item_p(id);
-	char path[CFG_PATH_MAX_LEN];
+	unsigned generation = cmd->cft_generation;
+	struct config_cache_item *ci;
+	char buf[CFG_PATH_MAX_LEN];
+	const char *path;
 	int profile_applied;
 	const char *str;
 
+	if ((ci = _config_cache_find(cmd, item, profile)))
+		return ci->v.str;
+
 	profile_applied = _apply_local_profile(cmd, profile);
-	_cfg_def_make_path(path, sizeof(path), item->id, item, 0);
+	path = _config_path(cmd, item, buf, sizeof(buf));
 
 	if (item->type != CFG_TYPE_STRING)
 		log_error(INTERNAL_ERROR "%s cfg tree element not declared as string.", path);
@@ -1282,20 +1441,26 @@ const char *find_config_tree_str(struct cmd_context *cmd, int id, struct profile
 						: dm_config_tree_find_str(cmd->cft, path, cfg_def_get_default_value(cmd, item, CFG_TYPE_STRING, profile));
 
 	if (profile_applied && profile)
-		remove_config_tree_by_source(cmd, profile->source);
+		_remove_local_profile(cmd, profile, generation);
+
+	if ((ci = _config_cache_store(cmd, item, profile)))
+		ci->v.str = str;
 
 	return str;
 }
 
+/* Not cached: it shares the cache item of find_config_tree_str. */
 const char *find_config_tree_str_allow_empty(struct cmd_context *cmd, int id, struct profile *profile)
 {
 	cfg_def_item_t *item = cfg_def_get_item_p(id);
-	char path[CFG_PATH_MAX_LEN];
+	unsigned generation = cmd->cft_generation;
+	char buf[CFG_PATH_MAX_LEN];
+	const char *path;
 	int profile_applied;
 	const char *str;
 
 	profile_applied = _apply_local_profile(cmd, profile);
-	_cfg_def_make_path(path, sizeof(path), item->id, item, 0);
+	path = _config_path(cmd, item, buf, sizeof(buf));
 
 	if (item->type != CFG_TYPE_STRING)
 		log_error(INTERNAL_ERROR "%s cfg tree element not declared as string.", path);
@@ -1306,7 +1471,7 @@ const char *find_config_tree_str_allow_empty(struct cmd_context *cmd, int id, st
 						: dm_config_tree_find_str_allow_empty(cmd->cft, path, cfg_def_get_default_value(cmd, item, CFG_TYPE_STRING, profile));
 
 	if (profile_applied && profile)
-		remove_config_tree_by_source(cmd, profile->source);
+		_remove_local_profile(cmd, profile, generation);
 
 	return str;
 }
@@ -1314,12 +1479,18 @@ const char *find_config_tree_str_allow_empty(struct cmd_context *cmd, int id, st
 int find_config_tree_int(struct cmd_context *cmd, int id, struct profile *profile)
 {
 	cfg_def_item_t *item = cfg_def_get_item_p(id);
-	char path[CFG_PATH_MAX_LEN];
+	unsigned generation = cmd->cft_generation;
+	struct config_cache_item *ci;
+	char buf[CFG_PATH_MAX_LEN];
+	const char *path;
 	int profile_applied;
 	int i;
 
+	if ((ci = _config_cache_find(cmd, item, profile)))
+		return ci->v.i;
+
 	profile_applied = _apply_local_profile(cmd, profile);
-	_cfg_def_make_path(path, sizeof(path), item->id, item, 0);
+	path = _config_path(cmd, item, buf, sizeof(buf));
 
 	if (item->type != CFG_TYPE_INT)
 		log_error(INTERNAL_ERROR "%s cfg tree element not declared as integer.", path);
@@ -1328,20 +1499,26 @@ int find_config_tree_int(struct cmd_context *cmd, int id, struct profile *profil
 					      : dm_config_tree_find_int(cmd->cft, path, cfg_def_get_default_value(cmd, item, CFG_TYPE_INT, profile));
 
 	if (profile_applied && profile)
-		remove_config_tree_by_source(cmd, profile->source);
+		_remove_local_profile(cmd, profile, generation);
+
+	if ((ci = _config_cache_store(cmd, item, profile)))
+		ci->v.i = i;
 
 	return i;
 }
 
+/* Not cached: it shares the cache item of find_config_tree_int. */
 int64_t find_config_tree_int64(struct cmd_context *cmd, int id, struct profile *profile)
 {
 	cfg_def_item_t *item = cfg_def_get_item_p(id);
-	char path[CFG_PATH_MAX_LEN];
+	unsigned generation = cmd->cft_generation;
+	char buf[CFG_PATH_MAX_LEN];
+	const char *path;
 	int profile_applied;
 	int i64;
 
 	profile_applied = _apply_local_profile(cmd, profile);
-	_cfg_def_make_path(path, sizeof(path), item->id, item, 0);
+	path = _config_path(cmd, item, buf, sizeof(buf));
 
 	if (item->type != CFG_TYPE_INT)
 		log_error(INTERNAL_ERROR "%s cfg tree element not declared as integer.", path);
@@ -1350,7 +1527,7 @@ int64_t find_config_tree_int64(struct cmd_context *cmd, int id, struct profile *
 						: dm_config_tree_find_int64(cmd->cft, path, cfg_def_get_default_value(cmd, item, CFG_TYPE_INT, profile));
 
 	if (profile_applied && profile)
-		remove_config_tree_by_source(cmd, profile->source);
+		_remove_local_profile(cmd, profile, generation);
 
 	return i64;
 }
@@ -1358,12 +1535,18 @@ int64_t find_config_tree_int64(struct cmd_context *cmd, int id, struct profile *
 float find_config_tree_float(struct cmd_context *cmd, int id, struct profile *profile)
 {
 	cfg_def_item_t *item = cfg_def_get_item_p(id);
-	char path[CFG_PATH_MAX_LEN];
+	unsigned generation = cmd->cft_generation;
+	struct config_cache_item *ci;
+	char buf[CFG_PATH_MAX_LEN];
+	const char *path;
 	int profile_applied;
 	float f;
 
+	if ((ci = _config_cache_find(cmd, item, profile)))
+		return ci->v.f;
+
 	profile_applied = _apply_local_profile(cmd, profile);
-	_cfg_def_make_path(path, sizeof(path), item->id, item, 0);
+	path = _config_path(cmd, item, buf, sizeof(buf));
 
 	if (item->type != CFG_TYPE_FLOAT)
 		log_error(INTERNAL_ERROR "%s cfg tree element not declared as float.", path);
@@ -1372,7 +1555,10 @@ float find_config_tree_float(struct cmd_context *cmd, int id, struct profile *pr
 					      : dm_config_tree_find_float(cmd->cft, path, cfg_def_get_default_value(cmd, item, CFG_TYPE_FLOAT, profile));
 
 	if (profile_applied && profile)
-		remove_config_tree_by_source(cmd, profile->source);
+		_remove_local_profile(cmd, profile, generation);
+
+	if ((ci = _config_cache_store(cmd, item, profile)))
+		ci->v.f = f;
 
 	return f;
 }
@@ -1397,12 +1583,18 @@ int find_config_bool(struct cmd_context *cmd, struct dm_config_tree *cft, int id
 int find_config_tree_bool(struct cmd_context *cmd, int id, struct profile *profile)
 {
 	cfg_def_item_t *item = cfg_def_get_item_p(id);
-	char path[CFG_PATH_MAX_LEN];
+	unsigned generation = cmd->cft_generation;
+	struct config_cache_item *ci;
+	char buf[CFG_PATH_MAX_LEN];
+	const char *path;
 	int profile_applied;
 	int b;
 
+	if ((ci = _config_cache_find(cmd, item, profile)))
+		return ci->v.i;
+
 	profile_applied = _apply_local_profile(cmd, profile);
-	_cfg_def_make_path(path, sizeof(path), item->id, item, 0);
+	path = _config_path(cmd, item, buf, sizeof(buf));
 
 	if (item->type != CFG_TYPE_BOOL)
 		log_error(INTERNAL_ERROR "%s cfg tree element not declared as boolean.", path);
@@ -1411,7 +1603,10 @@ int find_config_tree_bool(struct cmd_context *cmd, int id, struct profile *profi
 					      : dm_config_tree_find_bool(cmd->cft, path, cfg_def_get_default_value(cmd, item, CFG_TYPE_BOOL, profile));
 
 	if (profile_applied && profile)
-		remove_config_tree_by_source(cmd, profile->source);
+		_remove_local_profile(cmd, profile, generation);
+
+	if ((ci = _config_cache_store(cmd, item, profile)))
+		ci->v.i = b;
 
 	return b;
 }
@@ -1490,11 +1685,13 @@ static void _log_array_value_used(struct dm_pool *mem, const struct dm_config_no
 const struct dm_config_node *find_config_tree_array(struct cmd_context *cmd, int id, struct profile *profile)
 {
 	cfg_def_item_t *item = cfg_def_get_item_p(id);
-	char path[CFG_PATH_MAX_LEN];
+	unsigned generation = cmd->cft_generation;
+	char buf[CFG_PATH_MAX_LEN];
+	const char *path;
 	int profile_applied;
 	const struct dm_config_node *cn = NULL, *cn_def = NULL;
 	profile_applied = _apply_local_profile(cmd, profile);
-	_cfg_def_make_path(path, sizeof(path), item->id, item, 0);
+	path = _config_path(cmd, item, buf, sizeof(buf));
 
 	if (!(item->type & CFG_TYPE_ARRAY))
 		log_error(INTERNAL_ERROR "%s cfg tree element not declared as array.", path);
@@ -1511,7 +1708,7 @@ const struct dm_config_node *find_config_tree_array(struct cmd_context *cmd, int
 	}
 
 	if (profile_applied && profile)
-		remove_config_tree_by_source(cmd, profile->source);
+		_remove_local_profile(cmd, profile, generation);
 
 	return cn;
 }
@@ -233,6 +233,8 @@ int override_config_tree_from_string(struct cmd_context *cmd, const char *config
 int override_config_tree_from_profile(struct cmd_context *cmd, struct profile *profile);
 struct dm_config_tree *get_config_tree_by_source(struct cmd_context *, config_source_t source);
 struct dm_config_tree *remove_config_tree_by_source(struct cmd_context *cmd, config_source_t source);
+/* Must be called whenever cmd->cft is replaced or modified outside the functions above. */
+void invalidate_config_tree_cache(struct cmd_context *cmd);
 struct cft_check_handle *get_config_tree_check_handle(struct cmd_context *cmd, struct dm_config_tree *cft);
 config_source_t config_get_source_type(struct dm_config_tree *cft);
 
@@ -340,6 +340,25 @@ cfg(devices_sysfs_scan_CFG, "sysfs_scan", devices_CFG_SECTION, 0, CFG_TYPE_BOOL,
 cfg(devices_scan_lvs_CFG, "scan_lvs", devices_CFG_SECTION, 0, CFG_TYPE_BOOL, DEFAULT_SCAN_LVS, vsn(2, 2, 182), NULL, 0, NULL,
 	"Scan LVM LVs for layered PVs.\n")
 
+cfg(devices_io_engine_CFG, "io_engine", devices_CFG_SECTION, 0, CFG_TYPE_STRING, DEFAULT_IO_ENGINE, vsn(2, 3, 2), NULL, 0, NULL,
+	"Select the kernel interface used for device io.\n"
+	"#\n"
+	"Accepted values:\n"
+	"  libaio\n"
+	"    Linux native asynchronous io.\n"
+	"  io_uring\n"
+	"    io_uring with batched submission and completion. Reduces the\n"
+	"    syscall overhead of scanning many devices. LVM falls back to\n"
+	"    libaio if the kernel does not support io_uring.\n"
+	"#\n")
+
+cfg(devices_scan_cache_CFG, "scan_cache", devices_CFG_SECTION, 0, CFG_TYPE_BOOL, DEFAULT_SCAN_CACHE, vsn(2, 3, 2), NULL, 0, NULL,
+	"Keep a summary of the VG metadata found by label scan in the run dir.\n"
+	"When the label and metadata area header read from a device match\n"
+	"the saved entry, the metadata text is not read and parsed again.\n"
+	"This reduces the cost of scanning many PVs whose metadata is not\n"
+	"changing.\n")
+
 cfg(devices_multipath_component_detection_CFG, "multipath_component_detection", devices_CFG_SECTION, 0, CFG_TYPE_BOOL, DEFAULT_MULTIPATH_COMPONENT_DETECTION, vsn(2, 2, 89), NULL, 0, NULL,
 	"Ignore devices that are components of DM multipath devices.\n")
 
@@ -1193,6 +1212,12 @@ cfg(activation_retry_deactivation_CFG, "retry_deactivation", activation_CFG_SECT
 	"failing. This may happen because a process run from a quick udev rule\n"
 	"temporarily opened the device.\n")
 
+cfg(activation_activation_threads_CFG, "activation_threads", activation_CFG_SECTION, CFG_DEFAULT_COMMENTED, CFG_TYPE_INT, DEFAULT_ACTIVATION_THREADS, vsn(2, 3, 2), NULL, 0, NULL,
+	"Number of threads used to load and resume the devices of an LV.\n"
+	"Devices at the same level of the dependency tree, such as the\n"
+	"images of a raid LV, are created, loaded, resumed and suspended\n"
+	"in parallel.  Values of 0 or 1 process one device at a time.\n")
+
 cfg(activation_missing_stripe_filler_CFG, "missing_stripe_filler", activation_CFG_SECTION, CFG_ADVANCED, CFG_TYPE_STRING, DEFAULT_STRIPE_FILLER, vsn(1, 0, 0), NULL, 0, NULL,
 	"Method to fill missing stripes when activating an incomplete LV.\n"
 	"Using 'error' will make inaccessible parts of the device return I/O\n"
@@ -17,6 +17,7 @@
 #include "lib/device/bcache.h"
 
 #include "base/data-struct/radix-tree.h"
+#include "base/memory/zalloc.h"
 #include "lib/log/lvm-logging.h"
 #include "lib/log/log.h"
 
@@ -31,8 +32,15 @@
 #include <libaio.h>
 #include <unistd.h>
 #include <linux/fs.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/user.h>
 
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
 #define SECTOR_SHIFT 9L
 
 //----------------------------------------------------------------
@@ -157,9 +165,89 @@ static void _async_destroy(struct io_engine *ioe)
 	free(e);
 }
 
-static int _last_byte_fd;
-static uint64_t _last_byte_offset;
-static int _last_byte_sector_size;
+/*
+ * Several limits can be set at once, eg, when the metadata areas at the
+ * start and end of a device are written in the same batch.  A write is
+ * clamped by the nearest limit for its fd that lies beyond its offset.
+ */
+struct last_byte {
+	int fd;
+	int sector_size;
+	uint64_t offset;
+};
+
+static struct last_byte *_last_bytes;
+static unsigned _nr_last_bytes;
+static unsigned _max_last_bytes;
+
+static struct last_byte *_find_last_byte(int fd, sector_t offset, bool *have_fd)
+{
+	struct last_byte *lb, *r = NULL;
+	unsigned i;
+
+	*have_fd = false;
+
+	for (i = 0; i < _nr_last_bytes; i++) {
+		lb = _last_bytes + i;
+
+		if (lb->fd != fd)
+			continue;
+
+		*have_fd = true;
+
+		if ((lb->offset >= offset) && (!r || (lb->offset < r->offset)))
+			r = lb;
+	}
+
+	return r;
+}
+
+/*
+ * If bcache block goes past where lvm wants to write, then clamp it.
+ */
+static bool _clamp_last_byte(enum dir d, int fd, sector_t offset, sector_t *nbytes)
+{
+	struct last_byte *lb;
+	sector_t limit_nbytes;
+	sector_t extra_nbytes = 0;
+	bool have_fd;
+
+	if ((d != DIR_WRITE) || !_nr_last_bytes)
+		return true;
+
+	if (!(lb = _find_last_byte(fd, offset, &have_fd))) {
+		if (!have_fd)
+			return true;
+
+		log_error("Limit write at %llu len %llu beyond last byte",
+			  (unsigned long long)offset,
+			  (unsigned long long)*nbytes);
+		return false;
+	}
+
+	if (offset + *nbytes > lb->offset) {
+		limit_nbytes = lb->offset - offset;
+		if (limit_nbytes % lb->sector_size)
+			extra_nbytes = lb->sector_size - (limit_nbytes % lb->sector_size);
+
+		if (extra_nbytes) {
+			log_debug("Limit write at %llu len %llu to len %llu rounded to %llu",
+				  (unsigned long long)offset,
+				  (unsigned long long)*nbytes,
+				  (unsigned long long)limit_nbytes,
+				  (unsigned long long)(limit_nbytes + extra_nbytes));
+			*nbytes = limit_nbytes + extra_nbytes;
+		} else {
+			log_debug("Limit write at %llu len %llu to len %llu",
+				  (unsigned long long)offset,
+				  (unsigned long long)*nbytes,
+				  (unsigned long long)limit_nbytes);
+			*nbytes = limit_nbytes;
+		}
+	}
+
+	return true;
+}
 
 static bool _async_issue(struct io_engine *ioe, enum dir d, int fd,
 			 sector_t sb, sector_t se, void *data, void *context)
@@ -170,8 +258,6 @@ static bool _async_issue(struct io_engine *ioe, enum dir d, int fd,
 	struct async_engine *e = _to_async(ioe);
 	sector_t offset;
 	sector_t nbytes;
-	sector_t limit_nbytes;
-	sector_t extra_nbytes = 0;
 
 	if (((uintptr_t) data) & e->page_mask) {
 		log_warn("misaligned data buffer");
@@ -181,39 +267,8 @@ static bool _async_issue(struct io_engine *ioe, enum dir d, int fd,
 	offset = sb << SECTOR_SHIFT;
 	nbytes = (se - sb) << SECTOR_SHIFT;
 
-	/*
-	 * If bcache block goes past where lvm wants to write, then clamp it.
-	 */
-	if ((d == DIR_WRITE) && _last_byte_offset && (fd == _last_byte_fd)) {
-		if (offset > _last_byte_offset) {
-			log_error("Limit write at %llu len %llu beyond last byte %llu",
-				  (unsigned long long)offset,
-				  (unsigned long long)nbytes,
-				  (unsigned long long)_last_byte_offset);
-			return false;
-		}
-
-		if (offset + nbytes > _last_byte_offset) {
-			limit_nbytes = _last_byte_offset - offset;
-			if (limit_nbytes % _last_byte_sector_size)
-				extra_nbytes = _last_byte_sector_size - (limit_nbytes % _last_byte_sector_size);
-
-			if (extra_nbytes) {
-				log_debug("Limit write at %llu len %llu to len %llu rounded to %llu",
-					  (unsigned long long)offset,
-					  (unsigned long long)nbytes,
-					  (unsigned long long)limit_nbytes,
-					  (unsigned long long)(limit_nbytes + extra_nbytes));
-				nbytes = limit_nbytes + extra_nbytes;
-			} else {
-				log_debug("Limit write at %llu len %llu to len %llu",
-					  (unsigned long long)offset,
-					  (unsigned long long)nbytes,
-					  (unsigned long long)limit_nbytes);
-				nbytes = limit_nbytes;
-			}
-		}
-	}
+	if (!_clamp_last_byte(d, fd, offset, &nbytes))
+		return false;
 
 	cb = _cb_alloc(e->cbs, context);
 	if (!cb) {
@@ -325,6 +380,7 @@ struct io_engine *create_async_io_engine(void)
 	e->e.issue = _async_issue;
 	e->e.wait = _async_wait;
 	e->e.max_io = _async_max_io;
+	e->e.register_buffers = NULL;
 
 	e->aio_context = 0;
 	r = io_setup(MAX_IO, &e->aio_context);
@@ -348,6 +404,385 @@ struct io_engine *create_async_io_engine(void)
 
 //----------------------------------------------------------------
 
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+
+/*
+ * io_uring engine.  Requests are queued in the submission ring by issue()
+ * and handed to the kernel in a single io_uring_enter() call, together with
+ * reaping completions, when the caller waits.  If the bcache block pool can
+ * be registered with the ring the fixed buffer read/write opcodes are used,
+ * which avoids pinning and unpinning the pages on every io.
+ */
+
+struct uring_cb {
+	struct dm_list list;
+	void *context;
+	struct iovec iov;
+	uint64_t nbytes;
+};
+
+struct uring_engine {
+	struct io_engine e;
+	int ring_fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_entries;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	unsigned nr_queued;	/* in the submission ring, not yet entered */
+	unsigned nr_in_flight;	/* submitted, not yet completed */
+
+	struct dm_list free;
+	struct uring_cb *cbs;
+
+	uint8_t *fixed_data;
+	size_t fixed_len;
+
+	unsigned page_mask;
+};
+
+static int _io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int _io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int _io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static struct uring_engine *_to_uring(struct io_engine *e)
+{
+	return container_of(e, struct uring_engine, e);
+}
+
+static void _uring_unmap(struct uring_engine *e)
+{
+	if (e->sqes)
+		munmap(e->sqes, e->sqes_size);
+	if (e->cq_ring && (e->cq_ring != e->sq_ring))
+		munmap(e->cq_ring, e->cq_ring_size);
+	if (e->sq_ring)
+		munmap(e->sq_ring, e->sq_ring_size);
+}
+
+static void _uring_destroy(struct io_engine *ioe)
+{
+	struct uring_engine *e = _to_uring(ioe);
+
+	if (e->nr_queued || e->nr_in_flight)
+		log_error("io_uring io still in flight");
+
+	_uring_unmap(e);
+
+	if (close(e->ring_fd))
+		log_sys_warn("close");
+
+	free(e->cbs);
+	free(e);
+}
+
+/*
+ * Hand everything queued in the submission ring to the kernel, optionally
+ * waiting for at least min_complete completions.
+ */
+static bool _uring_enter(struct uring_engine *e, unsigned min_complete)
+{
+	int r;
+	unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+
+	do {
+		r = _io_uring_enter(e->ring_fd, e->nr_queued, min_complete, flags);
+	} while ((r < 0) && (errno == EINTR));
+
+	if (r < 0) {
+		/* The kernel is short of resources, reap what we can. */
+		if ((errno == EAGAIN) || (errno == EBUSY))
+			return true;
+		log_sys_warn("io_uring_enter");
+		return false;
+	}
+
+	e->nr_queued -= r;
+	e->nr_in_flight += r;
+
+	return true;
+}
+
+static bool _uring_issue(struct io_engine *ioe, enum dir d, int fd,
+			 sector_t sb, sector_t se, void *data, void *context)
+{
+	struct uring_engine *e = _to_uring(ioe);
+	struct io_uring_sqe *sqe;
+	struct uring_cb *cb;
+	sector_t offset;
+	sector_t nbytes;
+	unsigned tail, idx;
+
+	if (((uintptr_t) data) & e->page_mask) {
+		log_warn("misaligned data buffer");
+		return false;
+	}
+
+	offset = sb << SECTOR_SHIFT;
+	nbytes = (se - sb) << SECTOR_SHIFT;
+
+	if (!_clamp_last_byte(d, fd, offset, &nbytes))
+		return false;
+
+	if (dm_list_empty(&e->free)) {
+		log_warn("couldn't allocate control block");
+		return false;
+	}
+
+	/* Submission ring full, push the batch to the kernel first. */
+	tail = *e->sq_tail;
+	if (tail - __atomic_load_n(e->sq_head, __ATOMIC_ACQUIRE) >= *e->sq_entries) {
+		if (!_uring_enter(e, 0))
+			return false;
+		if (tail - __atomic_load_n(e->sq_head, __ATOMIC_ACQUIRE) >= *e->sq_entries) {
+			log_warn("io_uring submission ring full");
+			return false;
+		}
+	}
+
+	cb = dm_list_item(_list_pop(&e->free), struct uring_cb);
+	cb->context = context;
+	cb->nbytes = nbytes;
+
+	idx = tail & *e->sq_mask;
+	sqe = e->sqes + idx;
+	memset(sqe, 0, sizeof(*sqe));
+
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->user_data = (uint64_t) (uintptr_t) cb;
+
+	if (e->fixed_data &&
+	    ((uint8_t *) data >= e->fixed_data) &&
+	    ((uint8_t *) data + nbytes <= e->fixed_data + e->fixed_len)) {
+		sqe->opcode = (d == DIR_READ) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+		sqe->addr = (uint64_t) (uintptr_t) data;
+		sqe->len = nbytes;
+		sqe->buf_index = 0;
+	} else {
+		cb->iov.iov_base = data;
+		cb->iov.iov_len = nbytes;
+		sqe->opcode = (d == DIR_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+		sqe->addr = (uint64_t) (uintptr_t) &cb->iov;
+		sqe->len = 1;
+	}
+
+	e->sq_array[idx] = idx;
+	__atomic_store_n(e->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	e->nr_queued++;
+
+	return true;
+}
+
+static bool _uring_wait(struct io_engine *ioe, io_complete_fn fn)
+{
+	struct uring_engine *e = _to_uring(ioe);
+	struct io_uring_cqe *cqe;
+	struct uring_cb *cb;
+	unsigned head;
+
+	if (!e->nr_queued && !e->nr_in_flight)
+		return true;
+
+	if (!_uring_enter(e, 1))
+		return false;
+
+	head = *e->cq_head;
+	while (head != __atomic_load_n(e->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = e->cqes + (head & *e->cq_mask);
+		cb = (struct uring_cb *) (uintptr_t) cqe->user_data;
+
+		if (cqe->res == cb->nbytes)
+			fn(cb->context, 0);
+
+		else if (cqe->res < 0)
+			fn(cb->context, cqe->res);
+
+		/* minimum acceptable read is 1 sector, as for aio */
+		else if (cqe->res >= (1 << SECTOR_SHIFT))
+			fn(cb->context, 0);
+
+		else
+			fn(cb->context, -ENODATA);
+
+		dm_list_add_h(&e->free, &cb->list);
+		e->nr_in_flight--;
+		head++;
+	}
+
+	__atomic_store_n(e->cq_head, head, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static unsigned _uring_max_io(struct io_engine *e)
+{
+	return MAX_IO;
+}
+
+static bool _uring_register_buffers(struct io_engine *ioe, void *data, size_t len)
+{
+	struct uring_engine *e = _to_uring(ioe);
+	struct iovec iov = { .iov_base = data, .iov_len = len };
+
+	/* Fails if RLIMIT_MEMLOCK is too small, plain reads still work. */
+	if (_io_uring_register(e->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1)) {
+		log_debug("io_uring unable to register %llu byte buffer: %s",
+			  (unsigned long long) len, strerror(errno));
+		return false;
+	}
+
+	e->fixed_data = data;
+	e->fixed_len = len;
+
+	return true;
+}
+
+static bool _uring_map(struct uring_engine *e, struct io_uring_params *p)
+{
+	uint8_t *sq, *cq;
+
+	e->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	e->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	e->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (e->cq_ring_size > e->sq_ring_size)
+			e->sq_ring_size = e->cq_ring_size;
+		e->cq_ring_size = e->sq_ring_size;
+	}
+
+	e->sq_ring = mmap(NULL, e->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, e->ring_fd, IORING_OFF_SQ_RING);
+	if (e->sq_ring == MAP_FAILED) {
+		e->sq_ring = NULL;
+		return false;
+	}
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP)
+		e->cq_ring = e->sq_ring;
+	else {
+		e->cq_ring = mmap(NULL, e->cq_ring_size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, e->ring_fd, IORING_OFF_CQ_RING);
+		if (e->cq_ring == MAP_FAILED) {
+			e->cq_ring = NULL;
+			return false;
+		}
+	}
+
+	e->sqes = mmap(NULL, e->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, e->ring_fd, IORING_OFF_SQES);
+	if (e->sqes == MAP_FAILED) {
+		e->sqes = NULL;
+		return false;
+	}
+
+	sq = e->sq_ring;
+	e->sq_head = (unsigned *) (sq + p->sq_off.head);
+	e->sq_tail = (unsigned *) (sq + p->sq_off.tail);
+	e->sq_mask = (unsigned *) (sq + p->sq_off.ring_mask);
+	e->sq_entries = (unsigned *) (sq + p->sq_off.ring_entries);
+	e->sq_array = (unsigned *) (sq + p->sq_off.array);
+
+	cq = e->cq_ring;
+	e->cq_head = (unsigned *) (cq + p->cq_off.head);
+	e->cq_tail = (unsigned *) (cq + p->cq_off.tail);
+	e->cq_mask = (unsigned *) (cq + p->cq_off.ring_mask);
+	e->cqes = (struct io_uring_cqe *) (cq + p->cq_off.cqes);
+
+	return true;
+}
+
+struct io_engine *create_uring_io_engine(void)
+{
+	unsigned i;
+	struct io_uring_params p;
+	struct uring_engine *e = zalloc(sizeof(*e));
+
+	if (!e)
+		return NULL;
+
+	e->e.destroy = _uring_destroy;
+	e->e.issue = _uring_issue;
+	e->e.wait = _uring_wait;
+	e->e.max_io = _uring_max_io;
+	e->e.register_buffers = _uring_register_buffers;
+
+	memset(&p, 0, sizeof(p));
+	e->ring_fd = _io_uring_setup(MAX_IO, &p);
+	if (e->ring_fd < 0) {
+		log_debug("io_uring_setup failed: %s", strerror(errno));
+		free(e);
+		return NULL;
+	}
+
+	if (!_uring_map(e, &p)) {
+		log_sys_warn("io_uring mmap");
+		goto bad;
+	}
+
+	/*
+	 * The completion ring is at least as large as the submission ring,
+	 * so limiting control blocks to MAX_IO keeps it from overflowing.
+	 */
+	if (!(e->cbs = malloc(MAX_IO * sizeof(*e->cbs)))) {
+		log_warn("couldn't create control block set");
+		goto bad;
+	}
+
+	dm_list_init(&e->free);
+	for (i = 0; i < MAX_IO; i++)
+		dm_list_add(&e->free, &e->cbs[i].list);
+
+	e->page_mask = sysconf(_SC_PAGESIZE) - 1;
+
+	return &e->e;
+
+bad:
+	_uring_unmap(e);
+	(void) close(e->ring_fd);
+	free(e->cbs);
+	free(e);
+	return NULL;
+}
+
+#else
+
+struct io_engine *create_uring_io_engine(void)
+{
+	log_debug("io_uring support not compiled in.");
+	return NULL;
+}
+
+#endif
+
+//----------------------------------------------------------------
+
 struct sync_io {
         struct dm_list list;
 	void *context;
@@ -450,6 +885,7 @@ struct io_engine *create_sync_io_engine(void)
         e->e.issue = _sync_issue;
         e->e.wait = _sync_wait;
         e->e.max_io = _sync_max_io;
+        e->e.register_buffers = NULL;
 
         dm_list_init(&e->complete);
         return &e->e;
@@ -497,16 +933,33 @@ enum block_flags {
 	BF_DIRTY = (1 << 1),
 };
 
+/*
+ * The block data is allocated in chunks.  The first chunk is sized by
+ * bcache_create(), further chunks are added when the cache has to evict to
+ * make room and it's still below max_cache_blocks.  Chunks other than the
+ * first are released again once none of their blocks are in use.
+ */
+struct block_chunk {
+	struct dm_list list;
+	void *data;
+	struct block *blocks;
+	unsigned nr_blocks;
+	unsigned nr_used;
+};
+
 struct bcache {
 	sector_t block_sectors;
 	uint64_t nr_data_blocks;
 	uint64_t nr_cache_blocks;
+	uint64_t max_cache_blocks;
 	unsigned max_io;
+	unsigned engine_max_io;
+	unsigned page_size;
 
 	struct io_engine *engine;
 
-	void *raw_data;
-	struct block *raw_blocks;
+	struct dm_list chunks;
+	unsigned nr_free;
 
 	/*
 	 * Lists that categorise the blocks.
@@ -532,6 +985,9 @@ struct bcache {
 	unsigned write_hits;
 	unsigned write_misses;
 	unsigned prefetches;
+	unsigned evictions;
+	unsigned grows;
+	unsigned shrinks;
 };
 
 //----------------------------------------------------------------
@@ -584,52 +1040,156 @@ static void _block_remove(struct block *b)
 
 //----------------------------------------------------------------
 
-static bool _init_free_list(struct bcache *cache, unsigned count, unsigned pgsize)
+static struct block_chunk *_add_chunk(struct bcache *cache, unsigned count)
 {
 	unsigned i;
 	size_t block_size = cache->block_sectors << SECTOR_SHIFT;
-	unsigned char *data =
-		(unsigned char *) _alloc_aligned(count * block_size, pgsize);
+	struct block_chunk *chunk = malloc(sizeof(*chunk));
+
+	if (!chunk)
+		return NULL;
 
 	/* Allocate the data for each block.  We page align the data. */
-	if (!data)
-		return false;
+	chunk->data = _alloc_aligned(count * block_size, cache->page_size);
+	if (!chunk->data) {
+		free(chunk);
+		return NULL;
+	}
 
-	cache->raw_blocks = malloc(count * sizeof(*cache->raw_blocks));
-	if (!cache->raw_blocks) {
-		free(data);
-		return false;
+	chunk->blocks = malloc(count * sizeof(*chunk->blocks));
+	if (!chunk->blocks) {
+		free(chunk->data);
+		free(chunk);
+		return NULL;
 	}
 
-	cache->raw_data = data;
+	chunk->nr_blocks = count;
+	chunk->nr_used = 0;
 
 	for (i = 0; i < count; i++) {
-		struct block *b = cache->raw_blocks + i;
+		struct block *b = chunk->blocks + i;
 		b->cache = cache;
-		b->data = data + (block_size * i);
+		b->chunk = chunk;
+		b->data = (unsigned char *) chunk->data + (block_size * i);
 		dm_list_add(&cache->free, &b->list);
 	}
 
-	return true;
+	dm_list_add(&cache->chunks, &chunk->list);
+	cache->nr_free += count;
+	cache->nr_cache_blocks += count;
+	cache->max_io = cache->nr_cache_blocks < cache->engine_max_io ?
+			cache->nr_cache_blocks : cache->engine_max_io;
+
+	return chunk;
+}
+
+static void _del_chunk(struct bcache *cache, struct block_chunk *chunk)
+{
+	unsigned i;
+
+	/* All blocks are on the free list. */
+	for (i = 0; i < chunk->nr_blocks; i++)
+		dm_list_del(&chunk->blocks[i].list);
+
+	cache->nr_free -= chunk->nr_blocks;
+	cache->nr_cache_blocks -= chunk->nr_blocks;
+	cache->max_io = cache->nr_cache_blocks < cache->engine_max_io ?
+			cache->nr_cache_blocks : cache->engine_max_io;
+
+	dm_list_del(&chunk->list);
+	free(chunk->data);
+	free(chunk->blocks);
+	free(chunk);
+}
+
+static bool _init_free_list(struct bcache *cache, unsigned count)
+{
+	return _add_chunk(cache, count) ? true : false;
 }
 
 static void _exit_free_list(struct bcache *cache)
 {
-	free(cache->raw_data);
-	free(cache->raw_blocks);
+	struct block_chunk *chunk, *tmp;
+
+	dm_list_iterate_items_safe(chunk, tmp, &cache->chunks) {
+		free(chunk->data);
+		free(chunk->blocks);
+		free(chunk);
+	}
+}
+
+static struct block_chunk *_first_chunk(struct bcache *cache)
+{
+	return dm_list_item(dm_list_first(&cache->chunks), struct block_chunk);
+}
+
+/*
+ * Called when there are no free blocks.  Rather than evict, double the
+ * cache, up to max_cache_blocks.
+ */
+static bool _grow(struct bcache *cache)
+{
+	uint64_t count = cache->nr_cache_blocks;
+
+	if (cache->nr_cache_blocks >= cache->max_cache_blocks)
+		return false;
+
+	if (count > cache->max_cache_blocks - cache->nr_cache_blocks)
+		count = cache->max_cache_blocks - cache->nr_cache_blocks;
+
+	if (!_add_chunk(cache, count)) {
+		/* Not fatal, we just evict as if we were at the limit. */
+		log_debug("bcache unable to grow by %u blocks", (unsigned) count);
+		cache->max_cache_blocks = cache->nr_cache_blocks;
+		return false;
+	}
+
+	cache->grows++;
+
+	return true;
+}
+
+/*
+ * Release grown chunks that are no longer in use, provided the cache would
+ * still have as many free blocks as it gives back.  This stops a cache that
+ * has just grown from immediately shrinking again.
+ */
+static void _shrink(struct bcache *cache)
+{
+	struct block_chunk *chunk, *tmp;
+	struct block_chunk *first = _first_chunk(cache);
+
+	dm_list_iterate_items_safe(chunk, tmp, &cache->chunks) {
+		if (chunk == first)
+			continue;
+
+		if (chunk->nr_used || (cache->nr_free < 2 * chunk->nr_blocks))
+			continue;
+
+		_del_chunk(cache, chunk);
+		cache->shrinks++;
+	}
 }
 
 static struct block *_alloc_block(struct bcache *cache)
 {
+	struct block *b;
+
 	if (dm_list_empty(&cache->free))
 		return NULL;
 
-	return dm_list_struct_base(_list_pop(&cache->free), struct block, list);
+	b = dm_list_struct_base(_list_pop(&cache->free), struct block, list);
+	b->chunk->nr_used++;
+	cache->nr_free--;
+
+	return b;
 }
 
 static void _free_block(struct block *b)
 {
 	dm_list_add(&b->cache->free, &b->list);
+	b->chunk->nr_used--;
+	b->cache->nr_free++;
 }
 
 /*----------------------------------------------------------------
@@ -787,6 +1347,7 @@ static struct block *_find_unused_clean_block(struct bcache *cache)
 		if (!b->ref_count) {
 			_unlink_block(b);
 			_block_remove(b);
+			cache->evictions++;
 			return b;
 		}
 	}
@@ -799,6 +1360,9 @@ static struct block *_new_block(struct bcache *cache, int fd, block_address i, b
 	struct block *b;
 
 	b = _alloc_block(cache);
+	if (!b && _grow(cache))
+		b = _alloc_block(cache);
+
 	while (!b && !dm_list_empty(&cache->clean)) {
 		b = _find_unused_clean_block(cache);
 		if (!b) {
@@ -962,13 +1526,18 @@ struct bcache *bcache_create(sector_t block_sectors, unsigned nr_cache_blocks,
 		return NULL;
 
 	cache->block_sectors = block_sectors;
-	cache->nr_cache_blocks = nr_cache_blocks;
-	cache->max_io = nr_cache_blocks < max_io ? nr_cache_blocks : max_io;
+	cache->nr_cache_blocks = 0;
+	cache->max_cache_blocks = nr_cache_blocks;
+	cache->max_io = 0;
+	cache->engine_max_io = max_io;
+	cache->page_size = pgsize;
 	cache->engine = engine;
 	cache->nr_locked = 0;
 	cache->nr_dirty = 0;
 	cache->nr_io_pending = 0;
 
+	dm_list_init(&cache->chunks);
+	cache->nr_free = 0;
 	dm_list_init(&cache->free);
 	dm_list_init(&cache->errored);
 	dm_list_init(&cache->dirty);
@@ -988,14 +1557,21 @@ struct bcache *bcache_create(sector_t block_sectors, unsigned nr_cache_blocks,
 	cache->write_hits = 0;
 	cache->write_misses = 0;
 	cache->prefetches = 0;
+	cache->evictions = 0;
+	cache->grows = 0;
+	cache->shrinks = 0;
 
-	if (!_init_free_list(cache, nr_cache_blocks, pgsize)) {
+	if (!_init_free_list(cache, nr_cache_blocks)) {
 		cache->engine->destroy(cache->engine);
 		radix_tree_destroy(cache->rtree);
 		free(cache);
 		return NULL;
 	}
 
+	if (engine->register_buffers)
+		(void) engine->register_buffers(engine, _first_chunk(cache)->data,
+						nr_cache_blocks * (block_sectors << SECTOR_SHIFT));
+
 	return cache;
 }
 
@@ -1006,9 +1582,10 @@ void bcache_destroy(struct bcache *cache)
 
 	bcache_flush(cache);
 	_wait_all(cache);
+	/* Engine first, it may still have the block data registered. */
+	cache->engine->destroy(cache->engine);
 	_exit_free_list(cache);
 	radix_tree_destroy(cache->rtree);
-	cache->engine->destroy(cache->engine);
 	free(cache);
 }
 
@@ -1022,6 +1599,31 @@ unsigned bcache_nr_cache_blocks(struct bcache *cache)
 	return cache->nr_cache_blocks;
 }
 
+void bcache_set_max_cache_blocks(struct bcache *cache, unsigned nr_cache_blocks)
+{
+	if (nr_cache_blocks < _first_chunk(cache)->nr_blocks)
+		nr_cache_blocks = _first_chunk(cache)->nr_blocks;
+
+	cache->max_cache_blocks = nr_cache_blocks;
+}
+
+void bcache_get_stats(struct bcache *cache, struct bcache_stats *stats)
+{
+	stats->nr_cache_blocks = cache->nr_cache_blocks;
+	stats->max_cache_blocks = cache->max_cache_blocks;
+	stats->nr_free = cache->nr_free;
+	stats->nr_dirty = cache->nr_dirty;
+	stats->read_hits = cache->read_hits;
+	stats->read_misses = cache->read_misses;
+	stats->write_zeroes = cache->write_zeroes;
+	stats->write_hits = cache->write_hits;
+	stats->write_misses = cache->write_misses;
+	stats->prefetches = cache->prefetches;
+	stats->evictions = cache->evictions;
+	stats->grows = cache->grows;
+	stats->shrinks = cache->shrinks;
+}
+
 unsigned bcache_max_prefetches(struct bcache *cache)
 {
 	return cache->max_io;
@@ -1042,6 +1644,21 @@ void bcache_prefetch(struct bcache *cache, int fd, block_address i)
 	}
 }
 
+bool bcache_io_pending(struct bcache *cache, int fd, block_address i)
+{
+	struct block *b = _block_lookup(cache, fd, i);
+
+	return b && _test_flags(b, BF_IO_PENDING);
+}
+
+bool bcache_wait_any(struct bcache *cache)
+{
+	if (dm_list_empty(&cache->io_pending))
+		return false;
+
+	return _wait_io(cache);
+}
+
 //----------------------------------------------------------------
 
 static void _recycle_block(struct bcache *cache, struct block *b)
@@ -1114,7 +1731,20 @@ bool bcache_flush(struct bcache *cache)
 	dm_list_splice(&cache->dirty, &cache->errored);
 
 	while (!dm_list_empty(&cache->dirty)) {
-		struct block *b = dm_list_item(_list_pop(&cache->dirty), struct block);
+		struct block *b;
+
+		// A grown cache can hold more dirty blocks than the engine
+		// takes at once.
+		if (cache->nr_io_pending >= cache->max_io) {
+			if (!_wait_io(cache)) {
+				// Nothing completes, keep the rest for a later flush.
+				dm_list_splice(&cache->errored, &cache->dirty);
+				return false;
+			}
+			continue;
+		}
+
+		b = dm_list_item(_list_pop(&cache->dirty), struct block);
 		if (b->ref_count || _test_flags(b, BF_IO_PENDING)) {
 			// The superblock may well be still locked.
 			continue;
@@ -1226,6 +1856,9 @@ bool bcache_invalidate_fd(struct bcache *cache, int fd)
 	it.it.visit = _invalidate_v;
 	radix_tree_iterate(cache->rtree, k.bytes, k.bytes + sizeof(k.parts.fd), &it.it);
 	radix_tree_remove_prefix(cache->rtree, k.bytes, k.bytes + sizeof(k.parts.fd));
+
+	_shrink(cache);
+
 	return it.success;
 }
 
@@ -1233,19 +1866,52 @@ bool bcache_invalidate_fd(struct bcache *cache, int fd)
 
 void bcache_set_last_byte(struct bcache *cache, int fd, uint64_t offset, int sector_size)
 {
-	_last_byte_fd = fd;
-	_last_byte_offset = offset;
-	_last_byte_sector_size = sector_size;
+	struct last_byte *lb;
+	unsigned i;
+
 	if (!sector_size)
-		_last_byte_sector_size = 512;
+		sector_size = 512;
+
+	for (i = 0; i < _nr_last_bytes; i++) {
+		lb = _last_bytes + i;
+		if ((lb->fd == fd) && (lb->offset == offset)) {
+			lb->sector_size = sector_size;
+			return;
+		}
+	}
+
+	if (_nr_last_bytes == _max_last_bytes) {
+		unsigned max = _max_last_bytes ? _max_last_bytes * 2 : 8;
+
+		if (!(lb = realloc(_last_bytes, sizeof(*lb) * max))) {
+			log_error("Failed to allocate last byte limit.");
+			return;
+		}
+		_last_bytes = lb;
+		_max_last_bytes = max;
+	}
+
+	lb = _last_bytes + _nr_last_bytes++;
+	lb->fd = fd;
+	lb->offset = offset;
+	lb->sector_size = sector_size;
 }
 
 void bcache_unset_last_byte(struct bcache *cache, int fd)
 {
-	if (_last_byte_fd == fd) {
-		_last_byte_fd = 0;
-		_last_byte_offset = 0;
-		_last_byte_sector_size = 0;
+	unsigned i = 0;
+
+	while (i < _nr_last_bytes) {
+		if (_last_bytes[i].fd == fd)
+			_last_bytes[i] = _last_bytes[--_nr_last_bytes];
+		else
+			i++;
+	}
+
+	if (!_nr_last_bytes) {
+		free(_last_bytes);
+		_last_bytes = NULL;
+		_max_last_bytes = 0;
 	}
 }
 
@@ -46,14 +46,27 @@ struct io_engine {
 		      sector_t sb, sector_t se, void *data, void *context);
 	bool (*wait)(struct io_engine *e, io_complete_fn fn);
 	unsigned (*max_io)(struct io_engine *e);
+
+	/*
+	 * Optional, may be NULL.  bcache passes in its block data so the
+	 * engine can pre-register it with the kernel.  Failure is not fatal.
+	 */
+	bool (*register_buffers)(struct io_engine *e, void *data, size_t len);
 };
 
 struct io_engine *create_async_io_engine(void);
 struct io_engine *create_sync_io_engine(void);
 
+/*
+ * Returns NULL if io_uring is not supported by the kernel or was not
+ * available at build time, callers should fall back to the async engine.
+ */
+struct io_engine *create_uring_io_engine(void);
+
 /*----------------------------------------------------------------*/
 
 struct bcache;
+struct block_chunk;
 struct block {
 	/* clients may only access these three fields */
 	int fd;
@@ -61,6 +74,7 @@ struct block {
 	void *data;
 
 	struct bcache *cache;
+	struct block_chunk *chunk;
 	struct dm_list list;
 
 	unsigned flags;
@@ -95,6 +109,33 @@ sector_t bcache_block_sectors(struct bcache *cache);
 unsigned bcache_nr_cache_blocks(struct bcache *cache);
 unsigned bcache_max_prefetches(struct bcache *cache);
 
+/*
+ * By default the cache stays at the nr_cache_blocks it was created with.
+ * Raising the maximum lets it grow, rather than evict, when it runs out of
+ * free blocks.  Blocks added this way are released again once they are no
+ * longer in use, eg, after bcache_invalidate_fd().
+ */
+void bcache_set_max_cache_blocks(struct bcache *cache, unsigned nr_cache_blocks);
+
+struct bcache_stats {
+	unsigned nr_cache_blocks;
+	unsigned max_cache_blocks;
+	unsigned nr_free;
+	unsigned nr_dirty;
+
+	unsigned read_hits;
+	unsigned read_misses;
+	unsigned write_zeroes;
+	unsigned write_hits;
+	unsigned write_misses;
+	unsigned prefetches;
+	unsigned evictions;
+	unsigned grows;
+	unsigned shrinks;
+};
+
+void bcache_get_stats(struct bcache *cache, struct bcache_stats *stats);
+
 /*
  * Use the prefetch method to take advantage of asynchronous IO.  For example,
  * if you wanted to read a block from many devices concurrently you'd do
@@ -113,9 +154,24 @@ unsigned bcache_max_prefetches(struct bcache *cache);
  * It's slightly sub optimal, since you may not run the gets in the order that
  * they complete.  But we're talking a very small difference, and it's worth it
  * to keep callbacks out of this interface.
+ *
+ * If the difference does matter, eg, some devices are much slower than
+ * others, poll with bcache_io_pending() and only get the blocks that have
+ * arrived, calling bcache_wait_any() when none have.
  */
 void bcache_prefetch(struct bcache *cache, int fd, block_address index);
 
+/*
+ * Returns true if the block has io in flight.
+ */
+bool bcache_io_pending(struct bcache *cache, int fd, block_address index);
+
+/*
+ * Waits for at least one in flight io to complete.  Returns false if there
+ * was no io in flight, or the wait failed.
+ */
+bool bcache_wait_any(struct bcache *cache);
+
 /*
  * Returns true on success.
  */
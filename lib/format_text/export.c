@@ -23,6 +23,7 @@
 #include "lib/format_text/text_export.h"
 #include "lvm-version.h"
 #include "lib/commands/toolcontext.h"
+#include "lib/cache/lvmcache.h"
 #include "libdaemon/client/config-util.h"
 
 #include <stdarg.h>
@@ -1051,7 +1052,27 @@ int text_vg_export_file(struct volume_group *vg, const char *desc, FILE *fp)
 	return r;
 }
 
-/* Returns amount of buffer used incl. terminating NUL */
+/*
+ * Initial size of a VG's export buffer: large enough for the metadata
+ * text found by the label scan, with room to grow, so the buffer does
+ * not need doubling up from a small size on the first export.
+ */
+static uint32_t _export_buf_size(struct volume_group *vg)
+{
+	size_t hint = lvmcache_vg_mda_size((const char *) &vg->id);
+	uint32_t size = 65536;	/* Initial metadata limit */
+
+	hint += hint / 8;
+	while (size < hint && size < UINT32_MAX / 2)
+		size *= 2;
+
+	return size;
+}
+
+/*
+ * Exports into vg->export_buf, which stays owned by the VG and is reused
+ * by the next export.  Returns amount of buffer used incl. terminating NUL.
+ */
 size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf)
 {
 	struct formatter *f;
@@ -1059,29 +1080,37 @@ size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf)
 
 	_init();
 
+	if (!vg->export_buf) {
+		vg->export_buf_size = _export_buf_size(vg);
+		if (!(vg->export_buf = malloc(vg->export_buf_size))) {
+			log_error("text_export buffer allocation failed");
+			vg->export_buf_size = 0;
+			return 0;
+		}
+	}
+
 	if (!(f = zalloc(sizeof(*f))))
 		return_0;
 
-	f->data.buf.size = 65536;	/* Initial metadata limit */
-	if (!(f->data.buf.start = malloc(f->data.buf.size))) {
-		log_error("text_export buffer allocation failed");
-		goto out;
-	}
+	f->data.buf.start = vg->export_buf;
+	f->data.buf.size = vg->export_buf_size;
 
 	f->indent = 0;
 	f->header = 0;
 	f->out_with_comment = &_out_with_comment_raw;
 	f->nl = &_nl_raw;
 
-	if (!_text_vg_export(f, vg, desc)) {
-		free(f->data.buf.start);
+	if (!_text_vg_export(f, vg, desc))
 		goto_out;
-	}
 
 	r = f->data.buf.used + 1;
 	*buf = f->data.buf.start;
 
       out:
+	/* The buffer may have been extended. */
+	vg->export_buf = f->data.buf.start;
+	vg->export_buf_size = f->data.buf.size;
+
 	free(f);
 	return r;
 }
@@ -1096,18 +1125,19 @@ struct dm_config_tree *export_vg_to_config_tree(struct volume_group *vg)
 	char *buf = NULL;
 	struct dm_config_tree *vg_cft;
 
-	if (!export_vg_to_buffer(vg, &buf)) {
+	/* Within vg_write, reuse the text just written to the metadata areas. */
+	if (vg->export_used)
+		buf = vg->export_buf;
+	else if (!export_vg_to_buffer(vg, &buf)) {
 		log_error("Could not format metadata for VG %s.", vg->name);
 		return_NULL;
 	}
 
 	if (!(vg_cft = config_tree_from_string_without_dup_node_check(buf))) {
 		log_error("Error parsing metadata for VG %s.", vg->name);
-		free(buf);
 		return_NULL;
 	}
 
-	free(buf);
 	return vg_cft;
 }
 
@@ -37,11 +37,6 @@
 static struct format_instance *_text_create_text_instance(const struct format_type *fmt,
 							  const struct format_instance_ctx *fic);
 
-struct text_fid_context {
-	char *raw_metadata_buf;
-	uint32_t raw_metadata_buf_size;
-};
-
 int rlocn_is_ignored(const struct raw_locn *rlocn)
 {
 	return (rlocn->flags & RAW_LOCN_IGNORED ? 1 : 0);
@@ -678,7 +673,6 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 			 struct metadata_area *mda)
 {
 	struct mda_context *mdac = (struct mda_context *) mda->metadata_locn;
-	struct text_fid_context *fidtc = (struct text_fid_context *) fid->private;
 	struct raw_locn *rlocn_old;
 	struct raw_locn *rlocn_new;
 	struct mda_header *mdah;
@@ -708,16 +702,15 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 	 * Create a text metadata representation of struct vg in buffer.
 	 * This buffer is written to disk below.  This function is called
 	 * to write metadata to each device/mda in the VG.  The first time
-	 * the metadata text is saved in raw_metadata_buf and subsequent
-	 * mdas use that.
+	 * the metadata text is kept in vg->export_buf with its checksum and
+	 * subsequent mdas use that.  vg_write resets export_used.
 	 */
-	if (fidtc->raw_metadata_buf) {
-		new_buf = fidtc->raw_metadata_buf;
-		new_size = fidtc->raw_metadata_buf_size;
-	} else {
-		new_size = text_vg_export_raw(vg, "", &new_buf);
-		fidtc->raw_metadata_buf = new_buf;
-		fidtc->raw_metadata_buf_size = new_size;
+	if (vg->export_used) {
+		new_buf = vg->export_buf;
+		new_size = vg->export_used;
+	} else if ((new_size = text_vg_export_raw(vg, "", &new_buf))) {
+		vg->export_used = new_size;
+		vg->export_crc = calc_crc(INITIAL_CRC, (uint8_t *)new_buf, (uint32_t)new_size);
 	}
 
 	if (!new_size || !new_buf) {
@@ -928,22 +921,14 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 
 	dev_unset_last_byte(mdac->area.dev);
 
-	rlocn_new->checksum = calc_crc(INITIAL_CRC,
-				       (uint8_t *)new_buf,
-				       (uint32_t)(rlocn_new->size - new_wrap));
-	if (new_wrap)
-		rlocn_new->checksum = calc_crc(rlocn_new->checksum,
-					(uint8_t *)new_buf + rlocn_new->size - new_wrap,
-					(uint32_t)new_wrap);
+	/* The checksum of the wrapped text is the same as of the whole. */
+	rlocn_new->checksum = vg->export_crc;
 
 	r = 1;
 
       out:
-	if (!r) {
-		free(fidtc->raw_metadata_buf);
-		fidtc->raw_metadata_buf = NULL;
-		fidtc->raw_metadata_buf_size = 0;
-	}
+	if (!r)
+		vg->export_used = 0;
 
 	return r;
 }
@@ -966,7 +951,6 @@ static int _vg_commit_raw_rlocn(struct format_instance *fid,
 				int precommit)
 {
 	struct mda_context *mdac = (struct mda_context *) mda->metadata_locn;
-	struct text_fid_context *fidtc = (struct text_fid_context *) fid->private;
 	struct mda_header *mdab;
 	struct raw_locn *rlocn_slot0;
 	struct raw_locn *rlocn_slot1;
@@ -1127,11 +1111,6 @@ static int _vg_commit_raw_rlocn(struct format_instance *fid,
 	r = 1;
 
       out:
-	if (!precommit) {
-		free(fidtc->raw_metadata_buf);
-		fidtc->raw_metadata_buf = NULL;
-	}
-
 	return r;
 }
 
@@ -1442,6 +1421,21 @@ static int _vg_remove_file(struct format_instance *fid __attribute__((unused)),
 	return 1;
 }
 
+uint64_t mda_header_free_sectors(const struct mda_header *mdah)
+{
+	/*
+	 * Report remaining space given that a single copy of metadata
+	 * can be as large as half the total metadata space, minus 512
+	 * because each copy is rounded to begin on a sector boundary.
+	 */
+	uint64_t max_size = ((mdah->size - MDA_HEADER_SIZE) / 2) - 512;
+
+	if (mdah->raw_locns[0].size >= max_size)
+		return UINT64_C(0);
+
+	return (max_size - mdah->raw_locns[0].size) >> SECTOR_SHIFT;
+}
+
 int read_metadata_location_summary(const struct format_type *fmt,
 		    struct mda_header *mdah, int primary_mda, struct device_area *dev_area,
 		    struct lvmcache_vgsummary *vgsummary, uint64_t *mda_free_sectors)
@@ -1576,19 +1570,8 @@ int read_metadata_location_summary(const struct format_type *fmt,
 			   (unsigned long long)rlocn->size,
 			   vgsummary->vgname);
 
-	if (mda_free_sectors) {
-		/*
-		 * Report remaining space given that a single copy of metadata
-		 * can be as large as half the total metadata space, minus 512
-		 * because each copy is rounded to begin on a sector boundary.
-		 */
-		max_size = ((mdah->size - MDA_HEADER_SIZE) / 2) - 512;
-
-		if (rlocn->size >= max_size)
-			*mda_free_sectors = UINT64_C(0);
-		else
-			*mda_free_sectors = (max_size - rlocn->size) >> SECTOR_SHIFT;
-	}
+	if (mda_free_sectors)
+		*mda_free_sectors = mda_header_free_sectors(mdah);
 
 	return 1;
 }
@@ -2077,19 +2060,10 @@ static int _create_vg_text_instance(struct format_instance *fid,
                                     const struct format_instance_ctx *fic)
 {
 	uint32_t type = fic->type;
-	struct text_fid_context *fidtc;
 	struct metadata_area *mda;
 	struct lvmcache_vginfo *vginfo;
 	const char *vg_name, *vg_id;
 
-	if (!(fidtc = (struct text_fid_context *)
-			dm_pool_zalloc(fid->mem, sizeof(*fidtc)))) {
-		log_error("Couldn't allocate text_fid_context.");
-		return 0;
-	}
-
-	fid->private = (void *) fidtc;
-
 	if (type & FMT_INSTANCE_PRIVATE_MDAS) {
 		if (!(mda = dm_pool_zalloc(fid->mem, sizeof(*mda))))
 			return_0;
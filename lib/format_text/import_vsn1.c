@@ -571,12 +571,10 @@ static int _read_lvnames(struct format_instance *fid __attribute__((unused)),
 	if (!(lv = alloc_lv(mem)))
 		return_0;
 
-	if (!link_lv_to_vg(vg, lv))
-		return_0;
-
 	if (!(lv->name = dm_pool_strdup(mem, lvn->key)))
 		return_0;
 
+	lv->vg = vg;
 	log_debug_metadata("Importing logical volume %s.", display_lvname(lv));
 
 	if (!(lvn = lvn->child)) {
@@ -585,6 +583,19 @@ static int _read_lvnames(struct format_instance *fid __attribute__((unused)),
 		return 0;
 	}
 
+	/* FIXME: read full lvid */
+	if (!_read_id(&lv->lvid.id[1], lvn, "id")) {
+		log_error("Couldn't read uuid for logical volume %s.",
+			  display_lvname(lv));
+		return 0;
+	}
+
+	memcpy(&lv->lvid.id[0], &vg->id, sizeof(lv->lvid.id[0]));
+
+	/* Linked with name and lvid set, so the VG indexes them */
+	if (!link_lv_to_vg(vg, lv))
+		return_0;
+
 	if (!_read_flag_config(lvn, &lvstatus, LV_FLAGS)) {
 		log_error("Couldn't read status flags for logical volume %s.",
 			  display_lvname(lv));
@@ -907,15 +918,6 @@ static int _read_lvsegs(struct format_instance *fid,
 		return 0;
 	}
 
-	/* FIXME: read full lvid */
-	if (!_read_id(&lv->lvid.id[1], lvn, "id")) {
-		log_error("Couldn't read uuid for logical volume %s.",
-			  display_lvname(lv));
-		return 0;
-	}
-
-	memcpy(&lv->lvid.id[0], &lv->vg->id, sizeof(lv->lvid.id[0]));
-
 	if (!_read_segments(lv, lvn, pv_hash))
 		return_0;
 
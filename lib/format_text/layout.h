@@ -105,5 +105,6 @@ struct mda_context {
 int read_metadata_location_summary(const struct format_type *fmt, struct mda_header *mdah, int primary_mda, 
 		    struct device_area *dev_area, struct lvmcache_vgsummary *vgsummary,
 		    uint64_t *mda_free_sectors);
+uint64_t mda_header_free_sectors(const struct mda_header *mdah);
 
 #endif
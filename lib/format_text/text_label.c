@@ -18,6 +18,7 @@
 #include "lib/format_text/format-text.h"
 #include "layout.h"
 #include "lib/label/label.h"
+#include "lib/label/scan-cache.h"
 #include "lib/mm/xlate.h"
 #include "lib/cache/lvmcache.h"
 
@@ -322,6 +323,7 @@ static int _text_initialise_label(struct labeller *l __attribute__((unused)),
 struct _update_mda_baton {
 	struct lvmcache_info *info;
 	struct label *label;
+	uint32_t label_crc;
 };
 
 static int _read_mda_header_and_metadata(struct metadata_area *mda, void *baton)
@@ -346,14 +348,19 @@ static int _read_mda_header_and_metadata(struct metadata_area *mda, void *baton)
 		return 1;
 	}
 
-	if (!read_metadata_location_summary(fmt, mdah, mda_is_primary(mda), &mdac->area,
-					    &vgsummary, &mdac->free_sectors)) {
+	if (mdah->raw_locns[0].offset &&
+	    scan_cache_lookup(mdac->area.dev, p->label_crc, mdah, &vgsummary))
+		mdac->free_sectors = mda_header_free_sectors(mdah);
+
+	else if (!read_metadata_location_summary(fmt, mdah, mda_is_primary(mda), &mdac->area,
+						 &vgsummary, &mdac->free_sectors)) {
 		if (vgsummary.zero_offset)
 			return 1;
 
 		log_error("Failed to read metadata summary from %s", dev_name(mdac->area.dev));
 		goto fail;
-	}
+	} else
+		scan_cache_update(mdac->area.dev, p->label_crc, mdah, &vgsummary);
 
 	if (!lvmcache_update_vgname_and_id(p->info, &vgsummary)) {
 		log_error("Failed to save lvm summary for %s", dev_name(mdac->area.dev));
@@ -438,6 +445,7 @@ static int _text_read(struct labeller *l, struct device *dev, void *label_buf,
 out:
 	baton.info = info;
 	baton.label = *label;
+	baton.label_crc = xlate32(lh->crc_xl);
 
 	/*
 	 * In the vg_read phase, we compare all mdas and decide which to use
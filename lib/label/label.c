@@ -18,6 +18,7 @@
 #include "base/memory/zalloc.h"
 #include "lib/misc/lib.h"
 #include "lib/label/label.h"
+#include "lib/label/scan-cache.h"
 #include "lib/misc/crc.h"
 #include "lib/mm/xlate.h"
 #include "lib/cache/lvmcache.h"
@@ -556,6 +557,9 @@ static int _scan_dev_close(struct device *dev)
 		return 0;
 	}
 
+	if (scan_bcache)
+		bcache_unset_last_byte(scan_bcache, dev->bcache_fd);
+
 	if (close(dev->bcache_fd))
 		log_warn("close %s errno %d", dev_name(dev), errno);
 	dev->bcache_fd = -1;
@@ -593,6 +597,57 @@ static void _drop_bad_aliases(struct device *dev)
 	}
 }
 
+/*
+ * Get and process the first block of a device once its read is done.
+ */
+static void _scan_dev_process(struct cmd_context *cmd, struct dev_filter *f,
+			      struct device *dev, int *read_errors,
+			      int *process_errors, int *failed_count)
+{
+	struct block *bb = NULL;
+	int scan_failed = 0;
+	int is_lvm_device = 0;
+	int ret;
+
+	if (!bcache_get(scan_bcache, dev->bcache_fd, 0, 0, &bb)) {
+		log_debug_devs("Scan failed to read %s.", dev_name(dev));
+		scan_failed = 1;
+		(*read_errors)++;
+		(*failed_count)++;
+		lvmcache_del_dev(dev);
+	} else {
+		log_debug_devs("Processing data from device %s %d:%d fd %d block %p",
+			       dev_name(dev),
+			       (int)MAJOR(dev->dev),
+			       (int)MINOR(dev->dev),
+			       dev->bcache_fd, bb);
+
+		ret = _process_block(cmd, f, dev, bb, 0, 0, &is_lvm_device);
+
+		if (!ret && is_lvm_device) {
+			log_debug_devs("Scan failed to process %s", dev_name(dev));
+			scan_failed = 1;
+			(*process_errors)++;
+			(*failed_count)++;
+			lvmcache_del_dev(dev);
+		}
+	}
+
+	if (bb)
+		bcache_put(bb);
+
+	/*
+	 * Keep the bcache block of lvm devices we have processed so
+	 * that the vg_read phase can reuse it.  If bcache failed to
+	 * read the block, or the device does not belong to lvm, then
+	 * drop it from bcache.
+	 */
+	if (scan_failed || !is_lvm_device) {
+		bcache_invalidate_fd(scan_bcache, dev->bcache_fd);
+		_scan_dev_close(dev);
+	}
+}
+
 /*
  * Read or reread label/metadata from selected devs.
  *
@@ -611,17 +666,14 @@ static int _scan_list(struct cmd_context *cmd, struct dev_filter *f,
 	struct dm_list done_devs;
 	struct dm_list reopen_devs;
 	struct device_list *devl, *devl2;
-	struct block *bb;
 	int retried_open = 0;
 	int scan_read_errors = 0;
 	int scan_process_errors = 0;
 	int scan_failed_count = 0;
-	int rem_prefetches;
+	int max_prefetches;
+	int in_flight = 0;
 	int submit_count;
-	int scan_failed;
-	int is_lvm_device;
-	int error;
-	int ret;
+	int done_count;
 
 	dm_list_init(&wait_devs);
 	dm_list_init(&done_devs);
@@ -629,93 +681,67 @@ static int _scan_list(struct cmd_context *cmd, struct dev_filter *f,
 
 	log_debug_devs("Scanning %d devices for VG info", dm_list_size(devs));
 
+	max_prefetches = bcache_max_prefetches(scan_bcache);
+
  scan_more:
-	rem_prefetches = bcache_max_prefetches(scan_bcache);
-	submit_count = 0;
+	/*
+	 * Keep up to max_prefetches reads in flight.  Devices are processed
+	 * in the order their reads complete, and each completion frees a
+	 * slot for the next device, so one slow device does not hold up
+	 * processing of, or issuing reads to, the others.
+	 *
+	 * Completed blocks are processed before more reads are submitted.
+	 * Only then can the cache reuse a clean block, so a prefetched
+	 * block is never tossed before it has been looked at.
+	 */
+	while (!dm_list_empty(devs) || !dm_list_empty(&wait_devs)) {
+		done_count = 0;
 
-	dm_list_iterate_items_safe(devl, devl2, devs) {
+		dm_list_iterate_items_safe(devl, devl2, &wait_devs) {
+			if (bcache_io_pending(scan_bcache, devl->dev->bcache_fd, 0))
+				continue;
 
-		/*
-		 * If we prefetch more devs than blocks in the cache, then the
-		 * cache will wait for earlier reads to complete, toss the
-		 * results, and reuse those blocks before we've had a chance to
-		 * use them.  So, prefetch as many as are available, wait for
-		 * and process them, then repeat.
-		 */
-		if (!rem_prefetches)
-			break;
+			_scan_dev_process(cmd, f, devl->dev, &scan_read_errors,
+					  &scan_process_errors, &scan_failed_count);
 
-		if (!_in_bcache(devl->dev)) {
-			if (!_scan_dev_open(devl->dev)) {
-				log_debug_devs("Scan failed to open %s.", dev_name(devl->dev));
-				dm_list_del(&devl->list);
-				dm_list_add(&reopen_devs, &devl->list);
-				continue;
-			}
+			dm_list_del(&devl->list);
+			dm_list_add(&done_devs, &devl->list);
+			in_flight--;
+			done_count++;
 		}
 
-		bcache_prefetch(scan_bcache, devl->dev->bcache_fd, 0);
+		submit_count = 0;
 
-		rem_prefetches--;
-		submit_count++;
+		dm_list_iterate_items_safe(devl, devl2, devs) {
+			if (in_flight >= max_prefetches)
+				break;
 
-		dm_list_del(&devl->list);
-		dm_list_add(&wait_devs, &devl->list);
-	}
+			if (!_in_bcache(devl->dev)) {
+				if (!_scan_dev_open(devl->dev)) {
+					log_debug_devs("Scan failed to open %s.", dev_name(devl->dev));
+					dm_list_del(&devl->list);
+					dm_list_add(&reopen_devs, &devl->list);
+					continue;
+				}
+			}
 
-	log_debug_devs("Scanning submitted %d reads", submit_count);
+			bcache_prefetch(scan_bcache, devl->dev->bcache_fd, 0);
 
-	dm_list_iterate_items_safe(devl, devl2, &wait_devs) {
-		bb = NULL;
-		error = 0;
-		scan_failed = 0;
-		is_lvm_device = 0;
+			in_flight++;
+			submit_count++;
 
-		if (!bcache_get(scan_bcache, devl->dev->bcache_fd, 0, 0, &bb)) {
-			log_debug_devs("Scan failed to read %s error %d.", dev_name(devl->dev), error);
-			scan_failed = 1;
-			scan_read_errors++;
-			scan_failed_count++;
-			lvmcache_del_dev(devl->dev);
-		} else {
-			log_debug_devs("Processing data from device %s %d:%d fd %d block %p",
-				       dev_name(devl->dev),
-				       (int)MAJOR(devl->dev->dev),
-				       (int)MINOR(devl->dev->dev),
-				       devl->dev->bcache_fd, bb);
-
-			ret = _process_block(cmd, f, devl->dev, bb, 0, 0, &is_lvm_device);
-
-			if (!ret && is_lvm_device) {
-				log_debug_devs("Scan failed to process %s", dev_name(devl->dev));
-				scan_failed = 1;
-				scan_process_errors++;
-				scan_failed_count++;
-				lvmcache_del_dev(devl->dev);
-			}
+			dm_list_del(&devl->list);
+			dm_list_add(&wait_devs, &devl->list);
 		}
 
-		if (bb)
-			bcache_put(bb);
+		if (submit_count)
+			log_debug_devs("Scanning submitted %d reads", submit_count);
 
-		/*
-		 * Keep the bcache block of lvm devices we have processed so
-		 * that the vg_read phase can reuse it.  If bcache failed to
-		 * read the block, or the device does not belong to lvm, then
-		 * drop it from bcache.
-		 */
-		if (scan_failed || !is_lvm_device) {
-			bcache_invalidate_fd(scan_bcache, devl->dev->bcache_fd);
-			_scan_dev_close(devl->dev);
-		}
-
-		dm_list_del(&devl->list);
-		dm_list_add(&done_devs, &devl->list);
+		/* Nothing was ready, sleep until the next read completes. */
+		if (!done_count && !submit_count)
+			(void) bcache_wait_any(scan_bcache);
 	}
 
-	if (!dm_list_empty(devs))
-		goto scan_more;
-
 	/*
 	 * We're done scanning all the devs.  If we failed to open any of them
 	 * the first time through, refresh device paths and retry.  We failed
@@ -773,11 +799,11 @@ out:
 }
 
 /*
- * How many blocks to set up in bcache?  Is 1024 a good max?
+ * How many blocks to set up in bcache?
  *
- * Currently, we tell bcache to set up N blocks where N
- * is the number of devices that are going to be scanned.
- * Reasons why this number may not be be a good choice:
+ * We tell bcache to start with N blocks where N is the
+ * number of devices that are going to be scanned, clamped
+ * to MIN/MAX_BCACHE_BLOCKS.  This is only a starting point:
  *
  * - there may be a lot of non-lvm devices, which
  *   would make this number larger than necessary
@@ -788,18 +814,35 @@ out:
  *   would make this number smaller than it
  *   should be for the best performance.
  *
- * This is even more tricky to estimate when lvmetad
- * is used, because it's hard to predict how many
- * devs might need to be scanned when using lvmetad.
- * This currently just sets up bcache with MIN blocks.
+ * So rather than evict blocks that the vg_read phase will
+ * want again, bcache is allowed to grow up to
+ * MAX_BCACHE_GROW_BLOCKS.  Blocks of non-lvm devices are
+ * dropped as soon as they are scanned, so the cache only
+ * grows when lvm data is being kept, and it shrinks again
+ * when devices are dropped from it.
  */
 
 #define MIN_BCACHE_BLOCKS 32
 #define MAX_BCACHE_BLOCKS 1024
+#define MAX_BCACHE_GROW_BLOCKS 8192
+
+static void _log_bcache_stats(const char *when)
+{
+	struct bcache_stats stats;
+
+	bcache_get_stats(scan_bcache, &stats);
+
+	log_debug_devs("bcache %s: blocks %u (max %u) free %u hits %u misses %u "
+		       "prefetches %u evictions %u grows %u shrinks %u",
+		       when, stats.nr_cache_blocks, stats.max_cache_blocks,
+		       stats.nr_free, stats.read_hits + stats.write_hits,
+		       stats.read_misses + stats.write_misses, stats.prefetches,
+		       stats.evictions, stats.grows, stats.shrinks);
+}
 
 static int _setup_bcache(int cache_blocks)
 {
-	struct io_engine *ioe;
+	struct io_engine *ioe = NULL;
 
 	if (cache_blocks < MIN_BCACHE_BLOCKS)
 		cache_blocks = MIN_BCACHE_BLOCKS;
@@ -807,7 +850,10 @@ static int _setup_bcache(int cache_blocks)
 	if (cache_blocks > MAX_BCACHE_BLOCKS)
 		cache_blocks = MAX_BCACHE_BLOCKS;
 
-	if (!(ioe = create_async_io_engine())) {
+	if (use_io_uring() && !(ioe = create_uring_io_engine()))
+		log_debug_devs("io_uring is not available, using libaio.");
+
+	if (!ioe && !(ioe = create_async_io_engine())) {
 		log_error("Failed to create bcache io engine.");
 		return 0;
 	}
@@ -817,6 +863,8 @@ static int _setup_bcache(int cache_blocks)
 		return 0;
 	}
 
+	bcache_set_max_cache_blocks(scan_bcache, MAX_BCACHE_GROW_BLOCKS);
+
 	return 1;
 }
 
@@ -889,8 +937,15 @@ int label_scan(struct cmd_context *cmd)
 			return 0;
 	}
 
+	if (!scan_cache_init(cmd))
+		stack;
+
 	_scan_list(cmd, cmd->full_filter, &all_devs, NULL);
 
+	scan_cache_save(1);
+
+	_log_bcache_stats("after label scan");
+
 	dm_list_iterate_items_safe(devl, devl2, &all_devs) {
 		dm_list_del(&devl->list);
 		free(devl);
@@ -1014,6 +1069,11 @@ void label_scan_destroy(struct cmd_context *cmd)
 	if (!scan_bcache)
 		return;
 
+	_log_bcache_stats("at destroy");
+
+	scan_cache_save(0);
+	scan_cache_destroy();
+
 	label_scan_drop(cmd);
 
 	bcache_destroy(scan_bcache);
@@ -1186,6 +1246,96 @@ bool dev_read_bytes(struct device *dev, uint64_t start, size_t len, void *data)
 
 }
 
+static void _reopen_for_write(struct device *dev)
+{
+	if (_in_bcache(dev) && !(dev->flags & DEV_BCACHE_WRITE)) {
+		/* FIXME: avoid tossing out bcache blocks just to replace fd. */
+		log_debug("Close and reopen to write %s", dev_name(dev));
+		bcache_invalidate_fd(scan_bcache, dev->bcache_fd);
+		_scan_dev_close(dev);
+
+		dev->flags |= DEV_BCACHE_WRITE;
+		label_scan_open(dev);
+	}
+}
+
+/*
+ * Devices written since dev_write_batch_begin().
+ */
+static int _write_batch;
+static struct dm_list _write_batch_devs = DM_LIST_HEAD_INIT(_write_batch_devs);
+
+static void _write_batch_add(struct device *dev)
+{
+	struct device_list *devl;
+
+	dm_list_iterate_items(devl, &_write_batch_devs)
+		if (devl->dev == dev)
+			return;
+
+	if (!(devl = zalloc(sizeof(*devl)))) {
+		/* Without a record the write would not be checked, so flush it now. */
+		if (!bcache_flush(scan_bcache))
+			dev->flags |= DEV_WRITE_FAILED;
+		return;
+	}
+
+	dev->flags &= ~DEV_WRITE_FAILED;
+	devl->dev = dev;
+	dm_list_add(&_write_batch_devs, &devl->list);
+}
+
+void dev_write_batch_begin(void)
+{
+	_write_batch++;
+}
+
+bool dev_write_batch_end(void)
+{
+	struct device_list *devl, *devl2;
+	bool r = true;
+
+	if (!_write_batch) {
+		log_error(INTERNAL_ERROR "dev_write_batch_end without begin.");
+		return false;
+	}
+
+	if (--_write_batch)
+		return true;
+
+	if (dm_list_empty(&_write_batch_devs))
+		return true;
+
+	log_debug_devs("Writing batch to %d devices.", dm_list_size(&_write_batch_devs));
+
+	/*
+	 * All the writes go out together.  If any fail, each device is
+	 * written back on its own to find out which ones.
+	 */
+	if (!bcache_flush(scan_bcache))
+		r = false;
+
+	dm_list_iterate_items_safe(devl, devl2, &_write_batch_devs) {
+		if (!r && _in_bcache(devl->dev) &&
+		    !bcache_invalidate_fd(scan_bcache, devl->dev->bcache_fd)) {
+			log_error("Error writing device %s.", dev_name(devl->dev));
+			devl->dev->flags |= DEV_WRITE_FAILED;
+			label_scan_invalidate(devl->dev);
+		}
+
+		if (devl->dev->flags & DEV_WRITE_FAILED)
+			r = false;
+
+		if (_in_bcache(devl->dev))
+			dev_unset_last_byte(devl->dev);
+
+		dm_list_del(&devl->list);
+		free(devl);
+	}
+
+	return r;
+}
+
 bool dev_write_bytes(struct device *dev, uint64_t start, size_t len, void *data)
 {
 	if (test_mode())
@@ -1197,15 +1347,7 @@ bool dev_write_bytes(struct device *dev, uint64_t start, size_t len, void *data)
 		return false;
 	}
 
-	if (_in_bcache(dev) && !(dev->flags & DEV_BCACHE_WRITE)) {
-		/* FIXME: avoid tossing out bcache blocks just to replace fd. */
-		log_debug("Close and reopen to write %s", dev_name(dev));
-		bcache_invalidate_fd(scan_bcache, dev->bcache_fd);
-		_scan_dev_close(dev);
-
-		dev->flags |= DEV_BCACHE_WRITE;
-		label_scan_open(dev);
-	}
+	_reopen_for_write(dev);
 
 	if (dev->bcache_fd <= 0) {
 		/* This is not often needed, perhaps only with lvmetad. */
@@ -1224,6 +1366,11 @@ bool dev_write_bytes(struct device *dev, uint64_t start, size_t len, void *data)
 		return false;
 	}
 
+	if (_write_batch) {
+		_write_batch_add(dev);
+		return true;
+	}
+
 	if (!bcache_flush(scan_bcache)) {
 		log_error("Error writing device %s at %llu length %u.",
 			  dev_name(dev), (unsigned long long)start, (uint32_t)len);
@@ -1243,15 +1390,7 @@ bool dev_write_zeros(struct device *dev, uint64_t start, size_t len)
 		return false;
 	}
 
-	if (_in_bcache(dev) && !(dev->flags & DEV_BCACHE_WRITE)) {
-		/* FIXME: avoid tossing out bcache blocks just to replace fd. */
-		log_debug("Close and reopen to write %s", dev_name(dev));
-		bcache_invalidate_fd(scan_bcache, dev->bcache_fd);
-		_scan_dev_close(dev);
-
-		dev->flags |= DEV_BCACHE_WRITE;
-		label_scan_open(dev);
-	}
+	_reopen_for_write(dev);
 
 	if (dev->bcache_fd <= 0) {
 		/* This is not often needed, perhaps only with lvmetad. */
@@ -1294,15 +1433,7 @@ bool dev_set_bytes(struct device *dev, uint64_t start, size_t len, uint8_t val)
 		return false;
 	}
 
-	if (_in_bcache(dev) && !(dev->flags & DEV_BCACHE_WRITE)) {
-		/* FIXME: avoid tossing out bcache blocks just to replace fd. */
-		log_debug("Close and reopen to write %s", dev_name(dev));
-		bcache_invalidate_fd(scan_bcache, dev->bcache_fd);
-		_scan_dev_close(dev);
-
-		dev->flags |= DEV_BCACHE_WRITE;
-		label_scan_open(dev);
-	}
+	_reopen_for_write(dev);
 
 	if (dev->bcache_fd <= 0) {
 		/* This is not often needed, perhaps only with lvmetad. */
@@ -1343,11 +1474,19 @@ void dev_set_last_byte(struct device *dev, uint64_t offset)
 
 	dev_get_block_size(dev, &phys_block_size, &block_size);
 
+	/* The limit belongs to the fd the write will use. */
+	if (!test_mode())
+		_reopen_for_write(dev);
+
 	bcache_set_last_byte(scan_bcache, dev->bcache_fd, offset, phys_block_size);
 }
 
 void dev_unset_last_byte(struct device *dev)
 {
+	/* Batched writes are not issued yet, dev_write_batch_end() unsets it. */
+	if (_write_batch)
+		return;
+
 	bcache_unset_last_byte(scan_bcache, dev->bcache_fd);
 }
 
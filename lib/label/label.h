@@ -127,4 +127,13 @@ bool dev_set_bytes(struct device *dev, uint64_t start, size_t len, uint8_t val);
 void dev_set_last_byte(struct device *dev, uint64_t offset);
 void dev_unset_last_byte(struct device *dev);
 
+/*
+ * Between these, dev_write_bytes() leaves its blocks dirty in bcache rather
+ * than waiting for each write.  dev_write_batch_end() issues all of them
+ * together and waits for them to complete.  Devices with a failed write
+ * are flagged DEV_WRITE_FAILED.
+ */
+void dev_write_batch_begin(void);
+bool dev_write_batch_end(void);
+
 #endif
@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "lib/misc/lib.h"
+#include "lib/label/scan-cache.h"
+#include "lib/cache/lvmcache.h"
+#include "lib/commands/toolcontext.h"
+#include "lib/label/label.h"
+#include "lib/format_text/format-text.h"
+#include "lib/format_text/layout.h"
+#include "lib/mm/xlate.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * One line per metadata area:
+ *
+ * major:minor mda_start dev_size label_crc mdah_crc rlocn_offset rlocn_size
+ * rlocn_checksum seqno vgstatus vgid vgname creation_host system_id lock_type
+ *
+ * Names cannot contain white space, empty strings are written as "-".
+ */
+#define SCAN_CACHE_FILE DEFAULT_RUN_DIR "/scan_cache"
+#define SCAN_CACHE_HEADER "# lvm scan cache version 1"
+#define SCAN_CACHE_LINE_FMT "%u:%u %" PRIu64 " %" PRIu64 " %" PRIx32 " %" PRIx32 \
+			    " %" PRIu64 " %" PRIu64 " %" PRIx32 " %d %" PRIx64
+
+struct scan_cache_key {
+	uint64_t devno;
+	uint64_t mda_start;
+} __attribute__ ((packed));
+
+struct scan_cache_entry {
+	struct dm_list list;
+	struct scan_cache_key key;
+
+	uint64_t dev_size;
+	uint32_t label_crc;
+	uint32_t mdah_crc;
+	uint64_t rlocn_offset;
+	uint64_t rlocn_size;
+	uint32_t rlocn_checksum;
+
+	int seqno;
+	uint64_t vgstatus;
+	struct id vgid;
+	const char *vgname;
+	const char *creation_host;
+	const char *system_id;
+	const char *lock_type;
+
+	unsigned seen:1;
+};
+
+static struct dm_pool *_mem;
+static struct dm_hash_table *_entries;
+static struct dm_list _entry_list;
+static int _dirty;
+static unsigned _hits;
+static unsigned _misses;
+
+static const char *_dup_field(const char *str)
+{
+	if (!strcmp(str, "-"))
+		return NULL;
+
+	return dm_pool_strdup(_mem, str);
+}
+
+static const char *_out_field(const char *str)
+{
+	return (str && *str) ? str : "-";
+}
+
+static struct scan_cache_entry *_add_entry(const struct scan_cache_key *key)
+{
+	struct scan_cache_entry *e;
+
+	if (!(e = dm_pool_zalloc(_mem, sizeof(*e))))
+		return_NULL;
+
+	e->key = *key;
+
+	if (!dm_hash_insert_binary(_entries, &e->key, sizeof(e->key), e)) {
+		log_debug_devs("Scan cache failed to insert entry.");
+		return NULL;
+	}
+
+	dm_list_add(&_entry_list, &e->list);
+
+	return e;
+}
+
+static int _parse_line(const char *line)
+{
+	struct scan_cache_entry tmp, *e;
+	char vgid[ID_LEN + 1];
+	char vgname[NAME_LEN + 1];
+	char creation_host[NAME_LEN + 1];
+	char system_id[NAME_LEN + 1];
+	char lock_type[NAME_LEN + 1];
+	unsigned major, minor;
+
+	memset(&tmp, 0, sizeof(tmp));
+
+	if (sscanf(line, SCAN_CACHE_LINE_FMT " %32s %128s %128s %128s %128s",
+		   &major, &minor, &tmp.key.mda_start, &tmp.dev_size,
+		   &tmp.label_crc, &tmp.mdah_crc, &tmp.rlocn_offset,
+		   &tmp.rlocn_size, &tmp.rlocn_checksum, &tmp.seqno,
+		   &tmp.vgstatus, vgid, vgname, creation_host, system_id,
+		   lock_type) != 16)
+		return 0;
+
+	if ((strlen(vgid) != ID_LEN) || !validate_name(vgname))
+		return 0;
+
+	tmp.key.devno = (uint64_t) MKDEV(major, minor);
+
+	/* Duplicate keys are not written, ignore them if present. */
+	if (dm_hash_lookup_binary(_entries, &tmp.key, sizeof(tmp.key)))
+		return 0;
+
+	if (!(e = _add_entry(&tmp.key)))
+		return_0;
+
+	e->dev_size = tmp.dev_size;
+	e->label_crc = tmp.label_crc;
+	e->mdah_crc = tmp.mdah_crc;
+	e->rlocn_offset = tmp.rlocn_offset;
+	e->rlocn_size = tmp.rlocn_size;
+	e->rlocn_checksum = tmp.rlocn_checksum;
+	e->seqno = tmp.seqno;
+	e->vgstatus = tmp.vgstatus;
+	memcpy(&e->vgid, vgid, ID_LEN);
+
+	if (!(e->vgname = _dup_field(vgname)))
+		return_0;
+	e->creation_host = _dup_field(creation_host);
+	e->system_id = _dup_field(system_id);
+	e->lock_type = _dup_field(lock_type);
+
+	return 1;
+}
+
+static void _load(void)
+{
+	char line[1024];
+	unsigned count = 0, bad = 0;
+	FILE *fp;
+
+	if (!(fp = fopen(SCAN_CACHE_FILE, "r"))) {
+		if (errno != ENOENT)
+			log_sys_debug("fopen", SCAN_CACHE_FILE);
+		return;
+	}
+
+	if (!fgets(line, sizeof(line), fp) ||
+	    strncmp(line, SCAN_CACHE_HEADER, sizeof(SCAN_CACHE_HEADER) - 1)) {
+		log_debug_devs("Scan cache %s has unknown format, ignoring.", SCAN_CACHE_FILE);
+		goto out;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (_parse_line(line))
+			count++;
+		else
+			bad++;
+	}
+
+	log_debug_devs("Scan cache loaded %u entries from %s (%u ignored).",
+		       count, SCAN_CACHE_FILE, bad);
+	if (bad)
+		_dirty = 1;
+out:
+	if (fclose(fp))
+		log_sys_debug("fclose", SCAN_CACHE_FILE);
+}
+
+int scan_cache_init(struct cmd_context *cmd)
+{
+	if (_entries)
+		return 1;
+
+	if (!find_config_tree_bool(cmd, devices_scan_cache_CFG, NULL))
+		return 1;
+
+	if (!(_mem = dm_pool_create("scan_cache", 8192)))
+		return_0;
+
+	if (!(_entries = dm_hash_create(1024))) {
+		dm_pool_destroy(_mem);
+		_mem = NULL;
+		return_0;
+	}
+
+	dm_list_init(&_entry_list);
+	_dirty = 0;
+	_hits = 0;
+	_misses = 0;
+
+	_load();
+
+	return 1;
+}
+
+void scan_cache_destroy(void)
+{
+	if (!_entries)
+		return;
+
+	log_debug_devs("Scan cache hits %u misses %u.", _hits, _misses);
+
+	dm_hash_destroy(_entries);
+	_entries = NULL;
+	dm_pool_destroy(_mem);
+	_mem = NULL;
+}
+
+void scan_cache_save(int prune)
+{
+	char tmp_path[PATH_MAX];
+	struct scan_cache_entry *e, *e2;
+	int fd;
+	FILE *fp;
+
+	if (!_entries)
+		return;
+
+	if (prune) {
+		dm_list_iterate_items_safe(e, e2, &_entry_list) {
+			if (e->seen)
+				continue;
+			dm_hash_remove_binary(_entries, &e->key, sizeof(e->key));
+			dm_list_del(&e->list);
+			_dirty = 1;
+		}
+	}
+
+	if (!_dirty)
+		return;
+
+	if (dm_snprintf(tmp_path, sizeof(tmp_path), "%s.%d", SCAN_CACHE_FILE, (int) getpid()) < 0)
+		return;
+
+	/* Written to a temporary file and renamed so readers never see a partial file. */
+	if ((fd = open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR)) < 0) {
+		log_debug_devs("Scan cache cannot create %s: %s", tmp_path, strerror(errno));
+		return;
+	}
+
+	if (!(fp = fdopen(fd, "w"))) {
+		log_sys_debug("fdopen", tmp_path);
+		if (close(fd))
+			log_sys_debug("close", tmp_path);
+		goto bad;
+	}
+
+	fprintf(fp, "%s\n", SCAN_CACHE_HEADER);
+
+	dm_list_iterate_items(e, &_entry_list)
+		fprintf(fp, SCAN_CACHE_LINE_FMT " %.32s %s %s %s %s\n",
+			(unsigned) MAJOR(e->key.devno), (unsigned) MINOR(e->key.devno),
+			e->key.mda_start, e->dev_size, e->label_crc, e->mdah_crc,
+			e->rlocn_offset, e->rlocn_size, e->rlocn_checksum,
+			e->seqno, e->vgstatus, (const char *) &e->vgid, e->vgname,
+			_out_field(e->creation_host), _out_field(e->system_id),
+			_out_field(e->lock_type));
+
+	if (lvm_fclose(fp, tmp_path))
+		goto_bad;
+
+	if (rename(tmp_path, SCAN_CACHE_FILE)) {
+		log_sys_debug("rename", SCAN_CACHE_FILE);
+		goto bad;
+	}
+
+	log_debug_devs("Scan cache saved %d entries to %s.",
+		       dm_list_size(&_entry_list), SCAN_CACHE_FILE);
+	_dirty = 0;
+
+	return;
+bad:
+	if (unlink(tmp_path))
+		log_sys_debug("unlink", tmp_path);
+}
+
+static void _make_key(struct device *dev, struct mda_header *mdah,
+		      struct scan_cache_key *key)
+{
+	memset(key, 0, sizeof(*key));
+	key->devno = (uint64_t) dev->dev;
+	key->mda_start = mdah->start;
+}
+
+int scan_cache_lookup(struct device *dev, uint32_t label_crc,
+		      struct mda_header *mdah, struct lvmcache_vgsummary *vgsummary)
+{
+	struct scan_cache_key key;
+	struct scan_cache_entry *e;
+	struct raw_locn *rlocn = mdah->raw_locns;
+	uint64_t dev_size;
+
+	if (!_entries)
+		return 0;
+
+	_make_key(dev, mdah, &key);
+
+	if (!(e = dm_hash_lookup_binary(_entries, &key, sizeof(key))) ||
+	    !dev_get_size(dev, &dev_size) ||
+	    (e->dev_size != dev_size) ||
+	    (e->label_crc != label_crc) ||
+	    (e->mdah_crc != xlate32(mdah->checksum_xl)) ||
+	    (e->rlocn_offset != rlocn->offset) ||
+	    (e->rlocn_size != rlocn->size) ||
+	    (e->rlocn_checksum != rlocn->checksum)) {
+		_misses++;
+		return 0;
+	}
+
+	e->seen = 1;
+	_hits++;
+
+	vgsummary->vgname = e->vgname;
+	vgsummary->vgid = e->vgid;
+	vgsummary->vgstatus = e->vgstatus;
+	vgsummary->creation_host = (char *) e->creation_host;
+	vgsummary->system_id = e->system_id;
+	vgsummary->lock_type = e->lock_type;
+	vgsummary->mda_checksum = rlocn->checksum;
+	vgsummary->mda_size = rlocn->size;
+	vgsummary->seqno = e->seqno;
+
+	log_debug_devs("Scan cache found VG %s seqno %d on %s at %llu.",
+		       e->vgname, e->seqno, dev_name(dev),
+		       (unsigned long long) mdah->start);
+
+	return 1;
+}
+
+void scan_cache_update(struct device *dev, uint32_t label_crc,
+		       struct mda_header *mdah, const struct lvmcache_vgsummary *vgsummary)
+{
+	struct scan_cache_key key;
+	struct scan_cache_entry *e;
+	struct raw_locn *rlocn = mdah->raw_locns;
+	uint64_t dev_size;
+
+	if (!_entries || !vgsummary->vgname)
+		return;
+
+	if (!dev_get_size(dev, &dev_size))
+		return;
+
+	_make_key(dev, mdah, &key);
+
+	if (!(e = dm_hash_lookup_binary(_entries, &key, sizeof(key))) &&
+	    !(e = _add_entry(&key)))
+		return;
+
+	e->dev_size = dev_size;
+	e->label_crc = label_crc;
+	e->mdah_crc = xlate32(mdah->checksum_xl);
+	e->rlocn_offset = rlocn->offset;
+	e->rlocn_size = rlocn->size;
+	e->rlocn_checksum = rlocn->checksum;
+	e->seqno = vgsummary->seqno;
+	e->vgstatus = vgsummary->vgstatus;
+	e->vgid = vgsummary->vgid;
+	/* Cleared by vgchange --systemid "" or --locktype none. */
+	e->creation_host = NULL;
+	e->system_id = NULL;
+	e->lock_type = NULL;
+
+	/* Names with white space could not be read back. */
+	if (!(e->vgname = dm_pool_strdup(_mem, vgsummary->vgname)) ||
+	    (vgsummary->creation_host && strpbrk(vgsummary->creation_host, " \t\n")) ||
+	    (vgsummary->creation_host && !(e->creation_host = dm_pool_strdup(_mem, vgsummary->creation_host))) ||
+	    (vgsummary->system_id && !(e->system_id = dm_pool_strdup(_mem, vgsummary->system_id))) ||
+	    (vgsummary->lock_type && !(e->lock_type = dm_pool_strdup(_mem, vgsummary->lock_type)))) {
+		dm_hash_remove_binary(_entries, &e->key, sizeof(e->key));
+		dm_list_del(&e->list);
+		return;
+	}
+
+	e->seen = 1;
+	_dirty = 1;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _LVM_SCAN_CACHE_H
+#define _LVM_SCAN_CACHE_H
+
+struct cmd_context;
+struct device;
+struct mda_header;
+struct lvmcache_vgsummary;
+
+/*
+ * Persistent cache of the VG summary found in each metadata area during
+ * label scan.  An entry is only used when the device, its label and the
+ * mda_header read by the current scan all match what was seen when the
+ * entry was saved, which avoids reading and parsing the metadata text.
+ */
+int scan_cache_init(struct cmd_context *cmd);
+void scan_cache_destroy(void);
+
+/*
+ * Write the cache out if it changed.  After a full label scan, prune
+ * drops entries for metadata areas that were not seen.
+ */
+void scan_cache_save(int prune);
+
+int scan_cache_lookup(struct device *dev, uint32_t label_crc,
+		      struct mda_header *mdah, struct lvmcache_vgsummary *vgsummary);
+void scan_cache_update(struct device *dev, uint32_t label_crc,
+		       struct mda_header *mdah, const struct lvmcache_vgsummary *vgsummary);
+
+#endif
@@ -57,6 +57,8 @@ struct daemon_parms {
 	unsigned background;
 	unsigned outstanding_count;
 	unsigned progress_display;
+	unsigned single_step;		/* check once, see LVPOLL_SINGLE_STEP_ENV */
+	unsigned in_progress;		/* single_step found it unfinished */
 	const char *progress_title;
 	uint64_t lv_type;
 	struct poll_functions *poll_fns;
@@ -2006,6 +2006,15 @@ static int _alloc_parallel_area(struct alloc_handle *ah, uint32_t max_to_allocat
 				" on %s start PE %" PRIu32 " length %" PRIu32 ".",
 				s, pv_dev_name(aa[s].pv), aa[s].pe, aa[s].len);
 
+		if (s < ah->area_count) {
+			if (!pva->map->alloced_areas &&
+			    !(pva->map->alloced_areas = dm_bitset_create(ah->mem, ah->area_count))) {
+				log_error("alloced areas bitset allocation failed");
+				return 0;
+			}
+			dm_bit_set(pva->map->alloced_areas, s);
+		}
+
 		consume_pv_area(pva, aa[s].len);
 
 		dm_list_add(&ah->alloced_areas[s], &aa[s].list);
@@ -2493,6 +2502,7 @@ static int _check_cling(struct alloc_handle *ah,
 			struct alloc_state *alloc_state)
 {
 	struct pv_match pvmatch;
+	struct lv_segment *seg;
 	int r;
 	uint32_t le, len;
 
@@ -2506,14 +2516,16 @@ static int _check_cling(struct alloc_handle *ah,
 		/* Check entire LV */
 		le = 0;
 		len = prev_lvseg->le + prev_lvseg->len;
+		seg = NULL;
 	} else {
 		/* Only check 1 LE at end of previous LV segment */
 		le = prev_lvseg->le + prev_lvseg->len - 1;
 		len = 1;
+		seg = prev_lvseg;
 	}
 
 	/* FIXME Cope with stacks by flattening */
-	if (!(r = _for_each_pv(ah->cmd, prev_lvseg->lv, le, len, NULL, NULL,
+	if (!(r = _for_each_pv(ah->cmd, prev_lvseg->lv, le, len, seg, NULL,
 			       0, 0, -1, 1,
 			       _is_condition, &pvmatch)))
 		stack;
@@ -2542,7 +2554,7 @@ static int _check_contiguous(struct alloc_handle *ah,
 
 	/* FIXME Cope with stacks by flattening */
 	if (!(r = _for_each_pv(ah->cmd, prev_lvseg->lv,
-			       prev_lvseg->le + prev_lvseg->len - 1, 1, NULL, NULL,
+			       prev_lvseg->le + prev_lvseg->len - 1, 1, prev_lvseg, NULL,
 			       0, 0, -1, 1,
 			       _is_condition, &pvmatch)))
 		stack;
@@ -2570,12 +2582,22 @@ static int _check_cling_to_alloced(struct alloc_handle *ah, const struct dm_conf
 	if (alloc_state->log_area_count_still_needed)
 		return 0;
 
+	/* Without tags only the PV itself matters, so use its own record. */
+	if (!cling_tag_list_cn && !pva->map->alloced_areas)
+		return 0;
+
 	for (s = 0; s < ah->area_count; s++) {
 		if (positional && alloc_state->areas[s].pva)
 			continue;	/* Area already assigned */
+		if (!cling_tag_list_cn) {
+			if (!dm_bit(pva->map->alloced_areas, s))
+				continue;
+			if (positional)
+				_reserve_required_area(ah, alloc_state, pva, pva->count, s, 0);
+			return 1;
+		}
 		dm_list_iterate_items(aa, &ah->alloced_areas[s]) {
-			if ((!cling_tag_list_cn && (pva->map->pv == aa[0].pv)) ||
-			    (cling_tag_list_cn && _pvs_have_matching_tag(cling_tag_list_cn, pva->map->pv, aa[0].pv, 0))) {
+			if (_pvs_have_matching_tag(cling_tag_list_cn, pva->map->pv, aa[0].pv, 0)) {
 				if (positional)
 					_reserve_required_area(ah, alloc_state, pva, pva->count, s, 0);
 				return 1;
@@ -2700,15 +2722,7 @@ static uint32_t _calc_required_extents(struct alloc_handle *ah, struct pv_area *
 	} else if (required < ah->log_len)
 		required = ah->log_len;
 
-	if (required >= pva->unreserved) {
-		required = pva->unreserved;
-		pva->unreserved = 0;
-	} else {
-		pva->unreserved -= required;
-		reinsert_changed_pv_area(pva);
-	}
-
-	return required;
+	return reserve_pv_area(pva, required);
 }
 
 static void _clear_areas(struct alloc_state *alloc_state)
@@ -2721,19 +2735,6 @@ static void _clear_areas(struct alloc_state *alloc_state)
 		alloc_state->areas[s].pva = NULL;
 }
 
-static void _reset_unreserved(struct dm_list *pvms)
-{
-	struct pv_map *pvm;
-	struct pv_area *pva;
-
-	dm_list_iterate_items(pvm, pvms)
-		dm_list_iterate_items(pva, &pvm->areas)
-			if (pva->unreserved != pva->count) {
-				pva->unreserved = pva->count;
-				reinsert_changed_pv_area(pva);
-			}
-}
-
 static void _report_needed_allocation_space(struct alloc_handle *ah,
 					    struct alloc_state *alloc_state,
 					    struct dm_list *pvms)
@@ -2828,7 +2829,7 @@ static int _find_some_parallel_space(struct alloc_handle *ah,
 	uint32_t required;
 
 	_clear_areas(alloc_state);
-	_reset_unreserved(pvms);
+	reset_pv_maps_unreserved(pvms);
 
 	/* num_positional_areas holds the number of parallel allocations that must be contiguous/cling */
 	/* These appear first in the array, so it is also the offset to the non-preferred allocations */
@@ -13,6 +13,7 @@
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include "base/memory/zalloc.h"
 #include "lib/misc/lib.h"
 #include "lib/device/device.h"
 #include "lib/metadata/metadata.h"
@@ -144,6 +145,7 @@ void add_pvl_to_vgs(struct volume_group *vg, struct pv_list *pvl)
 	vg->pv_count++;
 	pvl->pv->vg = vg;
 	pv_set_fid(pvl->pv, vg->fid);
+	vg_index_add_pv(vg, pvl);
 }
 
 void del_pvl_from_vgs(struct volume_group *vg, struct pv_list *pvl)
@@ -153,6 +155,9 @@ void del_pvl_from_vgs(struct volume_group *vg, struct pv_list *pvl)
 	vg->pv_count--;
 	dm_list_del(&pvl->list);
 
+	if (vg->pv_ids && (dm_hash_lookup_binary(vg->pv_ids, &pvl->pv->id, sizeof(pvl->pv->id)) == pvl))
+		dm_hash_remove_binary(vg->pv_ids, &pvl->pv->id, sizeof(pvl->pv->id));
+
 	pvl->pv->vg = vg->fid->fmt->orphan_vg; /* orphan */
 	if ((info = lvmcache_info_from_pvid((const char *) &pvl->pv->id, pvl->pv->dev, 0)))
 		lvmcache_fid_add_mdas(info, vg->fid->fmt->orphan_vg->fid,
@@ -855,27 +860,14 @@ static void _vg_move_cached_precommitted_to_committed(struct volume_group *vg)
 
 /*
  * Update content of precommitted VG
- *
- * TODO: Optimize in the future, since lvmetad needs similar
- *       config tree processing in lvmetad_vg_update().
  */
 static int _vg_update_embedded_copy(struct volume_group *vg, struct volume_group **vg_embedded)
 {
-	struct dm_config_tree *cft;
-
 	_vg_wipe_cached_precommitted(vg);
 
-	/* Copy the VG using an export followed by import */
-	if (!(cft = export_vg_to_config_tree(vg)))
+	if (!(*vg_embedded = copy_vg(vg)))
 		return_0;
 
-	if (!(*vg_embedded = import_vg_from_config_tree(cft, vg->fid))) {
-		dm_config_destroy(cft);
-		return_0;
-	}
-
-	dm_config_destroy(cft);
-
 	return 1;
 }
 
@@ -1559,13 +1551,30 @@ struct pv_list *find_pv_in_vg_by_uuid(const struct volume_group *vg,
 {
 	struct pv_list *pvl;
 
+	if (vg->pv_ids &&
+	    (pvl = dm_hash_lookup_binary(vg->pv_ids, id, sizeof(*id))) &&
+	    (pvl->pv->vg == vg) && id_equal(&pvl->pv->id, id))
+		return pvl;
+
 	dm_list_iterate_items(pvl, &vg->pvs)
-		if (id_equal(&pvl->pv->id, id))
+		if (id_equal(&pvl->pv->id, id)) {
+			vg_index_add_pv(vg, pvl);
 			return pvl;
+		}
 
 	return NULL;
 }
 
+/*
+ * Index hits are checked against the LV, a miss falls back to the list
+ * and indexes what it finds there, e.g. an LV renamed since it was linked.
+ * So a miss costs a walk of the whole list, even if nothing is found.
+ */
+static int _lvl_is_current(const struct volume_group *vg, const struct lv_list *lvl)
+{
+	return (lvl->lv->vg == vg) && !(lvl->lv->status & LV_REMOVED);
+}
+
 struct lv_list *find_lv_in_vg(const struct volume_group *vg,
 			      const char *lv_name)
 {
@@ -1578,9 +1587,16 @@ struct lv_list *find_lv_in_vg(const struct volume_group *vg,
 	else
 		ptr = lv_name;
 
+	if (vg->lv_names &&
+	    (lvl = dm_hash_lookup(vg->lv_names, ptr)) &&
+	    _lvl_is_current(vg, lvl) && !strcmp(lvl->lv->name, ptr))
+		return lvl;
+
 	dm_list_iterate_items(lvl, &vg->lvs)
-		if (!strcmp(lvl->lv->name, ptr))
+		if (!strcmp(lvl->lv->name, ptr)) {
+			vg_index_add_lv(vg, lvl);
 			return lvl;
+		}
 
 	return NULL;
 }
@@ -1602,9 +1618,16 @@ struct logical_volume *find_lv_in_vg_by_lvid(struct volume_group *vg,
 {
 	struct lv_list *lvl;
 
+	if (vg->lv_ids &&
+	    (lvl = dm_hash_lookup_binary(vg->lv_ids, &lvid->id, sizeof(lvid->id))) &&
+	    _lvl_is_current(vg, lvl) && !strncmp(lvl->lv->lvid.s, lvid->s, sizeof(*lvid)))
+		return lvl->lv;
+
 	dm_list_iterate_items(lvl, &vg->lvs)
-		if (!strncmp(lvl->lv->lvid.s, lvid->s, sizeof(*lvid)))
+		if (!strncmp(lvl->lv->lvid.s, lvid->s, sizeof(*lvid))) {
+			vg_index_add_lv(vg, lvl);
 			return lvl->lv;
+		}
 
 	return NULL;
 }
@@ -2840,6 +2863,49 @@ static int _handle_historical_lvs(struct volume_group *vg)
  * After vg_write() returns success,
  * caller MUST call either vg_commit() or vg_revert()
  */
+/*
+ * Metadata writes are batched, so a failed write is only seen once the
+ * batch is complete.  Handle it like a failed mda->ops->vg_write for the
+ * mdas before end.
+ */
+static int _vg_check_batched_writes(struct volume_group *vg, struct dm_list *end,
+				    int *wrote)
+{
+	struct metadata_area *mda;
+	struct device *dev;
+
+	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
+		if (&mda->list == end)
+			break;
+		if (mda->status & MDA_FAILED)
+			continue;
+		if (!(dev = mda_get_device(mda)) || !(dev->flags & DEV_WRITE_FAILED))
+			continue;
+		if (!vg->cmd->handles_missing_pvs)
+			return 0;
+
+		log_warn("WARNING: Failed to write an MDA of VG %s.", vg->name);
+		mda->status |= MDA_FAILED;
+		--(*wrote);
+	}
+
+	return 1;
+}
+
+static void _vg_revert_mdas(struct volume_group *vg)
+{
+	struct metadata_area *mda;
+
+	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
+		if (mda->status & MDA_FAILED)
+			continue;
+		if (mda->ops->vg_revert &&
+		    !mda->ops->vg_revert(vg->fid, vg, mda)) {
+			stack;
+		}
+	}
+}
+
 int vg_write(struct volume_group *vg)
 {
 	struct dm_list *mdah;
@@ -2847,6 +2913,7 @@ int vg_write(struct volume_group *vg)
 	struct metadata_area *mda;
 	struct lv_list *lvl;
 	int revert = 0, wrote = 0;
+	int r;
 
 	if (vg_is_shared(vg)) {
 		dm_list_iterate_items(lvl, &vg->lvs) {
@@ -2914,7 +2981,13 @@ int vg_write(struct volume_group *vg)
 		dm_list_del(&pvl->list);
 	}
 
-	/* Write to each copy of the metadata area */
+	/*
+	 * Write to each copy of the metadata area.  The writes to all devices
+	 * are issued together and all complete before any are committed.
+	 * The text is exported once, by the first mda written.
+	 */
+	vg->export_used = 0;
+	dev_write_batch_begin();
 	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
 		if (mda->status & MDA_FAILED)
 			continue;
@@ -2937,6 +3010,12 @@ int vg_write(struct volume_group *vg)
 			++ wrote;
 	}
 
+	if (!dev_write_batch_end() &&
+	    !_vg_check_batched_writes(vg, revert ? &mda->list : &vg->fid->metadata_areas_in_use, &wrote)) {
+		stack;
+		revert = 1;
+	}
+
 	if (revert || !wrote) {
 		log_error("Failed to write VG %s.", vg->name);
 		dm_list_uniterate(mdah, &vg->fid->metadata_areas_in_use, &mda->list) {
@@ -2950,30 +3029,38 @@ int vg_write(struct volume_group *vg)
 				stack;
 			}
 		}
+		vg->export_used = 0;
 		return 0;
 	}
 
 	/* Now pre-commit each copy of the new metadata */
+	dev_write_batch_begin();
 	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
 		if (mda->status & MDA_FAILED)
 			continue;
 		if (mda->ops->vg_precommit &&
 		    !mda->ops->vg_precommit(vg->fid, vg, mda)) {
 			stack;
-			/* Revert */
-			dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
-				if (mda->status & MDA_FAILED)
-					continue;
-				if (mda->ops->vg_revert &&
-				    !mda->ops->vg_revert(vg->fid, vg, mda)) {
-					stack;
-				}
-			}
-			return 0;
+			revert = 1;
+			break;
 		}
 	}
 
-	if (!_vg_update_embedded_copy(vg, &vg->vg_precommitted)) /* prepare precommited */
+	if (!dev_write_batch_end()) {
+		stack;
+		revert = 1;
+	}
+
+	if (revert) {
+		_vg_revert_mdas(vg);
+		vg->export_used = 0;
+		return 0;
+	}
+
+	/* prepare precommited, reusing the exported text */
+	r = _vg_update_embedded_copy(vg, &vg->vg_precommitted);
+	vg->export_used = 0;
+	if (!r)
 		return_0;
 
 	lockd_vg_update(vg);
@@ -2985,7 +3072,10 @@ static int _vg_commit_mdas(struct volume_group *vg)
 {
 	struct metadata_area *mda, *tmda;
 	struct dm_list ignored;
-	int failed = 0;
+	struct device *dev;
+	uint8_t *committed;
+	unsigned i;
+	int batch_ok;
 	int cache_updated = 0;
 
 	/* Rearrange the metadata_areas_in_use so ignored mdas come first. */
@@ -2997,22 +3087,41 @@ static int _vg_commit_mdas(struct volume_group *vg)
 	dm_list_iterate_items_safe(mda, tmda, &ignored)
 		dm_list_move(&vg->fid->metadata_areas_in_use, &mda->list);
 
-	/* Commit to each copy of the metadata area */
+	if (!(committed = zalloc(dm_list_size(&vg->fid->metadata_areas_in_use) + 1))) {
+		log_error("Failed to allocate mda commit state.");
+		return 0;
+	}
+
+	/* Commit to each copy of the metadata area, all written together */
+	dev_write_batch_begin();
+	i = 0;
 	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
-		if (mda->status & MDA_FAILED)
+		if (mda->status & MDA_FAILED) {
+			i++;
 			continue;
-		failed = 0;
+		}
 		if (mda->ops->vg_commit &&
-		    !mda->ops->vg_commit(vg->fid, vg, mda)) {
+		    !mda->ops->vg_commit(vg->fid, vg, mda))
 			stack;
-			failed = 1;
-		}
-		/* Update cache first time we succeed */
-		if (!failed && !cache_updated) {
+		else
+			committed[i] = 1;
+		i++;
+	}
+	batch_ok = dev_write_batch_end();
+
+	i = 0;
+	dm_list_iterate_items(mda, &vg->fid->metadata_areas_in_use) {
+		if (committed[i++] &&
+		    (batch_ok || !(dev = mda_get_device(mda)) || !(dev->flags & DEV_WRITE_FAILED))) {
+			/* Update cache if any commit succeeded */
 			lvmcache_update_vg(vg, 0);
 			cache_updated = 1;
+			break;
 		}
 	}
+
+	free(committed);
+
 	return cache_updated;
 }
 
@@ -56,7 +56,61 @@ static int _create_single_area(struct dm_pool *mem, struct pv_map *pvm,
 	pva->start = start;
 	pva->count = length;
 	pva->unreserved = pva->count;
-	_insert_area(&pvm->areas, pva, 0);
+
+	/* Put in size order by _sort_areas() once the PV is complete. */
+	dm_list_add(&pvm->areas, &pva->list);
+	pvm->pe_count += length;
+
+	return 1;
+}
+
+struct area_sort {
+	struct pv_area *pva;
+	unsigned seq;
+};
+
+static int _comp_area_size(const void *l, const void *r)
+{
+	const struct area_sort *lhs = l, *rhs = r;
+
+	if (lhs->pva->count != rhs->pva->count)
+		return (lhs->pva->count < rhs->pva->count) ? 1 : -1;
+
+	return (lhs->seq < rhs->seq) ? -1 : 1;
+}
+
+/*
+ * Order the areas of a new map largest first.  Equal sizes stay in the
+ * order they were found, as inserting them one by one would leave them.
+ */
+static int _sort_areas(struct pv_map *pvm)
+{
+	struct area_sort *areas;
+	struct pv_area *pva;
+	unsigned i, count = dm_list_size(&pvm->areas);
+
+	if (count < 2)
+		return 1;
+
+	if (!(areas = malloc(sizeof(*areas) * count))) {
+		log_error("Failed to allocate PV area sort array.");
+		return 0;
+	}
+
+	i = 0;
+	dm_list_iterate_items(pva, &pvm->areas) {
+		areas[i].pva = pva;
+		areas[i].seq = i;
+		i++;
+	}
+
+	qsort(areas, count, sizeof(*areas), _comp_area_size);
+
+	dm_list_init(&pvm->areas);
+	for (i = 0; i < count; i++)
+		dm_list_add(&pvm->areas, &areas[i].pva->list);
+
+	free(areas);
 
 	return 1;
 }
@@ -163,6 +217,10 @@ static int _create_maps(struct dm_pool *mem, struct dm_list *pvs, struct dm_list
 			return_0;
 	}
 
+	dm_list_iterate_items(pvm, pvms)
+		if (!_sort_areas(pvm))
+			return_0;
+
 	return 1;
 }
 
@@ -193,6 +251,9 @@ struct dm_list *create_pv_maps(struct dm_pool *mem, struct volume_group *vg,
 
 void consume_pv_area(struct pv_area *pva, uint32_t to_go)
 {
+	if (pva->unreserved != pva->count)
+		pva->map->reserved_areas--;
+
 	_remove_area(pva);
 
 	assert(to_go <= pva->count);
@@ -216,6 +277,50 @@ void reinsert_changed_pv_area(struct pv_area *pva)
 	_insert_area(&pva->map->areas, pva, 1);
 }
 
+/*
+ * Set aside up to 'required' extents of pva for the current allocation
+ * pass and return how many were set aside.  A partly reserved area moves
+ * down the list according to what is left of it.
+ */
+uint32_t reserve_pv_area(struct pv_area *pva, uint32_t required)
+{
+	if (pva->unreserved == pva->count && required)
+		pva->map->reserved_areas++;
+
+	if (required >= pva->unreserved) {
+		required = pva->unreserved;
+		pva->unreserved = 0;
+	} else {
+		pva->unreserved -= required;
+		reinsert_changed_pv_area(pva);
+	}
+
+	return required;
+}
+
+/*
+ * Make all reserved extents available again before the next pass.
+ * Only the areas reserved are touched: once they are all reset, the
+ * rest of each list is left alone.
+ */
+void reset_pv_maps_unreserved(struct dm_list *pvms)
+{
+	struct pv_map *pvm;
+	struct pv_area *pva;
+
+	dm_list_iterate_items(pvm, pvms)
+		dm_list_iterate_items(pva, &pvm->areas) {
+			if (!pvm->reserved_areas)
+				break;
+
+			if (pva->unreserved != pva->count) {
+				pva->unreserved = pva->count;
+				pvm->reserved_areas--;
+				reinsert_changed_pv_area(pva);
+			}
+		}
+}
+
 uint32_t pv_maps_size(struct dm_list *pvms)
 {
 	struct pv_map *pvm;
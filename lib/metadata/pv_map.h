@@ -56,6 +56,12 @@ struct pv_map {
 	struct dm_list areas;		/* struct pv_areas */
 	uint32_t pe_count;		/* Total number of PEs */
 
+	/* Number of areas with some extents reserved during this pass. */
+	uint32_t reserved_areas;
+
+	/* Parallel areas (by index) already allocated on this PV. */
+	dm_bitset_t alloced_areas;
+
 	struct dm_list list;
 };
 
@@ -67,6 +73,8 @@ struct dm_list *create_pv_maps(struct dm_pool *mem, struct volume_group *vg,
 
 void consume_pv_area(struct pv_area *pva, uint32_t to_go);
 void reinsert_changed_pv_area(struct pv_area *pva);
+uint32_t reserve_pv_area(struct pv_area *pva, uint32_t required);
+void reset_pv_maps_unreserved(struct dm_list *pvms);
 
 uint32_t pv_maps_size(struct dm_list *pvms);
 
@@ -15,11 +15,23 @@
 
 #include "lib/misc/lib.h"
 #include "lib/metadata/metadata.h"
+#include "lib/metadata/segtype.h"
+#include "lib/datastruct/str_list.h"
 #include "lib/display/display.h"
 #include "lib/activate/activate.h"
 #include "lib/commands/toolcontext.h"
 #include "lib/format_text/archiver.h"
 
+static void _free_indexes(struct volume_group *vg)
+{
+	if (vg->lv_names)
+		dm_hash_destroy(vg->lv_names);
+	if (vg->lv_ids)
+		dm_hash_destroy(vg->lv_ids);
+	if (vg->pv_ids)
+		dm_hash_destroy(vg->pv_ids);
+}
+
 struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
 			      const char *vg_name)
 {
@@ -52,6 +64,16 @@ struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
 		return NULL;
 	}
 
+	if (!(vg->lv_names = dm_hash_create(64)) ||
+	    !(vg->lv_ids = dm_hash_create(64)) ||
+	    !(vg->pv_ids = dm_hash_create(16))) {
+		log_error("Failed to allocate VG index hashtables.");
+		_free_indexes(vg);
+		dm_hash_destroy(vg->hostnames);
+		dm_pool_destroy(vgmem);
+		return NULL;
+	}
+
 	dm_list_init(&vg->pvs);
 	dm_list_init(&vg->pv_write_list);
 	dm_list_init(&vg->lvs);
@@ -78,6 +100,8 @@ static void _free_vg(struct volume_group *vg)
 
 	log_debug_mem("Freeing VG %s at %p.", vg->name ? : "<no name>", vg);
 
+	free(vg->export_buf);
+	_free_indexes(vg);
 	dm_hash_destroy(vg->hostnames);
 	dm_pool_destroy(vg->vgmem);
 }
@@ -118,6 +142,7 @@ int link_lv_to_vg(struct volume_group *vg, struct logical_volume *lv)
 	lv->vg = vg;
 	dm_list_add(&vg->lvs, &lvl->list);
 	lv->status &= ~LV_REMOVED;
+	vg_index_add_lv(vg, lvl);
 
 	return 1;
 }
@@ -129,12 +154,454 @@ int unlink_lv_from_vg(struct logical_volume *lv)
 	if (!(lvl = find_lv_in_vg(lv->vg, lv->name)))
 		return_0;
 
+	vg_index_del_lv(lv->vg, lvl);
 	dm_list_move(&lv->vg->removed_lvs, &lvl->list);
 	lv->status |= LV_REMOVED;
 
 	return 1;
 }
 
+/*
+ * Failure to index only makes a lookup rebuild the index.
+ * The name and lvid are not known yet when importing.
+ */
+void vg_index_add_lv(const struct volume_group *vg, struct lv_list *lvl)
+{
+	if (!vg->lv_names)
+		return;
+
+	if (lvl->lv->name)
+		(void) dm_hash_insert(vg->lv_names, lvl->lv->name, lvl);
+
+	(void) dm_hash_insert_binary(vg->lv_ids, &lvl->lv->lvid.id, sizeof(lvl->lv->lvid.id), lvl);
+}
+
+void vg_index_del_lv(const struct volume_group *vg, struct lv_list *lvl)
+{
+	if (!vg->lv_names)
+		return;
+
+	if (lvl->lv->name && (dm_hash_lookup(vg->lv_names, lvl->lv->name) == lvl))
+		dm_hash_remove(vg->lv_names, lvl->lv->name);
+
+	if (dm_hash_lookup_binary(vg->lv_ids, &lvl->lv->lvid.id, sizeof(lvl->lv->lvid.id)) == lvl)
+		dm_hash_remove_binary(vg->lv_ids, &lvl->lv->lvid.id, sizeof(lvl->lv->lvid.id));
+}
+
+void vg_index_add_pv(const struct volume_group *vg, struct pv_list *pvl)
+{
+	if (vg->pv_ids)
+		(void) dm_hash_insert_binary(vg->pv_ids, &pvl->pv->id, sizeof(pvl->pv->id), pvl);
+}
+
+/*
+ * copy_vg() state: every PV segment, LV, LV segment and generic LV
+ * of the source VG is entered in the map with its copy, so pointers
+ * between them can be redirected to the copies.
+ */
+struct vg_copy {
+	struct volume_group *vg;
+	struct dm_pool *mem;
+	struct dm_hash_table *map;
+	int failed;
+};
+
+static int _copy_map_add(struct vg_copy *c, const void *from, void *to)
+{
+	if (!dm_hash_insert_binary(c->map, &from, sizeof(from), to)) {
+		log_error("Failed to map copied VG object.");
+		return 0;
+	}
+
+	return 1;
+}
+
+static void *_copy_of(struct vg_copy *c, const void *from)
+{
+	void *to;
+
+	if (!from)
+		return NULL;
+
+	if (!(to = dm_hash_lookup_binary(c->map, &from, sizeof(from)))) {
+		log_error(INTERNAL_ERROR "VG %s references an object outside of it.",
+			  c->vg->name);
+		c->failed = 1;
+	}
+
+	return to;
+}
+
+static const char *_copy_str(struct vg_copy *c, const char *str)
+{
+	const char *r;
+
+	if (!str)
+		return NULL;
+
+	if (!(r = dm_pool_strdup(c->mem, str)))
+		c->failed = 1;
+
+	return r;
+}
+
+static int _copy_pv(struct vg_copy *c, const struct physical_volume *pv)
+{
+	struct pv_list *pvl;
+	struct physical_volume *pvc;
+	struct pv_segment *pvseg, *pvsegc;
+
+	if (!(pvl = dm_pool_zalloc(c->mem, sizeof(*pvl))) ||
+	    !(pvc = dm_pool_alloc(c->mem, sizeof(*pvc))))
+		return_0;
+
+	*pvc = *pv;
+	pvc->fid = NULL;
+	pvc->vg_name = _copy_str(c, c->vg->name);
+	memset(&pvc->old_id, 0, sizeof(pvc->old_id));
+	pvc->status &= ~(PV_MOVED_VG | UNLABELLED_PV);
+	pvc->is_labelled = 1; /* All format_text PVs are labelled. */
+	pvc->pe_align = 0;
+	pvc->pe_align_offset = 0;
+
+	dm_list_init(&pvc->tags);
+	if (!str_list_dup(c->mem, &pvc->tags, &pv->tags))
+		return_0;
+
+	dm_list_init(&pvc->segments);
+	dm_list_iterate_items(pvseg, &pv->segments) {
+		if (!(pvsegc = dm_pool_alloc(c->mem, sizeof(*pvsegc))))
+			return_0;
+		*pvsegc = *pvseg;
+		pvsegc->pv = pvc;
+		dm_list_add(&pvc->segments, &pvsegc->list);
+		if (!_copy_map_add(c, pvseg, pvsegc))
+			return_0;
+	}
+
+	pvl->pv = pvc;
+	add_pvl_to_vgs(c->vg, pvl);
+
+	return 1;
+}
+
+static int _copy_glv(struct vg_copy *c, const struct generic_logical_volume *glv,
+		     struct logical_volume *lvc)
+{
+	struct generic_logical_volume *glvc;
+	struct historical_logical_volume *hlv;
+	struct glv_list *glvl;
+
+	if (!(glvc = dm_pool_zalloc(c->mem, sizeof(*glvc))))
+		return_0;
+
+	if (lvc) {
+		glvc->live = lvc;
+		lvc->this_glv = glvc;
+	} else {
+		if (!(hlv = dm_pool_zalloc(c->mem, sizeof(*hlv))) ||
+		    !(glvl = dm_pool_zalloc(c->mem, sizeof(*glvl))))
+			return_0;
+
+		glvc->is_historical = 1;
+		glvc->historical = hlv;
+		hlv->lvid = glv->historical->lvid;
+		hlv->name = _copy_str(c, glv->historical->name);
+		hlv->vg = c->vg;
+		hlv->timestamp = glv->historical->timestamp;
+		hlv->timestamp_removed = glv->historical->timestamp_removed;
+		dm_list_init(&hlv->indirect_glvs);
+
+		glvl->glv = glvc;
+		dm_list_add(&c->vg->historical_lvs, &glvl->list);
+	}
+
+	return _copy_map_add(c, glv, glvc);
+}
+
+static int _copy_lv(struct vg_copy *c, const struct logical_volume *lv)
+{
+	struct logical_volume *lvc;
+
+	if (!(lvc = alloc_lv(c->mem)))
+		return_0;
+
+	lvc->lvid = lv->lvid;
+	lvc->name = _copy_str(c, lv->name);
+	lvc->vg = c->vg;
+	/* Runtime-only flags are never written to the metadata */
+	lvc->status = lv->status & ~(LV_NOSCAN | LV_TEMPORARY | LV_PENDING_DELETE |
+				     LV_REMOVED | POSTORDER_FLAG);
+	lvc->alloc = lv->alloc;
+	lvc->profile = lv->profile;
+	lvc->read_ahead = lv->read_ahead;
+	lvc->major = lvc->minor = -1;
+	if (lv->status & FIXED_MINOR) {
+		lvc->major = lv->major;
+		lvc->minor = lv->minor;
+	}
+	lvc->size = lv->size;
+	lvc->le_count = lv->le_count;
+	lvc->origin_count = lv->origin_count;
+	lvc->external_count = lv->external_count;
+	lvc->lock_args = _copy_str(c, lv->lock_args);
+
+	if (!str_list_dup(c->mem, &lvc->tags, &lv->tags))
+		return_0;
+
+	if (!link_lv_to_vg(c->vg, lvc))
+		return_0;
+
+	if (lv->timestamp && !lv_set_creation(lvc, lv->hostname, lv->timestamp))
+		return_0;
+
+	if (lv->this_glv && !_copy_glv(c, lv->this_glv, lvc))
+		return_0;
+
+	return _copy_map_add(c, lv, lvc);
+}
+
+static struct lv_segment_area *_copy_areas(struct vg_copy *c,
+					   const struct lv_segment_area *areas,
+					   uint32_t area_count)
+{
+	struct lv_segment_area *areasc;
+	uint32_t s;
+
+	if (!areas)
+		return NULL;
+
+	if (!(areasc = dm_pool_alloc(c->mem, area_count * sizeof(*areasc)))) {
+		c->failed = 1;
+		return_NULL;
+	}
+
+	for (s = 0; s < area_count; s++) {
+		areasc[s] = areas[s];
+		if (areas[s].type == AREA_PV)
+			areasc[s].u.pv.pvseg = _copy_of(c, areas[s].u.pv.pvseg);
+		else if (areas[s].type == AREA_LV)
+			areasc[s].u.lv.lv = _copy_of(c, areas[s].u.lv.lv);
+	}
+
+	return areasc;
+}
+
+static int _copy_seg(struct vg_copy *c, const struct lv_segment *seg,
+		     struct logical_volume *lvc)
+{
+	struct lv_segment *segc;
+	struct lv_thin_message *tmsg, *tmsgc;
+
+	if (!(segc = dm_pool_alloc(c->mem, sizeof(*segc))))
+		return_0;
+
+	*segc = *seg;
+	segc->lv = lvc;
+	segc->origin = _copy_of(c, seg->origin);
+	segc->indirect_origin = _copy_of(c, seg->indirect_origin);
+	segc->merge_lv = _copy_of(c, seg->merge_lv);
+	segc->cow = _copy_of(c, seg->cow);
+	segc->log_lv = _copy_of(c, seg->log_lv);
+	segc->metadata_lv = _copy_of(c, seg->metadata_lv);
+	segc->external_lv = _copy_of(c, seg->external_lv);
+	segc->pool_lv = _copy_of(c, seg->pool_lv);
+	segc->pvmove_source_seg = NULL;
+	segc->areas = _copy_areas(c, seg->areas, seg->area_count);
+	segc->meta_areas = _copy_areas(c, seg->meta_areas, seg->area_count);
+	segc->policy_name = _copy_str(c, seg->policy_name);
+
+	if (seg->policy_settings &&
+	    !(segc->policy_settings = dm_config_clone_node_with_mem(c->mem, seg->policy_settings, 0)))
+		return_0;
+
+	if (seg->segtype_private) {
+		/* Only unknown segments keep their config nodes there */
+		if (!seg_unknown(seg)) {
+			log_error(INTERNAL_ERROR "Cannot copy private data of %s segment.",
+				  lvseg_name(seg));
+			return 0;
+		}
+		if (!(segc->segtype_private = dm_config_clone_node_with_mem(c->mem, seg->segtype_private, 1)))
+			return_0;
+	}
+
+	dm_list_init(&segc->tags);
+	if (!str_list_dup(c->mem, &segc->tags, &seg->tags))
+		return_0;
+
+	dm_list_init(&segc->origin_list);
+	dm_list_init(&segc->thin_messages);
+	dm_list_iterate_items(tmsg, &seg->thin_messages) {
+		if (!(tmsgc = dm_pool_alloc(c->mem, sizeof(*tmsgc))))
+			return_0;
+		*tmsgc = *tmsg;
+		if ((tmsg->type == DM_THIN_MESSAGE_CREATE_SNAP) ||
+		    (tmsg->type == DM_THIN_MESSAGE_CREATE_THIN))
+			tmsgc->u.lv = _copy_of(c, tmsg->u.lv);
+		dm_list_add(&segc->thin_messages, &tmsgc->list);
+	}
+
+	dm_list_add(&lvc->segments, &segc->list);
+
+	return _copy_map_add(c, seg, segc);
+}
+
+static int _copy_glv_lists(struct vg_copy *c, const struct dm_list *glvs,
+			   struct dm_list *glvsc)
+{
+	struct glv_list *glvl, *glvlc;
+
+	dm_list_iterate_items(glvl, glvs) {
+		if (!(glvlc = dm_pool_zalloc(c->mem, sizeof(*glvlc))))
+			return_0;
+		glvlc->glv = _copy_of(c, glvl->glv);
+		dm_list_add(glvsc, &glvlc->list);
+	}
+
+	return 1;
+}
+
+/*
+ * Links between LVs kept in lists of the referenced LV, once all
+ * segments are copied.
+ */
+static int _copy_lv_links(struct vg_copy *c, const struct logical_volume *lv)
+{
+	struct logical_volume *lvc = _copy_of(c, lv);
+	struct lv_segment *seg, *segc;
+	struct seg_list *sl, *slc;
+
+	if (!lvc)
+		return_0;
+
+	lvc->snapshot = _copy_of(c, lv->snapshot);
+
+	dm_list_iterate_items_gen(seg, &lv->snapshot_segs, origin_list) {
+		if (!(segc = _copy_of(c, seg)))
+			return_0;
+		dm_list_add(&lvc->snapshot_segs, &segc->origin_list);
+	}
+
+	dm_list_iterate_items(sl, &lv->segs_using_this_lv) {
+		if (!(slc = dm_pool_zalloc(c->mem, sizeof(*slc))))
+			return_0;
+		slc->count = sl->count;
+		slc->seg = _copy_of(c, sl->seg);
+		dm_list_add(&lvc->segs_using_this_lv, &slc->list);
+	}
+
+	return _copy_glv_lists(c, &lv->indirect_glvs, &lvc->indirect_glvs);
+}
+
+/*
+ * Copy a VG with all its PVs, LVs, segments and historical LVs into
+ * a new memory pool, as an import of its exported metadata would.
+ */
+struct volume_group *copy_vg(const struct volume_group *vg)
+{
+	struct vg_copy c = { 0 };
+	struct pv_list *pvl;
+	struct lv_list *lvl;
+	struct glv_list *glvl;
+	struct lv_segment *seg;
+	struct pv_segment *pvseg;
+	struct logical_volume *lvc;
+	struct generic_logical_volume *glvc;
+	int visible;
+
+	if (!(c.vg = alloc_vg("copy_vg", vg->cmd, vg->name)))
+		return_NULL;
+
+	c.mem = c.vg->vgmem;
+
+	if (!(c.map = dm_hash_create(dm_list_size(&vg->lvs) * 4 + 64))) {
+		log_error("Failed to allocate VG copy map.");
+		goto bad;
+	}
+
+	c.vg->original_fmt = vg->original_fmt;
+	c.vg->seqno = vg->seqno;
+	c.vg->alloc = vg->alloc;
+	c.vg->profile = vg->profile;
+	c.vg->status = vg->status & ~(PRECOMMITTED | ARCHIVED_VG);
+	c.vg->id = vg->id;
+	if (vg->system_id && *vg->system_id)
+		c.vg->system_id = _copy_str(&c, vg->system_id);
+	c.vg->lock_type = _copy_str(&c, vg->lock_type);
+	c.vg->lock_args = _copy_str(&c, vg->lock_args);
+	c.vg->extent_size = vg->extent_size;
+	c.vg->max_lv = vg->max_lv;
+	c.vg->max_pv = vg->max_pv;
+	c.vg->mda_copies = vg->mda_copies;
+
+	if (!str_list_dup(c.mem, &c.vg->tags, &vg->tags))
+		goto_bad;
+
+	dm_list_iterate_items(pvl, &vg->pvs)
+		if (!_copy_pv(&c, pvl->pv))
+			goto_bad;
+
+	c.vg->extent_count = vg->extent_count;
+	c.vg->free_count = vg->free_count;
+
+	/* Visible LVs first, in the order the export writes them */
+	for (visible = 1; visible >= 0; visible--)
+		dm_list_iterate_items(lvl, &vg->lvs)
+			if ((lv_is_visible(lvl->lv) ? 1 : 0) == visible &&
+			    !_copy_lv(&c, lvl->lv))
+				goto_bad;
+
+	dm_list_iterate_items(glvl, &vg->historical_lvs)
+		if (!_copy_glv(&c, glvl->glv, NULL))
+			goto_bad;
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		if (!(lvc = _copy_of(&c, lvl->lv)))
+			goto_bad;
+		dm_list_iterate_items(seg, &lvl->lv->segments)
+			if (!_copy_seg(&c, seg, lvc))
+				goto_bad;
+	}
+
+	dm_list_iterate_items(lvl, &vg->lvs)
+		if (!_copy_lv_links(&c, lvl->lv))
+			goto_bad;
+
+	dm_list_iterate_items(glvl, &vg->historical_lvs) {
+		if (!(glvc = _copy_of(&c, glvl->glv)))
+			goto_bad;
+		glvc->historical->indirect_origin = _copy_of(&c, glvl->glv->historical->indirect_origin);
+		if (!_copy_glv_lists(&c, &glvl->glv->historical->indirect_glvs,
+				     &glvc->historical->indirect_glvs))
+			goto_bad;
+	}
+
+	dm_list_iterate_items(pvl, &c.vg->pvs)
+		dm_list_iterate_items(pvseg, &pvl->pv->segments)
+			pvseg->lvseg = _copy_of(&c, pvseg->lvseg);
+
+	c.vg->pool_metadata_spare_lv = _copy_of(&c, vg->pool_metadata_spare_lv);
+	c.vg->sanlock_lv = _copy_of(&c, vg->sanlock_lv);
+
+	if (c.failed)
+		goto_bad;
+
+	dm_hash_destroy(c.map);
+
+	vg_set_fid(c.vg, vg->fid);
+
+	return c.vg;
+
+bad:
+	log_error("Failed to copy VG %s.", vg->name);
+	if (c.map)
+		dm_hash_destroy(c.map);
+	release_vg(c.vg);
+
+	return NULL;
+}
+
 int vg_max_lv_reached(struct volume_group *vg)
 {
 	if (!vg->max_lv)
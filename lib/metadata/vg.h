@@ -21,6 +21,8 @@
 struct cmd_context;
 struct format_instance;
 struct logical_volume;
+struct lv_list;
+struct pv_list;
 
 typedef enum {
 	ALLOC_INVALID,
@@ -53,6 +55,17 @@ struct volume_group {
 	struct volume_group *vg_committed;
 	struct volume_group *vg_precommitted;
 
+	/*
+	 * Text metadata export buffer, kept at its largest size and reused
+	 * by the next export of this VG.  export_used is non-zero while
+	 * vg_write holds the text of the current VG in it, with export_crc
+	 * its checksum.
+	 */
+	char *export_buf;
+	uint32_t export_buf_size;
+	uint32_t export_used;
+	uint32_t export_crc;
+
 	alloc_policy_t alloc;
 	struct profile *profile;
 	uint64_t status;
@@ -130,6 +143,18 @@ struct volume_group {
 	uint32_t mda_copies; /* target number of mdas for this VG */
 
 	struct dm_hash_table *hostnames; /* map of creation hostnames */
+
+	/*
+	 * Indexes of lvs by name and lvid and of pvs by id.  LVs get renamed
+	 * and moved in many places without updating them, so they are only a
+	 * cache: a hit is checked against the LV, a miss walks the list and
+	 * indexes what it finds there.  Lookups of absent LVs and PVs stay
+	 * O(N).  See find_lv_in_vg().
+	 */
+	struct dm_hash_table *lv_names;	/* struct lv_list */
+	struct dm_hash_table *lv_ids;	/* struct lv_list */
+	struct dm_hash_table *pv_ids;	/* struct pv_list */
+
 	struct logical_volume *pool_metadata_spare_lv; /* one per VG */
 	struct logical_volume *sanlock_lv; /* one per VG */
 };
@@ -144,6 +169,17 @@ struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
 void release_vg(struct volume_group *vg);
 void free_orphan_vg(struct volume_group *vg);
 
+/*
+ * copy_vg() returns a copy of the VG in its own memory pool, equivalent
+ * to importing its exported metadata, which must be released with
+ * release_vg().
+ */
+struct volume_group *copy_vg(const struct volume_group *vg);
+
+void vg_index_add_lv(const struct volume_group *vg, struct lv_list *lvl);
+void vg_index_del_lv(const struct volume_group *vg, struct lv_list *lvl);
+void vg_index_add_pv(const struct volume_group *vg, struct pv_list *pvl);
+
 char *vg_fmt_dup(const struct volume_group *vg);
 char *vg_name_dup(const struct volume_group *vg);
 char *vg_system_id_dup(const struct volume_group *vg);
@@ -13,17 +13,15 @@
  */
 
 /*
- * Helper program to generate table included in crc.c.
+ * Helper program to generate tables included in crc.c.
  */
 #include "lib/misc/lib.h"
 
 int main(int argc, char **argv)
 {
+	uint32_t crctab[8][256];
 	uint32_t crc, i, j;
 
-	printf("\t/* CRC-32 byte lookup table generated by crc_gen.c */\n");
-	printf("\tstatic const uint32_t crctab[] = {");
-
 	for (i = 0; i < 256; i++) {
 		crc = i;
 		for (j = 0; j < 8; j++) {
@@ -32,16 +30,31 @@ int main(int argc, char **argv)
 			else
 				crc = crc >> 1;
 		}
+		crctab[0][i] = crc;
+	}
+
+	/* Table j advances the CRC of a byte followed by j zero bytes */
+	for (j = 1; j < 8; j++)
+		for (i = 0; i < 256; i++)
+			crctab[j][i] = (crctab[j - 1][i] >> 8) ^ crctab[0][crctab[j - 1][i] & 0xff];
 
-		if (i % 8)
-			printf(" ");
-		else
-			printf("\n\t\t");
+	printf("/* CRC-32 slice-by-8 lookup tables generated by crc_gen.c */\n");
+	printf("static const uint32_t _crctab[8][256] = {");
 
-		printf("0x%08.8x,", crc);
+	for (j = 0; j < 8; j++) {
+		printf("\n\t{");
+		for (i = 0; i < 256; i++) {
+			if (i % 8)
+				printf(" ");
+			else
+				printf("\n\t\t");
+
+			printf("0x%08.8x,", crctab[j][i]);
+		}
+		printf("\n\t},");
 	}
 
-	printf("\n\t};\n");
+	printf("\n};\n");
 
 	return 0;
 }
@@ -30,6 +30,7 @@ static int _fwraid_filtering = 0;
 static int _pvmove = 0;
 static int _obtain_device_list_from_udev = DEFAULT_OBTAIN_DEVICE_LIST_FROM_UDEV;
 static enum dev_ext_e _external_device_info_source = DEV_EXT_NONE;
+static int _use_io_uring = 0;
 static int _trust_cache = 0; /* Don't scan when incomplete VGs encountered */
 static int _debug_level = 0;
 static int _debug_classes_logged = 0;
@@ -99,6 +100,11 @@ void init_external_device_info_source(enum dev_ext_e src)
 	_external_device_info_source = src;
 }
 
+void init_use_io_uring(int use_io_uring)
+{
+	_use_io_uring = use_io_uring;
+}
+
 void init_trust_cache(int trustcache)
 {
 	_trust_cache = trustcache;
@@ -245,6 +251,11 @@ enum dev_ext_e external_device_info_source(void)
 	return _external_device_info_source;
 }
 
+int use_io_uring(void)
+{
+	return _use_io_uring;
+}
+
 int trust_cache(void)
 {
 	return _trust_cache;
@@ -30,6 +30,7 @@ void init_internal_filtering(int level);
 void init_fwraid_filtering(int level);
 void init_pvmove(int level);
 void init_external_device_info_source(enum dev_ext_e src);
+void init_use_io_uring(int use_io_uring);
 void init_obtain_device_list_from_udev(int device_list_from_udev);
 void init_trust_cache(int trustcache);
 void init_debug(int level);
@@ -61,6 +62,7 @@ int fwraid_filtering(void);
 int pvmove_mode(void);
 int obtain_device_list_from_udev(void);
 enum dev_ext_e external_device_info_source(void);
+int use_io_uring(void);
 int trust_cache(void);
 int verbose_level(void);
 int silent_mode(void);
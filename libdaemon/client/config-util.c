@@ -242,6 +242,7 @@ struct dm_config_node *config_make_nodes_v(struct dm_config_tree *cft,
 	struct dm_config_node *cn;
 	const char *fmt;
 	char *key;
+	size_t len;
 
 	while ((next = va_arg(ap, char *))) {
 		cn = NULL;
@@ -257,7 +258,10 @@ struct dm_config_node *config_make_nodes_v(struct dm_config_tree *cft,
 			return NULL;
 		}
 
-		key[fmt - next] = '\0';
+		/* "name = %?" leaves a space after the key */
+		for (len = fmt - next; len && key[len - 1] == ' '; len--)
+			;
+		key[len] = '\0';
 		fmt += 2;
 
 		if (!strcmp(fmt, FMTd64)) {
@@ -411,3 +415,404 @@ void buffer_init(struct buffer *buf)
 	buf->allocated = buf->used = 0;
 	buf->mem = 0;
 }
+
+/*
+ * The binary message format.  Both ends of the socket run on the same
+ * machine, so numbers are in host byte order.
+ *
+ *   frame:  DAEMON_FRAME_MAGIC, body length (u32), nodes
+ *   node:   WIRE_SECTION key node... WIRE_END
+ *         | WIRE_VALUE key format_flags (u32) count (u32) value...
+ *   key:    length (u16), bytes
+ *   value:  DM_CFG_* type (u8), then an int64, a float, length (u32) and
+ *           bytes of a string, or nothing for an empty array
+ */
+#define WIRE_SECTION	1
+#define WIRE_VALUE	2
+#define WIRE_END	3
+
+int buffer_is_binary(const struct buffer *buf)
+{
+	return buf->mem && buf->used >= DAEMON_FRAME_HEADER_SIZE &&
+		!memcmp(buf->mem, DAEMON_FRAME_MAGIC, 4);
+}
+
+/* Size of the whole frame according to its header, 0 if it is invalid. */
+int buffer_frame_size(const struct buffer *buf)
+{
+	uint32_t len;
+
+	if (!buffer_is_binary(buf))
+		return 0;
+
+	memcpy(&len, buf->mem + 4, sizeof(len));
+
+	if (len > INT_MAX / 2)
+		return 0;
+
+	return (int) len + DAEMON_FRAME_HEADER_SIZE;
+}
+
+static int _wire_put(struct buffer *buf, const void *data, size_t len)
+{
+	if ((buf->allocated - buf->used < (int) len) &&
+	    !buffer_realloc(buf, (int) len))
+		return 0;
+
+	memcpy(buf->mem + buf->used, data, len);
+	buf->used += len;
+	return 1;
+}
+
+static int _wire_put_u8(struct buffer *buf, uint8_t val)
+{
+	return _wire_put(buf, &val, sizeof(val));
+}
+
+static int _wire_put_u32(struct buffer *buf, uint32_t val)
+{
+	return _wire_put(buf, &val, sizeof(val));
+}
+
+static int _wire_put_key(struct buffer *buf, uint8_t tag, const char *key, size_t len)
+{
+	uint16_t keylen = (uint16_t) len;
+
+	if (len > UINT16_MAX) {
+		log_error(INTERNAL_ERROR "Config key %.32s... is too long.", key);
+		return 0;
+	}
+
+	return _wire_put_u8(buf, tag) &&
+		_wire_put(buf, &keylen, sizeof(keylen)) &&
+		_wire_put(buf, key, len);
+}
+
+/* A key with a single value following. */
+static int _wire_put_scalar(struct buffer *buf, const char *key, size_t len)
+{
+	return _wire_put_key(buf, WIRE_VALUE, key, len) &&
+		_wire_put_u32(buf, 0) &&
+		_wire_put_u32(buf, 1);
+}
+
+static int _wire_put_int(struct buffer *buf, int64_t val)
+{
+	return _wire_put_u8(buf, DM_CFG_INT) &&
+		_wire_put(buf, &val, sizeof(val));
+}
+
+static int _wire_put_str(struct buffer *buf, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (len > INT_MAX / 2) {
+		log_error(INTERNAL_ERROR "Config string is too long.");
+		return 0;
+	}
+
+	return _wire_put_u8(buf, DM_CFG_STRING) &&
+		_wire_put_u32(buf, (uint32_t) len) &&
+		_wire_put(buf, str, len);
+}
+
+static int _wire_put_value(struct buffer *buf, const struct dm_config_value *v)
+{
+	switch (v->type) {
+	case DM_CFG_INT:
+		return _wire_put_int(buf, v->v.i);
+	case DM_CFG_FLOAT:
+		return _wire_put_u8(buf, DM_CFG_FLOAT) &&
+			_wire_put(buf, &v->v.f, sizeof(v->v.f));
+	case DM_CFG_STRING:
+		return _wire_put_str(buf, v->v.str);
+	case DM_CFG_EMPTY_ARRAY:
+		return _wire_put_u8(buf, DM_CFG_EMPTY_ARRAY);
+	}
+
+	log_error(INTERNAL_ERROR "Unknown config value type %d.", (int) v->type);
+	return 0;
+}
+
+/* The node and its siblings, like dm_config_write_node. */
+static int _wire_put_node(struct buffer *buf, const struct dm_config_node *cn)
+{
+	const struct dm_config_value *v;
+	uint32_t count;
+
+	for (; cn; cn = cn->sib) {
+		if (!cn->v) {
+			if (!_wire_put_key(buf, WIRE_SECTION, cn->key, strlen(cn->key)) ||
+			    !_wire_put_node(buf, cn->child) ||
+			    !_wire_put_u8(buf, WIRE_END))
+				return 0;
+			continue;
+		}
+
+		for (count = 0, v = cn->v; v; v = v->next)
+			count++;
+
+		if (!_wire_put_key(buf, WIRE_VALUE, cn->key, strlen(cn->key)) ||
+		    !_wire_put_u32(buf, cn->v->format_flags) ||
+		    !_wire_put_u32(buf, count))
+			return 0;
+
+		for (v = cn->v; v; v = v->next)
+			if (!_wire_put_value(buf, v))
+				return 0;
+	}
+
+	return 1;
+}
+
+static int _wire_start(struct buffer *buf)
+{
+	return _wire_put(buf, DAEMON_FRAME_MAGIC, 4) &&
+		_wire_put_u32(buf, 0);
+}
+
+static void _wire_finish(struct buffer *buf)
+{
+	uint32_t len = (uint32_t) (buf->used - DAEMON_FRAME_HEADER_SIZE);
+
+	memcpy(buf->mem + 4, &len, sizeof(len));
+}
+
+int buffer_binary_vf(struct buffer *buf, const char *key, const char *id, va_list ap)
+{
+	struct buffer bin;
+	const char *next;
+	const char *eq;
+	const char *string;
+	int keylen;
+	int r = 0;
+
+	buffer_init(&bin);
+
+	if (!_wire_start(&bin) ||
+	    !_wire_put_scalar(&bin, key, strlen(key)) ||
+	    !_wire_put_str(&bin, id))
+		goto out;
+
+	while ((next = va_arg(ap, const char *))) {
+		if (!(eq = strchr(next, '='))) {
+			log_error(INTERNAL_ERROR "Bad format string at '%s'", next);
+			goto out;
+		}
+		if (strstr(next, "%d")) {
+			log_error(INTERNAL_ERROR "Do not use  %%d and use correct 64bit form");
+			goto out;
+		}
+
+		for (keylen = eq - next; keylen && next[keylen - 1] == ' '; keylen--)
+			;
+
+		if (strstr(next, FMTd64)) {
+			if (!_wire_put_scalar(&bin, next, keylen) ||
+			    !_wire_put_int(&bin, va_arg(ap, int64_t)))
+				goto out;
+		} else if (strstr(next, "%s") && (string = va_arg(ap, const char *))) {
+			if (!_wire_put_scalar(&bin, next, keylen) ||
+			    !_wire_put_str(&bin, string))
+				goto out;
+		} else {
+			/* %b blocks, literal text and NULL strings */
+			r = -1;
+			goto out;
+		}
+	}
+
+	_wire_finish(&bin);
+	*buf = bin;
+
+	return 1;
+out:
+	buffer_destroy(&bin);
+	return r;
+}
+
+int buffer_binary_node(struct buffer *buf, const struct dm_config_node *cn)
+{
+	if (!_wire_start(buf) || !_wire_put_node(buf, cn)) {
+		buffer_destroy(buf);
+		return 0;
+	}
+
+	_wire_finish(buf);
+
+	return 1;
+}
+
+struct wire_in {
+	const char *pos;
+	const char *end;
+};
+
+static int _wire_get(struct wire_in *in, void *data, size_t len)
+{
+	if ((size_t) (in->end - in->pos) < len)
+		return 0;
+
+	memcpy(data, in->pos, len);
+	in->pos += len;
+	return 1;
+}
+
+static const char *_wire_get_str(struct wire_in *in, struct dm_pool *mem, size_t len)
+{
+	const char *str;
+
+	if ((size_t) (in->end - in->pos) < len)
+		return NULL;
+
+	str = dm_pool_strndup(mem, in->pos, len);
+	in->pos += len;
+	return str;
+}
+
+static int _wire_get_value(struct wire_in *in, struct dm_pool *mem,
+			   struct dm_config_value *v)
+{
+	uint32_t len;
+	uint8_t type;
+
+	if (!_wire_get(in, &type, sizeof(type)))
+		return 0;
+
+	switch (type) {
+	case DM_CFG_INT:
+		v->type = DM_CFG_INT;
+		return _wire_get(in, &v->v.i, sizeof(v->v.i));
+	case DM_CFG_FLOAT:
+		v->type = DM_CFG_FLOAT;
+		return _wire_get(in, &v->v.f, sizeof(v->v.f));
+	case DM_CFG_STRING:
+		v->type = DM_CFG_STRING;
+		return _wire_get(in, &len, sizeof(len)) &&
+			(v->v.str = _wire_get_str(in, mem, len));
+	case DM_CFG_EMPTY_ARRAY:
+		v->type = DM_CFG_EMPTY_ARRAY;
+		return 1;
+	}
+
+	return 0;
+}
+
+struct dm_config_tree *config_tree_from_binary(const struct buffer *buf)
+{
+	struct dm_config_tree *cft;
+	struct dm_config_node *cn, *parent = NULL, *last = NULL;
+	struct dm_config_value *v, *last_v;
+	struct wire_in in;
+	uint32_t flags, count;
+	uint16_t keylen;
+	uint8_t tag;
+
+	if (buffer_frame_size(buf) != buf->used) {
+		log_error("Invalid binary message header.");
+		return NULL;
+	}
+
+	if (!(cft = dm_config_create()))
+		return_NULL;
+
+	in.pos = buf->mem + DAEMON_FRAME_HEADER_SIZE;
+	in.end = buf->mem + buf->used;
+
+	while (in.pos < in.end) {
+		if (!_wire_get(&in, &tag, sizeof(tag)))
+			goto_bad;
+
+		if (tag == WIRE_END) {
+			if (!parent)
+				goto_bad;
+			last = parent;
+			parent = parent->parent;
+			continue;
+		}
+
+		if ((tag != WIRE_SECTION && tag != WIRE_VALUE) ||
+		    !_wire_get(&in, &keylen, sizeof(keylen)) ||
+		    !(cn = dm_pool_zalloc(cft->mem, sizeof(*cn))) ||
+		    !(cn->key = _wire_get_str(&in, cft->mem, keylen)))
+			goto_bad;
+
+		cn->parent = parent;
+		if (last)
+			last->sib = cn;
+		else if (parent)
+			parent->child = cn;
+		else
+			cft->root = cn;
+		last = cn;
+
+		if (tag == WIRE_SECTION) {
+			parent = cn;
+			last = NULL;
+			continue;
+		}
+
+		if (!_wire_get(&in, &flags, sizeof(flags)) ||
+		    !_wire_get(&in, &count, sizeof(count)) || !count)
+			goto_bad;
+
+		for (last_v = NULL; count; count--, last_v = v) {
+			if (!(v = dm_config_create_value(cft)) ||
+			    !_wire_get_value(&in, cft->mem, v))
+				goto_bad;
+			if (last_v)
+				last_v->next = v;
+			else {
+				v->format_flags = flags;
+				cn->v = v;
+			}
+		}
+	}
+
+	if (parent)
+		goto_bad;
+
+	return cft;
+bad:
+	log_error("Failed to decode binary message.");
+	dm_config_destroy(cft);
+	return NULL;
+}
+
+struct dm_config_tree *config_tree_from_buffer(const struct buffer *buf)
+{
+	if (buffer_is_binary(buf))
+		return config_tree_from_binary(buf);
+
+	if (!buf->mem)
+		return_NULL;
+
+	return config_tree_from_string_without_dup_node_check(buf->mem);
+}
+
+int buffer_to_text(struct buffer *buf)
+{
+	struct dm_config_tree *cft;
+	struct buffer text;
+
+	if (!buffer_is_binary(buf))
+		return 1;
+
+	if (!(cft = config_tree_from_binary(buf)))
+		return_0;
+
+	buffer_init(&text);
+
+	if (!dm_config_write_node(cft->root, buffer_line, &text) ||
+	    (!text.mem && !buffer_append(&text, ""))) {
+		buffer_destroy(&text);
+		dm_config_destroy(cft);
+		return_0;
+	}
+
+	dm_config_destroy(cft);
+	buffer_destroy(buf);
+	*buf = text;
+
+	return 1;
+}
@@ -30,6 +30,30 @@ int buffer_realloc(struct buffer *buf, int needed);
 
 int buffer_line(const char *line, void *baton);
 
+/*
+ * Binary messages.  A frame starts with DAEMON_FRAME_MAGIC and the length
+ * of the body, which holds the config tree as a sequence of tagged nodes
+ * and typed values.  Text messages never start with a NUL byte, so both
+ * encodings can be told apart on the wire.  The binary encoding is only
+ * used once the daemon advertised it in its reply to "hello".
+ */
+#define DAEMON_FRAME_MAGIC "\0LDB"
+#define DAEMON_FRAME_HEADER_SIZE 8
+
+int buffer_is_binary(const struct buffer *buf);
+int buffer_frame_size(const struct buffer *buf);
+
+/*
+ * Start a binary frame with "key = id" and append the "name = %?" list
+ * used by buffer_append_vf.  Returns -1 without touching the buffer when
+ * the list holds something only the text format can carry (%b, NULL).
+ */
+int buffer_binary_vf(struct buffer *buf, const char *key, const char *id, va_list ap);
+int buffer_binary_node(struct buffer *buf, const struct dm_config_node *cn);
+
+/* Replace a binary frame with the same message in the text format. */
+int buffer_to_text(struct buffer *buf);
+
 int set_flag(struct dm_config_tree *cft, struct dm_config_node *parent,
 	     const char *field, const char *flag, int want);
 
@@ -67,5 +91,9 @@ struct dm_config_node *config_make_nodes(struct dm_config_tree *cft,
 					 ...);
 
 struct dm_config_tree *config_tree_from_string_without_dup_node_check(const char *config_settings);
+struct dm_config_tree *config_tree_from_binary(const struct buffer *buf);
+
+/* Parse a message read by buffer_read, in either encoding. */
+struct dm_config_tree *config_tree_from_buffer(const struct buffer *buf);
 
 #endif /* _LVM_DAEMON_CONFIG_UTIL_H */
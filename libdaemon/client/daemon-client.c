@@ -62,6 +62,7 @@ daemon_handle daemon_open(daemon_info i)
 	if (h.protocol)
 		h.protocol = strdup(h.protocol); /* keep around */
 	h.protocol_version = daemon_reply_int(r, "version", 0);
+	h.binary = daemon_reply_int(r, "binary", 0) ? 1 : 0;
 
 	if (i.protocol && (!h.protocol || strcmp(h.protocol, i.protocol))) {
 		log_error("Daemon %s: requested protocol %s != %s",
@@ -104,11 +105,17 @@ daemon_reply daemon_send(daemon_handle h, daemon_request rq)
 
 	buffer = rq.buffer;
 
-	if (!buffer.mem)
-		if (!dm_config_write_node(rq.cft->root, buffer_line, &buffer)) {
+	if (!buffer.mem) {
+		if (h.binary) {
+			if (!buffer_binary_node(&buffer, rq.cft->root)) {
+				reply.error = ENOMEM;
+				return reply;
+			}
+		} else if (!dm_config_write_node(rq.cft->root, buffer_line, &buffer)) {
 			reply.error = ENOMEM;
 			return reply;
 		}
+	}
 
 	if (!buffer.mem) {
 		log_error(INTERNAL_ERROR "Daemon send: no memory available");
@@ -120,7 +127,7 @@ daemon_reply daemon_send(daemon_handle h, daemon_request rq)
 		reply.error = errno;
 
 	if (buffer_read(h.socket_fd, &reply.buffer)) {
-		reply.cft = config_tree_from_string_without_dup_node_check(reply.buffer.mem);
+		reply.cft = config_tree_from_buffer(&reply.buffer);
 		if (!reply.cft)
 			reply.error = EPROTO;
 	} else
@@ -145,10 +152,19 @@ daemon_reply daemon_send_simple_v(daemon_handle h, const char *id, va_list ap)
 	daemon_request rq = { .cft = NULL };
 	daemon_reply repl;
 	va_list apc;
+	int r = -1;
+
+	if (h.binary) {
+		va_copy(apc, ap);
+		r = buffer_binary_vf(&rq.buffer, "request", id, apc);
+		va_end(apc);
+		if (!r)
+			return err;
+	}
 
 	va_copy(apc, ap);
-	if (!buffer_append_f(&rq.buffer, "request = %s", id, NULL) ||
-	    !buffer_append_vf(&rq.buffer, apc)) {
+	if (r < 0 && (!buffer_append_f(&rq.buffer, "request = %s", id, NULL) ||
+	    !buffer_append_vf(&rq.buffer, apc))) {
 		va_end(apc);
 		buffer_destroy(&rq.buffer);
 		return err;
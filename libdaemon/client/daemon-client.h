@@ -21,6 +21,7 @@ typedef struct {
 	int socket_fd; /* the fd we use to talk to the daemon */
 	const char *protocol;
 	int protocol_version;  /* version of the protocol the daemon uses */
+	int binary;  /* the daemon accepts binary messages */
 	int error;
 } daemon_handle;
 
@@ -76,7 +77,8 @@ daemon_handle daemon_open(daemon_info i);
  * In case the request contains a non-NULL buffer pointer, this buffer is sent
  * *verbatim* to the server. In this case, the cft pointer may be NULL (but will
  * be ignored even if non-NULL). If the buffer is NULL, the cft is required to
- * be a valid pointer, and is used to build up the request.
+ * be a valid pointer, and is used to build up the request, in the binary
+ * format if the daemon announced it. The reply may come in either format.
  */
 daemon_reply daemon_send(daemon_handle h, daemon_request rq);
 
@@ -19,25 +19,51 @@
 #include "libdaemon/client/daemon-io.h"
 
 #include <errno.h>
+#include <poll.h>
 
 /*
- * Read a single message from a (socket) filedescriptor. Messages are delimited
- * by blank lines. This call will block until all of a message is received. The
- * memory will be allocated from heap. Upon error, all memory is freed and the
- * buffer pointer is set to NULL.
- *
- * See also write_buffer about blocking (read_buffer has identical behaviour).
+ * Read a message from a (socket) filedescriptor into buffer, appending to
+ * what an earlier call left there.  Text messages are delimited by blank
+ * lines, binary frames carry their size in the header (see config-util.h).
+ * With wait set, blocks until all of the message is received.  Without,
+ * returns 0 with errno EAGAIN when the rest is not there yet.
  */
-int buffer_read(int fd, struct buffer *buffer) {
+static int _buffer_read(int fd, struct buffer *buffer, int wait)
+{
 	int result;
+	int size = 0; /* of a binary frame, once its header is in */
 
-	if (!buffer_realloc(buffer, 32)) /* ensure we have some space */
+	if (buffer->used >= DAEMON_FRAME_HEADER_SIZE && !buffer->mem[0])
+		size = buffer_frame_size(buffer);
+
+	if ((buffer->allocated - buffer->used < 32) &&
+	    !buffer_realloc(buffer, 32)) /* ensure we have some space */
 		return 0;
 
 	while (1) {
-		result = read(fd, buffer->mem + buffer->used, buffer->allocated - buffer->used);
+		result = read(fd, buffer->mem + buffer->used,
+			      (size ? size : buffer->allocated) - buffer->used);
 		if (result > 0) {
 			buffer->used += result;
+			if (!buffer->mem[0]) {
+				if (!size && buffer->used >= DAEMON_FRAME_HEADER_SIZE) {
+					if (!(size = buffer_frame_size(buffer))) {
+						errno = EPROTO;
+						return 0;
+					}
+					if ((buffer->allocated < size) &&
+					    !buffer_realloc(buffer, size))
+						return 0;
+				}
+				if (size && buffer->used >= size) {
+					if (buffer->used > size) {
+						errno = EPROTO;
+						return 0;
+					}
+					break; /* success, the whole frame is in */
+				}
+				continue;
+			}
 			if (buffer->used >= 4 && !strncmp((buffer->mem) + buffer->used - 4, "\n##\n", 4)) {
 				buffer->used -= 4;
 				buffer->mem[buffer->used] = 0;
@@ -49,31 +75,58 @@ int buffer_read(int fd, struct buffer *buffer) {
 		} else if (result == 0) {
 			errno = ECONNRESET;
 			return 0; /* we should never encounter EOF here */
-		} else if (result < 0 && (errno == EAGAIN ||
-					  (EWOULDBLOCK != EAGAIN && errno == EWOULDBLOCK) ||
-					  errno == EINTR || errno == EIO)) {
-			fd_set in;
-			FD_ZERO(&in);
-			FD_SET(fd, &in);
+		} else if (!wait) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EWOULDBLOCK)
+				errno = EAGAIN; /* the rest is not there yet */
+			return 0;
+		} else if (errno == EAGAIN ||
+			   (EWOULDBLOCK != EAGAIN && errno == EWOULDBLOCK) ||
+			   errno == EINTR || errno == EIO) {
+			struct pollfd pfd = { .fd = fd, .events = POLLIN };
 			/* ignore the result, this is just a glorified sleep */
-			select(FD_SETSIZE, &in, NULL, NULL, NULL);
-		} else if (result < 0)
+			(void) poll(&pfd, 1, -1);
+		} else
 			return 0;
 	}
 
 	return 1;
 }
 
+/*
+ * Read a single message. This call will block until all of a message is
+ * received. The memory will be allocated from heap. Upon error, all memory is
+ * freed and the buffer pointer is set to NULL.
+ *
+ * See also write_buffer about blocking (read_buffer has identical behaviour).
+ */
+int buffer_read(int fd, struct buffer *buffer) {
+	return _buffer_read(fd, buffer, 1);
+}
+
+/*
+ * Read what is there of a message on a non-blocking fd.  Returns 1 once
+ * all of it is in.  Returns 0 with errno EAGAIN when more is to come:
+ * call again with the same buffer once fd is readable.
+ */
+int buffer_read_nonblocking(int fd, struct buffer *buffer)
+{
+	return _buffer_read(fd, buffer, 0);
+}
+
 /*
  * Write a buffer to a filedescriptor. Keep trying. Blocks (even on
- * SOCK_NONBLOCK) until all of the write went through.
+ * SOCK_NONBLOCK) until all of the write went through. Binary frames are
+ * sent without the text terminator.
  */
 int buffer_write(int fd, const struct buffer *buffer) {
 	static const struct buffer _terminate = { .mem = (char *) "\n##\n", .used = 4 };
 	const struct buffer *use;
+	int parts = buffer_is_binary(buffer) ? 1 : 2;
 	int done, written, result;
 
-	for (done = 0; done < 2; ++done) {
+	for (done = 0; done < parts; ++done) {
 		use = (done == 0) ? buffer : &_terminate;
 		for (written = 0; written < use->used;) {
 			result = write(fd, use->mem + written, use->used - written);
@@ -82,11 +135,9 @@ int buffer_write(int fd, const struct buffer *buffer) {
 			else if (result < 0 && (errno == EAGAIN ||
 						(EWOULDBLOCK != EAGAIN && errno == EWOULDBLOCK) ||
 						errno == EINTR || errno == EIO)) {
-				fd_set out;
-				FD_ZERO(&out);
-				FD_SET(fd, &out);
+				struct pollfd pfd = { .fd = fd, .events = POLLOUT };
 				/* ignore the result, this is just a glorified sleep */
-				select(FD_SETSIZE, NULL, &out, NULL, NULL);
+				(void) poll(&pfd, 1, -1);
 			} else if (result < 0)
 				return 0; /* too bad */
 		}
@@ -20,6 +20,7 @@
 /* TODO function names */
 
 int buffer_read(int fd, struct buffer *buffer);
+int buffer_read_nonblocking(int fd, struct buffer *buffer);
 int buffer_write(int fd, const struct buffer *buffer);
 
 #endif /* _LVM_DAEMON_IO_H */
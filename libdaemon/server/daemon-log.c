@@ -143,6 +143,24 @@ void daemon_log_multi(log_state *s, int type, const char *prefix, const char *ms
 	free(buf);
 }
 
+void daemon_log_buffer(log_state *s, int type, const char *prefix, const struct buffer *buf)
+{
+	struct dm_config_tree *cft;
+
+	if (!_type_interesting(s, type))
+		return;
+
+	if (!buffer_is_binary(buf)) {
+		daemon_log_multi(s, type, prefix, buf->mem);
+		return;
+	}
+
+	if ((cft = config_tree_from_binary(buf))) {
+		daemon_log_cft(s, type, prefix, cft->root);
+		dm_config_destroy(cft);
+	}
+}
+
 void daemon_log_enable(log_state *s, int outlet, int type, int enable)
 {
 	if (type >= 32)
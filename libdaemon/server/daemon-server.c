@@ -21,6 +21,7 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sys/epoll.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -87,9 +88,10 @@ static int _is_idle(daemon_state s)
 	return s.idle && s.idle->is_idle && !s.threads->next;
 }
 
-static struct timeval *_get_timeout(daemon_state s)
+/* In milliseconds for epoll_wait, -1 waits without a timeout. */
+static int _get_timeout(daemon_state s)
 {
-	return s.idle ? s.idle->ptimeout : NULL;
+	return s.idle ? s.idle->ptimeout->tv_sec * 1000 + s.idle->ptimeout->tv_usec / 1000 : -1;
 }
 
 static void _reset_timeout(daemon_state s)
@@ -416,10 +418,24 @@ response daemon_reply_simple(const char *id, ...)
 {
 	va_list ap;
 	response res = { .cft = NULL };
+	int r;
 
+	buffer_init(&res.buffer);
+
+	/* Text clients get the reply converted in _client_request. */
 	va_start(ap, id);
+	r = buffer_binary_vf(&res.buffer, "response", id, ap);
+	va_end(ap);
 
-	buffer_init(&res.buffer);
+	if (r > 0)
+		return res;
+
+	va_start(ap, id);
+
+	if (!r) {
+		res.error = ENOMEM;
+		goto end;
+	}
 	if (!buffer_append_f(&res.buffer, "response = %s", id, NULL)) {
 		res.error = ENOMEM;
 		goto end;
@@ -441,65 +457,239 @@ static response _builtin_handler(daemon_state s, client_handle h, request r)
 
 	if (!strcmp(rq, "hello")) {
 		return daemon_reply_simple("OK", "protocol = %s", s.protocol ?: "default",
-					   "version = %" PRId64, (int64_t) s.protocol_version, NULL);
+					   "version = %" PRId64, (int64_t) s.protocol_version,
+					   "binary = %" PRId64, INT64_C(1), NULL);
 	}
 
 	buffer_init(&res.buffer);
 	return res;
 }
 
-static void *_client_thread(void *state)
+/*
+ * Clients are served by a fixed pool of worker threads.  The main loop
+ * waits on the listening socket and on all client sockets with epoll.
+ * Client sockets are registered with EPOLLONESHOT, so a client with a
+ * request is handed to a single worker, which reads the request, sends
+ * the response and rearms the socket.  A client can keep its connection
+ * open for further requests without holding a thread.  Client sockets
+ * are non-blocking: a worker takes what is there of a request, keeps it
+ * in the client's thread_state and rearms the socket for the rest, so a
+ * client that stalls halfway through a request does not hold a thread
+ * either.
+ */
+
+#define DAEMON_WORKER_THREADS 8
+#define DAEMON_MAX_EVENTS 64
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	thread_state *queue;		/* clients with a request waiting */
+	thread_state **queue_tail;
+	unsigned closed;		/* clients waiting for _reap */
+	int stop;
+	int epoll_fd;
+	pthread_t *workers;
+	int worker_count;
+} _pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.queue_tail = &_pool.queue,
+	.epoll_fd = -1,
+};
+
+/*
+ * Read what the client sent and once a whole request is in, send the
+ * response, in the format of the request.  Returns 0 when the client is
+ * to be closed.
+ */
+static int _client_request(thread_state *ts)
 {
-	thread_state *ts = state;
 	request req;
 	response res;
+	int binary;
 
-	buffer_init(&req.buffer);
+	if (!buffer_read_nonblocking(ts->client.socket_fd, &ts->req))
+		return (errno == EAGAIN);
 
-	while (1) {
-		if (!buffer_read(ts->client.socket_fd, &req.buffer))
-			goto fail;
+	req.buffer = ts->req;
+	buffer_init(&ts->req);
 
-		req.cft = config_tree_from_string_without_dup_node_check(req.buffer.mem);
+	binary = buffer_is_binary(&req.buffer);
+	req.cft = config_tree_from_buffer(&req.buffer);
 
-		if (!req.cft)
-			fprintf(stderr, "error parsing request:\n %s\n", req.buffer.mem);
-		else
-			daemon_log_cft(ts->s.log, DAEMON_LOG_WIRE, "<- ", req.cft->root);
+	if (!req.cft)
+		fprintf(stderr, "error parsing request:\n %s\n", binary ? "(binary)" : req.buffer.mem);
+	else
+		daemon_log_cft(ts->s.log, DAEMON_LOG_WIRE, "<- ", req.cft->root);
 
-		res = _builtin_handler(ts->s, ts->client, req);
+	res = _builtin_handler(ts->s, ts->client, req);
 
-		if (res.error == EPROTO) /* Not a builtin, delegate to the custom handler. */
-			res = ts->s.handler(ts->s, ts->client, req);
+	if (res.error == EPROTO) /* Not a builtin, delegate to the custom handler. */
+		res = ts->s.handler(ts->s, ts->client, req);
 
-		if (!res.buffer.mem) {
+	if (!res.buffer.mem) {
+		if (binary) {
+			if (!buffer_binary_node(&res.buffer, res.cft->root))
+				goto fail;
+		} else {
 			if (!dm_config_write_node(res.cft->root, buffer_line, &res.buffer))
 				goto fail;
 			if (!buffer_append(&res.buffer, "\n\n"))
 				goto fail;
-			dm_config_destroy(res.cft);
 		}
+		dm_config_destroy(res.cft);
+	} else if (!binary && !buffer_to_text(&res.buffer))
+		goto fail;
 
-		if (req.cft)
-			dm_config_destroy(req.cft);
-		buffer_destroy(&req.buffer);
+	if (req.cft)
+		dm_config_destroy(req.cft);
+	buffer_destroy(&req.buffer);
 
-		daemon_log_multi(ts->s.log, DAEMON_LOG_WIRE, "-> ", res.buffer.mem);
-		buffer_write(ts->client.socket_fd, &res.buffer);
+	daemon_log_buffer(ts->s.log, DAEMON_LOG_WIRE, "-> ", &res.buffer);
+	buffer_write(ts->client.socket_fd, &res.buffer);
 
-		buffer_destroy(&res.buffer);
-	}
+	buffer_destroy(&res.buffer);
+
+	return 1;
 fail:
+	buffer_destroy(&req.buffer);
+	return 0;
+}
+
+static void _client_close(thread_state *ts)
+{
 	/* TODO what should we really do here? */
 	if (close(ts->client.socket_fd))
 		perror("close");
-	buffer_destroy(&req.buffer);
+
+	pthread_mutex_lock(&_pool.mutex);
 	ts->active = 0;
+	_pool.closed++;
+	pthread_mutex_unlock(&_pool.mutex);
+}
+
+static void *_worker_thread(void *arg __attribute__((unused)))
+{
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT };
+	thread_state *ts;
+
+	pthread_mutex_lock(&_pool.mutex);
+	while (1) {
+		while (!_pool.queue && !_pool.stop)
+			pthread_cond_wait(&_pool.cond, &_pool.mutex);
+
+		if (!(ts = _pool.queue))
+			break;
+
+		if (!(_pool.queue = ts->work_next))
+			_pool.queue_tail = &_pool.queue;
+		pthread_mutex_unlock(&_pool.mutex);
+
+		ts->client.thread_id = pthread_self();
+
+		if (_client_request(ts)) {
+			ev.data.ptr = ts;
+			if (!epoll_ctl(_pool.epoll_fd, EPOLL_CTL_MOD, ts->client.socket_fd, &ev))
+				goto next;
+			ERROR(&ts->s, "Failed to rearm client socket: %s.", strerror(errno));
+		}
+
+		_client_close(ts);
+next:
+		pthread_mutex_lock(&_pool.mutex);
+	}
+	pthread_mutex_unlock(&_pool.mutex);
+
 	return NULL;
 }
 
+static void _queue_client(thread_state *ts)
+{
+	pthread_mutex_lock(&_pool.mutex);
+	ts->work_next = NULL;
+	*_pool.queue_tail = ts;
+	_pool.queue_tail = &ts->work_next;
+	pthread_cond_signal(&_pool.cond);
+	pthread_mutex_unlock(&_pool.mutex);
+}
+
+static int _pool_start(daemon_state *s)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	pthread_attr_t attr;
+	sigset_t sigs, old;
+	int count = s->worker_threads ? : DAEMON_WORKER_THREADS;
+	int r = 0;
+
+	if ((_pool.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		ERROR(s, "Failed to create epoll fd: %s.", strerror(errno));
+		return 0;
+	}
+
+	if (epoll_ctl(_pool.epoll_fd, EPOLL_CTL_ADD, s->socket_fd, &ev)) {
+		ERROR(s, "Failed to add socket fd %d to epoll: %s.", s->socket_fd, strerror(errno));
+		return 0;
+	}
+
+	if (!(_pool.workers = calloc(count, sizeof(pthread_t)))) {
+		ERROR(s, "Failed to allocate worker threads.");
+		return 0;
+	}
+
+	/* Leave the exit signals to the main loop. */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGHUP);
+	sigaddset(&sigs, SIGQUIT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &sigs, &old);
+
+	pthread_attr_init(&attr);
+	if (s->thread_stack_size > 0)
+		pthread_attr_setstacksize(&attr, s->thread_stack_size + getpagesize());
+
+	for (_pool.worker_count = 0; _pool.worker_count < count; _pool.worker_count++)
+		if ((errno = pthread_create(&_pool.workers[_pool.worker_count], &attr,
+					    _worker_thread, NULL))) {
+			ERROR(s, "Failed to create worker thread: %s.", strerror(errno));
+			goto out;
+		}
+
+	r = 1;
+out:
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return r;
+}
+
+static void _pool_stop(daemon_state s)
+{
+	int i;
+
+	pthread_mutex_lock(&_pool.mutex);
+	_pool.stop = 1;
+	pthread_cond_broadcast(&_pool.cond);
+	pthread_mutex_unlock(&_pool.mutex);
+
+	for (i = 0; i < _pool.worker_count; i++)
+		if ((errno = pthread_join(_pool.workers[i], NULL)))
+			ERROR(&s, "pthread_join failed: %s", strerror(errno));
+
+	free(_pool.workers);
+	_pool.workers = NULL;
+	_pool.worker_count = 0;
+
+	if (_pool.epoll_fd >= 0 && close(_pool.epoll_fd))
+		perror("epoll close");
+	_pool.epoll_fd = -1;
+}
+
 static int _handle_connect(daemon_state s)
 {
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT };
 	thread_state *ts;
 	struct sockaddr_un sockaddr;
 	client_handle client = { .thread_id = 0 };
@@ -515,6 +705,13 @@ static int _handle_connect(daemon_state s)
 	 if (fcntl(client.socket_fd, F_SETFD, FD_CLOEXEC))
 		WARN(&s, "setting CLOEXEC on client socket fd %d failed", client.socket_fd);
 
+	if (fcntl(client.socket_fd, F_SETFL, fcntl(client.socket_fd, F_GETFL, 0) | O_NONBLOCK)) {
+		ERROR(&s, "Failed to set O_NONBLOCK on client socket: %s.", strerror(errno));
+		if (close(client.socket_fd))
+			perror("close");
+		return 0;
+	}
+
 	if (!(ts = malloc(sizeof(thread_state)))) {
 		if (close(client.socket_fd))
 			perror("close");
@@ -522,31 +719,49 @@ static int _handle_connect(daemon_state s)
 		return 0;
 	}
 
-	ts->next = s.threads->next;
-	s.threads->next = ts;
-
 	ts->active = 1;
 	ts->s = s;
 	ts->client = client;
+	ts->work_next = NULL;
+	buffer_init(&ts->req);
 
-	if ((errno = pthread_create(&ts->client.thread_id, NULL, _client_thread, ts))) {
-		ERROR(&s, "Failed to create client thread: %s.", strerror(errno));
+	ev.data.ptr = ts;
+	if (epoll_ctl(_pool.epoll_fd, EPOLL_CTL_ADD, client.socket_fd, &ev)) {
+		ERROR(&s, "Failed to add client socket to epoll: %s.", strerror(errno));
+		if (close(client.socket_fd))
+			perror("close");
+		free(ts);
 		return 0;
 	}
 
+	ts->next = s.threads->next;
+	s.threads->next = ts;
+
 	return 1;
 }
 
+/*
+ * Free the state of closed clients.  With waiting set, the workers have
+ * stopped and any clients still connected are closed too.
+ */
 static void _reap(daemon_state s, int waiting)
 {
 	thread_state *last = s.threads, *ts = last->next;
-	void *rv;
+
+	pthread_mutex_lock(&_pool.mutex);
+	if (!waiting && !_pool.closed) {
+		pthread_mutex_unlock(&_pool.mutex);
+		return;
+	}
+	_pool.closed = 0;
+	pthread_mutex_unlock(&_pool.mutex);
 
 	while (ts) {
 		if (waiting || !ts->active) {
-			if ((errno = pthread_join(ts->client.thread_id, &rv)))
-				ERROR(&s, "pthread_join failed: %s", strerror(errno));
+			if (ts->active && close(ts->client.socket_fd))
+				perror("close");
 			last->next = ts->next;
+			buffer_destroy(&ts->req);
 			free(ts);
 		} else
 			last = ts;
@@ -560,7 +775,8 @@ void daemon_start(daemon_state s)
 	log_state _log = { { 0 } };
 	thread_state _threads = { .next = NULL };
 	unsigned timeout_count = 0;
-	fd_set in;
+	struct epoll_event events[DAEMON_MAX_EVENTS];
+	int i, n;
 
 	/*
 	 * Switch to C locale to avoid reading large locale-archive file used by
@@ -643,15 +859,25 @@ void daemon_start(daemon_state s)
 		if (!s.daemon_init(&s))
 			failed = 1;
 
+	if (!failed && !_pool_start(&s))
+		failed = 1;
+
 	while (!failed) {
 		_reset_timeout(s);
-		FD_ZERO(&in);
-		FD_SET(s.socket_fd, &in);
-		if (select(FD_SETSIZE, &in, NULL, NULL, _get_timeout(s)) < 0 && errno != EINTR)
-			perror("select error");
-		if (FD_ISSET(s.socket_fd, &in)) {
-			timeout_count = 0;
-			_handle_connect(s);
+		/* Poll for the last clients to go away once shutdown is requested. */
+		if ((n = epoll_wait(_pool.epoll_fd, events, DAEMON_MAX_EVENTS,
+				    _shutdown_requested ? 100 : _get_timeout(s))) < 0) {
+			if (errno != EINTR)
+				perror("epoll_wait error");
+			n = 0;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!events[i].data.ptr) {
+				timeout_count = 0;
+				_handle_connect(s);
+			} else
+				_queue_client(events[i].data.ptr);
 		}
 
 		_reap(s, 0);
@@ -670,6 +896,7 @@ void daemon_start(daemon_state s)
 	}
 
 	INFO(&s, "%s waiting for client threads to finish", s.name);
+	_pool_stop(s);
 	_reap(s, 1);
 out:
 	/* If activated by systemd, do not unlink the socket - systemd takes care of that! */
@@ -95,6 +95,12 @@ typedef struct daemon_state {
 	 */
 	int thread_stack_size;
 
+	/*
+	 * Number of threads serving client requests, DAEMON_WORKER_THREADS
+	 * when 0.  Clients stay connected without holding a thread.
+	 */
+	int worker_threads;
+
 	/* Flags & attributes affecting the behaviour of the daemon. */
 	unsigned avoid_oom:1;
 	unsigned foreground:1;
@@ -121,10 +127,13 @@ typedef struct daemon_state {
 	void *private; /* the global daemon state */
 } daemon_state;
 
+/* One for each connected client, on daemon_state.threads. */
 typedef struct thread_state {
 	daemon_state s;
 	client_handle client;
 	struct thread_state *next;
+	struct thread_state *work_next; /* queue of clients for the workers */
+	struct buffer req; /* request read so far */
 	volatile int active;
 } thread_state;
 
@@ -169,6 +178,9 @@ void daemon_log_cft(log_state *s, int type, const char *prefix,
 /* Log a multi-line block, prefixing each line with "prefix". */
 void daemon_log_multi(log_state *s, int type, const char *prefix, const char *message);
 
+/* Log a message as read or written on a socket, in either format. */
+void daemon_log_buffer(log_state *s, int type, const char *prefix, const struct buffer *buf);
+
 /* Log a formatted message as "type". See also daemon-log.h. */
 void daemon_logf(log_state *s, int type, const char *format, ...)
 	__attribute__ ((format(printf, 3, 4)));
@@ -22,13 +22,17 @@
 #include "configure.h"
 #include "libdm/misc/dm-logging.h"
 #include "libdm/dm-tools/util.h"
+#include "libdm/dmstats_shm.h"
 
 #include <ctype.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <langinfo.h>
 #include <locale.h>
+#include <math.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -6098,6 +6102,524 @@ bad:
 	return 0;
 }
 
+/*
+ * Stats daemon: sample every region of every device once per interval
+ * and publish per-region counters and metrics in a shared memory ring
+ * that readers consume without issuing ioctls (see dmstats_shm.h).
+ */
+#define DMSTATS_SHM_NR_SLOTS 8
+#define DMSTATS_SHM_MIN_RECORDS 64
+
+struct stats_daemon_dev {
+	struct dm_list list;
+	struct dm_stats *dms;
+	char *name;
+	uint32_t major;
+	uint32_t minor;
+	uint64_t pass;		/* last pass this device was listed in */
+	uint64_t *ids;		/* region_ids sampled in this pass */
+	uint64_t nr_ids;
+	uint64_t *prev_ids;	/* and in the pass before */
+	uint64_t nr_prev_ids;
+	struct dm_timestamp *ts;
+	struct dm_timestamp *prev_ts;
+};
+
+struct stats_ring {
+	const char *path;
+	int fd;
+	size_t size;
+	uint64_t seq;		/* last sample number published */
+	struct dmstats_shm_header *hdr;
+};
+
+static volatile sig_atomic_t _stats_daemon_exit = 0;
+
+static void _stats_daemon_sig(int sig __attribute__((unused)))
+{
+	_stats_daemon_exit = 1;
+}
+
+static size_t _shm_slot_size(uint64_t max_records)
+{
+	return sizeof(struct dmstats_shm_slot) +
+		max_records * sizeof(struct dmstats_shm_record);
+}
+
+static struct dmstats_shm_slot *_shm_slot(struct dmstats_shm_header *hdr,
+					  uint64_t seq)
+{
+	return (struct dmstats_shm_slot *) ((char *) hdr + hdr->header_size +
+					    (seq % hdr->nr_slots) * hdr->slot_size);
+}
+
+/*
+ * Tell readers of the current ring to re-open the path and unmap it.
+ */
+static void _shm_ring_retire(struct stats_ring *ring)
+{
+	if (!ring->hdr)
+		return;
+
+	__atomic_or_fetch(&ring->hdr->flags, DMSTATS_SHM_RETIRED, __ATOMIC_RELEASE);
+
+	if (munmap(ring->hdr, ring->size))
+		log_sys_debug("munmap", ring->path);
+	if (close(ring->fd))
+		log_sys_debug("close", ring->path);
+
+	ring->hdr = NULL;
+	ring->fd = -1;
+}
+
+/*
+ * Create a ring with room for max_records per sample and rename it
+ * over ring->path, retiring any previous ring. Sample numbers carry on
+ * from the previous ring.
+ */
+static int _shm_ring_create(struct stats_ring *ring, uint64_t max_records)
+{
+	struct dmstats_shm_header *hdr;
+	char tmp_path[PATH_MAX];
+	size_t size;
+	int fd;
+
+	size = sizeof(*hdr) + DMSTATS_SHM_NR_SLOTS * _shm_slot_size(max_records);
+
+	if (dm_snprintf(tmp_path, sizeof(tmp_path), "%s.%d",
+			ring->path, (int) getpid()) < 0) {
+		log_error("Shared memory path %s is too long.", ring->path);
+		return 0;
+	}
+
+	if ((fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0) {
+		log_sys_error("open", tmp_path);
+		return 0;
+	}
+
+	/* Zero filled: every slot starts out empty. */
+	if (ftruncate(fd, (off_t) size)) {
+		log_sys_error("ftruncate", tmp_path);
+		goto bad;
+	}
+
+	if ((hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0)) == MAP_FAILED) {
+		log_sys_error("mmap", tmp_path);
+		goto bad;
+	}
+
+	hdr->magic = DMSTATS_SHM_MAGIC;
+	hdr->version = DMSTATS_SHM_VERSION;
+	hdr->pid = (uint32_t) getpid();
+	hdr->nr_slots = DMSTATS_SHM_NR_SLOTS;
+	hdr->nr_counters = DMSTATS_SHM_NR_COUNTERS;
+	hdr->nr_metrics = DMSTATS_SHM_NR_METRICS;
+	hdr->header_size = sizeof(*hdr);
+	hdr->slot_size = _shm_slot_size(max_records);
+	hdr->record_size = sizeof(struct dmstats_shm_record);
+	hdr->max_records = max_records;
+	hdr->interval_ns = _interval;
+
+	if (rename(tmp_path, ring->path)) {
+		log_sys_error("rename", ring->path);
+		if (munmap(hdr, size))
+			log_sys_debug("munmap", tmp_path);
+		goto bad;
+	}
+
+	_shm_ring_retire(ring);
+
+	ring->hdr = hdr;
+	ring->fd = fd;
+	ring->size = size;
+
+	log_verbose("Publishing up to " FMTu64 " regions per sample in %s.",
+		    max_records, ring->path);
+
+	return 1;
+
+bad:
+	if (close(fd))
+		log_sys_debug("close", tmp_path);
+	if (unlink(tmp_path))
+		log_sys_debug("unlink", tmp_path);
+
+	return 0;
+}
+
+/*
+ * Invalidate the slot for the next sample before rewriting it: a
+ * reader that copied part of it sees the sequence number change.
+ */
+static struct dmstats_shm_slot *_shm_ring_begin(struct stats_ring *ring)
+{
+	struct dmstats_shm_slot *slot = _shm_slot(ring->hdr, ring->seq + 1);
+
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	return slot;
+}
+
+static void _shm_ring_commit(struct stats_ring *ring,
+			     struct dmstats_shm_slot *slot)
+{
+	ring->seq++;
+	__atomic_store_n(&slot->seq, ring->seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->hdr->seq, ring->seq, __ATOMIC_RELEASE);
+}
+
+static void _stats_daemon_dev_destroy(struct stats_daemon_dev *dev)
+{
+	dm_stats_destroy(dev->dms);
+	dm_timestamp_destroy(dev->ts);
+	dm_timestamp_destroy(dev->prev_ts);
+	dm_free(dev->ids);
+	dm_free(dev->prev_ids);
+	dm_free(dev->name);
+	dm_free(dev);
+}
+
+static struct stats_daemon_dev *_stats_daemon_dev_create(struct dm_names *names)
+{
+	struct stats_daemon_dev *dev;
+
+	if (!(dev = dm_zalloc(sizeof(*dev))))
+		return_NULL;
+
+	dev->major = (uint32_t) MAJOR(names->dev);
+	dev->minor = (uint32_t) MINOR(names->dev);
+
+	if (!(dev->name = dm_strdup(names->name)) ||
+	    !(dev->dms = dm_stats_create(DM_STATS_PROGRAM_ID)) ||
+	    !(dev->ts = dm_timestamp_alloc()) ||
+	    !(dev->prev_ts = dm_timestamp_alloc()))
+		goto_bad;
+
+	if (!dm_stats_bind_devno(dev->dms, (int) dev->major, (int) dev->minor))
+		goto_bad;
+
+	return dev;
+
+bad:
+	_stats_daemon_dev_destroy(dev);
+	return NULL;
+}
+
+/*
+ * Was region_id also sampled in the previous pass? Counters of a new
+ * region cover an unknown interval and are not published.
+ */
+static int _stats_daemon_region_primed(const struct stats_daemon_dev *dev,
+				       uint64_t region_id)
+{
+	uint64_t lo = 0, hi = dev->nr_prev_ids, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (dev->prev_ids[mid] == region_id)
+			return 1;
+		if (dev->prev_ids[mid] < region_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+/*
+ * List the regions of a device and read and clear their counters.
+ * Returns the number of regions to publish in *nr_records.
+ */
+static int _stats_daemon_sample(struct stats_daemon_dev *dev,
+				const char *program_id, uint64_t *nr_records)
+{
+	struct dm_timestamp *ts;
+	uint64_t *ids, nr_regions, i;
+
+	ids = dev->prev_ids;
+	dev->prev_ids = dev->ids;
+	dev->nr_prev_ids = dev->nr_ids;
+	dev->ids = ids;
+	dev->nr_ids = 0;
+
+	/*
+	 * A DM_STATS_REGIONS_ALL populate lists the regions itself, but
+	 * refuses a handle that had none when it was last listed.
+	 */
+	if (!dm_stats_get_nr_regions(dev->dms) &&
+	    !dm_stats_list(dev->dms, program_id))
+		return_0;
+
+	if (!dm_stats_get_nr_regions(dev->dms))
+		return 1;
+
+	if (!dm_stats_populate(dev->dms, program_id, DM_STATS_REGIONS_ALL))
+		return_0;
+
+	if (!(nr_regions = dm_stats_get_nr_regions(dev->dms)))
+		return 1;
+
+	if (!(ids = dm_realloc(dev->ids, nr_regions * sizeof(*ids)))) {
+		log_error("Could not allocate region list for %s.", dev->name);
+		return 0;
+	}
+	dev->ids = ids;
+
+	dm_stats_foreach_region(dev->dms)
+		dev->ids[dev->nr_ids++] = dm_stats_get_current_region(dev->dms);
+
+	ts = dev->prev_ts;
+	dev->prev_ts = dev->ts;
+	dev->ts = ts;
+	if (!dm_timestamp_get(dev->ts))
+		return_0;
+
+	dm_stats_set_sampling_interval_ns(dev->dms,
+					  dm_timestamp_delta(dev->ts, dev->prev_ts));
+
+	for (i = 0; i < dev->nr_ids; i++)
+		if (_stats_daemon_region_primed(dev, dev->ids[i]))
+			(*nr_records)++;
+
+	return 1;
+}
+
+static void _stats_daemon_record(struct dmstats_shm_record *rec,
+				 const struct stats_daemon_dev *dev,
+				 uint64_t region_id)
+{
+	const struct dm_stats *dms = dev->dms;
+	int i;
+
+	memset(rec, 0, sizeof(*rec));
+	(void) dm_strncpy(rec->name, dev->name, sizeof(rec->name));
+	rec->major = dev->major;
+	rec->minor = dev->minor;
+	rec->region_id = region_id;
+	rec->group_id = dm_stats_get_group_id(dms, region_id);
+	(void) dm_stats_get_region_start(dms, &rec->start, region_id);
+	(void) dm_stats_get_region_len(dms, &rec->len, region_id);
+	rec->nr_areas = dm_stats_get_region_nr_areas(dms, region_id);
+
+	for (i = 0; i < DMSTATS_SHM_NR_COUNTERS; i++)
+		rec->counters[i] = dm_stats_get_counter(dms, (dm_stats_counter_t) i,
+							region_id,
+							DM_STATS_WALK_REGION);
+
+	for (i = 0; i < DMSTATS_SHM_NR_METRICS; i++)
+		if (!dm_stats_get_metric(dms, i, region_id, DM_STATS_WALK_REGION,
+					 &rec->metrics[i]))
+			rec->metrics[i] = NAN;
+}
+
+/*
+ * Find the devices present in this pass, adding new ones to the
+ * table and dropping the ones that went away.
+ */
+static int _stats_daemon_update_devs(struct dm_hash_table *devs_by_name,
+				     struct dm_list *devs, uint64_t pass)
+{
+	struct stats_daemon_dev *dev, *tmp;
+	struct dm_names *names;
+	struct dm_task *dmt;
+	unsigned next = 0;
+	int r = 0;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_LIST)))
+		return_0;
+
+	if (!_task_run(dmt))
+		goto_out;
+
+	if (!(names = dm_task_get_names(dmt)))
+		goto_out;
+
+	if (names->dev)
+		do {
+			names = (struct dm_names *)((char *) names + next);
+			next = names->next;
+
+			if (!(dev = dm_hash_lookup(devs_by_name, names->name)) ||
+			    (dev->major != MAJOR(names->dev)) ||
+			    (dev->minor != MINOR(names->dev))) {
+				if (dev) {
+					dm_hash_remove(devs_by_name, dev->name);
+					dm_list_del(&dev->list);
+					_stats_daemon_dev_destroy(dev);
+				}
+				if (!(dev = _stats_daemon_dev_create(names)))
+					goto_out;
+				if (!dm_hash_insert(devs_by_name, dev->name, dev)) {
+					_stats_daemon_dev_destroy(dev);
+					goto_out;
+				}
+				dm_list_add(devs, &dev->list);
+			}
+			dev->pass = pass;
+		} while (next);
+
+	dm_list_iterate_items_safe(dev, tmp, devs)
+		if (dev->pass != pass) {
+			log_verbose("Device %s removed.", dev->name);
+			dm_hash_remove(devs_by_name, dev->name);
+			dm_list_del(&dev->list);
+			_stats_daemon_dev_destroy(dev);
+		}
+
+	r = 1;
+out:
+	dm_task_destroy(dmt);
+	return r;
+}
+
+/*
+ * Sample all devices and publish the regions that were present in
+ * the previous pass as the next sample in the ring.
+ */
+static int _stats_daemon_pass(struct stats_ring *ring,
+			      struct dm_hash_table *devs_by_name,
+			      struct dm_list *devs, uint64_t pass,
+			      const char *program_id,
+			      struct dm_timestamp *pass_ts,
+			      struct dm_timestamp *prev_pass_ts)
+{
+	struct dmstats_shm_slot *slot;
+	struct stats_daemon_dev *dev;
+	uint64_t nr_records = 0, i;
+	struct timespec now;
+
+	if (!_stats_daemon_update_devs(devs_by_name, devs, pass))
+		return_0;
+
+	dm_list_iterate_items(dev, devs)
+		if (!_stats_daemon_sample(dev, program_id, &nr_records)) {
+			/* Removed since the list or no longer readable. */
+			log_warn("WARNING: Could not sample regions of %s.",
+				 dev->name);
+			dev->nr_ids = 0;
+		}
+
+	if (!dm_timestamp_get(pass_ts))
+		return_0;
+
+	/* Counters read by the first pass cover an unknown interval. */
+	if (pass == 1)
+		return 1;
+
+	if (nr_records > ring->hdr->max_records &&
+	    !_shm_ring_create(ring, 2 * nr_records))
+		return_0;
+
+	slot = _shm_ring_begin(ring);
+	slot->nr_records = 0;
+
+	dm_list_iterate_items(dev, devs)
+		for (i = 0; i < dev->nr_ids; i++)
+			if (_stats_daemon_region_primed(dev, dev->ids[i]))
+				_stats_daemon_record(&slot->records[slot->nr_records++],
+						     dev, dev->ids[i]);
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	slot->timestamp_ns = (uint64_t) now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+	slot->interval_ns = dm_timestamp_delta(pass_ts, prev_pass_ts);
+
+	_shm_ring_commit(ring, slot);
+
+	log_debug("Published sample " FMTu64 " with " FMTu64 " regions.",
+		  ring->seq, slot->nr_records);
+
+	return 1;
+}
+
+static int _stats_daemon(CMD_ARGS)
+{
+	struct dm_timestamp *pass_ts = NULL, *prev_pass_ts = NULL, *ts;
+	struct dm_hash_table *devs_by_name = NULL;
+	struct stats_daemon_dev *dev, *tmp;
+	struct stats_ring ring = { .fd = -1 };
+	const char *program_id = "";
+	struct sigaction act;
+	struct dm_list devs;
+	uint64_t pass = 0;
+	int r = 0;
+
+	if (names) {
+		log_error("Device names are not compatible with daemon.");
+		return 0;
+	}
+
+	/* All programs' regions unless restricted. */
+	if (_switches[PROGRAM_ID_ARG])
+		program_id = _string_args[PROGRAM_ID_ARG];
+
+	ring.path = argc ? argv[0] : DMSTATS_SHM_PATH;
+
+	dm_list_init(&devs);
+
+	if (!(devs_by_name = dm_hash_create(128)) ||
+	    !(pass_ts = dm_timestamp_alloc()) ||
+	    !(prev_pass_ts = dm_timestamp_alloc()))
+		goto_out;
+
+	if (!_shm_ring_create(&ring, DMSTATS_SHM_MIN_RECORDS))
+		goto_out;
+
+	if (!_switches[FOREGROUND_ARG]) {
+		if (daemon(0, _switches[VERBOSE_ARG])) {
+			log_sys_error("daemon", "");
+			goto out;
+		}
+		ring.hdr->pid = (uint32_t) getpid();
+	}
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = _stats_daemon_sig;
+	act.sa_flags = SA_RESTART;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	/* main() starts the timer when --interval is given */
+	if ((_count < 2) && !_start_timer())
+		goto_out;
+
+	while (!_stats_daemon_exit) {
+		ts = prev_pass_ts;
+		prev_pass_ts = pass_ts;
+		pass_ts = ts;
+
+		if (!_stats_daemon_pass(&ring, devs_by_name, &devs, ++pass,
+					program_id, pass_ts, prev_pass_ts))
+			goto_out;
+
+		if (!_stats_daemon_exit && !_do_timer_wait())
+			goto_out;
+	}
+
+	r = 1;
+out:
+	/* Do not let main() repeat the command for --interval. */
+	_count = 1;
+
+	dm_list_iterate_items_safe(dev, tmp, &devs)
+		_stats_daemon_dev_destroy(dev);
+
+	if (ring.hdr) {
+		if (unlink(ring.path))
+			log_sys_debug("unlink", ring.path);
+		_shm_ring_retire(&ring);
+	}
+
+	if (devs_by_name)
+		dm_hash_destroy(devs_by_name);
+	dm_timestamp_destroy(pass_ts);
+	dm_timestamp_destroy(prev_pass_ts);
+
+	return r;
+}
+
 /*
  * Command dispatch tables and usage.
  */
@@ -6116,6 +6638,8 @@ static int _stats_help(CMD_ARGS);
  *   create --filemap [--nogroup] [--nomonitor] [--follow=mode]
  *       [--programid <id>] [--userdata <data> ]
  *       [--bounds histogram_boundaries] [--precise] [<file_path>]
+ *   daemon [--interval <seconds>] [--programid id] [--foreground]
+ *       [<shm_path>]
  *   delete [--allprograms|--programid id]
  *       [--allregions|--regionid id]
  *       [--alldevices|<device>...]
@@ -6164,6 +6688,8 @@ static int _stats_help(CMD_ARGS);
 #define GROUP_OPTS "[--alias NAME] --regions <regions>" INDENT ALL_PROGS_OPT ALL_DEVICES_OPT
 #define UNGROUP_OPTS GROUP_ID_OPT ALL_PROGS_OPT INDENT ALL_DEVICES_OPT
 #define UPDATE_OPTS GROUP_ID_OPT INDENT FILE_MONITOR_OPTS " <file_path>"
+#define DAEMON_OPTS "[--interval <seconds>] [--programid <id>] [--foreground]" INDENT \
+"[<shm_path>]"
 
 /*
  * The 'create' command has two entries in the table, to allow for the
@@ -6175,6 +6701,7 @@ static struct command _stats_subcommands[] = {
 	{"clear", ALL_REGIONS_OPT ALL_DEVICES_OPT, 0, -1, 1, 0, _stats_clear},
 	{"create", CREATE_OPTS ALL_DEVICES_OPT, 0, -1, 1, 0, _stats_create},
 	{"create", FILEMAP_OPTS "<file_path>", 0, -1, 1, 0, _stats_create},
+	{"daemon", DAEMON_OPTS, 0, 1, 0, 0, _stats_daemon},
 	{"delete", ALL_PROGS_REGIONS_DEVICES, 1, -1, 1, 0, _stats_delete},
 	{"group", GROUP_OPTS, 1, -1, 1, 0, _stats_group},
 	{"list", ALL_PROGS_OPT ALL_REGIONS_OPT, 0, -1, 1, 0, _stats_report},
@@ -6205,6 +6732,7 @@ static struct command _stats_subcommands[] = {
 #undef REPORT_OPTS
 #undef GROUP_OPTS
 #undef UNGROUP_OPTS
+#undef DAEMON_OPTS
 
 static int _dmsetup_help(CMD_ARGS);
 
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of the device-mapper userspace tools.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _DM_STATS_SHM_H
+#define _DM_STATS_SHM_H
+
+#include <stdint.h>
+
+/*
+ * Shared memory ring written by 'dmstats daemon'.
+ *
+ * The daemon samples every region of every device-mapper device once
+ * per interval and publishes one record per region in a ring of
+ * samples mapped from a file (DMSTATS_SHM_PATH by default). There is a
+ * single writer and any number of readers; readers never block the
+ * writer and never issue device-mapper ioctls.
+ *
+ * File layout:
+ *
+ *   struct dmstats_shm_header        header_size bytes
+ *   struct dmstats_shm_slot [0]      slot_size bytes each,
+ *   ...                              nr_slots slots
+ *
+ * Sample number seq lives in slot (seq % nr_slots). Sample numbers
+ * start at 1 and increase by one for every published sample.
+ *
+ * Read protocol (all loads of seq fields are atomic):
+ *
+ *   1. s = header->seq (acquire). Zero means no sample yet.
+ *   2. slot = slot (s % nr_slots); if slot->seq (acquire) != s the
+ *      slot is being rewritten: go back to 1.
+ *   3. Copy what is needed from the slot.
+ *   4. Acquire fence, then re-read slot->seq: if it is no longer s
+ *      the copy may be torn: go back to 1.
+ *
+ * Older samples s - 1 ... s - nr_slots + 1 may be read the same way.
+ *
+ * When the daemon needs more records per slot than the ring holds, or
+ * exits, it sets DMSTATS_SHM_RETIRED in header->flags. The file at the
+ * path is replaced by a larger ring, or removed on exit. Readers that
+ * find the flag set should unmap and open the path again.
+ *
+ * Readers must check magic and version, and should use header_size,
+ * slot_size and record_size rather than sizeof() so that fields can be
+ * appended in later versions.
+ */
+
+#define DMSTATS_SHM_PATH "/dev/shm/dmstats"
+#define DMSTATS_SHM_MAGIC 0x54534d44 /* "DMST" */
+#define DMSTATS_SHM_VERSION 1
+
+/* header->flags */
+#define DMSTATS_SHM_RETIRED 0x00000001
+
+/* Indexed by dm_stats_counter_t and dm_stats_metric_t. */
+#define DMSTATS_SHM_NR_COUNTERS 13
+#define DMSTATS_SHM_NR_METRICS 14
+
+struct dmstats_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t pid;		/* pid of the writing daemon */
+	uint32_t nr_slots;
+	uint32_t nr_counters;	/* DMSTATS_SHM_NR_COUNTERS */
+	uint32_t nr_metrics;	/* DMSTATS_SHM_NR_METRICS */
+	uint32_t padding;
+	uint64_t header_size;	/* offset of the first slot */
+	uint64_t slot_size;
+	uint64_t record_size;
+	uint64_t max_records;	/* record capacity of each slot */
+	uint64_t interval_ns;	/* configured sampling interval */
+	uint64_t seq;		/* newest complete sample, 0 if none */
+};
+
+struct dmstats_shm_record {
+	char name[128];		/* device-mapper device name */
+	uint32_t major;
+	uint32_t minor;
+	uint64_t region_id;
+	uint64_t group_id;	/* DM_STATS_GROUP_NONE if ungrouped */
+	uint64_t start;		/* region start in sectors */
+	uint64_t len;		/* region length in sectors */
+	uint64_t nr_areas;
+	/* counter deltas over the interval, summed over all areas */
+	uint64_t counters[DMSTATS_SHM_NR_COUNTERS];
+	/* metrics for the whole region, NaN if unavailable */
+	double metrics[DMSTATS_SHM_NR_METRICS];
+};
+
+struct dmstats_shm_slot {
+	uint64_t seq;		/* sample number, 0 while being written */
+	uint64_t timestamp_ns;	/* CLOCK_REALTIME when sampling finished */
+	uint64_t interval_ns;	/* measured time since the last sample */
+	uint64_t nr_records;
+	struct dmstats_shm_record records[0];
+};
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "math.h" /* log10() */
 
+#include <stddef.h> /* offsetof */
 #include <sys/sysmacros.h>
 #include <sys/ioctl.h>
 #include <sys/vfs.h> /* fstatfs */
@@ -38,6 +39,7 @@
 
 #define DM_STATS_REGION_NOT_PRESENT UINT64_MAX
 #define DM_STATS_GROUP_NOT_PRESENT DM_STATS_GROUP_NONE
+#define DM_STATS_COUNTERS_NO_SLOT UINT64_MAX
 
 #define NSEC_PER_USEC   1000L
 #define NSEC_PER_MSEC   1000000L
@@ -101,6 +103,7 @@ struct dm_stats_region {
 	struct dm_histogram *bounds; /* histogram configuration */
 	struct dm_histogram *histogram; /* aggregate cache */
 	struct dm_stats_counters *counters;
+	uint64_t counters_idx; /* first slot in the handle counters table */
 };
 
 struct dm_stats_group {
@@ -128,6 +131,8 @@ struct dm_stats {
 	int precise; /* use precise_timestamps when creating regions */
 	struct dm_stats_region *regions;
 	struct dm_stats_group *groups;
+	struct dm_stats_counters *counters; /* area counters for all regions */
+	uint64_t nr_counters; /* size of the counters table */
 	/* statistics cursor */
 	uint64_t walk_flags; /* walk control flags */
 	uint64_t cur_flags;
@@ -978,6 +983,64 @@ static int _stats_parse_list_region(struct dm_stats *dms,
 	}
 
 	region->counters = NULL;
+	region->counters_idx = DM_STATS_COUNTERS_NO_SLOT;
+	return 1;
+}
+
+/*
+ * Assign slots in the counters table to each listed region that does
+ * not have any yet, growing the table if needed. Called by
+ * dm_stats_populate() only, so that listing regions does not allocate
+ * counters. Slots are never moved while a region is present, so that
+ * regions populated earlier keep reading their own counters; a deleted
+ * region's slots are reused once the regions are listed again. The
+ * table is kept across dm_stats_list() calls so that periodic populates
+ * of an unchanged set of regions do not allocate.
+ */
+static int _stats_counters_reserve(struct dm_stats *dms)
+{
+	struct dm_stats_counters *counters;
+	struct dm_stats_region *region;
+	uint64_t i, nr_counters = 0;
+
+	for (i = 0; i <= dms->max_region; i++) {
+		region = &dms->regions[i];
+		if (!_stats_region_present(region) ||
+		    (region->counters_idx == DM_STATS_COUNTERS_NO_SLOT))
+			continue;
+		if (region->counters_idx + _nr_areas_region(region) > nr_counters)
+			nr_counters = region->counters_idx
+				      + _nr_areas_region(region);
+	}
+
+	for (i = 0; i <= dms->max_region; i++) {
+		region = &dms->regions[i];
+		if (!_stats_region_present(region) ||
+		    (region->counters_idx != DM_STATS_COUNTERS_NO_SLOT))
+			continue;
+		region->counters_idx = nr_counters;
+		nr_counters += _nr_areas_region(region);
+	}
+
+	if (nr_counters <= dms->nr_counters)
+		return 1;
+
+	if (!(counters = dm_realloc(dms->counters,
+				    nr_counters * sizeof(*counters)))) {
+		log_error("Could not allocate memory for stats counters.");
+		return 0;
+	}
+
+	/* The table may have moved: repoint populated regions. */
+	for (i = 0; i <= dms->max_region; i++) {
+		region = &dms->regions[i];
+		if (_stats_region_present(region) && region->counters)
+			region->counters = counters + region->counters_idx;
+	}
+
+	dms->counters = counters;
+	dms->nr_counters = nr_counters;
+
 	return 1;
 }
 
@@ -1133,10 +1196,35 @@ bad:
 	return 0;
 }
 
+/*
+ * Parse an unsigned decimal at *c and advance *c past it.
+ */
+static int _stats_parse_u64(const char **c, uint64_t *val)
+{
+	const char *p = *c;
+	uint64_t v = 0;
+	unsigned d;
+
+	if ((d = (unsigned) (*p - '0')) > 9)
+		return 0;
+
+	do {
+		if ((v > UINT64_MAX / 10) ||
+		    ((v == UINT64_MAX / 10) && (d > UINT64_MAX % 10)))
+			return 0;
+		v = v * 10 + d;
+	} while ((d = (unsigned) (*++p - '0')) <= 9);
+
+	*val = v;
+	*c = p;
+
+	return 1;
+}
+
 /*
  * Parse histogram data returned from a @stats_print operation.
  */
-static int _stats_parse_histogram(struct dm_pool *mem, char *hist_str,
+static int _stats_parse_histogram(struct dm_pool *mem, const char *hist_str,
 				  struct dm_histogram **histogram,
 				  struct dm_stats_region *region)
 {
@@ -1145,10 +1233,9 @@ static int _stats_parse_histogram(struct dm_pool *mem, char *hist_str,
 	struct dm_histogram hist = {
 		.nr_bins = region->bounds->nr_bins
 	};
-	const char *c, *v, *val_start;
+	const char *c, *v;
 	struct dm_histogram_bin cur;
 	uint64_t sum = 0, this_val;
-	char *endptr = NULL;
 	int bin = 0;
 
 	c = hist_str;
@@ -1170,16 +1257,11 @@ static int _stats_parse_histogram(struct dm_pool *mem, char *hist_str,
 		if (*c == ',')
 			goto badchar;
 		else {
-			val_start = c;
-			endptr = NULL;
-
-			errno = 0;
-			this_val = strtoull(val_start, &endptr, 10);
-			if (errno || !endptr) {
+			/* Advance to colon, or end. */
+			if (!_stats_parse_u64(&c, &this_val)) {
 				log_error("Could not parse histogram value.");
 				goto bad;
 			}
-			c = endptr; /* Advance to colon, or end. */
 
 			if (*c == ':')
 				c++;
@@ -1219,32 +1301,41 @@ static int _stats_parse_region(struct dm_stats *dms, const char *resp,
 			       struct dm_stats_region *region,
 			       uint64_t timescale)
 {
+	/* Counter fields of a @stats_print row, in kernel order. */
+	static const size_t _fields[] = {
+		offsetof(struct dm_stats_counters, reads),
+		offsetof(struct dm_stats_counters, reads_merged),
+		offsetof(struct dm_stats_counters, read_sectors),
+		offsetof(struct dm_stats_counters, read_nsecs),
+		offsetof(struct dm_stats_counters, writes),
+		offsetof(struct dm_stats_counters, writes_merged),
+		offsetof(struct dm_stats_counters, write_sectors),
+		offsetof(struct dm_stats_counters, write_nsecs),
+		offsetof(struct dm_stats_counters, io_in_progress),
+		offsetof(struct dm_stats_counters, io_nsecs),
+		offsetof(struct dm_stats_counters, weighted_io_nsecs),
+		offsetof(struct dm_stats_counters, total_read_nsecs),
+		offsetof(struct dm_stats_counters, total_write_nsecs)
+	};
+	struct dm_stats_counters *counters, *cur;
 	struct dm_histogram *hist = NULL;
-	struct dm_pool *mem = dms->mem;
-	struct dm_stats_counters cur;
-	FILE *stats_rows = NULL;
+	uint64_t nr_areas = 0, max_areas;
 	uint64_t start = 0, len = 0;
-	char row[STATS_ROW_BUF_LEN];
-	int r;
+	const char *c;
+	unsigned i;
 
 	if (!resp) {
 		log_error("Could not parse empty @stats_print response.");
 		return 0;
 	}
 
-	region->start = UINT64_MAX;
-
-	if (!dm_pool_begin_object(mem, 512))
-		goto_bad;
-
 	/*
-	 * dm_task_get_message_response() returns a 'const char *' but
-	 * since fmemopen also permits "w" it expects a 'char *'.
+	 * Areas are parsed straight into the region's slots in the
+	 * counters table sized by dm_stats_populate(): the same memory
+	 * is reused each time the region is populated.
 	 */
-	/* coverity[alloc_strlen] intentional */
-	stats_rows = fmemopen((char *)resp, strlen(resp), "r");
-	if (!stats_rows)
-		goto_bad;
+	counters = dms->counters + region->counters_idx;
+	max_areas = _nr_areas_region(region);
 
 	/*
 	 * Output format for each step-sized area of a region:
@@ -1272,91 +1363,82 @@ static int _stats_parse_region(struct dm_stats *dms, const char *resp,
 	 * 12. the total time spent reading in milliseconds
 	 * 13. the total time spent writing in milliseconds
 	 *
+	 * An optional histogram follows the counters.
 	*/
-	while (fgets(row, sizeof(row), stats_rows)) {
-		r = sscanf(row, FMTu64 "+" FMTu64 /* start+len */
-			   /* reads */
-			   FMTu64 " " FMTu64 " " FMTu64 " " FMTu64 " "
-			   /* writes */
-			   FMTu64 " " FMTu64 " " FMTu64 " " FMTu64 " "
-			   /* in flight & io nsecs */
-			   FMTu64 " " FMTu64 " " FMTu64 " "
-			   /* tot read/write nsecs */
-			   FMTu64 " " FMTu64, &start, &len,
-			   &cur.reads, &cur.reads_merged, &cur.read_sectors,
-			   &cur.read_nsecs,
-			   &cur.writes, &cur.writes_merged, &cur.write_sectors,
-			   &cur.write_nsecs,
-			   &cur.io_in_progress,
-			   &cur.io_nsecs, &cur.weighted_io_nsecs,
-			   &cur.total_read_nsecs, &cur.total_write_nsecs);
-		if (r != 15) {
-			log_error("Could not parse @stats_print row.");
-			goto bad;
+	for (c = resp; *c; c++) {
+		if (nr_areas == max_areas) {
+			log_error("Too many areas in @stats_print response "
+				  "for region " FMTu64 ".", region->region_id);
+			return 0;
+		}
+
+		cur = &counters[nr_areas];
+
+		if (!_stats_parse_u64(&c, &start) || (*c++ != '+') ||
+		    !_stats_parse_u64(&c, &len))
+			goto badrow;
+
+		for (i = 0; i < DM_ARRAY_SIZE(_fields); i++) {
+			if (*c++ != ' ')
+				goto badrow;
+			if (!_stats_parse_u64(&c, (uint64_t *)
+					      ((char *) cur + _fields[i])))
+				goto badrow;
 		}
 
 		/* scale time values up if needed */
 		if (timescale != 1) {
-			cur.read_nsecs *= timescale;
-			cur.write_nsecs *= timescale;
-			cur.io_nsecs *= timescale;
-			cur.weighted_io_nsecs *= timescale;
-			cur.total_read_nsecs *= timescale;
-			cur.total_write_nsecs *= timescale;
+			cur->read_nsecs *= timescale;
+			cur->write_nsecs *= timescale;
+			cur->io_nsecs *= timescale;
+			cur->weighted_io_nsecs *= timescale;
+			cur->total_read_nsecs *= timescale;
+			cur->total_write_nsecs *= timescale;
 		}
 
 		if (region->bounds) {
-			/* Find first histogram separator. */
-			char *hist_str = strchr(row, ':');
-			if (!hist_str) {
-				log_error("Could not parse histogram value.");
-				goto bad;
-			}
-			/* Find space preceding histogram. */
-			while (hist_str && *(hist_str - 1) != ' ')
-				hist_str--;
+			if (*c++ != ' ')
+				goto badrow;
 
-			/* Use a separate pool for histogram objects since we
-			 * are growing the area table and each area's histogram
-			 * table simultaneously.
+			/* Use a separate pool for histogram objects since
+			 * the region's histograms are freed together.
 			 */
-			if (!_stats_parse_histogram(dms->hist_mem, hist_str,
+			if (!_stats_parse_histogram(dms->hist_mem, c,
 						    &hist, region))
-				goto_bad;
+				return_0;
 			hist->dms = dms;
 			hist->region = region;
 		}
 
-		cur.histogram = hist;
-
-		if (!dm_pool_grow_object(mem, &cur, sizeof(cur)))
-			goto_bad;
+		cur->histogram = hist;
 
-		if (region->start == UINT64_MAX) {
+		if (!nr_areas) {
 			region->start = start;
 			region->step = len; /* area size is always uniform. */
 		}
+
+		nr_areas++;
+
+		/* Skip any histogram and advance to the next row. */
+		if (!(c = strchr(c, '\n')))
+			break;
 	}
 
-	if (region->start == UINT64_MAX)
+	if (!nr_areas) {
 		/* no area data read from @stats_print */
-		goto bad;
+		log_error("Empty @stats_print response for region " FMTu64 ".",
+			  region->region_id);
+		return 0;
+	}
 
 	region->len = (start + len) - region->start;
 	region->timescale = timescale;
-	region->counters = dm_pool_end_object(mem);
-
-	if (fclose(stats_rows))
-		stack;
+	region->counters = counters;
 
 	return 1;
 
-bad:
-	if (stats_rows)
-		if (fclose(stats_rows))
-			stack;
-	dm_pool_abandon_object(mem);
-
+badrow:
+	log_error("Could not parse @stats_print row.");
 	return 0;
 }
 
@@ -2354,6 +2436,15 @@ int dm_stats_populate(struct dm_stats *dms, const char *program_id,
 		goto_bad;
 	}
 
+	/* All regions were deleted since the handle was last listed. */
+	if (all_regions && !dms->regions) {
+		dms->walk_flags = saved_flags;
+		return 1;
+	}
+
+	if (!_stats_counters_reserve(dms))
+		goto_bad;
+
 	dms->walk_flags = DM_STATS_WALK_REGION;
 	dm_stats_walk_start(dms);
 	do {
@@ -2399,6 +2490,7 @@ void dm_stats_destroy(struct dm_stats *dms)
 	dm_pool_destroy(dms->mem);
 	dm_pool_destroy(dms->hist_mem);
 	dm_pool_destroy(dms->group_mem);
+	dm_free(dms->counters);
 	dm_free(dms->program_id);
 	dm_free((char *) dms->name);
 	dm_free(dms);
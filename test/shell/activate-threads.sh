@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Activate, reload, suspend and deactivate LVs with the devices of
+# one tree level processed by several threads, logging at full debug
+# level so the threads log concurrently.
+
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux have_raid 1 3 0 || skip
+
+aux prepare_vg 6
+
+aux lvmconf 'activation/activation_threads = 4'
+
+lvcreate -an -Zn --type raid1 -m 5 -l 2 -n raid $vg
+lvcreate -an -Zn -i 6 -l 6 -n striped $vg
+
+lvchange -ay -vvvv $vg/raid 2>debug
+grep "tree nodes with up to 4 threads" debug
+aux wait_for_sync $vg raid
+check lv_field $vg/raid lv_active "active"
+
+lvchange -ay -vvvv $vg/striped 2>debug
+
+# suspend and resume
+lvchange --refresh -vvvv $vg/raid 2>debug
+grep "tree nodes with up to 4 threads" debug
+
+# reload with new tables
+lvextend -l +2 -vvvv $vg/raid 2>debug
+lvextend -l +6 -vvvv $vg/striped 2>debug
+check lv_field $vg/raid seg_count "1"
+
+lvchange -an -vvvv $vg 2>debug
+check lv_field $vg/raid lv_active ""
+check lv_field $vg/striped lv_active ""
+
+# the same with serial processing gives the same devices
+aux lvmconf 'activation/activation_threads = 0'
+lvchange -ay $vg
+dmsetup table | grep "^$vg-" | sort >serial
+lvchange -an $vg
+aux lvmconf 'activation/activation_threads = 4'
+lvchange -ay $vg
+dmsetup table | grep "^$vg-" | sort >threaded
+diff serial threaded
+
+vgremove -ff $vg
@@ -0,0 +1,70 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check that 'dmstats daemon' publishes a region in its shared memory
+# ring, following the layout in libdm/dmstats_shm.h.
+
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+# Don't attempt to test stats with driver < 4.33.00
+aux driver_at_least 4 33 || skip
+
+aux prepare_devs 1
+
+SHM="$PWD/dmstats.shm"
+
+# native endian unsigned integer of $2 bytes at offset $1
+read_uint() {
+	od -An -t u"$2" -j "$1" -N "$2" "$SHM" | tr -d ' '
+}
+
+dmstats create --programid shmtest "$dev1"
+
+dmstats daemon --foreground --interval 1 --programid shmtest "$SHM" &
+PID_DAEMON=$!
+
+# A region is published from the second sample onwards
+for i in {30..0} ; do
+	test "$i" -eq 0 && die "dmstats daemon published no region."
+	if test -s "$SHM" ; then
+		seq=$(read_uint 72 8)
+		test "$seq" -ge 2 && break
+	fi
+	sleep .5
+done
+
+# struct dmstats_shm_header
+test "$(read_uint 0 4)" -eq $(( 0x54534d44 ))
+test "$(read_uint 4 4)" -eq 1
+test "$(read_uint 12 4)" -eq "$PID_DAEMON"
+nr_slots=$(read_uint 16 4)
+header_size=$(read_uint 32 8)
+slot_size=$(read_uint 40 8)
+
+# struct dmstats_shm_slot of the newest sample
+slot=$(( header_size + (seq % nr_slots) * slot_size ))
+test "$(read_uint "$slot" 8)" -eq "$seq"
+test "$(read_uint $(( slot + 24 )) 8)" -eq 1
+
+# name of its only struct dmstats_shm_record
+dd if="$SHM" bs=1 skip=$(( slot + 32 )) count=128 2>/dev/null | tr -d '\0' > name
+test "$(< name)" = "$(basename "$dev1")"
+
+kill "$PID_DAEMON"
+wait "$PID_DAEMON"
+
+# The ring is removed on exit
+test ! -e "$SHM"
+
+dmstats delete --allregions "$dev1"
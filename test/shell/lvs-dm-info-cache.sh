@@ -0,0 +1,51 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check that reporting a whole VG from the dm info cache gives the same
+# info and status as querying each LV from the kernel: the cache is only
+# read once a report covers more than a few LVs of a VG.
+
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux have_thin 1 0 0 || skip
+
+aux prepare_vg 2
+
+lvcreate -L4 -T $vg/pool
+for i in $(seq 1 10) ; do
+	lvcreate -V8 -n thin$i $vg/pool
+done
+dd if=/dev/zero of="$DM_DEV_DIR/$vg/thin1" bs=1M count=1 oflag=direct
+dd if=/dev/zero of="$DM_DEV_DIR/$vg/thin2" bs=1M count=2 oflag=direct
+
+lvcreate -L4 -n linear $vg
+lvcreate -an -Zn -L4 -n inactive $vg
+lvcreate -s -L4 -n snap $vg/linear
+
+FIELDS=lv_name,lv_attr,lv_read_ahead,lv_kernel_read_ahead,data_percent,metadata_percent
+
+# cached: all LVs of the VG
+lvs -vvvv --noheadings -o $FIELDS $vg >cached 2>debug
+grep "Cached status of" debug
+
+# uncached: one LV at a time
+for lv in $(lvs --noheadings -o lv_name $vg) ; do
+	lvs -vvvv --noheadings -o $FIELDS $vg/$lv 2>debug
+	not grep "Cached status of" debug
+done >uncached
+
+cat cached
+diff cached uncached
+
+vgremove -ff $vg
@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check that lvmpolld reports a pvmove of several segments as finished
+# successfully: it runs lvpoll once per segment and the last one removes
+# the pvmove LV.
+
+SKIP_WITH_LVMLOCKD=1
+
+. lib/inittest
+
+test -e LOCAL_LVMPOLLD || skip
+
+aux prepare_vg 3 20
+
+# lv1 gets two segments on dev1 with lv2 in between
+lvcreate -aey -l4 -n $lv1 $vg "$dev1"
+lvcreate -aey -l4 -n $lv2 $vg "$dev1"
+lvextend -l+4 $vg/$lv1 "$dev1"
+check lv_field $vg/$lv1 seg_count "2"
+
+for mode in "" "-b"
+do
+	pvmove $mode -i1 "$dev1" "$dev2" 2>&1 | tee out
+	not grep "unexpected return code" out
+
+	if test -n "$mode"; then
+		for i in {100..0} ; do
+			test "$i" -eq 0 && die "pvmove did not finish."
+			lvs -a $vg | grep -q pvmove || break
+			sleep .1
+		done
+	fi
+
+	lvs -a -o+devices $vg | tee out
+	not grep "pvmove" out
+	not grep "$dev1" out
+	check lv_on $vg $lv1 "$dev2"
+	check lv_on $vg $lv2 "$dev2"
+
+	# and back for the next round
+	pvmove -i1 "$dev2" "$dev1"
+	check lv_on $vg $lv1 "$dev1"
+done
+
+vgremove -ff $vg
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+#include "lib/misc/lib.h"
+#include "lib/metadata/metadata.h"
+#include "lib/commands/toolcontext.h"
+#include "lib/metadata/lv_alloc.h"
+#include "lib/metadata/pv_alloc.h"
+#include "lib/metadata/segtype.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//----------------------------------------------------------------
+
+// Settings come from the defaults of an empty config tree.
+static struct cmd_context _cmd;
+
+static void _destroy_instance(struct format_instance *fid)
+{
+	fid->ref_count--;
+}
+
+static struct format_handler _ops = {
+	.destroy_instance = _destroy_instance,
+};
+static struct format_type _fmt = { .ops = &_ops };
+static struct format_instance _fid = { .fmt = &_fmt };
+
+static struct segment_type _striped = {
+	.flags = SEG_AREAS_STRIPED,
+	.name = "striped",
+};
+
+static void *_vg_init(void)
+{
+	struct volume_group *vg;
+
+	T_ASSERT((_cmd.cft = dm_config_create()));
+
+	T_ASSERT((vg = alloc_vg("alloc test", &_cmd, "vg0")));
+	memset(&vg->id, 'V', sizeof(vg->id));
+	vg_set_fid(vg, &_fid);
+	vg->extent_size = 8192;
+	vg->alloc = ALLOC_NORMAL;
+
+	return vg;
+}
+
+static void _vg_exit(void *fixture)
+{
+	release_vg(fixture);
+	dm_config_destroy(_cmd.cft);
+	_cmd.cft = NULL;
+}
+
+static struct logical_volume *_add_lv(struct volume_group *vg, const char *name)
+{
+	struct logical_volume *lv;
+
+	T_ASSERT((lv = alloc_lv(vg->vgmem)));
+	T_ASSERT((lv->name = dm_pool_strdup(vg->vgmem, name)));
+	lv->status = LVM_READ | LVM_WRITE | VISIBLE_LV;
+	T_ASSERT(link_lv_to_vg(vg, lv));
+
+	return lv;
+}
+
+static struct physical_volume *_add_pv(struct volume_group *vg, uint32_t pe_count)
+{
+	struct pv_list *pvl;
+	struct physical_volume *pv;
+
+	T_ASSERT((pvl = dm_pool_zalloc(vg->vgmem, sizeof(*pvl))));
+	T_ASSERT((pv = pvl->pv = dm_pool_zalloc(vg->vgmem, sizeof(*pv))));
+	T_ASSERT((pv->dev = dm_pool_zalloc(vg->vgmem, sizeof(*pv->dev))));
+	memset(&pv->id, 'P', sizeof(pv->id));
+	pv->id.uuid[0] += vg->pv_count;
+	pv->pe_count = pe_count;
+	pv->status = ALLOCATABLE_PV;
+	dm_list_init(&pv->tags);
+	dm_list_init(&pv->segments);
+	T_ASSERT(alloc_pv_segment_whole_pv(vg->vgmem, pv));
+	add_pvl_to_vgs(vg, pvl);
+
+	vg->extent_count += pe_count;
+	vg->free_count += pe_count;
+
+	return pv;
+}
+
+// Map pe:len of the PV to the next extents of lv.
+static void _use(struct logical_volume *lv, struct physical_volume *pv, uint32_t pe, uint32_t len)
+{
+	struct lv_segment *seg;
+
+	T_ASSERT((seg = alloc_lv_segment(&_striped, lv, lv->le_count, len, 0, 0, 0,
+					 NULL, 1, len, 0, 0, 0, 0, NULL)));
+	T_ASSERT(set_lv_segment_area_pv(seg, 0, pv, pe));
+	dm_list_add(&lv->segments, &seg->list);
+	lv->le_count += len;
+	lv->size = (uint64_t) lv->le_count * lv->vg->extent_size;
+}
+
+static struct logical_volume *_alloc(struct volume_group *vg, const char *name, uint32_t stripes,
+				     uint32_t extents, alloc_policy_t alloc)
+{
+	struct logical_volume *lv = _add_lv(vg, name);
+	struct alloc_handle *ah;
+
+	T_ASSERT((ah = allocate_extents(vg, NULL, &_striped, stripes, 0, 0, 0, extents,
+					&vg->pvs, alloc, 0, NULL)));
+	T_ASSERT(lv_add_segment(ah, 0, stripes, lv, &_striped, stripes > 1 ? 128 : 0, 0, 0));
+	alloc_destroy(ah);
+
+	T_ASSERT_EQUAL(lv->le_count, extents);
+
+	return lv;
+}
+
+//----------------------------------------------------------------
+
+/*
+ * Normal allocation replaces its candidate on a PV by each following
+ * area that is still big enough, so of equal areas the last in list
+ * order is used.  Equal areas are listed in PE order.
+ */
+static void test_equal_areas(void *fixture)
+{
+	struct volume_group *vg = fixture;
+	struct physical_volume *pv = _add_pv(vg, 60);
+	struct logical_volume *used = _add_lv(vg, "used"), *lv;
+
+	// free: 10-17, 30-37, 50-57
+	_use(used, pv, 0, 10);
+	_use(used, pv, 18, 12);
+	_use(used, pv, 38, 12);
+	_use(used, pv, 58, 2);
+
+	lv = _alloc(vg, "lv", 1, 8, ALLOC_NORMAL);
+	T_ASSERT_EQUAL(dm_list_size(&lv->segments), 1);
+	T_ASSERT(seg_pv(first_seg(lv), 0) == pv);
+	T_ASSERT_EQUAL(seg_pe(first_seg(lv), 0), 50);
+
+	lv = _alloc(vg, "lv2", 1, 8, ALLOC_NORMAL);
+	T_ASSERT_EQUAL(seg_pe(first_seg(lv), 0), 30);
+}
+
+/*
+ * Once some space is used, the rest sticks to the same PV while it has
+ * free extents.
+ */
+static void test_cling_to_alloced(void *fixture)
+{
+	struct volume_group *vg = fixture;
+	struct physical_volume *pv0 = _add_pv(vg, 40);
+	struct physical_volume *pv1 = _add_pv(vg, 20);
+	struct logical_volume *used = _add_lv(vg, "used"), *lv;
+	struct lv_segment *seg;
+
+	// pv0 free: 0-19, 25-27, 30-32; pv1 free: 0-9, 10-19 as one
+	_use(used, pv0, 20, 5);
+	_use(used, pv0, 28, 2);
+	_use(used, pv0, 33, 7);
+
+	lv = _alloc(vg, "lv", 1, 26, ALLOC_NORMAL);
+	T_ASSERT_EQUAL(dm_list_size(&lv->segments), 3);
+	dm_list_iterate_items(seg, &lv->segments)
+		T_ASSERT(seg_pv(seg, 0) == pv0);
+	T_ASSERT_EQUAL(first_seg(lv)->len, 20);
+	T_ASSERT(!pv1->pe_alloc_count);
+}
+
+static void test_striped(void *fixture)
+{
+	struct volume_group *vg = fixture;
+	struct logical_volume *used = _add_lv(vg, "used"), *lv;
+	struct physical_volume *pv;
+	struct lv_segment *seg;
+	unsigned i, s, t;
+
+	// PVs with free runs of 3 + i extents between used ones
+	for (i = 0; i < 6; i++) {
+		pv = _add_pv(vg, 100);
+		for (s = 0; s < 100; s += 10)
+			_use(used, pv, s, 7 - i);
+	}
+
+	lv = _alloc(vg, "lv", 4, 40, ALLOC_NORMAL);
+	dm_list_iterate_items(seg, &lv->segments) {
+		T_ASSERT_EQUAL(seg->area_count, 4);
+		for (s = 0; s < 4; s++)
+			for (t = s + 1; t < 4; t++)
+				T_ASSERT(seg_pv(seg, s) != seg_pv(seg, t));
+	}
+}
+
+static void test_anywhere(void *fixture)
+{
+	struct volume_group *vg = fixture;
+	struct physical_volume *pv = _add_pv(vg, 100);
+	struct logical_volume *used = _add_lv(vg, "used"), *lv;
+	struct lv_segment *seg;
+	unsigned i;
+
+	for (i = 0; i < 100; i += 4)
+		_use(used, pv, i, 2);
+
+	// every free run of 2
+	lv = _alloc(vg, "lv", 1, 50, ALLOC_ANYWHERE);
+	T_ASSERT_EQUAL(dm_list_size(&lv->segments), 25);
+	dm_list_iterate_items(seg, &lv->segments)
+		T_ASSERT_EQUAL(seg->len, 2);
+	T_ASSERT_EQUAL(vg->free_count, 0);
+}
+
+//----------------------------------------------------------------
+// Allocation from VGs whose PVs are split into a few hundred free
+// areas each.
+
+static unsigned _rand(unsigned *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7fff;
+}
+
+static struct volume_group *_fragmented_vg(unsigned nr_pvs, uint32_t pe_count)
+{
+	static const uint32_t _gaps[] = { 1, 2, 3, 5, 8, 13, 21, 40 };
+	struct volume_group *vg = _vg_init();
+	struct logical_volume *used = _add_lv(vg, "used");
+	struct physical_volume *pv;
+	uint32_t pe, len;
+	unsigned seed = 5, i;
+
+	for (i = 0; i < nr_pvs; i++) {
+		pv = _add_pv(vg, pe_count);
+		for (pe = 0; pe < pe_count; pe += len + _gaps[_rand(&seed) % DM_ARRAY_SIZE(_gaps)]) {
+			len = 20 + _rand(&seed) % 180;
+			if (len > pe_count - pe)
+				len = pe_count - pe;
+			_use(used, pv, pe, len);
+		}
+	}
+
+	return vg;
+}
+
+static void _bench(unsigned nr_pvs, const char *desc, uint32_t stripes,
+		   uint32_t extents, alloc_policy_t alloc)
+{
+	struct volume_group *vg = _fragmented_vg(nr_pvs, 16384);
+	uint64_t start;
+	uint32_t areas = 0;
+	struct pv_list *pvl;
+	struct pv_segment *pvseg;
+
+	dm_list_iterate_items(pvl, &vg->pvs)
+		dm_list_iterate_items(pvseg, &pvl->pv->segments)
+			if (!pvseg->lvseg)
+				areas++;
+
+	start = test_now_ns();
+	_alloc(vg, "lv", stripes, extents, alloc);
+	fprintf(stderr, "%4u PVs, %6u free areas: %-26s %6llu us\n",
+		nr_pvs, areas, desc, (unsigned long long) ((test_now_ns() - start) / 1000));
+
+	_vg_exit(vg);
+}
+
+static void test_bench_linear(void *fixture)
+{
+	_bench(50, "linear 5000 extents", 1, 5000, ALLOC_NORMAL);
+	_bench(200, "linear 20000 extents", 1, 20000, ALLOC_NORMAL);
+}
+
+static void test_bench_striped(void *fixture)
+{
+	_bench(50, "8 stripes 4000 extents", 8, 4000, ALLOC_NORMAL);
+	_bench(200, "8 stripes 16000 extents", 8, 16000, ALLOC_NORMAL);
+}
+
+static void test_bench_anywhere(void *fixture)
+{
+	_bench(50, "anywhere 5000 extents", 1, 5000, ALLOC_ANYWHERE);
+	_bench(200, "anywhere 5000 extents", 1, 5000, ALLOC_ANYWHERE);
+}
+
+//----------------------------------------------------------------
+
+#define T(path, desc, fn) register_test(ts, "/metadata/alloc/" path, desc, fn)
+#define B(path, desc, fn) register_bench(ts, "/metadata/alloc/" path, desc, fn)
+
+static struct test_suite *_alloc_tests(void)
+{
+	struct test_suite *ts = test_suite_create(_vg_init, _vg_exit);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("equal-areas", "equal free areas are used in list order", test_equal_areas);
+	T("cling-to-alloced", "allocation stays on the PVs already used", test_cling_to_alloced);
+	T("striped", "stripes are on different PVs", test_striped);
+	T("anywhere", "anywhere uses every free area", test_anywhere);
+
+	return ts;
+}
+
+// The benchmarks build their own VGs.
+static struct test_suite *_bench_tests(void)
+{
+	struct test_suite *ts = test_suite_create(NULL, NULL);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	B("bench/linear", "linear allocation from fragmented PVs", test_bench_linear);
+	B("bench/striped", "striped allocation from fragmented PVs", test_bench_striped);
+	B("bench/anywhere", "anywhere allocation from fragmented PVs", test_bench_anywhere);
+
+	return ts;
+}
+
+void alloc_tests(struct dm_list *all_tests)
+{
+	dm_list_add(all_tests, &_alloc_tests()->list);
+	dm_list_add(all_tests, &_bench_tests()->list);
+}
@@ -83,9 +83,17 @@ static void _expect(struct mock_engine *e, enum method m)
 	struct mock_call *mc = malloc(sizeof(*mc));
 	mc->m = m;
 	mc->match_args = false;
+	mc->wait_r = true;
 	dm_list_add(&e->expected_calls, &mc->list);
 }
 
+// The engine itself fails to wait, no io completes.
+static void _expect_bad_wait(struct mock_engine *e)
+{
+	_expect(e, E_WAIT);
+	dm_list_item(e->expected_calls.p, struct mock_call)->wait_r = false;
+}
+
 static void _expect_read(struct mock_engine *e, int fd, block_address b)
 {
 	struct mock_call *mc = malloc(sizeof(*mc));
@@ -268,7 +276,12 @@ static bool _mock_wait(struct io_engine *e, io_complete_fn fn)
 {
 	struct mock_io *io;
 	struct mock_engine *me = _to_mock(e);
-	_match(me, E_WAIT);
+	struct mock_call *mc = _match_pop(me, E_WAIT);
+	bool r = mc->wait_r;
+
+	free(mc);
+	if (!r)
+		return false;
 
 	// FIXME: provide a way to control how many are completed and whether
 	// they error.
@@ -296,6 +309,7 @@ static struct mock_engine *_mock_create(unsigned max_io, sector_t block_size)
 	m->e.issue = _mock_issue;
 	m->e.wait = _mock_wait;
 	m->e.max_io = _mock_max_io;
+	m->e.register_buffers = NULL;
 
 	m->max_io = max_io;
 	m->block_size = block_size;
@@ -487,6 +501,79 @@ static void test_block_gets_evicted_with_many_reads(void *context)
 	}
 }
 
+static void test_cache_grows_rather_than_evicts(void *context)
+{
+	struct fixture *f = context;
+	struct mock_engine *me = f->me;
+	struct bcache *cache = f->cache;
+	struct bcache_stats stats;
+	const unsigned nr_cache_blocks = 16;
+
+	int fd = 17;   // arbitrary key
+	unsigned i;
+	struct block *b;
+
+	bcache_set_max_cache_blocks(cache, 2 * nr_cache_blocks);
+
+	for (i = 0; i < 2 * nr_cache_blocks; i++) {
+		_expect_read(me, fd, i);
+		_expect(me, E_WAIT);
+		T_ASSERT(bcache_get(cache, fd, i, 0, &b));
+		bcache_put(b);
+	}
+	T_ASSERT_EQUAL(bcache_nr_cache_blocks(cache), 2 * nr_cache_blocks);
+
+	// Everything is still cached, so no io.
+	for (i = 0; i < 2 * nr_cache_blocks; i++) {
+		T_ASSERT(bcache_get(cache, fd, i, 0, &b));
+		bcache_put(b);
+	}
+
+	bcache_get_stats(cache, &stats);
+	T_ASSERT_EQUAL(stats.evictions, 0);
+	T_ASSERT_EQUAL(stats.grows, 1);
+
+	// Reaching the new limit evicts as usual.
+	_expect_read(me, fd, 2 * nr_cache_blocks);
+	_expect(me, E_WAIT);
+	T_ASSERT(bcache_get(cache, fd, 2 * nr_cache_blocks, 0, &b));
+	bcache_put(b);
+
+	bcache_get_stats(cache, &stats);
+	T_ASSERT_EQUAL(stats.evictions, 1);
+	T_ASSERT_EQUAL(stats.grows, 1);
+}
+
+static void test_cache_shrinks_when_unused(void *context)
+{
+	struct fixture *f = context;
+	struct mock_engine *me = f->me;
+	struct bcache *cache = f->cache;
+	struct bcache_stats stats;
+	const unsigned nr_cache_blocks = 16;
+
+	int fd = 17;   // arbitrary key
+	unsigned i;
+	struct block *b;
+
+	bcache_set_max_cache_blocks(cache, 2 * nr_cache_blocks);
+
+	for (i = 0; i < 2 * nr_cache_blocks; i++) {
+		_expect_read(me, fd, i);
+		_expect(me, E_WAIT);
+		T_ASSERT(bcache_get(cache, fd, i, 0, &b));
+		bcache_put(b);
+	}
+	T_ASSERT_EQUAL(bcache_nr_cache_blocks(cache), 2 * nr_cache_blocks);
+
+	T_ASSERT(bcache_invalidate_fd(cache, fd));
+	T_ASSERT_EQUAL(bcache_nr_cache_blocks(cache), nr_cache_blocks);
+
+	bcache_get_stats(cache, &stats);
+	T_ASSERT_EQUAL(stats.shrinks, 1);
+	T_ASSERT_EQUAL(stats.nr_free, nr_cache_blocks);
+}
+
 static void test_prefetch_issues_a_read(void *context)
 {
 	struct fixture *f = context;
@@ -534,6 +621,41 @@ static void test_too_many_prefetches_does_not_trigger_a_wait(void *context)
 		_expect(me, E_WAIT);
 }
 
+static void test_wait_any_completes_prefetches(void *context)
+{
+	struct fixture *f = context;
+	struct mock_engine *me = f->me;
+	struct bcache *cache = f->cache;
+
+	int fd = 17;   // arbitrary key
+	unsigned i;
+	struct block *b;
+
+	T_ASSERT(!bcache_wait_any(cache));
+
+	for (i = 0; i < 4; i++) {
+		_expect_read(me, fd, i);
+		bcache_prefetch(cache, fd, i);
+		T_ASSERT(bcache_io_pending(cache, fd, i));
+	}
+	_no_outstanding_expectations(me);
+
+	// The mock completes io in the order it was issued.
+	for (i = 0; i < 4; i++) {
+		_expect(me, E_WAIT);
+		T_ASSERT(bcache_wait_any(cache));
+		T_ASSERT(!bcache_io_pending(cache, fd, i));
+		if (i < 3)
+			T_ASSERT(bcache_io_pending(cache, fd, i + 1));
+
+		// already read, so no further io
+		T_ASSERT(bcache_get(cache, fd, i, 0, &b));
+		bcache_put(b);
+	}
+
+	T_ASSERT(!bcache_wait_any(cache));
+}
+
 static void test_dirty_data_gets_written_back(void *context)
 {
 	struct fixture *f = context;
@@ -608,6 +730,75 @@ static void test_flush_waits_for_all_dirty(void *context)
 	_no_outstanding_expectations(me);
 }
 
+static void test_flush_limits_writes_in_flight(void *context)
+{
+	struct fixture *f = context;
+	struct mock_engine *me = f->me;
+	struct bcache *cache = f->cache;
+
+	// twice what the engine takes at once
+	const unsigned count = 32;
+	int fd = 17;   // arbitrary key
+	unsigned i;
+	struct block *b;
+
+	for (i = 0; i < count; i++) {
+		T_ASSERT(bcache_get(cache, fd, i, GF_ZERO, &b));
+		bcache_put(b);
+	}
+
+	for (i = 0; i < 16; i++)
+		_expect_write(me, fd, i);
+
+	for (; i < count; i++) {
+		_expect(me, E_WAIT);
+		_expect_write(me, fd, i);
+	}
+
+	for (i = 0; i < 16; i++)
+		_expect(me, E_WAIT);
+
+	T_ASSERT(bcache_flush(cache));
+	_no_outstanding_expectations(me);
+}
+
+static void test_flush_fails_when_wait_fails(void *context)
+{
+	struct fixture *f = context;
+	struct mock_engine *me = f->me;
+	struct bcache *cache = f->cache;
+
+	// twice what the engine takes at once
+	const unsigned count = 32;
+	int fd = 17;   // arbitrary key
+	unsigned i;
+	struct block *b;
+
+	for (i = 0; i < count; i++) {
+		T_ASSERT(bcache_get(cache, fd, i, GF_ZERO, &b));
+		bcache_put(b);
+	}
+
+	for (i = 0; i < 16; i++)
+		_expect_write(me, fd, i);
+	_expect_bad_wait(me);
+
+	T_ASSERT(!bcache_flush(cache));
+	_no_outstanding_expectations(me);
+
+	// the blocks not written are flushed next time
+	for (i = 16; i < count; i++) {
+		_expect(me, E_WAIT);
+		_expect_write(me, fd, i);
+	}
+
+	for (i = 0; i < 16; i++)
+		_expect(me, E_WAIT);
+
+	T_ASSERT(bcache_flush(cache));
+	_no_outstanding_expectations(me);
+}
+
 static void test_multiple_files(void *context)
 {
 	static int _fds[] = {1, 128, 345, 678, 890};
@@ -881,8 +1072,11 @@ static struct test_suite *_small_tests(void)
 	T("get-reads", "bcache_get() triggers read", test_get_triggers_read);
 	T("reads-cached", "repeated reads are cached", test_repeated_reads_are_cached);
 	T("blocks-get-evicted", "block get evicted with many reads", test_block_gets_evicted_with_many_reads);
+	T("cache-grows", "cache grows rather than evicts up to the max", test_cache_grows_rather_than_evicts);
+	T("cache-shrinks", "grown cache shrinks when unused", test_cache_shrinks_when_unused);
 	T("prefetch-reads", "prefetch issues a read", test_prefetch_issues_a_read);
 	T("prefetch-never-waits", "too many prefetches does not trigger a wait", test_too_many_prefetches_does_not_trigger_a_wait);
+	T("prefetch-wait-any", "wait_any completes prefetches one at a time", test_wait_any_completes_prefetches);
 	T("writeback-occurs", "dirty data gets written back", test_dirty_data_gets_written_back);
 	T("zero-flag-dirties", "zeroed data counts as dirty", test_zeroed_data_counts_as_dirty);
 	T("read-multiple-files", "read from multiple files", test_multiple_files);
@@ -912,6 +1106,8 @@ static struct test_suite *_large_tests(void)
 	}
 
 	T("flush-waits", "flush waits for all dirty", test_flush_waits_for_all_dirty);
+	T("flush-limits-in-flight", "flush issues no more writes than the engine takes", test_flush_limits_writes_in_flight);
+	T("flush-wait-fails", "flush gives up when the engine fails to wait", test_flush_fails_when_wait_fails);
 
 	return ts;
 }
@@ -103,6 +103,13 @@ static void *_sync_init(void)
 	return _fix_init(e);
 }
 
+static void *_uring_init(void)
+{
+	struct io_engine *e = create_uring_io_engine();
+	T_ASSERT(e);
+	return _fix_init(e);
+}
+
 static void _fix_exit(void *fixture)
 {
         struct fixture *f = fixture;
@@ -370,6 +377,30 @@ static void _test_set_many_boundaries(void *fixture)
         _set_cycle(fixture, byte(13, 13), byte(23, 13));
 }
 
+//----------------------------------------------------------------
+// Several last_byte limits on one fd, as used when writing a batch of
+// metadata areas.  Only the async and uring engines clamp.
+
+static void _test_last_byte_multiple(void *fixture)
+{
+	struct fixture *f = fixture;
+	uint8_t pat = _random_pattern();
+
+	_do_write(f, byte(2, 0), byte(3, 0), pat);
+	_do_write(f, byte(10, 0), byte(11, 0), pat);
+
+	bcache_set_last_byte(f->cache, f->fd, byte(2, 1024), 512);
+	bcache_set_last_byte(f->cache, f->fd, byte(10, 2048), 512);
+	T_ASSERT(bcache_flush(f->cache));
+	bcache_unset_last_byte(f->cache, f->fd);
+
+	_reopen(f);
+	_verify(f, byte(2, 0), byte(2, 1024), pat);
+	_verify(f, byte(2, 1024), byte(3, 0), INIT_PATTERN);
+	_verify(f, byte(10, 0), byte(10, 2048), pat);
+	_verify(f, byte(10, 2048), byte(11, 0), INIT_PATTERN);
+}
+
 //----------------------------------------------------------------
 
 #define T(path, desc, fn) register_test(ts, "/base/device/bcache/utils/async/" path, desc, fn)
@@ -403,6 +434,8 @@ static struct test_suite *_async_tests(void)
         T("set-within-single-block", "set within single block", _test_set_within_single_block);
         T("set-cross-one-boundary", "set across one boundary", _test_set_cross_one_boundary);
         T("set-many-boundaries", "set many boundaries", _test_set_many_boundaries);
+
+        T("last-byte-multiple", "several last_byte limits on one fd", _test_last_byte_multiple);
 #undef T
 
         return ts;
@@ -443,9 +476,52 @@ static struct test_suite *_sync_tests(void)
         return ts;
 }
 
+static struct test_suite *_uring_tests(void)
+{
+        struct test_suite *ts = test_suite_create(_uring_init, _fix_exit);
+        if (!ts) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+        }
+
+#define T(path, desc, fn) register_test(ts, "/base/device/bcache/utils/uring/" path, desc, fn)
+        T("rw-first-block", "read/write/verify the first block", _test_rw_first_block);
+        T("rw-last-block", "read/write/verify the last block", _test_rw_last_block);
+        T("rw-several-blocks", "read/write/verify several whole blocks", _test_rw_several_whole_blocks);
+        T("rw-within-single-block", "read/write/verify within single block", _test_rw_within_single_block);
+        T("rw-cross-one-boundary", "read/write/verify across one boundary", _test_rw_cross_one_boundary);
+        T("rw-many-boundaries", "read/write/verify many boundaries", _test_rw_many_boundaries);
+
+        T("zero-first-block", "zero the first block", _test_zero_first_block);
+        T("zero-last-block", "zero the last block", _test_zero_last_block);
+        T("zero-several-blocks", "zero several whole blocks", _test_zero_several_whole_blocks);
+        T("zero-within-single-block", "zero within single block", _test_zero_within_single_block);
+        T("zero-cross-one-boundary", "zero across one boundary", _test_zero_cross_one_boundary);
+        T("zero-many-boundaries", "zero many boundaries", _test_zero_many_boundaries);
+
+        T("set-first-block", "set the first block", _test_set_first_block);
+        T("set-last-block", "set the last block", _test_set_last_block);
+        T("set-several-blocks", "set several whole blocks", _test_set_several_whole_blocks);
+        T("set-within-single-block", "set within single block", _test_set_within_single_block);
+        T("set-cross-one-boundary", "set across one boundary", _test_set_cross_one_boundary);
+        T("set-many-boundaries", "set many boundaries", _test_set_many_boundaries);
+
+        T("last-byte-multiple", "several last_byte limits on one fd", _test_last_byte_multiple);
+#undef T
+
+        return ts;
+}
+
 void bcache_utils_tests(struct dm_list *all_tests)
 {
+	struct io_engine *e;
+
 	dm_list_add(all_tests, &_async_tests()->list);
 	dm_list_add(all_tests, &_sync_tests()->list);
+
+	if ((e = create_uring_io_engine())) {
+		e->destroy(e);
+		dm_list_add(all_tests, &_uring_tests()->list);
+	}
 }
 
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+#include "lib/misc/lib.h"
+#include "lib/commands/toolcontext.h"
+#include "lib/config/config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//----------------------------------------------------------------
+// find_config_tree_*() values are cached in the cmd_context; any
+// change to the cascade or to the profile in effect must show.
+
+struct fixture {
+	struct cmd_context *cmd;
+	char dir[64];
+};
+
+static const char *_profiles[][2] = {
+	{ "units", "global {\nunits = \"m\"\n}\n" },
+	{ "nozero", "allocation {\nthin_pool_zero = 0\n}\n" },
+};
+
+static void _write(const char *path, const char *text)
+{
+	FILE *f;
+
+	T_ASSERT((f = fopen(path, "w")));
+	T_ASSERT(fputs(text, f) >= 0);
+	T_ASSERT(!fclose(f));
+}
+
+static void *_fixture_init(void)
+{
+	struct fixture *f = malloc(sizeof(*f));
+	char path[128];
+	unsigned i;
+
+	T_ASSERT(f);
+
+	// An LVM_SYSTEM_DIR without lvm.conf, only profiles
+	snprintf(f->dir, sizeof(f->dir), "/tmp/config_cache_t.XXXXXX");
+	T_ASSERT(mkdtemp(f->dir));
+	snprintf(path, sizeof(path), "%s/profile", f->dir);
+	T_ASSERT(!mkdir(path, 0700));
+
+	for (i = 0; i < DM_ARRAY_SIZE(_profiles); i++) {
+		snprintf(path, sizeof(path), "%s/profile/%s.profile", f->dir, _profiles[i][0]);
+		_write(path, _profiles[i][1]);
+	}
+
+	T_ASSERT((f->cmd = create_toolcontext(0, f->dir, 0, 0, 0, 0)));
+
+	return f;
+}
+
+static void _fixture_exit(void *fixture)
+{
+	struct fixture *f = fixture;
+	char path[128];
+	unsigned i;
+
+	destroy_toolcontext(f->cmd);
+
+	for (i = 0; i < DM_ARRAY_SIZE(_profiles); i++) {
+		snprintf(path, sizeof(path), "%s/profile/%s.profile", f->dir, _profiles[i][0]);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/profile", f->dir);
+	rmdir(path);
+	rmdir(f->dir);
+	free(f);
+}
+
+//----------------------------------------------------------------
+
+static void test_config_string(void *fixture)
+{
+	struct cmd_context *cmd = ((struct fixture *) fixture)->cmd;
+
+	// twice, so the second one is served from the cache
+	T_ASSERT_EQUAL(find_config_tree_int(cmd, backup_retain_min_CFG, NULL), DEFAULT_ARCHIVE_NUMBER);
+	T_ASSERT_EQUAL(find_config_tree_int(cmd, backup_retain_min_CFG, NULL), DEFAULT_ARCHIVE_NUMBER);
+
+	// as --config does it
+	T_ASSERT(override_config_tree_from_string(cmd, "backup { retain_min = 42 }"));
+	T_ASSERT_EQUAL(find_config_tree_int(cmd, backup_retain_min_CFG, NULL), 42);
+
+	T_ASSERT(remove_config_tree_by_source(cmd, CONFIG_STRING));
+	T_ASSERT_EQUAL(find_config_tree_int(cmd, backup_retain_min_CFG, NULL), DEFAULT_ARCHIVE_NUMBER);
+}
+
+static void test_command_profile(void *fixture)
+{
+	struct cmd_context *cmd = ((struct fixture *) fixture)->cmd;
+	struct profile *profile;
+
+	T_ASSERT(!strcmp(find_config_tree_str(cmd, global_units_CFG, NULL), DEFAULT_UNITS));
+
+	// as --commandprofile does it
+	T_ASSERT((profile = add_profile(cmd, "units", CONFIG_PROFILE_COMMAND)));
+	T_ASSERT(load_profile(cmd, profile));
+	T_ASSERT(override_config_tree_from_profile(cmd, profile));
+	T_ASSERT(!strcmp(find_config_tree_str(cmd, global_units_CFG, NULL), "m"));
+
+	T_ASSERT(remove_config_tree_by_source(cmd, CONFIG_PROFILE_COMMAND));
+	T_ASSERT(!strcmp(find_config_tree_str(cmd, global_units_CFG, NULL), DEFAULT_UNITS));
+}
+
+static void test_local_profile(void *fixture)
+{
+	struct cmd_context *cmd = ((struct fixture *) fixture)->cmd;
+	struct profile *profile;
+
+	T_ASSERT((profile = add_profile(cmd, "nozero", CONFIG_PROFILE_METADATA)));
+	T_ASSERT(load_profile(cmd, profile));
+
+	// a profile attached to a VG or LV is applied for one lookup only
+	T_ASSERT_EQUAL(find_config_tree_bool(cmd, allocation_thin_pool_zero_CFG, NULL), DEFAULT_THIN_POOL_ZERO);
+	T_ASSERT_EQUAL(find_config_tree_bool(cmd, allocation_thin_pool_zero_CFG, profile), 0);
+	T_ASSERT_EQUAL(find_config_tree_bool(cmd, allocation_thin_pool_zero_CFG, NULL), DEFAULT_THIN_POOL_ZERO);
+	T_ASSERT_EQUAL(find_config_tree_bool(cmd, allocation_thin_pool_zero_CFG, profile), 0);
+
+	// and does not drop values cached without it
+	T_ASSERT_EQUAL(find_config_tree_int(cmd, backup_retain_min_CFG, NULL), DEFAULT_ARCHIVE_NUMBER);
+	T_ASSERT_EQUAL(find_config_tree_bool(cmd, allocation_thin_pool_zero_CFG, profile), 0);
+	T_ASSERT_EQUAL(find_config_tree_int(cmd, backup_retain_min_CFG, NULL), DEFAULT_ARCHIVE_NUMBER);
+}
+
+static void test_config_string_and_local_profile(void *fixture)
+{
+	struct cmd_context *cmd = ((struct fixture *) fixture)->cmd;
+	struct profile *profile;
+
+	T_ASSERT((profile = add_profile(cmd, "nozero", CONFIG_PROFILE_METADATA)));
+	T_ASSERT(load_profile(cmd, profile));
+	T_ASSERT_EQUAL(find_config_tree_bool(cmd, allocation_thin_pool_zero_CFG, profile), 0);
+
+	// --config comes before any profile in the cascade
+	T_ASSERT(override_config_tree_from_string(cmd, "allocation { thin_pool_zero = 1 }"));
+	T_ASSERT_EQUAL(find_config_tree_bool(cmd, allocation_thin_pool_zero_CFG, profile), 1);
+
+	T_ASSERT(remove_config_tree_by_source(cmd, CONFIG_STRING));
+	T_ASSERT_EQUAL(find_config_tree_bool(cmd, allocation_thin_pool_zero_CFG, profile), 0);
+}
+
+//----------------------------------------------------------------
+
+#define T(path, desc, fn) register_test(ts, "/config/cache/" path, desc, fn)
+
+void config_cache_tests(struct dm_list *all_tests)
+{
+	struct test_suite *ts = test_suite_create(_fixture_init, _fixture_exit);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("config-string", "--config overrides are seen and dropped", test_config_string);
+	T("command-profile", "command profiles are seen and dropped", test_command_profile);
+	T("local-profile", "VG and LV profiles apply to their lookups only", test_local_profile);
+	T("config-string-local-profile", "--config overrides local profiles", test_config_string_and_local_profile);
+
+	dm_list_add(all_tests, &ts->list);
+}
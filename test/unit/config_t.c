@@ -149,7 +149,185 @@ static void test_cascade(void *fixture)
 	dm_config_destroy(t2);
 }
 
+static void test_parse_in_place(void *fixture)
+{
+	// no trailing newline, so the last token ends at the end of the buffer
+	static const char *text =
+		"id = \"yada-yada\"\n"
+		"seqno=15\n"
+		"status = [\"READ\", \"WRITE\"]\n"
+		"flags = []\n"
+		"creation_host = \"es\\\"caped\"\n"
+		"physical_volumes {\n"
+		"    pv0{ id = 'abcd-efgh' device = /dev/sda # comment\n"
+		"    }\n"
+		"}\n"
+		"last = bare";
+	struct dm_config_tree *tree = dm_config_create();
+	size_t len = strlen(text);
+	char *buf = malloc(len + 1);
+	const struct dm_config_value *value;
+
+	T_ASSERT(tree);
+	T_ASSERT(buf);
+	memcpy(buf, text, len);
+	buf[len] = 'X';
+
+	T_ASSERT(dm_config_parse_in_place(tree, buf, buf + len, 0));
+
+	T_ASSERT(!strcmp(dm_config_find_str(tree->root, "id", "foo"), "yada-yada"));
+	T_ASSERT_EQUAL(dm_config_find_int(tree->root, "seqno", 0), 15);
+	T_ASSERT(!strcmp(dm_config_find_str(tree->root, "creation_host", "foo"), "es\"caped"));
+	T_ASSERT(!strcmp(dm_config_find_str(tree->root, "physical_volumes/pv0/id", "foo"), "abcd-efgh"));
+	T_ASSERT(!strcmp(dm_config_find_str(tree->root, "physical_volumes/pv0/device", "foo"), "/dev/sda"));
+	T_ASSERT(!strcmp(dm_config_find_str(tree->root, "last", "foo"), "bare"));
+
+	T_ASSERT(dm_config_get_list(tree->root, "status", &value));
+	T_ASSERT(!strcmp(value->v.str, "READ"));
+	T_ASSERT(!strcmp(value->next->v.str, "WRITE"));
+	T_ASSERT(dm_config_get_list(tree->root, "flags", &value));
+	T_ASSERT(value->next == NULL);
+
+	// strings point into the buffer rather than being copied
+	T_ASSERT(dm_config_find_str(tree->root, "id", NULL) > buf);
+	T_ASSERT(dm_config_find_str(tree->root, "id", NULL) < buf + len);
+
+	dm_config_destroy(tree);
+	free(buf);
+}
+
+//----------------------------------------------------------------
+// Parse cost for the metadata of a VG with many LVs.
+
+static char *_gen_metadata(unsigned nr_lvs, size_t *len)
+{
+	size_t size = 4096 + (size_t) nr_lvs * 512, used;
+	char *buf = malloc(size + 1);
+	unsigned i;
+
+	T_ASSERT(buf);
+
+	used = snprintf(buf, size,
+			"vg0 {\n"
+			"id = \"Rbm1Tc-NdZp-0kFP-VkUz-4ETB-8qH0-RJeTwH\"\n"
+			"seqno = 1234\n"
+			"format = \"lvm2\"\n"
+			"status = [\"RESIZEABLE\", \"READ\", \"WRITE\"]\n"
+			"flags = []\n"
+			"extent_size = 8192\n"
+			"max_lv = 0\n"
+			"max_pv = 0\n"
+			"metadata_copies = 0\n"
+			"physical_volumes {\n"
+			"pv0 {\n"
+			"id = \"ZFeT9m-SzVm-WUsl-6nrb-IbTz-CzJG-jlckqc\"\n"
+			"device = \"/dev/sda\"\n"
+			"status = [\"ALLOCATABLE\"]\n"
+			"flags = []\n"
+			"dev_size = 17179869184\n"
+			"pe_start = 2048\n"
+			"pe_count = 2097151\n"
+			"}\n"
+			"}\n"
+			"logical_volumes {\n");
+
+	for (i = 0; i < nr_lvs; i++)
+		used += snprintf(buf + used, size - used,
+				 "lvol%u {\n"
+				 "id = \"hVo0dc-Uy3u-Lxyx-0JNC-WFR6-CB1Z-%06u\"\n"
+				 "status = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+				 "flags = []\n"
+				 "creation_time = 1537195932\n"
+				 "creation_host = \"host.example.com\"\n"
+				 "segment_count = 1\n"
+				 "segment1 {\n"
+				 "start_extent = 0\n"
+				 "extent_count = 1\n"
+				 "type = \"striped\"\n"
+				 "stripe_count = 1\n"
+				 "stripes = [\n"
+				 "\"pv0\", %u\n"
+				 "]\n"
+				 "}\n"
+				 "}\n", i, i, i);
+
+	used += snprintf(buf + used, size - used, "}\n}\n");
+	T_ASSERT(used < size);
+
+	*len = used;
+	return buf;
+}
+
+static uint64_t _time_parse(const char *text, size_t len, char *buf)
+{
+	struct dm_config_tree *tree;
+	uint64_t start, ns;
+
+	T_ASSERT((tree = dm_config_create()));
+
+	if (buf) {
+		memcpy(buf, text, len);
+		start = test_now_ns();
+		T_ASSERT(dm_config_parse_in_place(tree, buf, buf + len, 1));
+	} else {
+		start = test_now_ns();
+		T_ASSERT(dm_config_parse_without_dup_node_check(tree, text, text + len));
+	}
+	ns = test_now_ns() - start;
+
+	T_ASSERT(dm_config_find_node(tree->root, "vg0/logical_volumes/lvol0/segment1"));
+	dm_config_destroy(tree);
+
+	return ns;
+}
+
+#define BENCH_PARSE_RUNS 7
+
+/* Best of several runs, taking turns so neither parser warms up the other */
+static void _bench_parse(unsigned nr_lvs)
+{
+	char *text, *buf;
+	size_t len;
+	uint64_t ns, copy_ns = UINT64_MAX, in_place_ns = UINT64_MAX;
+	unsigned i;
+
+	text = _gen_metadata(nr_lvs, &len);
+	T_ASSERT((buf = malloc(len + 1)));
+
+	for (i = 0; i < BENCH_PARSE_RUNS; i++) {
+		if ((i & 1) && ((ns = _time_parse(text, len, buf)) < in_place_ns))
+			in_place_ns = ns;
+		if ((ns = _time_parse(text, len, NULL)) < copy_ns)
+			copy_ns = ns;
+		if (!(i & 1) && ((ns = _time_parse(text, len, buf)) < in_place_ns))
+			in_place_ns = ns;
+	}
+
+	fprintf(stderr, "%6u LVs, %8zu bytes: copy %6llu us, in place %6llu us\n",
+		nr_lvs, len, (unsigned long long) (copy_ns / 1000),
+		(unsigned long long) (in_place_ns / 1000));
+
+	free(buf);
+	free(text);
+}
+
+static void test_bench_parse_1k(void *fixture)
+{
+	_bench_parse(1000);
+}
+
+static void test_bench_parse_10k(void *fixture)
+{
+	_bench_parse(10000);
+}
+
+static void test_bench_parse_100k(void *fixture)
+{
+	_bench_parse(100000);
+}
+
 #define T(path, desc, fn) register_test(ts, "/metadata/config/" path, desc, fn)
+#define B(path, desc, fn) register_bench(ts, "/metadata/config/" path, desc, fn)
 
 void config_tests(struct dm_list *all_tests)
 {
@@ -162,6 +340,10 @@ void config_tests(struct dm_list *all_tests)
 	T("parse", "parsing various", test_parse);
 	T("clone", "duplicating a config tree", test_clone);
 	T("cascade", "cascade", test_cascade);
+	T("parse-in-place", "parsing without copying tokens", test_parse_in_place);
+	B("bench/parse-1k", "parse cost with 1k LVs", test_bench_parse_1k);
+	B("bench/parse-10k", "parse cost with 10k LVs", test_bench_parse_10k);
+	B("bench/parse-100k", "parse cost with 100k LVs", test_bench_parse_100k);
 
 	dm_list_add(all_tests, &ts->list);
 };
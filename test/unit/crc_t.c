@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+#include "lib/misc/crc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//----------------------------------------------------------------
+// The original byte at a time table lookup, as the reference.
+
+static uint32_t _ref_tab[256];
+
+static void _ref_init(void)
+{
+	uint32_t crc, i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+		_ref_tab[i] = crc;
+	}
+}
+
+static uint32_t _ref_crc(uint32_t crc, const uint8_t *buf, uint32_t size)
+{
+	while (size--)
+		crc = _ref_tab[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#define BUF_SIZE (4 * 1024 * 1024)
+
+static void *_crc_init(void)
+{
+	uint8_t *buf = malloc(BUF_SIZE);
+	unsigned i;
+
+	T_ASSERT(buf);
+	srandom(1);
+	for (i = 0; i < BUF_SIZE; i++)
+		buf[i] = random();
+
+	_ref_init();
+
+	return buf;
+}
+
+static void _crc_exit(void *fixture)
+{
+	free(fixture);
+}
+
+//----------------------------------------------------------------
+
+static void test_check_values(void *fixture)
+{
+	const uint8_t *s = (const uint8_t *) "123456789";
+
+	// the standard CRC-32 check value, with the usual inversions
+	T_ASSERT_EQUAL(calc_crc(0xffffffff, s, 9) ^ 0xffffffff, 0xcbf43926);
+	T_ASSERT_EQUAL(calc_crc(INITIAL_CRC, s, 9), 0x4991cf02);
+	T_ASSERT_EQUAL(calc_crc(INITIAL_CRC, s, 0), INITIAL_CRC);
+}
+
+static void test_all_lengths_and_offsets(void *fixture)
+{
+	const uint8_t *buf = fixture;
+	uint32_t offset, len;
+
+	// covers each path's head, body and tail handling
+	for (offset = 0; offset < 16; offset++)
+		for (len = 0; len < 600; len++)
+			T_ASSERT_EQUAL(calc_crc(INITIAL_CRC, buf + offset, len),
+				       _ref_crc(INITIAL_CRC, buf + offset, len));
+}
+
+static void test_large(void *fixture)
+{
+	const uint8_t *buf = fixture;
+
+	T_ASSERT_EQUAL(calc_crc(INITIAL_CRC, buf, BUF_SIZE),
+		       _ref_crc(INITIAL_CRC, buf, BUF_SIZE));
+	T_ASSERT_EQUAL(calc_crc(INITIAL_CRC, buf + 3, BUF_SIZE - 7),
+		       _ref_crc(INITIAL_CRC, buf + 3, BUF_SIZE - 7));
+}
+
+static void test_split(void *fixture)
+{
+	const uint8_t *buf = fixture;
+	uint32_t split, crc;
+
+	// the metadata checksum is calculated in two parts when it wraps
+	for (split = 0; split < 70000; split += 4099) {
+		crc = calc_crc(INITIAL_CRC, buf, split);
+		crc = calc_crc(crc, buf + split, 70000 - split);
+		T_ASSERT_EQUAL(crc, _ref_crc(INITIAL_CRC, buf, 70000));
+	}
+}
+
+//----------------------------------------------------------------
+
+static void _bench(const uint8_t *buf, uint32_t size, unsigned loops)
+{
+	uint64_t start, crc_ns, ref_ns;
+	uint32_t crc = 0, ref = 0;
+	unsigned i;
+
+	start = test_now_ns();
+	for (i = 0; i < loops; i++)
+		crc ^= calc_crc(INITIAL_CRC, buf, size);
+	crc_ns = test_now_ns() - start;
+
+	start = test_now_ns();
+	for (i = 0; i < loops; i++)
+		ref ^= _ref_crc(INITIAL_CRC, buf, size);
+	ref_ns = test_now_ns() - start;
+
+	T_ASSERT_EQUAL(crc, ref);
+
+	fprintf(stderr, "%8u bytes: calc_crc %6llu MB/s, byte table %6llu MB/s\n", size,
+		(unsigned long long) ((uint64_t) size * loops * 1000 / (crc_ns ? : 1)),
+		(unsigned long long) ((uint64_t) size * loops * 1000 / (ref_ns ? : 1)));
+}
+
+static void test_bench_512(void *fixture)
+{
+	_bench(fixture, 512, 20000);
+}
+
+static void test_bench_4m(void *fixture)
+{
+	_bench(fixture, BUF_SIZE, 10);
+}
+
+//----------------------------------------------------------------
+
+#define T(path, desc, fn) register_test(ts, "/lib/misc/crc/" path, desc, fn)
+#define B(path, desc, fn) register_bench(ts, "/lib/misc/crc/" path, desc, fn)
+
+void crc_tests(struct dm_list *all_tests)
+{
+	struct test_suite *ts = test_suite_create(_crc_init, _crc_exit);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("check-values", "known CRC values", test_check_values);
+	T("lengths-and-offsets", "matches the byte table for short unaligned buffers", test_all_lengths_and_offsets);
+	T("large", "matches the byte table for a 4MiB buffer", test_large);
+	T("split", "CRC calculated in two parts matches", test_split);
+	B("bench/512", "throughput for a sector", test_bench_512);
+	B("bench/4m", "throughput for 4MiB of metadata", test_bench_4m);
+
+	dm_list_add(all_tests, &ts->list);
+}
@@ -0,0 +1,553 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+#include "libdaemon/client/daemon-client.h"
+#include "libdaemon/client/daemon-io.h"
+#include "libdaemon/server/daemon-server.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//----------------------------------------------------------------
+// A daemon with a trivial handler is run in a child process.
+
+#define PROTOCOL "unit"
+
+struct fixture {
+	pid_t pid;
+	char path[64];
+};
+
+static response _echo(daemon_state s, client_handle h, request r)
+{
+	return daemon_reply_simple("OK", "value = %" PRId64,
+				   (int64_t) daemon_request_int(r, "value", -1), NULL);
+}
+
+static daemon_info _info(struct fixture *f)
+{
+	daemon_info i = {
+		.path = "unit-daemon",
+		.socket = f->path,
+		.protocol = PROTOCOL,
+		.protocol_version = 1,
+	};
+
+	return i;
+}
+
+static void _raise_fd_limit(void)
+{
+	struct rlimit rl;
+
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		(void) setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+static void *_fixture_init(void)
+{
+	struct fixture *f = malloc(sizeof(*f));
+	struct stat st;
+	unsigned i;
+
+	T_ASSERT(f);
+	snprintf(f->path, sizeof(f->path), "/tmp/lvm-unit-daemon-%d.socket", (int) getpid());
+	(void) unlink(f->path);
+
+	_raise_fd_limit();
+	fflush(stdout);
+	fflush(stderr);
+
+	T_ASSERT((f->pid = fork()) >= 0);
+	if (!f->pid) {
+		daemon_state s = {
+			.name = "unit-daemon",
+			.foreground = 1,
+			.socket_path = f->path,
+			.socket_fd = -1,
+			.protocol = PROTOCOL,
+			.protocol_version = 1,
+			.handler = _echo,
+		};
+
+		daemon_start(s);
+		_exit(0);
+	}
+
+	for (i = 0; i < 500; i++) {
+		if (!stat(f->path, &st))
+			break;
+		usleep(10000);
+	}
+
+	T_ASSERT(i < 500);
+
+	// The socket exists between bind() and listen().
+	usleep(10000);
+
+	return f;
+}
+
+static void _fixture_exit(void *fixture)
+{
+	struct fixture *f = fixture;
+	int status;
+
+	kill(f->pid, SIGTERM);
+	T_ASSERT_EQUAL(waitpid(f->pid, &status, 0), f->pid);
+	T_ASSERT(WIFEXITED(status) && !WEXITSTATUS(status));
+	free(f);
+}
+
+//----------------------------------------------------------------
+
+static int _send(daemon_handle h, int value)
+{
+	daemon_reply r = daemon_send_simple(h, "echo", "value = %" PRId64, (int64_t) value, NULL);
+	int64_t v;
+
+	T_ASSERT(!r.error);
+	T_ASSERT(!strcmp(daemon_reply_str(r, "response", ""), "OK"));
+	v = daemon_reply_int(r, "value", -2);
+	daemon_reply_destroy(r);
+
+	return (int) v;
+}
+
+static void test_requests(void *fixture)
+{
+	daemon_handle h = daemon_open(_info(fixture));
+	int i;
+
+	T_ASSERT(h.socket_fd >= 0);
+
+	// one connection is reused for every request
+	for (i = 0; i < 1000; i++)
+		T_ASSERT_EQUAL(_send(h, i), i);
+
+	daemon_close(h);
+}
+
+static void test_many_connections(void *fixture)
+{
+	daemon_handle h[256];
+	unsigned i, round;
+
+	for (i = 0; i < DM_ARRAY_SIZE(h); i++) {
+		h[i] = daemon_open(_info(fixture));
+		T_ASSERT(h[i].socket_fd >= 0);
+	}
+
+	for (round = 0; round < 10; round++)
+		for (i = 0; i < DM_ARRAY_SIZE(h); i++)
+			T_ASSERT_EQUAL(_send(h[i], round * 1000 + i), round * 1000 + i);
+
+	for (i = 0; i < DM_ARRAY_SIZE(h); i++)
+		daemon_close(h[i]);
+}
+
+static void test_binary(void *fixture)
+{
+	daemon_handle h = daemon_open(_info(fixture));
+	daemon_request rq;
+	daemon_reply r;
+
+	T_ASSERT(h.socket_fd >= 0);
+	T_ASSERT(h.binary);
+
+	T_ASSERT_EQUAL(_send(h, 42), 42);
+
+	rq = daemon_request_make("echo");
+	T_ASSERT(rq.cft);
+	T_ASSERT(daemon_request_extend(rq, "value = %" PRId64, INT64_C(7), NULL));
+	r = daemon_send(h, rq);
+	T_ASSERT(!r.error);
+	T_ASSERT(buffer_is_binary(&r.buffer));
+	T_ASSERT_EQUAL(daemon_reply_int(r, "value", -2), 7);
+	daemon_reply_destroy(r);
+	daemon_request_destroy(rq);
+
+	daemon_close(h);
+}
+
+static void test_text(void *fixture)
+{
+	daemon_handle h = daemon_open(_info(fixture));
+	daemon_reply r;
+
+	T_ASSERT(h.socket_fd >= 0);
+
+	// a client that does not know the binary format
+	h.binary = 0;
+	r = daemon_send_simple(h, "echo", "value = %" PRId64, INT64_C(3), NULL);
+	T_ASSERT(!r.error);
+	T_ASSERT(!buffer_is_binary(&r.buffer));
+	T_ASSERT_EQUAL(daemon_reply_int(r, "value", -2), 3);
+	daemon_reply_destroy(r);
+
+	daemon_close(h);
+}
+
+static void test_reconnect(void *fixture)
+{
+	daemon_handle h;
+	unsigned i;
+
+	// a connection per request, the way lvm commands use a daemon
+	for (i = 0; i < 500; i++) {
+		h = daemon_open(_info(fixture));
+		T_ASSERT(h.socket_fd >= 0);
+		T_ASSERT_EQUAL(_send(h, i), i);
+		daemon_close(h);
+	}
+}
+
+static void _read_value(daemon_handle h, int value)
+{
+	struct buffer buf;
+	struct dm_config_tree *cft;
+
+	buffer_init(&buf);
+	T_ASSERT(buffer_read(h.socket_fd, &buf));
+	T_ASSERT((cft = config_tree_from_buffer(&buf)));
+	T_ASSERT_EQUAL(dm_config_find_int64(cft->root, "value", -2), value);
+	dm_config_destroy(cft);
+	buffer_destroy(&buf);
+}
+
+static void test_stalled_clients(void *fixture)
+{
+	static const char _text[] = "request = \"echo\"\n";
+	daemon_handle stalled[32], h;
+	struct dm_config_tree *cft;
+	struct buffer frame[DM_ARRAY_SIZE(stalled)];
+	char rest[64];
+	unsigned i, split;
+
+	// More clients than worker threads send part of a request:
+	// text ones their first line, binary ones part of the header
+	// or of the body.
+	for (i = 0; i < DM_ARRAY_SIZE(stalled); i++) {
+		stalled[i] = daemon_open(_info(fixture));
+		T_ASSERT(stalled[i].socket_fd >= 0);
+		buffer_init(&frame[i]);
+
+		if (i % 2) {
+			T_ASSERT_EQUAL(write(stalled[i].socket_fd, _text, sizeof(_text) - 1),
+				       sizeof(_text) - 1);
+			continue;
+		}
+
+		snprintf(rest, sizeof(rest), "request = \"echo\"\nvalue = %u\n", i);
+		T_ASSERT((cft = config_tree_from_string_without_dup_node_check(rest)));
+		T_ASSERT(buffer_binary_node(&frame[i], cft->root));
+		dm_config_destroy(cft);
+		split = (i % 4) ? 3 : DAEMON_FRAME_HEADER_SIZE + 2;
+		T_ASSERT_EQUAL(write(stalled[i].socket_fd, frame[i].mem, split), split);
+	}
+
+	// and the daemon still serves everyone else
+	h = daemon_open(_info(fixture));
+	T_ASSERT(h.socket_fd >= 0);
+	T_ASSERT_EQUAL(_send(h, 5), 5);
+	daemon_close(h);
+
+	// then the rest of each request arrives
+	for (i = 0; i < DM_ARRAY_SIZE(stalled); i++) {
+		if (i % 2) {
+			snprintf(rest, sizeof(rest), "value = %u\n\n##\n", i);
+			T_ASSERT_EQUAL(write(stalled[i].socket_fd, rest, strlen(rest)),
+				       strlen(rest));
+		} else {
+			split = (i % 4) ? 3 : DAEMON_FRAME_HEADER_SIZE + 2;
+			T_ASSERT_EQUAL(write(stalled[i].socket_fd, frame[i].mem + split,
+					     frame[i].used - split), frame[i].used - split);
+		}
+
+		_read_value(stalled[i], i);
+		buffer_destroy(&frame[i]);
+		daemon_close(stalled[i]);
+	}
+}
+
+//----------------------------------------------------------------
+// The binary encoding on its own.
+
+static const char *_config =
+	"request = \"echo\"\n"
+	"value = -9223372036854775807\n"
+	"ratio = 0.5\n"
+	"quoted = \"a \\\"b\\\" c\"\n"
+	"empty = \"\"\n"
+	"none = [ ]\n"
+	"list = [ \"x\", 1, \"y\" ]\n"
+	"section {\n"
+	"  inner {\n"
+	"    deep = 1\n"
+	"  }\n"
+	"  nothing {\n"
+	"  }\n"
+	"  after = \"z\"\n"
+	"}\n"
+	"last = 2\n";
+
+static void test_encode_decode(void *fixture)
+{
+	struct dm_config_tree *cft, *cft2;
+	struct buffer buf;
+
+	T_ASSERT((cft = config_tree_from_string_without_dup_node_check(_config)));
+
+	buffer_init(&buf);
+	T_ASSERT(buffer_binary_node(&buf, cft->root));
+	T_ASSERT(buffer_is_binary(&buf));
+	T_ASSERT_EQUAL(buffer_frame_size(&buf), buf.used);
+
+	T_ASSERT((cft2 = config_tree_from_buffer(&buf)));
+	T_ASSERT(!compare_config(cft->root, cft2->root));
+	dm_config_destroy(cft2);
+
+	T_ASSERT(buffer_to_text(&buf));
+	T_ASSERT(!buffer_is_binary(&buf));
+	T_ASSERT((cft2 = config_tree_from_buffer(&buf)));
+	T_ASSERT(!compare_config(cft->root, cft2->root));
+	dm_config_destroy(cft2);
+
+	buffer_destroy(&buf);
+	dm_config_destroy(cft);
+}
+
+static void test_encode_simple(void *fixture)
+{
+	struct dm_config_tree *cft, *cft2;
+	struct buffer buf;
+	response res;
+
+	buffer_init(&buf);
+	T_ASSERT(buffer_append_f(&buf, "response = %s", "OK",
+				 "value = %" PRId64, INT64_C(-5),
+				 "name = %s", "vg0", NULL));
+	T_ASSERT((cft = config_tree_from_buffer(&buf)));
+	buffer_destroy(&buf);
+
+	res = daemon_reply_simple("OK", "value = %" PRId64, INT64_C(-5),
+				  "name = %s", "vg0", NULL);
+	T_ASSERT(!res.error);
+	T_ASSERT(buffer_is_binary(&res.buffer));
+	T_ASSERT((cft2 = config_tree_from_buffer(&res.buffer)));
+	T_ASSERT(!compare_config(cft->root, cft2->root));
+	dm_config_destroy(cft2);
+	buffer_destroy(&res.buffer);
+	dm_config_destroy(cft);
+
+	// NULL strings are only representable as text
+	res = daemon_reply_simple("OK", "name = %s", NULL, NULL);
+	T_ASSERT(!res.error);
+	T_ASSERT(!buffer_is_binary(&res.buffer));
+	buffer_destroy(&res.buffer);
+}
+
+static void _no_log(int level, const char *file, int line,
+		    int dm_errno_or_class, const char *f, ...)
+{
+}
+
+static void test_decode_truncated(void *fixture)
+{
+	struct dm_config_tree *cft, *cft2;
+	struct buffer buf;
+	uint32_t len;
+	int used;
+
+	T_ASSERT((cft = config_tree_from_string_without_dup_node_check(_config)));
+	buffer_init(&buf);
+	T_ASSERT(buffer_binary_node(&buf, cft->root));
+
+	// every shorter frame with a consistent header is rejected or
+	// decodes to a prefix of the tree, it never reads past the end;
+	// each rejected frame logs an error
+	dm_log_with_errno_init(_no_log);
+	for (used = buf.used - 1; used >= DAEMON_FRAME_HEADER_SIZE; used--) {
+		len = used - DAEMON_FRAME_HEADER_SIZE;
+		memcpy(buf.mem + 4, &len, sizeof(len));
+		buf.used = used;
+		if ((cft2 = config_tree_from_binary(&buf)))
+			dm_config_destroy(cft2);
+	}
+	dm_log_with_errno_init(NULL);
+
+	buffer_destroy(&buf);
+	dm_config_destroy(cft);
+}
+
+//----------------------------------------------------------------
+// Load generator: each thread keeps its share of the clients connected
+// and sends requests on them in turn.
+
+#define BENCH_THREADS 32
+#define BENCH_ROUNDS 20
+
+struct bench_thread {
+	pthread_t thread;
+	struct fixture *f;
+	pthread_barrier_t *barrier;
+	unsigned nr_clients;
+	int binary;
+	unsigned failed;
+};
+
+static void *_bench_thread(void *arg)
+{
+	struct bench_thread *bt = arg;
+	daemon_handle *h = calloc(bt->nr_clients, sizeof(*h));
+	daemon_reply r;
+	unsigned i, round;
+
+	if (!h) {
+		bt->failed++;
+		return NULL;
+	}
+
+	for (i = 0; i < bt->nr_clients; i++)
+		if ((h[i] = daemon_open(_info(bt->f))).socket_fd < 0)
+			bt->failed++;
+		else if (!bt->binary)
+			h[i].binary = 0;
+
+	pthread_barrier_wait(bt->barrier);
+
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		for (i = 0; i < bt->nr_clients; i++) {
+			if (h[i].socket_fd < 0)
+				continue;
+			r = daemon_send_simple(h[i], "echo", "value = %" PRId64, (int64_t) i, NULL);
+			if (r.error || daemon_reply_int(r, "value", -1) != i)
+				bt->failed++;
+			daemon_reply_destroy(r);
+		}
+
+	pthread_barrier_wait(bt->barrier);
+
+	for (i = 0; i < bt->nr_clients; i++)
+		if (h[i].socket_fd >= 0)
+			daemon_close(h[i]);
+	free(h);
+
+	return NULL;
+}
+
+static void _bench(struct fixture *f, unsigned nr_clients, int binary)
+{
+	struct bench_thread bt[BENCH_THREADS];
+	pthread_barrier_t barrier;
+	struct rlimit rl;
+	uint64_t start, ns;
+	unsigned i;
+
+	// Both ends hold a socket for each client.
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < nr_clients + 64) {
+		fprintf(stderr, "%8u clients: skipped, open file limit %llu\n",
+			nr_clients, (unsigned long long) rl.rlim_cur);
+		return;
+	}
+
+	T_ASSERT(!pthread_barrier_init(&barrier, NULL, BENCH_THREADS + 1));
+
+	for (i = 0; i < BENCH_THREADS; i++) {
+		bt[i].f = f;
+		bt[i].barrier = &barrier;
+		bt[i].nr_clients = nr_clients / BENCH_THREADS;
+		bt[i].binary = binary;
+		bt[i].failed = 0;
+		T_ASSERT(!pthread_create(&bt[i].thread, NULL, _bench_thread, bt + i));
+	}
+
+	// every client is connected
+	pthread_barrier_wait(&barrier);
+	start = test_now_ns();
+
+	// every request is answered
+	pthread_barrier_wait(&barrier);
+	ns = test_now_ns() - start;
+
+	for (i = 0; i < BENCH_THREADS; i++) {
+		T_ASSERT(!pthread_join(bt[i].thread, NULL));
+		T_ASSERT_EQUAL(bt[i].failed, 0);
+	}
+
+	pthread_barrier_destroy(&barrier);
+
+	fprintf(stderr, "%8u clients: %llu requests/s (%s)\n", nr_clients,
+		(unsigned long long) ((uint64_t) nr_clients * BENCH_ROUNDS * 1000000000 / (ns ? : 1)),
+		binary ? "binary" : "text");
+}
+
+static void test_bench_64(void *fixture)
+{
+	_bench(fixture, 64, 1);
+}
+
+static void test_bench_text_64(void *fixture)
+{
+	_bench(fixture, 64, 0);
+}
+
+static void test_bench_1k(void *fixture)
+{
+	_bench(fixture, 1024, 1);
+}
+
+static void test_bench_4k(void *fixture)
+{
+	_bench(fixture, 4096, 1);
+}
+
+//----------------------------------------------------------------
+
+#define T(path, desc, fn) register_test(ts, "/libdaemon/server/" path, desc, fn)
+#define B(path, desc, fn) register_bench(ts, "/libdaemon/server/" path, desc, fn)
+
+void daemon_server_tests(struct dm_list *all_tests)
+{
+	struct test_suite *ts = test_suite_create(_fixture_init, _fixture_exit);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("requests", "many requests on one connection", test_requests);
+	T("many-connections", "requests on many open connections", test_many_connections);
+	T("reconnect", "a new connection for each request", test_reconnect);
+	T("binary", "binary requests once the daemon announced them", test_binary);
+	T("text", "text requests still get text replies", test_text);
+	T("stalled-clients", "clients stalling mid-request do not hold workers", test_stalled_clients);
+	T("encode-decode", "config tree survives the binary format", test_encode_decode);
+	T("encode-simple", "daemon_reply_simple encodes like the text format", test_encode_simple);
+	T("decode-truncated", "truncated frames are handled", test_decode_truncated);
+	B("bench/64", "request rate with 64 clients", test_bench_64);
+	B("bench/text-64", "request rate with 64 text clients", test_bench_text_64);
+	B("bench/1k", "request rate with 1024 clients", test_bench_1k);
+	B("bench/4k", "request rate with 4096 clients", test_bench_4k);
+
+	dm_list_add(all_tests, &ts->list);
+}
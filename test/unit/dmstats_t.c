@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+// The @stats_print parser is static, and libdm is not linked into
+// unit-test: build it in here.  This must come before units.h so that
+// libdm's libdevmapper.h is the one that is included.
+#include "libdm/libdm-stats.c"
+
+#include "units.h"
+
+//----------------------------------------------------------------
+
+// The parts of libdm outside libdm-stats.c that it uses here.
+
+void *dm_malloc_wrapper(size_t s, const char *file, int line)
+{
+	return malloc(s);
+}
+
+void *dm_zalloc_wrapper(size_t s, const char *file, int line)
+{
+	return calloc(1, s);
+}
+
+void *dm_realloc_wrapper(void *p, unsigned int s, const char *file, int line)
+{
+	return realloc(p, s);
+}
+
+void dm_free_wrapper(void *ptr)
+{
+	free(ptr);
+}
+
+char *dm_strdup_wrapper(const char *s, const char *file, int line)
+{
+	return strdup(s);
+}
+
+int dm_message_supports_precise_timestamps(void)
+{
+	return 1;
+}
+
+//----------------------------------------------------------------
+
+#define NR_REGIONS 3
+#define STEP 8
+
+static void _no_log(int level, const char *file, int line,
+		    int dm_errno_or_class, const char *f, ...)
+{
+}
+
+// A handle with NR_REGIONS listed regions of area size STEP, the
+// i'th region having i + 1 areas.
+static void *_fix_init(void)
+{
+	struct dm_stats *dms;
+	struct dm_stats_region *region;
+	uint64_t i;
+
+	T_ASSERT((dms = dm_stats_create("unit-test")));
+	T_ASSERT((dms->regions = dm_pool_zalloc(dms->mem, NR_REGIONS *
+						 sizeof(*dms->regions))));
+	dms->nr_regions = NR_REGIONS;
+	dms->max_region = NR_REGIONS - 1;
+
+	for (i = 0; i < NR_REGIONS; i++) {
+		region = &dms->regions[i];
+		region->region_id = i;
+		region->group_id = DM_STATS_GROUP_NOT_PRESENT;
+		region->len = (i + 1) * STEP;
+		region->step = STEP;
+		region->timescale = 1;
+		region->counters_idx = DM_STATS_COUNTERS_NO_SLOT;
+	}
+
+	T_ASSERT(_stats_counters_reserve(dms));
+
+	return dms;
+}
+
+static void _fix_exit(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+	uint64_t i;
+
+	for (i = 0; i < NR_REGIONS; i++)
+		dm_free(dms->regions[i].bounds);
+
+	dm_stats_destroy(dms);
+}
+
+static int _parse(struct dm_stats *dms, uint64_t region_id, const char *resp)
+{
+	struct dm_stats_region *region = &dms->regions[region_id];
+	int r;
+
+	dm_log_with_errno_init(_no_log);
+	r = _stats_parse_region(dms, resp, region, region->timescale);
+	dm_log_with_errno_init(NULL);
+
+	return r;
+}
+
+//----------------------------------------------------------------
+
+static void test_rows(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+	struct dm_stats_counters *c;
+
+	T_ASSERT(_parse(dms, 1,
+			"16+8 1 2 3 4 5 6 7 8 9 10 11 12 13\n"
+			"24+8 14 15 16 17 18 19 20 21 22 23 24 25 26\n"));
+
+	T_ASSERT_EQUAL(dms->regions[1].start, 16);
+	T_ASSERT_EQUAL(dms->regions[1].len, 16);
+	T_ASSERT_EQUAL(dms->regions[1].step, 8);
+
+	c = dms->regions[1].counters;
+	T_ASSERT(c);
+	T_ASSERT_EQUAL(c[0].reads, 1);
+	T_ASSERT_EQUAL(c[0].write_sectors, 7);
+	T_ASSERT_EQUAL(c[0].total_write_nsecs, 13);
+	T_ASSERT_EQUAL(c[1].reads, 14);
+	T_ASSERT_EQUAL(c[1].io_in_progress, 22);
+	T_ASSERT_EQUAL(c[1].total_write_nsecs, 26);
+	T_ASSERT(!c[1].histogram);
+}
+
+static void test_no_trailing_newline(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+
+	T_ASSERT(_parse(dms, 1,
+			"0+8 1 2 3 4 5 6 7 8 9 10 11 12 13\n"
+			"8+8 14 15 16 17 18 19 20 21 22 23 24 25 26"));
+	T_ASSERT_EQUAL(dms->regions[1].len, 16);
+	T_ASSERT_EQUAL(dms->regions[1].counters[1].total_write_nsecs, 26);
+}
+
+static void test_u64_limits(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+
+	T_ASSERT(_parse(dms, 0, "0+8 18446744073709551615 0 0 0 0 0 0 0 0 0 0 0 0"));
+	T_ASSERT_EQUAL(dms->regions[0].counters[0].reads, UINT64_MAX);
+
+	T_ASSERT(!_parse(dms, 0, "0+8 18446744073709551616 0 0 0 0 0 0 0 0 0 0 0 0"));
+	T_ASSERT(!_parse(dms, 0, "0+8 99999999999999999999 0 0 0 0 0 0 0 0 0 0 0 0"));
+}
+
+static void test_bad_rows(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+
+	T_ASSERT(!_parse(dms, 0, ""));
+	T_ASSERT(!_parse(dms, 0, "0+8 1 2 3 4 5 6 7 8 9 10 11 12\n"));
+	T_ASSERT(!_parse(dms, 0, "0+8 1 2 3 4 5 6 7 8 9 10 11 12 x\n"));
+	T_ASSERT(!_parse(dms, 0, "0 8 1 2 3 4 5 6 7 8 9 10 11 12 13\n"));
+	T_ASSERT(!_parse(dms, 0, "0+8 -1 2 3 4 5 6 7 8 9 10 11 12 13\n"));
+}
+
+static void test_too_many_areas(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+
+	// Region 0 has a single area: a second row would be written to
+	// region 1's slots.
+	T_ASSERT(_parse(dms, 1,
+			"0+8 1 1 1 1 1 1 1 1 1 1 1 1 1\n"
+			"8+8 1 1 1 1 1 1 1 1 1 1 1 1 1\n"));
+	T_ASSERT(!_parse(dms, 0,
+			 "0+8 2 2 2 2 2 2 2 2 2 2 2 2 2\n"
+			 "8+8 2 2 2 2 2 2 2 2 2 2 2 2 2\n"));
+	T_ASSERT_EQUAL(dms->regions[1].counters[0].reads, 1);
+}
+
+static void test_histogram(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+	struct dm_histogram *h;
+
+	T_ASSERT((dms->regions[1].bounds = dm_histogram_bounds_from_string("10,20")));
+
+	T_ASSERT(_parse(dms, 1,
+			"0+8 1 2 3 4 5 6 7 8 9 10 11 12 13 5:6\n"
+			"8+8 1 2 3 4 5 6 7 8 9 10 11 12 13 0:18446744073709551615"));
+
+	T_ASSERT((h = dms->regions[1].counters[0].histogram));
+	T_ASSERT_EQUAL(h->nr_bins, 2);
+	T_ASSERT_EQUAL(h->bins[0].count, 5);
+	T_ASSERT_EQUAL(h->bins[1].count, 6);
+	T_ASSERT_EQUAL(h->sum, 11);
+	T_ASSERT(h->region == &dms->regions[1]);
+
+	T_ASSERT((h = dms->regions[1].counters[1].histogram));
+	T_ASSERT_EQUAL(h->bins[1].count, UINT64_MAX);
+
+	// the counters before a histogram are still required
+	T_ASSERT(!_parse(dms, 1, "0+8 1 2 3 4 5 6 7 8 9 10 11 12 5:6\n"));
+}
+
+static void test_timescale(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+	struct dm_stats_counters *c;
+
+	dms->regions[0].timescale = NSEC_PER_MSEC;
+	T_ASSERT(_parse(dms, 0, "0+8 1 2 3 4 5 6 7 8 9 10 11 12 13\n"));
+
+	c = dms->regions[0].counters;
+	T_ASSERT_EQUAL(c[0].reads, 1);
+	T_ASSERT_EQUAL(c[0].read_nsecs, 4 * NSEC_PER_MSEC);
+	T_ASSERT_EQUAL(c[0].total_write_nsecs, 13 * NSEC_PER_MSEC);
+}
+
+// A region deleted without a re-list must not hand its slots, or move
+// those of another populated region, when the next region is populated.
+static void test_delete_keeps_slots(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+	struct dm_stats_counters *c1;
+
+	T_ASSERT(_parse(dms, 0, "0+8 1 1 1 1 1 1 1 1 1 1 1 1 1\n"));
+	T_ASSERT(_parse(dms, 1,
+			"0+8 2 2 2 2 2 2 2 2 2 2 2 2 2\n"
+			"8+8 2 2 2 2 2 2 2 2 2 2 2 2 2\n"));
+	c1 = dms->regions[1].counters;
+
+	_stats_region_destroy(&dms->regions[0]);
+	dms->regions[0].region_id = DM_STATS_REGION_NOT_PRESENT;
+	dms->nr_regions--;
+
+	T_ASSERT(_stats_counters_reserve(dms));
+	T_ASSERT(_parse(dms, 2,
+			"0+8 3 3 3 3 3 3 3 3 3 3 3 3 3\n"
+			"8+8 3 3 3 3 3 3 3 3 3 3 3 3 3\n"
+			"16+8 3 3 3 3 3 3 3 3 3 3 3 3 3\n"));
+
+	T_ASSERT(dms->regions[1].counters == c1);
+	T_ASSERT_EQUAL(c1[0].reads, 2);
+	T_ASSERT_EQUAL(c1[1].reads, 2);
+	T_ASSERT_EQUAL(dms->regions[2].counters[2].reads, 3);
+}
+
+// Regions listed after the table was sized get new slots, and regions
+// populated earlier still read their own counters if the table moves.
+static void test_grow_keeps_counters(void *fixture)
+{
+	struct dm_stats *dms = fixture;
+	uint64_t i;
+
+	for (i = 0; i < NR_REGIONS; i++)
+		T_ASSERT(_parse(dms, i, "0+8 7 7 7 7 7 7 7 7 7 7 7 7 7\n"));
+
+	dms->regions[2].len = 1024 * STEP;
+	dms->regions[2].counters = NULL;
+	dms->regions[2].counters_idx = DM_STATS_COUNTERS_NO_SLOT;
+	T_ASSERT(_stats_counters_reserve(dms));
+	T_ASSERT(dms->nr_counters >= dms->regions[2].counters_idx + 1024);
+
+	for (i = 0; i < NR_REGIONS - 1; i++) {
+		T_ASSERT(dms->regions[i].counters ==
+			 dms->counters + dms->regions[i].counters_idx);
+		T_ASSERT_EQUAL(dms->regions[i].counters[0].reads, 7);
+	}
+}
+
+//----------------------------------------------------------------
+
+#define T(path, desc, fn) register_test(ts, "/libdm/stats/" path, desc, fn)
+
+void dm_stats_tests(struct dm_list *all_tests)
+{
+	struct test_suite *ts = test_suite_create(_fix_init, _fix_exit);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("rows", "parse @stats_print rows into the region's counters", test_rows);
+	T("no-trailing-newline", "the last row need not end in a newline", test_no_trailing_newline);
+	T("u64-limits", "counters up to UINT64_MAX, overflow is rejected", test_u64_limits);
+	T("bad-rows", "malformed rows are rejected", test_bad_rows);
+	T("too-many-areas", "more rows than the region has areas are rejected", test_too_many_areas);
+	T("histogram", "parse histogram bins following the counters", test_histogram);
+	T("timescale", "time counters are scaled by the region timescale", test_timescale);
+	T("delete-keeps-slots", "deleting a region does not move other regions' counters", test_delete_keeps_slots);
+	T("grow-keeps-counters", "growing the counters table keeps populated counters", test_grow_keeps_counters);
+
+	dm_list_add(all_tests, &ts->list);
+}
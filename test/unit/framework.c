@@ -1,5 +1,7 @@
 #include "framework.h"
 
+#include <time.h>
+
 /*----------------------------------------------------------------
  * Assertions
  *--------------------------------------------------------------*/
@@ -44,9 +46,9 @@ void test_suite_destroy(struct test_suite *ts)
 	free(ts);
 }
 
-bool register_test(struct test_suite *ts,
-		   const char *path, const char *desc,
-		   void (*fn)(void *))
+static bool _register(struct test_suite *ts,
+		      const char *path, const char *desc,
+		      void (*fn)(void *), bool bench)
 {
 	struct test_details *t = malloc(sizeof(*t));
 	if (!t) {
@@ -58,9 +60,32 @@ bool register_test(struct test_suite *ts,
 	t->path = path;
 	t->desc = desc;
 	t->fn = fn;
+	t->bench = bench;
 	dm_list_add(&ts->tests, &t->list);
 
 	return true;
 }
 
+bool register_test(struct test_suite *ts,
+		   const char *path, const char *desc,
+		   void (*fn)(void *))
+{
+	return _register(ts, path, desc, fn, false);
+}
+
+bool register_bench(struct test_suite *ts,
+		    const char *path, const char *desc,
+		    void (*fn)(void *))
+{
+	return _register(ts, path, desc, fn, true);
+}
+
+uint64_t test_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 //-----------------------------------------------------------------
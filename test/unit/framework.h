@@ -26,6 +26,7 @@ struct test_details {
 	const char *path;
 	const char *desc;
 	void (*fn)(void *);
+	bool bench;
 };
 
 struct test_suite *test_suite_create(void *(*fixture_init)(void),
@@ -35,6 +36,13 @@ void test_suite_destroy(struct test_suite *ts);
 bool register_test(struct test_suite *ts,
 		   const char *path, const char *desc, void (*fn)(void *));
 
+// Benchmarks only run with 'unit-test bench'.
+bool register_bench(struct test_suite *ts,
+		    const char *path, const char *desc, void (*fn)(void *));
+
+// Monotonic time in nanoseconds, for timing benchmarks.
+uint64_t test_now_ns(void);
+
 void test_fail(const char *fmt, ...)
 	__attribute__((noreturn, format (printf, 1, 2)));
 
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+#include "base/data-struct/hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//----------------------------------------------------------------
+
+static void *_hash_init(void)
+{
+	// deliberately tiny, the table has to grow
+	struct dm_hash_table *t = dm_hash_create(1);
+	T_ASSERT(t);
+	return t;
+}
+
+static void _hash_exit(void *fixture)
+{
+	dm_hash_destroy(fixture);
+}
+
+static void _key(char *buf, size_t len, unsigned i)
+{
+	snprintf(buf, len, "/dev/disk/by-id/wwn-0x5000c500%08x", i);
+}
+
+//----------------------------------------------------------------
+
+static void test_create_destroy(void *fixture)
+{
+	T_ASSERT_EQUAL(dm_hash_get_num_entries(fixture), 0);
+}
+
+static void test_insert_lookup_many(void *fixture)
+{
+	struct dm_hash_table *t = fixture;
+	char key[64];
+	unsigned i;
+
+	for (i = 0; i < 10000; i++) {
+		_key(key, sizeof(key), i);
+		T_ASSERT(dm_hash_insert(t, key, (void *) (uintptr_t) (i + 1)));
+	}
+
+	T_ASSERT_EQUAL(dm_hash_get_num_entries(t), 10000);
+
+	for (i = 0; i < 10000; i++) {
+		_key(key, sizeof(key), i);
+		T_ASSERT_EQUAL((uintptr_t) dm_hash_lookup(t, key), i + 1);
+	}
+
+	_key(key, sizeof(key), 10000);
+	T_ASSERT(!dm_hash_lookup(t, key));
+}
+
+static void test_binary_keys(void *fixture)
+{
+	struct dm_hash_table *t = fixture;
+	uint64_t k;
+
+	// key lengths 1 to 8 cover the tail handling
+	for (k = 0; k < 4096; k++)
+		T_ASSERT(dm_hash_insert_binary(t, &k, 1 + (k % 8), (void *) (uintptr_t) (k + 1)));
+
+	for (k = 0; k < 4096; k++)
+		T_ASSERT(dm_hash_lookup_binary(t, &k, 1 + (k % 8)));
+}
+
+static void test_remove(void *fixture)
+{
+	struct dm_hash_table *t = fixture;
+	char key[64];
+	unsigned i;
+
+	for (i = 0; i < 1000; i++) {
+		_key(key, sizeof(key), i);
+		T_ASSERT(dm_hash_insert(t, key, (void *) (uintptr_t) (i + 1)));
+	}
+
+	for (i = 0; i < 1000; i += 2) {
+		_key(key, sizeof(key), i);
+		dm_hash_remove(t, key);
+	}
+
+	T_ASSERT_EQUAL(dm_hash_get_num_entries(t), 500);
+
+	for (i = 0; i < 1000; i++) {
+		_key(key, sizeof(key), i);
+		if (i % 2)
+			T_ASSERT(dm_hash_lookup(t, key));
+		else
+			T_ASSERT(!dm_hash_lookup(t, key));
+	}
+}
+
+static void test_iterate_after_grow(void *fixture)
+{
+	struct dm_hash_table *t = fixture;
+	struct dm_hash_node *n;
+	char key[64];
+	unsigned i, count = 0;
+	uint64_t sum = 0;
+
+	for (i = 0; i < 5000; i++) {
+		_key(key, sizeof(key), i);
+		T_ASSERT(dm_hash_insert(t, key, (void *) (uintptr_t) (i + 1)));
+	}
+
+	dm_hash_iterate(n, t) {
+		sum += (uintptr_t) dm_hash_get_data(t, n);
+		count++;
+	}
+
+	T_ASSERT_EQUAL(count, 5000);
+	T_ASSERT_EQUAL(sum, (uint64_t) 5000 * 5001 / 2);
+}
+
+static void test_multiple_values(void *fixture)
+{
+	struct dm_hash_table *t = fixture;
+	static const char *vals[] = { "a", "b", "c" };
+	char key[64];
+	unsigned i;
+	int count;
+
+	for (i = 0; i < 3; i++)
+		T_ASSERT(dm_hash_insert_allow_multiple(t, "dup", vals[i], 2));
+
+	// force a few resizes with the duplicates present
+	for (i = 0; i < 2000; i++) {
+		_key(key, sizeof(key), i);
+		T_ASSERT(dm_hash_insert(t, key, (void *) (uintptr_t) (i + 1)));
+	}
+
+	T_ASSERT(dm_hash_lookup_with_count(t, "dup", &count));
+	T_ASSERT_EQUAL(count, 3);
+	T_ASSERT(dm_hash_lookup_with_val(t, "dup", "b", 2) == vals[1]);
+
+	dm_hash_remove_with_val(t, "dup", "b", 2);
+	T_ASSERT(!dm_hash_lookup_with_val(t, "dup", "b", 2));
+	T_ASSERT(dm_hash_lookup_with_count(t, "dup", &count));
+	T_ASSERT_EQUAL(count, 2);
+}
+
+//----------------------------------------------------------------
+// Lookup cost as the table grows from a small size_hint.
+
+static void _bench(unsigned nr_keys)
+{
+	struct dm_hash_table *t = dm_hash_create(16);
+	char *keys;
+	uint64_t start, insert_ns, lookup_ns;
+	unsigned i;
+
+	T_ASSERT(t);
+	T_ASSERT((keys = malloc((size_t) nr_keys * 64)));
+
+	for (i = 0; i < nr_keys; i++)
+		_key(keys + (size_t) i * 64, 64, i);
+
+	start = test_now_ns();
+	for (i = 0; i < nr_keys; i++)
+		T_ASSERT(dm_hash_insert(t, keys + (size_t) i * 64, keys));
+	insert_ns = test_now_ns() - start;
+
+	start = test_now_ns();
+	for (i = 0; i < nr_keys; i++)
+		T_ASSERT(dm_hash_lookup(t, keys + (size_t) i * 64));
+	lookup_ns = test_now_ns() - start;
+
+	fprintf(stderr, "%8u keys: insert %4llu ns/key, lookup %4llu ns/key\n",
+		nr_keys, (unsigned long long) (insert_ns / nr_keys),
+		(unsigned long long) (lookup_ns / nr_keys));
+
+	dm_hash_destroy(t);
+	free(keys);
+}
+
+static void test_bench_10k(void *fixture)
+{
+	_bench(10000);
+}
+
+static void test_bench_100k(void *fixture)
+{
+	_bench(100000);
+}
+
+static void test_bench_1m(void *fixture)
+{
+	_bench(1000000);
+}
+
+//----------------------------------------------------------------
+
+#define T(path, desc, fn) register_test(ts, "/base/data-struct/hash/" path, desc, fn)
+#define B(path, desc, fn) register_bench(ts, "/base/data-struct/hash/" path, desc, fn)
+
+void hash_tests(struct dm_list *all_tests)
+{
+	struct test_suite *ts = test_suite_create(_hash_init, _hash_exit);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("create-destroy", "create and destroy an empty table", test_create_destroy);
+	T("insert-lookup-many", "table grows from a small size hint", test_insert_lookup_many);
+	T("binary-keys", "short binary keys of every tail length", test_binary_keys);
+	T("remove", "remove half the entries", test_remove);
+	T("iterate-after-grow", "iteration visits every entry once", test_iterate_after_grow);
+	T("multiple-values", "duplicate keys survive resizing", test_multiple_values);
+	B("bench/10k", "lookup cost with 10k keys", test_bench_10k);
+	B("bench/100k", "lookup cost with 100k keys", test_bench_100k);
+	B("bench/1m", "lookup cost with 1M keys", test_bench_1m);
+
+	dm_list_add(all_tests, &ts->list);
+}
@@ -216,7 +216,7 @@ static bool _run_tests(struct test_details **tests, unsigned nr)
 
 static void _usage(void)
 {
-	fprintf(stderr, "Usage: unit-test <list|run> [pattern]\n");
+	fprintf(stderr, "Usage: unit-test <list|run|bench> [pattern]\n");
 }
 
 static int _cmp_paths(const void *lhs, const void *rhs)
@@ -246,6 +246,18 @@ static unsigned _filter(const char *pattern, struct test_details **tests, unsign
 	return found;
 }
 
+// Benchmarks are kept out of 'run', 'bench' runs nothing else.
+static unsigned _filter_bench(bool bench, struct test_details **tests, unsigned nr)
+{
+	unsigned i, found = 0;
+
+	for (i = 0; i < nr; i++)
+		if (tests[i]->bench == bench)
+			tests[found++] = tests[i];
+
+	return found;
+}
+
 int main(int argc, char **argv)
 {
 	int r;
@@ -284,11 +296,14 @@ int main(int argc, char **argv)
 
 	// run or list them
 	if (argc == 1)
-		r = !_run_tests(t_array, nr_tests);
+		r = !_run_tests(t_array, _filter_bench(false, t_array, nr_tests));
 	else {
 		const char *cmd = argv[1];
 		if (!strcmp(cmd, "run"))
-			r = !_run_tests(t_array, nr_tests);
+			r = !_run_tests(t_array, _filter_bench(false, t_array, nr_tests));
+
+		else if (!strcmp(cmd, "bench"))
+			r = !_run_tests(t_array, _filter_bench(true, t_array, nr_tests));
 
 		else if (!strcmp(cmd, "list")) {
 			_list_tests(t_array, nr_tests);
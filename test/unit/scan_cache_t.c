@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+#include "lib/misc/lib.h"
+#include "lib/commands/toolcontext.h"
+#include "lib/cache/lvmcache.h"
+#include "lib/device/device.h"
+#include "lib/format_text/format-text.h"
+#include "lib/format_text/layout.h"
+#include "lib/label/scan-cache.h"
+#include "lib/mm/xlate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+//----------------------------------------------------------------
+
+static struct cmd_context _cmd;
+
+struct fixture {
+	char path[64];
+	struct dm_str_list alias;
+	struct device dev;
+	union {
+		struct mda_header mdah;
+		char buf[sizeof(struct mda_header) + 2 * sizeof(struct raw_locn)];
+	};
+};
+
+// A regular file stands in for the device, only its size is used.
+static void *_fix_init(void)
+{
+	struct fixture *f = calloc(1, sizeof(*f));
+	int fd;
+
+	T_ASSERT(f);
+
+	snprintf(f->path, sizeof(f->path), "/tmp/scan_cache_t.XXXXXX");
+	T_ASSERT((fd = mkstemp(f->path)) >= 0);
+	T_ASSERT(!ftruncate(fd, 1024 * 1024));
+	close(fd);
+
+	f->alias.str = f->path;
+	dm_list_init(&f->dev.aliases);
+	dm_list_add(&f->dev.aliases, &f->alias.list);
+	f->dev.flags = DEV_REGULAR;
+	f->dev.dev = MKDEV(253, 4095);
+
+	f->mdah.checksum_xl = xlate32(0x1234);
+	f->mdah.start = 4096;
+	f->mdah.raw_locns[0].offset = 512;
+	f->mdah.raw_locns[0].size = 1000;
+	f->mdah.raw_locns[0].checksum = 0x55;
+
+	T_ASSERT((_cmd.cft = dm_config_from_string("devices { scan_cache = 1 }")));
+	T_ASSERT(scan_cache_init(&_cmd));
+
+	return f;
+}
+
+static void _fix_exit(void *fixture)
+{
+	struct fixture *f = fixture;
+
+	scan_cache_destroy();
+	dm_config_destroy(_cmd.cft);
+	_cmd.cft = NULL;
+
+	unlink(f->path);
+	free(f);
+}
+
+//----------------------------------------------------------------
+
+static void _check(struct fixture *f, const struct lvmcache_vgsummary *expected)
+{
+	struct lvmcache_vgsummary vgsummary = { 0 };
+
+	T_ASSERT(scan_cache_lookup(&f->dev, 0xabcd, &f->mdah, &vgsummary));
+	T_ASSERT(!strcmp(vgsummary.vgname, expected->vgname));
+	T_ASSERT_EQUAL(vgsummary.seqno, expected->seqno);
+
+#define CHECK_STR(s, e) T_ASSERT(e ? (s && !strcmp(s, e)) : !s)
+	CHECK_STR(vgsummary.creation_host, expected->creation_host);
+	CHECK_STR(vgsummary.system_id, expected->system_id);
+	CHECK_STR(vgsummary.lock_type, expected->lock_type);
+#undef CHECK_STR
+}
+
+static void test_lookup(void *fixture)
+{
+	struct fixture *f = fixture;
+	struct lvmcache_vgsummary vgsummary = {
+		.vgname = "vg0",
+		.creation_host = (char *) "host1",
+		.system_id = "sys1",
+		.lock_type = "sanlock",
+		.seqno = 1,
+	};
+
+	T_ASSERT(!scan_cache_lookup(&f->dev, 0xabcd, &f->mdah, &vgsummary));
+
+	scan_cache_update(&f->dev, 0xabcd, &f->mdah, &vgsummary);
+	_check(f, &vgsummary);
+
+	// any change to the label or mda_header is a miss
+	T_ASSERT(!scan_cache_lookup(&f->dev, 0xabce, &f->mdah, &vgsummary));
+	f->mdah.raw_locns[0].checksum++;
+	T_ASSERT(!scan_cache_lookup(&f->dev, 0xabcd, &f->mdah, &vgsummary));
+}
+
+static void test_update_clears_fields(void *fixture)
+{
+	struct fixture *f = fixture;
+	struct lvmcache_vgsummary vgsummary = {
+		.vgname = "vg0",
+		.creation_host = (char *) "host1",
+		.system_id = "sys1",
+		.lock_type = "sanlock",
+		.seqno = 1,
+	};
+
+	scan_cache_update(&f->dev, 0xabcd, &f->mdah, &vgsummary);
+	_check(f, &vgsummary);
+
+	// as after vgchange --systemid "" --locktype none
+	f->mdah.raw_locns[0].checksum++;
+	vgsummary.creation_host = NULL;
+	vgsummary.system_id = NULL;
+	vgsummary.lock_type = NULL;
+	vgsummary.seqno = 2;
+
+	scan_cache_update(&f->dev, 0xabcd, &f->mdah, &vgsummary);
+	_check(f, &vgsummary);
+}
+
+//----------------------------------------------------------------
+
+#define T(path, desc, fn) register_test(ts, "/label/scan-cache/" path, desc, fn)
+
+void scan_cache_tests(struct dm_list *all_tests)
+{
+	struct test_suite *ts = test_suite_create(_fix_init, _fix_exit);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("lookup", "an updated entry is found until the mda changes", test_lookup);
+	T("update-clears-fields", "updating an entry drops names no longer set", test_update_clears_fields);
+
+	dm_list_add(all_tests, &ts->list);
+}
@@ -21,35 +21,53 @@
 
 // Declare the function that adds tests suites here ...
 void activation_generator_tests(struct dm_list *suites);
+void alloc_tests(struct dm_list *suites);
 void bcache_tests(struct dm_list *suites);
 void bcache_utils_tests(struct dm_list *suites);
 void bitset_tests(struct dm_list *suites);
+void config_cache_tests(struct dm_list *suites);
 void config_tests(struct dm_list *suites);
+void crc_tests(struct dm_list *suites);
+void daemon_server_tests(struct dm_list *suites);
 void dm_list_tests(struct dm_list *suites);
 void dm_status_tests(struct dm_list *suites);
+void dm_stats_tests(struct dm_list *suites);
+void hash_tests(struct dm_list *suites);
 void io_engine_tests(struct dm_list *suites);
 void percent_tests(struct dm_list *suites);
 void radix_tree_tests(struct dm_list *suites);
 void regex_tests(struct dm_list *suites);
+void scan_cache_tests(struct dm_list *suites);
 void string_tests(struct dm_list *suites);
 void vdo_tests(struct dm_list *suites);
+void vg_copy_tests(struct dm_list *suites);
+void vg_index_tests(struct dm_list *suites);
 
 // ... and call it in here.
 static inline void register_all_tests(struct dm_list *suites)
 {
         activation_generator_tests(suites);
+	alloc_tests(suites);
 	bcache_tests(suites);
 	bcache_utils_tests(suites);
 	bitset_tests(suites);
+	config_cache_tests(suites);
 	config_tests(suites);
+	crc_tests(suites);
+	daemon_server_tests(suites);
 	dm_list_tests(suites);
 	dm_status_tests(suites);
+	dm_stats_tests(suites);
+	hash_tests(suites);
 	io_engine_tests(suites);
 	percent_tests(suites);
 	radix_tree_tests(suites);
 	regex_tests(suites);
+	scan_cache_tests(suites);
 	string_tests(suites);
 	vdo_tests(suites);
+	vg_copy_tests(suites);
+	vg_index_tests(suites);
 }
 
 //-----------------------------------------------------------------
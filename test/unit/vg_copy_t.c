@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+#include "lib/misc/lib.h"
+#include "lib/metadata/metadata.h"
+#include "lib/commands/toolcontext.h"
+#include "lib/metadata/lv_alloc.h"
+#include "lib/metadata/pv_alloc.h"
+#include "lib/metadata/segtype.h"
+#include "lib/datastruct/str_list.h"
+#include "lib/format_text/archiver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+//----------------------------------------------------------------
+
+// display_lvname() formats into the cmd buffer
+static struct cmd_context _cmd;
+
+static struct segment_type _striped = {
+	.flags = SEG_AREAS_STRIPED,
+	.name = "striped",
+};
+
+static void _set_id(struct id *id, char c)
+{
+	memset(id->uuid, c, ID_LEN);
+}
+
+static struct logical_volume *_add_lv(struct volume_group *vg, const char *name, char c)
+{
+	struct logical_volume *lv;
+
+	T_ASSERT((lv = alloc_lv(vg->vgmem)));
+	T_ASSERT((lv->name = dm_pool_strdup(vg->vgmem, name)));
+	lv->lvid.id[0] = vg->id;
+	_set_id(&lv->lvid.id[1], c);
+	lv->status = LVM_READ | LVM_WRITE | VISIBLE_LV;
+	lv->le_count = 4;
+	lv->size = 4 * vg->extent_size;
+	T_ASSERT(link_lv_to_vg(vg, lv));
+
+	return lv;
+}
+
+static struct lv_segment *_add_seg(struct logical_volume *lv)
+{
+	struct lv_segment *seg;
+
+	T_ASSERT((seg = alloc_lv_segment(&_striped, lv, 0, lv->le_count, 0, 0, 0,
+					 NULL, 1, lv->le_count, 1, 0, 0, 0, NULL)));
+	dm_list_add(&lv->segments, &seg->list);
+
+	return seg;
+}
+
+/*
+ * A VG with a PV, an LV "data" on the PV, an LV "top" stacked on
+ * "data" and a historical LV.
+ */
+static void *_vg_init(void)
+{
+	struct volume_group *vg;
+	struct pv_list *pvl;
+	struct logical_volume *data, *top;
+	struct generic_logical_volume *glv;
+	struct glv_list *glvl;
+	struct dm_pool *mem;
+
+	T_ASSERT((vg = alloc_vg("vg copy test", &_cmd, "vg0")));
+	mem = vg->vgmem;
+	_set_id(&vg->id, 'V');
+	vg->extent_size = 8192;
+	vg->status = LVM_READ | LVM_WRITE | RESIZEABLE_VG | PRECOMMITTED;
+	T_ASSERT(str_list_add(mem, &vg->tags, "vgtag"));
+
+	T_ASSERT((pvl = dm_pool_zalloc(mem, sizeof(*pvl))));
+	T_ASSERT((pvl->pv = dm_pool_zalloc(mem, sizeof(*pvl->pv))));
+	_set_id(&pvl->pv->id, 'P');
+	pvl->pv->pe_count = 100;
+	pvl->pv->status = ALLOCATABLE_PV;
+	dm_list_init(&pvl->pv->tags);
+	dm_list_init(&pvl->pv->segments);
+	T_ASSERT(alloc_pv_segment_whole_pv(mem, pvl->pv));
+	add_pvl_to_vgs(vg, pvl);
+	vg->extent_count = vg->free_count = 100;
+
+	data = _add_lv(vg, "data", 'D');
+	data->status &= ~VISIBLE_LV;
+	T_ASSERT(set_lv_segment_area_pv(_add_seg(data), 0, pvl->pv, 10));
+	T_ASSERT(str_list_add(mem, &data->tags, "lvtag"));
+
+	top = _add_lv(vg, "top", 'T');
+	top->status |= LV_TEMPORARY | LV_NOSCAN;
+	T_ASSERT(set_lv_segment_area_lv(_add_seg(top), 0, data, 0, 0));
+	T_ASSERT(lv_set_creation(top, "hostA", 1500000000));
+
+	T_ASSERT((glv = dm_pool_zalloc(mem, sizeof(*glv))));
+	T_ASSERT((glv->historical = dm_pool_zalloc(mem, sizeof(*glv->historical))));
+	T_ASSERT((glvl = dm_pool_zalloc(mem, sizeof(*glvl))));
+	glv->is_historical = 1;
+	glv->historical->name = "gone";
+	glv->historical->vg = vg;
+	dm_list_init(&glv->historical->indirect_glvs);
+	T_ASSERT(add_glv_to_indirect_glvs(mem, glv, get_or_create_glv(mem, top, NULL)));
+	glvl->glv = glv;
+	dm_list_add(&vg->historical_lvs, &glvl->list);
+
+	return vg;
+}
+
+static void _vg_exit(void *fixture)
+{
+	release_vg(fixture);
+}
+
+//----------------------------------------------------------------
+
+static void test_copy_vg(void *fixture)
+{
+	struct volume_group *vg = fixture, *copy;
+
+	T_ASSERT((copy = copy_vg(vg)));
+	T_ASSERT(copy != vg);
+	T_ASSERT(copy->vgmem != vg->vgmem);
+	T_ASSERT(!strcmp(copy->name, "vg0"));
+	T_ASSERT(id_equal(&copy->id, &vg->id));
+	T_ASSERT_EQUAL(copy->extent_size, 8192);
+	T_ASSERT_EQUAL(copy->free_count, vg->free_count);
+	T_ASSERT(!(copy->status & PRECOMMITTED));
+	T_ASSERT(str_list_match_item(&copy->tags, "vgtag"));
+	T_ASSERT_EQUAL(dm_list_size(&copy->lvs), 2);
+
+	release_vg(copy);
+}
+
+static void test_copy_pvs(void *fixture)
+{
+	struct volume_group *vg = fixture, *copy;
+	struct pv_list *pvl;
+	struct pv_segment *pvseg;
+	struct logical_volume *data;
+
+	T_ASSERT((copy = copy_vg(vg)));
+	T_ASSERT((data = find_lv(copy, "data")));
+	T_ASSERT(dm_list_size(&copy->pvs) == 1);
+
+	pvl = dm_list_item(dm_list_first(&copy->pvs), struct pv_list);
+	T_ASSERT(pvl->pv != dm_list_item(dm_list_first(&vg->pvs), struct pv_list)->pv);
+	T_ASSERT(pvl->pv->vg == copy);
+	T_ASSERT(find_pv_in_vg_by_uuid(copy, &pvl->pv->id) == pvl);
+
+	// free, data, free
+	T_ASSERT_EQUAL(dm_list_size(&pvl->pv->segments), 3);
+	dm_list_iterate_items(pvseg, &pvl->pv->segments) {
+		T_ASSERT(pvseg->pv == pvl->pv);
+		if (pvseg->pe == 10) {
+			T_ASSERT(pvseg->lvseg == first_seg(data));
+			T_ASSERT(seg_pvseg(first_seg(data), 0) == pvseg);
+		} else
+			T_ASSERT(!pvseg->lvseg);
+	}
+
+	release_vg(copy);
+}
+
+static void test_copy_lvs(void *fixture)
+{
+	struct volume_group *vg = fixture, *copy;
+	struct logical_volume *data, *top;
+	struct seg_list *sl;
+
+	T_ASSERT((copy = copy_vg(vg)));
+	T_ASSERT((data = find_lv(copy, "data")));
+	T_ASSERT((top = find_lv(copy, "top")));
+	T_ASSERT(data != find_lv(vg, "data"));
+
+	T_ASSERT(data->vg == copy && top->vg == copy);
+	T_ASSERT(first_seg(data)->lv == data);
+	T_ASSERT(first_seg(top)->segtype == &_striped);
+	T_ASSERT(str_list_match_item(&data->tags, "lvtag"));
+
+	// stacking points at the copies
+	T_ASSERT(seg_type(first_seg(top), 0) == AREA_LV);
+	T_ASSERT(seg_lv(first_seg(top), 0) == data);
+	T_ASSERT_EQUAL(dm_list_size(&data->segs_using_this_lv), 1);
+	sl = dm_list_item(dm_list_first(&data->segs_using_this_lv), struct seg_list);
+	T_ASSERT(sl->seg == first_seg(top));
+
+	// runtime flags are dropped, creation kept
+	T_ASSERT(!(top->status & (LV_TEMPORARY | LV_NOSCAN)));
+	T_ASSERT(top->status & VISIBLE_LV);
+	T_ASSERT(!strcmp(top->hostname, "hostA"));
+	T_ASSERT(top->timestamp == 1500000000);
+
+	// visible LVs come first, as the export writes them
+	T_ASSERT(dm_list_item(dm_list_first(&copy->lvs), struct lv_list)->lv == top);
+
+	release_vg(copy);
+}
+
+static void test_copy_historical(void *fixture)
+{
+	struct volume_group *vg = fixture, *copy;
+	struct generic_logical_volume *glv;
+	struct glv_list *glvl;
+	struct logical_volume *top;
+
+	T_ASSERT((copy = copy_vg(vg)));
+	T_ASSERT((top = find_lv(copy, "top")));
+	T_ASSERT((glv = find_historical_glv(copy, "gone", 0, NULL)));
+	T_ASSERT(glv != find_historical_glv(vg, "gone", 0, NULL));
+	T_ASSERT(glv->historical->vg == copy);
+
+	T_ASSERT(top->this_glv && top->this_glv->live == top);
+	T_ASSERT(first_seg(top)->indirect_origin == glv);
+	glvl = dm_list_item(dm_list_first(&glv->historical->indirect_glvs), struct glv_list);
+	T_ASSERT(glvl->glv == top->this_glv);
+
+	release_vg(copy);
+}
+
+static void test_copy_is_independent(void *fixture)
+{
+	struct volume_group *vg = fixture, *copy;
+
+	T_ASSERT((copy = copy_vg(vg)));
+
+	find_lv(vg, "top")->name = "renamed";
+	T_ASSERT(find_lv(copy, "top"));
+	T_ASSERT(!find_lv(copy, "renamed"));
+
+	release_vg(copy);
+	T_ASSERT(find_lv(vg, "renamed"));
+}
+
+//----------------------------------------------------------------
+// Exporting a copy gives the same text as exporting the VG imported
+// again from its own export, which is what copy_vg() replaced.
+
+#define LV_HEAD(name, id, status) \
+	name " { id = \"" id "\" status = [" status "] flags = [] "
+#define SEG(...) "segment_count = 1 segment1 { start_extent = 0 " __VA_ARGS__ " } }\n"
+#define LINEAR(name, id, status, pe) \
+	LV_HEAD(name, id, status) \
+	SEG("extent_count = 1 type = \"striped\" stripe_count = 1 stripes = [\"pv0\", " #pe "]")
+#define RW "\"READ\", \"WRITE\""
+#define RWV RW ", \"VISIBLE\""
+
+static const char _metadata[] =
+	"contents = \"Text Format Volume Group\"\n"
+	"version = 1\n"
+	"vg {\n"
+	"id = \"hKRcPs-uHBt-hrkV-mx9u-0Z1k-DRT2-Z8YMCT\" seqno = 5\n"
+	"status = [\"RESIZEABLE\", \"READ\", \"WRITE\"] flags = []\n"
+	"extent_size = 8192 max_lv = 0 max_pv = 0 metadata_copies = 0\n"
+	"tags = [\"vgtag\"]\n"
+	"physical_volumes { pv0 {\n"
+	"id = \"U6OSvx-8is3-1IFU-vg7o-KY5l-V0eI-nRReyC\" device = \"/dev/loop0\"\n"
+	"status = [\"ALLOCATABLE\"] flags = [] dev_size = 409600\n"
+	"pe_start = 2048 pe_count = 49 tags = [\"pvtag\"]\n"
+	"} }\n"
+	"logical_volumes {\n"
+
+	LV_HEAD("lin", "iK2ZWe-qhFW-CEPy-YngF-b51y-BMWX-aSCrUZ", RWV)
+	"creation_time = 1700000000 creation_host = \"hostA\" tags = [\"t1\", \"t2\"] "
+	SEG("extent_count = 2 type = \"striped\" stripe_count = 1 stripes = [\"pv0\", 0]")
+	LV_HEAD("fixed", "Ja9mHC-LbbO-Mp1q-nlsj-Imrt-LWq1-RCY3Z2", RWV ", \"FIXED_MINOR\"")
+	"major = 253 minor = 77 read_ahead = 256 allocation_policy = \"contiguous\" "
+	SEG("extent_count = 1 type = \"striped\" stripe_count = 1 stripes = [\"pv0\", 2]")
+
+	/* mirror */
+	LV_HEAD("mir", "WD8s7b-A16J-7Pgl-OU3s-hVv5-UTG7-9BG16Q", RWV)
+	SEG("extent_count = 1 type = \"mirror\" mirror_count = 2 mirror_log = \"mir_mlog\" "
+	    "region_size = 1024 mirrors = [\"mir_mimage_0\", 0, \"mir_mimage_1\", 0]")
+	LINEAR("mir_mlog", "mtsL4F-28Gz-L2cE-pVZz-AQlx-J4SX-RVxfCQ", RW, 4)
+	LINEAR("mir_mimage_0", "GgXkH1-zxFU-bEct-T2NL-LzPk-kGoa-XmI63J", RW, 5)
+	LINEAR("mir_mimage_1", "ozGw82-KwD6-rQJM-9Uay-Y209-48VG-ZiHXJn", RW, 6)
+
+	/* raid1 */
+	LV_HEAD("r1", "B8dE3x-KJm8-GAF0-wAwa-IINY-NvDM-bZoOlJ", RWV)
+	SEG("extent_count = 1 type = \"raid1\" device_count = 2 region_size = 1024 "
+	    "raids = [\"r1_rmeta_0\", \"r1_rimage_0\", \"r1_rmeta_1\", \"r1_rimage_1\"]")
+	LINEAR("r1_rmeta_0", "Ll3fZJ-Z207-qc18-Ref3-bCaW-Wrpr-hZNlws", RW, 7)
+	LINEAR("r1_rimage_0", "ekkqH8-kQrP-TsDS-uFEh-btyv-AYmq-gq5UGn", RW, 8)
+	LINEAR("r1_rmeta_1", "9MB0bo-bzjc-U9kC-TGRB-I1oO-ZSHC-oHPbzR", RW, 9)
+	LINEAR("r1_rimage_1", "KZuQOB-dVti-9n4d-te2e-t68t-VkAK-qiaJ42", RW, 10)
+
+	/* thin pool with a pending message, thin snapshot, external origin */
+	LV_HEAD("pool", "cL0n95-KDk0-33XT-NGcy-mwgn-KR5B-LmFg8Q", RWV)
+	SEG("extent_count = 1 type = \"thin-pool\" metadata = \"pool_tmeta\" "
+	    "pool = \"pool_tdata\" transaction_id = 4 chunk_size = 128 "
+	    "discards = \"passdown\" zero_new_blocks = 1 "
+	    "message1 { create = \"thin4\" }")
+	LINEAR("pool_tmeta", "ysGFbu-N3z5-sbkm-2uZK-YivB-nrRg-1y7Jw6", RW, 11)
+	LINEAR("pool_tdata", "41RIFX-IpeU-cfik-k6In-rWvM-G1qx-vvhsp3", RW, 12)
+	LINEAR("lvol0_pmspare", "8MX9T4-FiLJ-Xguc-Aey3-Yj1i-vhNL-Y7yeKJ", RW, 13)
+	LV_HEAD("thin1", "oKf8rx-5sKI-7hD5-rgYc-0saN-QafA-h04Ycm", RWV)
+	SEG("extent_count = 4 type = \"thin\" thin_pool = \"pool\" transaction_id = 0 device_id = 1")
+	LV_HEAD("thin2", "pYLAkh-CkRp-kV2g-B69y-ZI60-sJqT-EugnPu", RWV)
+	SEG("extent_count = 4 type = \"thin\" thin_pool = \"pool\" transaction_id = 1 device_id = 2 "
+	    "origin = \"thin1\"")
+	LINEAR("ext", "cbaY7s-UMuC-zuze-e6uM-Dhqn-YNX5-I3SEQw", "\"READ\", \"VISIBLE\"", 14)
+	LV_HEAD("thin3", "qlIntm-pxf0-rfWC-fPKP-v8oy-9tcu-luY2L5", RWV)
+	SEG("extent_count = 1 type = \"thin\" thin_pool = \"pool\" transaction_id = 2 device_id = 3 "
+	    "external_origin = \"ext\"")
+	LV_HEAD("thin4", "6tpvgI-NLZM-fpob-Zpze-rJ3e-UebO-asWYwF", RWV)
+	SEG("extent_count = 1 type = \"thin\" thin_pool = \"pool\" transaction_id = 3 device_id = 4")
+
+	/* old style snapshot */
+	LINEAR("orig", "E32jgG-XYue-G8Ql-lXjj-03ut-gTG1-6Msi5n", RWV, 15)
+	LINEAR("snap", "jI6UcX-u05N-ZR6J-18VS-nltB-IkdT-3QpqXe", RWV, 16)
+	LV_HEAD("snapshot0", "R9CZBJ-qIC2-IDaz-1vkq-FbYP-7AKb-dSwLiL", RWV)
+	SEG("extent_count = 1 type = \"snapshot\" chunk_size = 8 origin = \"orig\" "
+	    "cow_store = \"snap\"")
+
+	/* cache with policy settings */
+	LV_HEAD("cpool", "iiq1rz-KzlN-foFa-lHuG-5P6C-7ROU-opuFRE", RW)
+	SEG("extent_count = 1 type = \"cache-pool\" data = \"cpool_cdata\" "
+	    "metadata = \"cpool_cmeta\" chunk_size = 128 metadata_format = 2 "
+	    "cache_mode = \"writethrough\" policy = \"smq\" "
+	    "policy_settings { migration_threshold = 2048 }")
+	LINEAR("cpool_cdata", "9oTAvJ-N6U6-PrPo-d6eW-GP4x-kGXY-4nttSt", RW, 17)
+	LINEAR("cpool_cmeta", "2JxkSS-VDMf-2h5M-9GKy-ljqB-n8KU-WYdFRz", RW, 18)
+	LV_HEAD("cached", "TOwyG2-kIUc-HfZq-OgrV-6f9i-XN19-QRSfC2", RWV)
+	SEG("extent_count = 1 type = \"cache\" cache_pool = \"cpool\" origin = \"cached_corig\"")
+	LINEAR("cached_corig", "7p2y8Z-5Bzk-6uCi-N6F9-nhBM-IA6h-QsrpyV", RW, 19)
+	"}\n"
+
+	"historical_logical_volumes {\n"
+	"hvol { id = \"kIwFA2-hXnK-4yns-Zg5Z-bhKV-aIs9-RWUPie\" creation_time = 1600000000 "
+	"removal_time = 1650000000 descendants = [\"thin2\"] }\n"
+	"hvol2 { id = \"GxKZtB-GRwW-Huah-CTCw-tIzv-YURK-FhP6yy\" creation_time = 1600000000 "
+	"removal_time = 1650000000 origin = \"-hvol\" }\n"
+	"}\n"
+	"}\n";
+
+struct round_trip {
+	char dir[64];
+	char path[80];
+	struct cmd_context *cmd;
+	struct volume_group *vg;
+};
+
+static void *_round_trip_init(void)
+{
+	struct round_trip *rt;
+	FILE *f;
+
+	T_ASSERT((rt = zalloc(sizeof(*rt))));
+
+	// An empty LVM_SYSTEM_DIR: no lvm.conf, the defaults will do
+	snprintf(rt->dir, sizeof(rt->dir), "/tmp/vg_copy_t.XXXXXX");
+	T_ASSERT(mkdtemp(rt->dir));
+	T_ASSERT((rt->cmd = create_toolcontext(0, rt->dir, 0, 0, 0, 0)));
+
+	snprintf(rt->path, sizeof(rt->path), "%s/vg", rt->dir);
+	T_ASSERT((f = fopen(rt->path, "w")));
+	T_ASSERT(fputs(_metadata, f) >= 0);
+	T_ASSERT(!fclose(f));
+
+	// The PV has no device
+	log_suppress(1);
+	rt->vg = backup_read_vg(rt->cmd, "vg", rt->path);
+	log_suppress(0);
+	T_ASSERT(rt->vg);
+
+	return rt;
+}
+
+static void _round_trip_exit(void *fixture)
+{
+	struct round_trip *rt = fixture;
+
+	release_vg(rt->vg);
+	destroy_toolcontext(rt->cmd);
+	unlink(rt->path);
+	rmdir(rt->dir);
+	free(rt);
+}
+
+// The VG text, without the header written after it.  The export
+// buffer belongs to the VG.
+static char *_export(struct volume_group *vg)
+{
+	char *buf, *header, *text;
+
+	T_ASSERT(export_vg_to_buffer(vg, &buf));
+	header = strstr(buf, "\n# Generated by");
+	T_ASSERT((text = strndup(buf, header ? (size_t) (header + 1 - buf) : strlen(buf))));
+
+	return text;
+}
+
+static void test_round_trip(void *fixture)
+{
+	struct round_trip *rt = fixture;
+	struct volume_group *copy, *reimport;
+	struct dm_config_tree *cft;
+	char *copy_text, *reimport_text;
+
+	T_ASSERT((cft = export_vg_to_config_tree(rt->vg)));
+	T_ASSERT((reimport = import_vg_from_config_tree(cft, rt->vg->fid)));
+	dm_config_destroy(cft);
+
+	T_ASSERT((copy = copy_vg(rt->vg)));
+	T_ASSERT(vg_validate(copy));
+
+	copy_text = _export(copy);
+	reimport_text = _export(reimport);
+	T_ASSERT(!strcmp(copy_text, reimport_text));
+
+	// every kind of LV made it into the text
+	T_ASSERT(strstr(copy_text, "type = \"mirror\""));
+	T_ASSERT(strstr(copy_text, "type = \"raid1\""));
+	T_ASSERT(strstr(copy_text, "create = \"thin4\""));
+	T_ASSERT(strstr(copy_text, "external_origin = \"ext\""));
+	T_ASSERT(strstr(copy_text, "type = \"snapshot\""));
+	T_ASSERT(strstr(copy_text, "migration_threshold"));
+	T_ASSERT(strstr(copy_text, "type = \"cache\""));
+	T_ASSERT(strstr(copy_text, "descendants = [\"thin2\"]"));
+	T_ASSERT(strstr(copy_text, "origin = \"-hvol\""));
+
+	free(copy_text);
+	free(reimport_text);
+	release_vg(copy);
+	release_vg(reimport);
+}
+
+//----------------------------------------------------------------
+
+#define T(path, desc, fn) register_test(ts, "/metadata/vg/copy/" path, desc, fn)
+
+void vg_copy_tests(struct dm_list *all_tests)
+{
+	struct test_suite *ts = test_suite_create(_vg_init, _vg_exit);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("vg", "VG fields and tags are copied", test_copy_vg);
+	T("pvs", "PV segments point at the copied LV segments", test_copy_pvs);
+	T("lvs", "LV segments and stacking point at the copies", test_copy_lvs);
+	T("historical", "historical LVs are linked to the copied LVs", test_copy_historical);
+	T("independent", "the copy does not share state with the VG", test_copy_is_independent);
+
+	dm_list_add(all_tests, &ts->list);
+
+	if (!(ts = test_suite_create(_round_trip_init, _round_trip_exit))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("round-trip", "export of a copy matches export of a reimport", test_round_trip);
+
+	dm_list_add(all_tests, &ts->list);
+}
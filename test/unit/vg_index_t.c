@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+#include "lib/misc/lib.h"
+#include "lib/metadata/metadata.h"
+#include "lib/commands/toolcontext.h"
+#include "lib/format_text/archiver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+//----------------------------------------------------------------
+
+static void *_vg_init(void)
+{
+	struct volume_group *vg = alloc_vg("vg index test", NULL, "vg0");
+
+	T_ASSERT(vg);
+	memset(&vg->id, 'V', sizeof(vg->id));
+
+	return vg;
+}
+
+static void _vg_exit(void *fixture)
+{
+	release_vg(fixture);
+}
+
+static void _set_id(struct id *id, char c, unsigned i)
+{
+	char buf[ID_LEN + 1];
+
+	snprintf(buf, sizeof(buf), "%c%031u", c, i);
+	memcpy(id->uuid, buf, ID_LEN);
+}
+
+static struct logical_volume *_add_lv(struct volume_group *vg, unsigned i)
+{
+	struct logical_volume *lv;
+	char name[32];
+
+	T_ASSERT((lv = alloc_lv(vg->vgmem)));
+	snprintf(name, sizeof(name), "lvol%u", i);
+	T_ASSERT((lv->name = dm_pool_strdup(vg->vgmem, name)));
+	lv->lvid.id[0] = vg->id;
+	_set_id(&lv->lvid.id[1], 'L', i);
+	T_ASSERT(link_lv_to_vg(vg, lv));
+
+	return lv;
+}
+
+static struct logical_volume *_find_by_lvid(struct volume_group *vg, unsigned i)
+{
+	union lvid lvid = { .id[0] = vg->id };
+
+	_set_id(&lvid.id[1], 'L', i);
+
+	return find_lv_in_vg_by_lvid(vg, &lvid);
+}
+
+//----------------------------------------------------------------
+
+static void test_lookup(void *fixture)
+{
+	struct volume_group *vg = fixture;
+	struct logical_volume *lvs[1000];
+	unsigned i;
+
+	for (i = 0; i < 1000; i++)
+		lvs[i] = _add_lv(vg, i);
+
+	for (i = 0; i < 1000; i++) {
+		T_ASSERT(find_lv(vg, lvs[i]->name) == lvs[i]);
+		T_ASSERT(_find_by_lvid(vg, i) == lvs[i]);
+	}
+
+	T_ASSERT(find_lv(vg, "vg0/lvol7") == lvs[7]);
+	T_ASSERT(!find_lv(vg, "lvol1000"));
+	T_ASSERT(!_find_by_lvid(vg, 1000));
+}
+
+static void test_rename(void *fixture)
+{
+	struct volume_group *vg = fixture;
+	struct logical_volume *lv0 = _add_lv(vg, 0);
+	struct logical_volume *lv1 = _add_lv(vg, 1);
+
+	T_ASSERT(find_lv(vg, "lvol0") == lv0);
+
+	// renamed behind the index back
+	lv0->name = "renamed";
+	T_ASSERT(!find_lv(vg, "lvol0"));
+	T_ASSERT(find_lv(vg, "renamed") == lv0);
+
+	// and the old name taken by another LV
+	lv1->name = "lvol0";
+	T_ASSERT(find_lv(vg, "lvol0") == lv1);
+	T_ASSERT(!find_lv(vg, "lvol1"));
+}
+
+static void test_unlink_relink(void *fixture)
+{
+	struct volume_group *vg = fixture;
+	struct logical_volume *lv = _add_lv(vg, 0);
+	struct lv_list *lvl;
+
+	T_ASSERT(unlink_lv_from_vg(lv));
+	T_ASSERT(!find_lv(vg, "lvol0"));
+	T_ASSERT(!_find_by_lvid(vg, 0));
+
+	T_ASSERT(link_lv_to_vg(vg, lv));
+	T_ASSERT((lvl = find_lv_in_vg(vg, "lvol0")));
+	T_ASSERT(lvl->lv == lv);
+	T_ASSERT(find_lv_in_lv_list(&vg->lvs, lv) == lvl);
+	T_ASSERT(_find_by_lvid(vg, 0) == lv);
+}
+
+static void test_move_between_vgs(void *fixture)
+{
+	struct volume_group *vg = fixture, *vg_to;
+	struct logical_volume *lv = _add_lv(vg, 0);
+	struct lv_list *lvl = find_lv_in_vg(vg, "lvol0");
+
+	T_ASSERT((vg_to = alloc_vg("vg index test", NULL, "vg1")));
+
+	// as vgsplit does it
+	dm_list_move(&vg_to->lvs, &lvl->list);
+	lv->vg = vg_to;
+
+	T_ASSERT(!find_lv(vg, "lvol0"));
+	T_ASSERT(find_lv(vg_to, "lvol0") == lv);
+
+	release_vg(vg_to);
+}
+
+static void test_pv_uuid(void *fixture)
+{
+	struct volume_group *vg = fixture;
+	struct pv_list *pvls[100];
+	struct id id;
+	unsigned i;
+
+	for (i = 0; i < 100; i++) {
+		T_ASSERT((pvls[i] = dm_pool_zalloc(vg->vgmem, sizeof(*pvls[i]))));
+		T_ASSERT((pvls[i]->pv = dm_pool_zalloc(vg->vgmem, sizeof(*pvls[i]->pv))));
+		_set_id(&pvls[i]->pv->id, 'P', i);
+		add_pvl_to_vgs(vg, pvls[i]);
+	}
+
+	for (i = 0; i < 100; i++) {
+		_set_id(&id, 'P', i);
+		T_ASSERT(find_pv_in_vg_by_uuid(vg, &id) == pvls[i]);
+	}
+
+	// uuid changed, as vgimportclone does
+	_set_id(&pvls[5]->pv->id, 'Q', 5);
+	_set_id(&id, 'P', 5);
+	T_ASSERT(!find_pv_in_vg_by_uuid(vg, &id));
+	_set_id(&id, 'Q', 5);
+	T_ASSERT(find_pv_in_vg_by_uuid(vg, &id) == pvls[5]);
+}
+
+//----------------------------------------------------------------
+// Cost of linking LVs and resolving references to them, as
+// importing the metadata of a VG does for every segment.
+
+static void _bench(unsigned nr_lvs)
+{
+	struct volume_group *vg = _vg_init();
+	uint64_t start, link_ns, name_ns, lvid_ns;
+	char name[32];
+	unsigned i;
+
+	start = test_now_ns();
+	for (i = 0; i < nr_lvs; i++)
+		_add_lv(vg, i);
+	link_ns = test_now_ns() - start;
+
+	start = test_now_ns();
+	for (i = 0; i < nr_lvs; i++) {
+		snprintf(name, sizeof(name), "lvol%u", (i * 7919) % nr_lvs);
+		T_ASSERT(find_lv(vg, name));
+	}
+	name_ns = test_now_ns() - start;
+
+	start = test_now_ns();
+	for (i = 0; i < nr_lvs; i++)
+		T_ASSERT(_find_by_lvid(vg, i));
+	lvid_ns = test_now_ns() - start;
+
+	fprintf(stderr, "%7u LVs: link %4llu ns/LV, by name %4llu ns/LV, by lvid %4llu ns/LV\n",
+		nr_lvs, (unsigned long long) (link_ns / nr_lvs),
+		(unsigned long long) (name_ns / nr_lvs),
+		(unsigned long long) (lvid_ns / nr_lvs));
+
+	_vg_exit(vg);
+}
+
+// Cost of reading the metadata of a VG with nr_lvs thin LVs, each in
+// its own pool: every thin LV looks up its pool by name, and every
+// pool its data and metadata LVs.
+static void _bench_import(unsigned nr_lvs)
+{
+	struct cmd_context *cmd;
+	struct volume_group *vg;
+	char dir[64], path[80];
+	uint64_t start, import_ns;
+	unsigned i;
+	FILE *f;
+
+	// An empty LVM_SYSTEM_DIR: no lvm.conf, the defaults will do
+	snprintf(dir, sizeof(dir), "/tmp/vg_index_t.XXXXXX");
+	T_ASSERT(mkdtemp(dir));
+	T_ASSERT((cmd = create_toolcontext(0, dir, 0, 0, 0, 0)));
+
+	snprintf(path, sizeof(path), "%s/vg", dir);
+	T_ASSERT((f = fopen(path, "w")));
+	fprintf(f, "contents = \"Text Format Volume Group\"\nversion = 1\n"
+		"vg0 {\nid = \"V%031u\" seqno = 1\n"
+		"status = [\"RESIZEABLE\", \"READ\", \"WRITE\"] flags = []\n"
+		"extent_size = 8192 max_lv = 0 max_pv = 0 metadata_copies = 0\n"
+		"physical_volumes { pv0 { id = \"P%031u\" device = \"/dev/loop0\"\n"
+		"status = [\"ALLOCATABLE\"] flags = [] dev_size = 409600\n"
+		"pe_start = 2048 pe_count = 40 } }\n"
+		"logical_volumes {\n", 0, 0);
+#define _SEG(type) "segment_count = 1 segment1 { start_extent = 0 extent_count = 1 type = \"" type "\""
+	for (i = 0; i < nr_lvs; i++)
+		fprintf(f, "pool%u { id = \"T%031u\" status = [\"READ\", \"WRITE\", \"VISIBLE\"] flags = [] "
+			_SEG("thin-pool") " metadata = \"pool%u_tmeta\" pool = \"pool%u_tdata\" "
+			"transaction_id = 1 chunk_size = 128 } }\n"
+			"pool%u_tmeta { id = \"M%031u\" status = [\"READ\", \"WRITE\"] flags = [] "
+			_SEG("zero") " } }\n"
+			"pool%u_tdata { id = \"D%031u\" status = [\"READ\", \"WRITE\"] flags = [] "
+			_SEG("zero") " } }\n"
+			"lvol%u { id = \"L%031u\" status = [\"READ\", \"WRITE\", \"VISIBLE\"] flags = [] "
+			_SEG("thin") " thin_pool = \"pool%u\" transaction_id = 0 device_id = 1 } }\n",
+			i, i, i, i, i, i, i, i, i, i, i);
+#undef _SEG
+	fprintf(f, "}\n}\n");
+	T_ASSERT(!fclose(f));
+
+	// The PV has no device
+	log_suppress(1);
+	start = test_now_ns();
+	vg = backup_read_vg(cmd, "vg0", path);
+	import_ns = test_now_ns() - start;
+	log_suppress(0);
+
+	T_ASSERT(vg);
+	T_ASSERT(find_lv(vg, "lvol0"));
+
+	fprintf(stderr, "%7u LVs: read and import %5llu ns/LV\n",
+		nr_lvs, (unsigned long long) (import_ns / nr_lvs));
+
+	release_vg(vg);
+	destroy_toolcontext(cmd);
+	unlink(path);
+	rmdir(dir);
+}
+
+static void test_bench_1k(void *fixture)
+{
+	_bench(1000);
+}
+
+static void test_bench_10k(void *fixture)
+{
+	_bench(10000);
+}
+
+static void test_bench_100k(void *fixture)
+{
+	_bench(100000);
+}
+
+// No import of 100k LVs: the duplicate node check of the config
+// parser makes reading the metadata text itself quadratic.
+static void test_bench_import_1k(void *fixture)
+{
+	_bench_import(1000);
+}
+
+static void test_bench_import_10k(void *fixture)
+{
+	_bench_import(10000);
+}
+
+//----------------------------------------------------------------
+
+#define T(path, desc, fn) register_test(ts, "/metadata/vg/index/" path, desc, fn)
+#define B(path, desc, fn) register_bench(ts, "/metadata/vg/index/" path, desc, fn)
+
+void vg_index_tests(struct dm_list *all_tests)
+{
+	struct test_suite *ts = test_suite_create(_vg_init, _vg_exit);
+	if (!ts) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	T("lookup", "LVs found by name and lvid", test_lookup);
+	T("rename", "renamed LVs are found by the new name only", test_rename);
+	T("unlink-relink", "unlinked LVs are not found until relinked", test_unlink_relink);
+	T("move", "LVs moved to another VG are found there", test_move_between_vgs);
+	T("pv-uuid", "PVs found by uuid", test_pv_uuid);
+	B("bench/1k", "lookup cost with 1k LVs", test_bench_1k);
+	B("bench/10k", "lookup cost with 10k LVs", test_bench_10k);
+	B("bench/100k", "lookup cost with 100k LVs", test_bench_100k);
+
+	dm_list_add(all_tests, &ts->list);
+
+	// import creates its own VG, no fixture
+	if (!(ts = test_suite_create(NULL, NULL))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	B("bench/import/1k", "read and import cost with 1k LVs", test_bench_import_1k);
+	B("bench/import/10k", "read and import cost with 10k LVs", test_bench_import_10k);
+
+	dm_list_add(all_tests, &ts->list);
+}
@@ -48,6 +48,7 @@ static int _set_daemon_parms(struct cmd_context *cmd, struct daemon_parms *parms
 	parms->aborting = arg_is_set(cmd, abort_ARG);
 	parms->progress_display = 1;
 	parms->wait_before_testing = (arg_sign_value(cmd, interval_ARG, SIGN_NONE) == SIGN_PLUS);
+	parms->single_step = !strcmp(getenv(LVPOLL_SINGLE_STEP_ENV) ? : "0", "1");
 
 	if (!strcmp(poll_oper, PVMOVE_POLL)) {
 		parms->progress_title = "Moved";
@@ -90,7 +91,11 @@ static int _poll_lv(struct cmd_context *cmd, const char *lv_name)
 	if (!_set_daemon_parms(cmd, &parms))
 		return_EINVALID_CMD_LINE;
 
-	return wait_for_single_lv(cmd, &id, &parms) ? ECMD_PROCESSED : ECMD_FAILED;
+	if (!wait_for_single_lv(cmd, &id, &parms))
+		return ECMD_FAILED;
+
+	/* lvmpolld runs the step again after the next interval */
+	return parms.in_progress ? LVPOLL_RET_IN_PROGRESS : ECMD_PROCESSED;
 }
 
 int lvpoll(struct cmd_context *cmd, int argc, char **argv)
@@ -216,6 +216,12 @@ int wait_for_single_lv(struct cmd_context *cmd, struct poll_operation_id *id,
 		if (!lockd_vg(cmd, id->vg_name, "un", 0, &lockd_state))
 			stack;
 
+		/* lvmpolld waits for the next step itself */
+		if (parms->single_step) {
+			parms->in_progress = !finished;
+			break;
+		}
+
 		/*
 		 * FIXME Sleeping after testing, while preferred, also works around
 		 * unreliable "finished" state checking in _percent_run.  If the
@@ -98,8 +98,11 @@ static int _do_info_and_status(struct cmd_context *cmd,
 		return 1;
 
 	if (do_status) {
-		if (!(status->seg_status.mem = dm_pool_create("reporter_pool", 1024)))
+		/* Emptied by the caller after each report_object() */
+		if (!cmd->report_status_mem &&
+		    !(cmd->report_status_mem = dm_pool_create("reporter_pool", 1024)))
 			return_0;
+		status->seg_status.mem = cmd->report_status_mem;
 
 		if (do_info)
 			/* both info and status */
@@ -183,7 +186,7 @@ static int _do_lvs_with_info_and_status_single(struct cmd_context *cmd,
 	r = ECMD_PROCESSED;
 out:
 	if (status.seg_status.mem)
-		dm_pool_destroy(status.seg_status.mem);
+		dm_pool_empty(status.seg_status.mem);
 
 	return r;
 }
@@ -245,7 +248,7 @@ static int _do_segs_with_info_and_status_single(struct cmd_context *cmd,
 	r = ECMD_PROCESSED;
 out:
 	if (status.seg_status.mem)
-		dm_pool_destroy(status.seg_status.mem);
+		dm_pool_empty(status.seg_status.mem);
 
 	return r;
 }
@@ -374,7 +377,7 @@ static int _do_pvsegs_sub_single(struct cmd_context *cmd,
 
  out:
 	if (status.seg_status.mem)
-		dm_pool_destroy(status.seg_status.mem);
+		dm_pool_empty(status.seg_status.mem);
 
 	return ret;
 }
@@ -1420,12 +1423,17 @@ static int _report(struct cmd_context *cmd, int argc, char **argv, report_type_t
 		return ECMD_FAILED;
 	}
 
+	/* Reporting does not change dm devices, read each VG's state once */
+	activation_info_cache(cmd, 1);
+
 	if (single_args->report_type == FULL) {
 		handle->custom_handle = &args;
 		r = process_each_vg(cmd, argc, argv, NULL, NULL, 0, 1, handle, &_full_report_single);
 	} else
 		r = _do_report(cmd, handle, &args, single_args);
 
+	activation_info_cache(cmd, 0);
+
 	if (!args.log_only && !dm_report_group_pop(cmd->cmd_report.report_group)) {
 		log_error("Failed to finalize main report section in report group.");
 		r = ECMD_FAILED;